@@ -0,0 +1,644 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace mediaFoundation
+{
+    // Just enough of the ASF container to get an exact duration and a time-to-packet index out of a WMA file, without
+    // going anywhere near Media Foundation.  Reads through the same kind of Reader as the MP4 parser:
+    //
+    //     bool ReadAt(uint64_t offset, void* dest, size_t bytes);   // all or nothing
+    //     uint64_t GetSize();
+    namespace asf
+    {
+        typedef uint8_t Guid[16];
+
+        // As they appear in the file, which is to say with the first three fields byte-swapped
+        constexpr Guid headerObject = { 0x30, 0x26, 0xb2, 0x75, 0x8e, 0x66, 0xcf, 0x11, 0xa6, 0xd9, 0x00, 0xaa, 0x00, 0x62, 0xce, 0x6c };
+        constexpr Guid filePropertiesObject = { 0xa1, 0xdc, 0xab, 0x8c, 0x47, 0xa9, 0xcf, 0x11, 0x8e, 0xe4, 0x00, 0xc0, 0x0c, 0x20, 0x53, 0x65 };
+        constexpr Guid streamPropertiesObject = { 0x91, 0x07, 0xdc, 0xb7, 0xb7, 0xa9, 0xcf, 0x11, 0x8e, 0xe6, 0x00, 0xc0, 0x0c, 0x20, 0x53, 0x65 };
+        constexpr Guid audioMedia = { 0x40, 0x9e, 0x69, 0xf8, 0x4d, 0x5b, 0xcf, 0x11, 0xa8, 0xfd, 0x00, 0x80, 0x5f, 0x5c, 0x44, 0x2b };
+        constexpr Guid dataObject = { 0x36, 0x26, 0xb2, 0x75, 0x8e, 0x66, 0xcf, 0x11, 0xa6, 0xd9, 0x00, 0xaa, 0x00, 0x62, 0xce, 0x6c };
+        constexpr Guid simpleIndexObject = { 0x90, 0x08, 0x00, 0x33, 0xb1, 0xe5, 0xcf, 0x11, 0x89, 0xf4, 0x00, 0xa0, 0xc9, 0x03, 0x49, 0xcb };
+        constexpr Guid indexObject = { 0xd3, 0x29, 0xe2, 0xd6, 0xda, 0x35, 0xd1, 0x11, 0x90, 0x34, 0x00, 0xa0, 0xc9, 0x03, 0x49, 0xbe };
+        constexpr Guid extendedContentDescriptionObject = { 0x40, 0xa4, 0xd0, 0xd2, 0x07, 0xe3, 0xd2, 0x11, 0x97, 0xf0, 0x00, 0xa0, 0xc9, 0x5e, 0xa8, 0x50 };
+
+        // Every object starts with its GUID and a 64-bit size that includes this header
+        constexpr size_t objectHeaderSize = 24;
+
+        // GUID, size, file ID, packet count and two reserved bytes come before the first packet
+        constexpr size_t dataObjectHeaderSize = 50;
+
+        inline uint16_t ReadU16(const uint8_t* data)
+        {
+            return static_cast<uint16_t>(data[0] | (data[1] << 8));
+        }
+
+        inline uint32_t ReadU32(const uint8_t* data)
+        {
+            return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) | (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+        }
+
+        inline uint64_t ReadU64(const uint8_t* data)
+        {
+            return static_cast<uint64_t>(ReadU32(data)) | (static_cast<uint64_t>(ReadU32(data + 4)) << 32);
+        }
+
+        inline bool IsGuid(const uint8_t* data, const Guid& guid)
+        {
+            return std::memcmp(data, guid, sizeof(Guid)) == 0;
+        }
+
+        // Where an object is, including its header.
+        struct Object
+        {
+            const uint8_t* guid;
+            uint64_t start;
+            uint64_t end;
+        };
+
+        // Size of a field in the packet header, going by its 2-bit length type.
+        inline size_t FieldSize(unsigned int lengthType)
+        {
+            static const size_t sizes[] = { 0, 1, 2, 4 };
+            return sizes[lengthType & 3];
+        }
+
+        // Tag names and values are all we want out of UTF-16, and the ones we care about are plain ASCII, so anything
+        // else just gets flattened to '?'.  Stops at the terminator, if there is one.
+        inline std::string NarrowUtf16(const uint8_t* data, size_t bytes)
+        {
+            std::string result;
+            for (size_t i = 0; i + 1 < bytes; i += 2)
+            {
+                const uint16_t character = ReadU16(data + i);
+                if (character == 0)
+                {
+                    break;
+                }
+                result.push_back(character < 0x80 ? static_cast<char>(character) : '?');
+            }
+            return result;
+        }
+
+        // Calls tag(name, value) for every attribute in the header's Extended Content Description object that's a
+        // string or an integer, with integers given as decimal.
+        template <typename Reader, typename TagFunc>
+        void ForEachContentAttribute(Reader& reader, TagFunc tag)
+        {
+            constexpr uint64_t maxObjectSize = 1024 * 1024;
+
+            uint8_t header[objectHeaderSize + 6];
+            if (!reader.ReadAt(0, header, sizeof(header)) || !IsGuid(header, headerObject))
+            {
+                return;
+            }
+
+            const uint64_t headerEnd = std::min<uint64_t>(ReadU64(header + 16), reader.GetSize());
+            uint64_t offset = sizeof(header);
+            uint64_t objectSize = 0;
+            for (;;)
+            {
+                uint8_t objectHeader[objectHeaderSize];
+                if (offset + objectHeaderSize > headerEnd || !reader.ReadAt(offset, objectHeader, sizeof(objectHeader)))
+                {
+                    return;
+                }
+
+                objectSize = ReadU64(objectHeader + 16);
+                if (objectSize < objectHeaderSize || objectSize > headerEnd - offset)
+                {
+                    return;
+                }
+                if (IsGuid(objectHeader, extendedContentDescriptionObject))
+                {
+                    break;
+                }
+                offset += objectSize;
+            }
+
+            std::vector<uint8_t> payload;
+            if (objectSize > maxObjectSize || objectSize < objectHeaderSize + 2)
+            {
+                return;
+            }
+            payload.resize(static_cast<size_t>(objectSize - objectHeaderSize));
+            if (!reader.ReadAt(offset + objectHeaderSize, payload.data(), payload.size()))
+            {
+                return;
+            }
+
+            // Each one is a name length and name, then a value type, value length and value
+            const uint16_t count = ReadU16(payload.data());
+            size_t position = 2;
+            for (uint16_t attribute = 0; attribute < count; ++attribute)
+            {
+                if (payload.size() - position < 2)
+                {
+                    return;
+                }
+                const size_t nameLength = ReadU16(payload.data() + position);
+                if (payload.size() - position < 6 + nameLength)
+                {
+                    return;
+                }
+                const uint8_t* name = payload.data() + position + 2;
+                const uint16_t valueType = ReadU16(payload.data() + position + 2 + nameLength);
+                const size_t valueLength = ReadU16(payload.data() + position + 4 + nameLength);
+                position += 6 + nameLength;
+                if (payload.size() - position < valueLength)
+                {
+                    return;
+                }
+                const uint8_t* value = payload.data() + position;
+                position += valueLength;
+
+                switch (valueType)
+                {
+                case 0:
+                    {
+                        tag(NarrowUtf16(name, nameLength), NarrowUtf16(value, valueLength));
+                        break;
+                    }
+                case 3:
+                    {
+                        if (valueLength >= 4)
+                        {
+                            tag(NarrowUtf16(name, nameLength), std::to_string(ReadU32(value)));
+                        }
+                        break;
+                    }
+                case 4:
+                    {
+                        if (valueLength >= 8)
+                        {
+                            tag(NarrowUtf16(name, nameLength), std::to_string(ReadU64(value)));
+                        }
+                        break;
+                    }
+                case 5:
+                    {
+                        if (valueLength >= 2)
+                        {
+                            tag(NarrowUtf16(name, nameLength), std::to_string(ReadU16(value)));
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // What we know about a WMA file's layout: its exact duration, where its packets are, and a time-to-packet index,
+    // either straight from the file's own index objects or, failing that, sampled from the packets themselves.
+    class AsfFileInfo
+    {
+    public:
+        AsfFileInfo() :
+            duration(0),
+            prerollMs(0),
+            packetSize(0),
+            packetCount(0),
+            firstPacketOffset(0),
+            dataEnd(0),
+            audioStreamNumber(0),
+            formatTag(0),
+            channels(0),
+            sampleRate(0),
+            bitsPerSample(0),
+            hasFileIndex(false),
+            hasSampledIndex(false)
+        { }
+
+        // Reads the header object and whichever index object the file has.  Only fails if the header is unusable;
+        // a missing index just means BuildSampledIndex() has something to do later.
+        template <typename Reader>
+        bool Parse(Reader& reader)
+        {
+            using namespace asf;
+
+            uint8_t header[objectHeaderSize + 6];
+            if (!reader.ReadAt(0, header, sizeof(header)) || !IsGuid(header, headerObject))
+            {
+                return false;
+            }
+
+            const uint64_t headerEnd = ReadU64(header + 16);
+            const uint32_t childCount = ReadU32(header + 24);
+            if (headerEnd < sizeof(header) || headerEnd > reader.GetSize())
+            {
+                return false;
+            }
+
+            bool haveFileProperties = false;
+            uint64_t offset = sizeof(header);
+            for (uint32_t child = 0; child < childCount; ++child)
+            {
+                uint8_t objectHeader[objectHeaderSize];
+                if (offset + objectHeaderSize > headerEnd || !reader.ReadAt(offset, objectHeader, sizeof(objectHeader)))
+                {
+                    break;
+                }
+
+                const uint64_t objectSize = ReadU64(objectHeader + 16);
+                if (objectSize < objectHeaderSize || objectSize > headerEnd - offset)
+                {
+                    return false;
+                }
+
+                if (IsGuid(objectHeader, filePropertiesObject))
+                {
+                    haveFileProperties = ParseFileProperties(reader, offset + objectHeaderSize, objectSize - objectHeaderSize);
+                }
+                else if (IsGuid(objectHeader, streamPropertiesObject) && audioStreamNumber == 0)
+                {
+                    ParseStreamProperties(reader, offset + objectHeaderSize, objectSize - objectHeaderSize);
+                }
+                offset += objectSize;
+            }
+
+            if (!haveFileProperties || !FindPackets(reader, headerEnd))
+            {
+                return false;
+            }
+
+            FindFileIndex(reader);
+            return true;
+        }
+
+        // Exact length of the audio, in 100ns units.  The play duration in the file counts the preroll as well.
+        uint64_t GetDuration() const
+        {
+            const uint64_t preroll = prerollMs * 10000;
+            return duration > preroll ? duration - preroll : 0;
+        }
+
+        uint64_t GetPacketCount() const
+        {
+            return packetCount;
+        }
+
+        uint64_t GetPacketOffset(uint64_t packet) const
+        {
+            return firstPacketOffset + packet * packetSize;
+        }
+
+        bool HasIndex() const
+        {
+            return hasFileIndex || hasSampledIndex;
+        }
+
+        bool HasFileIndex() const
+        {
+            return hasFileIndex;
+        }
+
+        // The basics of the audio stream's WAVEFORMATEX, or false if the header didn't have one.
+        bool GetAudioFormat(uint16_t* outFormatTag, uint16_t* outChannels, uint32_t* outSampleRate, uint16_t* outBitsPerSample) const
+        {
+            if (formatTag == 0)
+            {
+                return false;
+            }
+
+            *outFormatTag = formatTag;
+            *outChannels = channels;
+            *outSampleRate = sampleRate;
+            *outBitsPerSample = bitsPerSample;
+            return true;
+        }
+
+        // Makes an index for a file that didn't come with one, by reading the send time out of every so many packet
+        // headers.  Aims for about one entry a second, within reason.
+        template <typename Reader>
+        bool BuildSampledIndex(Reader& reader)
+        {
+            if (HasIndex() || packetCount == 0)
+            {
+                return HasIndex();
+            }
+
+            const uint64_t seconds = std::max<uint64_t>(GetDuration() / 10000000, 1);
+            const uint64_t entries = std::min<uint64_t>(std::min<uint64_t>(seconds, maxSampledEntries), packetCount);
+            const uint64_t step = std::max<uint64_t>(packetCount / entries, 1);
+
+            index.clear();
+            for (uint64_t packet = 0; packet < packetCount; packet += step)
+            {
+                uint32_t sendTimeMs = 0;
+                if (!ReadPacketSendTime(reader, packet, &sendTimeMs))
+                {
+                    index.clear();
+                    return false;
+                }
+
+                // Payloads are never presented before they're sent, so this can only err on the early side
+                const uint64_t time = sendTimeMs > prerollMs ? (sendTimeMs - prerollMs) * 10000ull : 0;
+                if (index.empty() || time >= index.back().time)
+                {
+                    index.push_back({ time, packet });
+                }
+            }
+
+            hasSampledIndex = !index.empty();
+            return hasSampledIndex;
+        }
+
+        // The latest indexed point at or before the given time, as the time it's known to start no later than and
+        // the packet it's in.
+        bool FindIndexEntry(uint64_t time, uint64_t* entryTime, uint64_t* packet) const
+        {
+            if (index.empty())
+            {
+                return false;
+            }
+
+            auto entry = std::upper_bound(index.begin(), index.end(), time, [](uint64_t value, const IndexEntry& indexEntry) { return value < indexEntry.time; });
+            if (entry != index.begin())
+            {
+                --entry;
+            }
+
+            *entryTime = entry->time;
+            *packet = entry->packet;
+            return true;
+        }
+
+    private:
+        struct IndexEntry
+        {
+            uint64_t time;
+            uint64_t packet;
+        };
+
+        static constexpr uint64_t maxSampledEntries = 4096;
+
+        template <typename Reader>
+        bool ParseFileProperties(Reader& reader, uint64_t offset, uint64_t size)
+        {
+            // File ID, file size, creation date, packet count, play and send duration, preroll, flags, min and max
+            // packet size
+            uint8_t properties[80];
+            if (size < sizeof(properties) || !reader.ReadAt(offset, properties, sizeof(properties)))
+            {
+                return false;
+            }
+
+            packetCount = asf::ReadU64(properties + 32);
+            duration = asf::ReadU64(properties + 40);
+            prerollMs = asf::ReadU64(properties + 56);
+            const uint32_t minPacketSize = asf::ReadU32(properties + 68);
+            const uint32_t maxPacketSize = asf::ReadU32(properties + 72);
+
+            // Variable-size packets would make finding one by number a linear scan; nobody writes those for audio
+            if (minPacketSize != maxPacketSize || minPacketSize == 0)
+            {
+                return false;
+            }
+            packetSize = minPacketSize;
+            return true;
+        }
+
+        template <typename Reader>
+        void ParseStreamProperties(Reader& reader, uint64_t offset, uint64_t size)
+        {
+            // Stream type, error correction type, time offset, two data lengths and then the flags, whose low 7 bits
+            // are the stream number.  After 4 reserved bytes comes the type-specific data, for audio a WAVEFORMATEX.
+            uint8_t properties[70];
+            if (size >= 50 && reader.ReadAt(offset, properties, 50) && asf::IsGuid(properties, asf::audioMedia))
+            {
+                audioStreamNumber = asf::ReadU16(properties + 48) & 0x7f;
+
+                if (size >= sizeof(properties) && asf::ReadU32(properties + 40) >= 16 && reader.ReadAt(offset + 50, properties + 50, sizeof(properties) - 50))
+                {
+                    formatTag = asf::ReadU16(properties + 54);
+                    channels = asf::ReadU16(properties + 56);
+                    sampleRate = asf::ReadU32(properties + 58);
+                    bitsPerSample = asf::ReadU16(properties + 68);
+                }
+            }
+        }
+
+        template <typename Reader>
+        bool FindPackets(Reader& reader, uint64_t dataOffset)
+        {
+            uint8_t dataHeader[asf::dataObjectHeaderSize];
+            if (!reader.ReadAt(dataOffset, dataHeader, sizeof(dataHeader)) || !asf::IsGuid(dataHeader, asf::dataObject))
+            {
+                return false;
+            }
+
+            firstPacketOffset = dataOffset + asf::dataObjectHeaderSize;
+            dataEnd = dataOffset + asf::ReadU64(dataHeader + 16);
+            if (dataEnd < firstPacketOffset || dataEnd > reader.GetSize())
+            {
+                return false;
+            }
+
+            // Broadcast files don't know their packet count up front; work it out from the size instead
+            const uint64_t packetsThatFit = (dataEnd - firstPacketOffset) / packetSize;
+            if (packetCount == 0 || packetCount > packetsThatFit)
+            {
+                packetCount = packetsThatFit;
+            }
+            return true;
+        }
+
+        // Index objects come after the data object.  Either kind will do; the simple index is normally only written
+        // for video, but it's easy enough to take if it's there.
+        template <typename Reader>
+        void FindFileIndex(Reader& reader)
+        {
+            uint8_t objectHeader[asf::objectHeaderSize];
+            for (uint64_t offset = dataEnd; offset + asf::objectHeaderSize <= reader.GetSize(); )
+            {
+                if (!reader.ReadAt(offset, objectHeader, sizeof(objectHeader)))
+                {
+                    return;
+                }
+
+                const uint64_t objectSize = asf::ReadU64(objectHeader + 16);
+                if (objectSize < asf::objectHeaderSize || objectSize > reader.GetSize() - offset)
+                {
+                    return;
+                }
+
+                const uint64_t payloadOffset = offset + asf::objectHeaderSize;
+                const uint64_t payloadSize = objectSize - asf::objectHeaderSize;
+                if (asf::IsGuid(objectHeader, asf::indexObject) && ParseIndex(reader, payloadOffset, payloadSize))
+                {
+                    return;
+                }
+                if (asf::IsGuid(objectHeader, asf::simpleIndexObject) && ParseSimpleIndex(reader, payloadOffset, payloadSize))
+                {
+                    return;
+                }
+                offset += objectSize;
+            }
+        }
+
+        template <typename Reader>
+        bool ReadObjectPayload(Reader& reader, uint64_t offset, uint64_t size, std::vector<uint8_t>* payload)
+        {
+            // An entry every second for a day is still only a few hundred KB; anything much bigger is junk
+            constexpr uint64_t maxIndexSize = 16 * 1024 * 1024;
+            if (size > maxIndexSize)
+            {
+                return false;
+            }
+
+            payload->resize(static_cast<size_t>(size));
+            return size == 0 || reader.ReadAt(offset, payload->data(), payload->size());
+        }
+
+        template <typename Reader>
+        bool ParseSimpleIndex(Reader& reader, uint64_t offset, uint64_t size)
+        {
+            // File ID, entry interval (100ns), max packet count, entry count, then packet number/count pairs
+            std::vector<uint8_t> payload;
+            if (size < 32 || !ReadObjectPayload(reader, offset, size, &payload))
+            {
+                return false;
+            }
+
+            const uint64_t interval = asf::ReadU64(payload.data() + 16);
+            const uint64_t entryCount = asf::ReadU32(payload.data() + 28);
+            if (interval == 0 || entryCount == 0 || entryCount * 6 > payload.size() - 32)
+            {
+                return false;
+            }
+
+            index.clear();
+            for (uint64_t entry = 0; entry < entryCount; ++entry)
+            {
+                AddFileIndexEntry(entry * interval, asf::ReadU32(payload.data() + 32 + entry * 6));
+            }
+
+            hasFileIndex = !index.empty();
+            return hasFileIndex;
+        }
+
+        template <typename Reader>
+        bool ParseIndex(Reader& reader, uint64_t offset, uint64_t size)
+        {
+            // Entry interval (ms), specifier count, block count, the specifiers (stream number and index type), and
+            // then the blocks.  Each block has an entry count, a base position per specifier, and then each entry
+            // has a byte offset from that base per specifier.
+            std::vector<uint8_t> payload;
+            if (size < 10 || !ReadObjectPayload(reader, offset, size, &payload))
+            {
+                return false;
+            }
+
+            const uint64_t intervalMs = asf::ReadU32(payload.data());
+            const size_t specifierCount = asf::ReadU16(payload.data() + 4);
+            const uint32_t blockCount = asf::ReadU32(payload.data() + 6);
+            if (intervalMs == 0 || specifierCount == 0 || payload.size() < 10 + specifierCount * 4)
+            {
+                return false;
+            }
+
+            // Prefer the audio stream's index, if there's more than one
+            size_t specifier = 0;
+            for (size_t candidate = 0; candidate < specifierCount; ++candidate)
+            {
+                if (asf::ReadU16(payload.data() + 10 + candidate * 4) == audioStreamNumber)
+                {
+                    specifier = candidate;
+                    break;
+                }
+            }
+
+            index.clear();
+            uint64_t entryNumber = 0;
+            size_t position = 10 + specifierCount * 4;
+            for (uint32_t block = 0; block < blockCount; ++block)
+            {
+                if (payload.size() - position < 4 + specifierCount * 8)
+                {
+                    break;
+                }
+
+                const uint64_t entryCount = asf::ReadU32(payload.data() + position);
+                const uint64_t blockBase = asf::ReadU64(payload.data() + position + 4 + specifier * 8);
+                position += 4 + specifierCount * 8;
+                if (entryCount * specifierCount * 4 > payload.size() - position)
+                {
+                    break;
+                }
+
+                for (uint64_t entry = 0; entry < entryCount; ++entry, ++entryNumber)
+                {
+                    const uint64_t byteOffset = blockBase + asf::ReadU32(payload.data() + position + (entry * specifierCount + specifier) * 4);
+                    AddFileIndexEntry(entryNumber * intervalMs * 10000, byteOffset / packetSize);
+                }
+                position += static_cast<size_t>(entryCount * specifierCount * 4);
+            }
+
+            hasFileIndex = !index.empty();
+            return hasFileIndex;
+        }
+
+        void AddFileIndexEntry(uint64_t time, uint64_t packet)
+        {
+            // Entries past the end (or for stretches with nothing to index, which some muxers fill with 0xFFFFFFFF)
+            // aren't any use to us
+            if (packet < packetCount)
+            {
+                index.push_back({ time, packet });
+            }
+        }
+
+        // Pulls the send time out of a packet's payload parsing information, skipping over the error correction data
+        // and whichever of the packet length, sequence and padding length fields are present.
+        template <typename Reader>
+        bool ReadPacketSendTime(Reader& reader, uint64_t packet, uint32_t* sendTimeMs)
+        {
+            uint8_t header[32];
+            if (!reader.ReadAt(GetPacketOffset(packet), header, std::min<size_t>(sizeof(header), packetSize)))
+            {
+                return false;
+            }
+
+            size_t position = 0;
+            if (header[0] & 0x80)
+            {
+                position += 1 + (header[0] & 0x0f);
+            }
+
+            const uint8_t lengthTypeFlags = header[position];
+            position += 2;
+            position += asf::FieldSize(lengthTypeFlags >> 5);
+            position += asf::FieldSize(lengthTypeFlags >> 1);
+            position += asf::FieldSize(lengthTypeFlags >> 3);
+            if (position + 6 > std::min<size_t>(sizeof(header), packetSize))
+            {
+                return false;
+            }
+
+            *sendTimeMs = asf::ReadU32(header + position);
+            return true;
+        }
+
+        uint64_t duration;
+        uint64_t prerollMs;
+        uint32_t packetSize;
+        uint64_t packetCount;
+        uint64_t firstPacketOffset;
+        uint64_t dataEnd;
+        uint16_t audioStreamNumber;
+        uint16_t formatTag;
+        uint16_t channels;
+        uint32_t sampleRate;
+        uint16_t bitsPerSample;
+        bool hasFileIndex;
+        bool hasSampledIndex;
+
+        std::vector<IndexEntry> index;
+    };
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace mediaFoundation
+{
+    // Turns lots of small, scattered reads (box headers, packet headers, an access unit at a time) into a few big
+    // aligned ones.  Keeps the last few blocks it's read, and once reads are marching through the file in order,
+    // fetches more than one block at a time.  Reads at least a block long skip the cache altogether.
+    //
+    // Knows nothing about where the data comes from; blocks are fetched through the function passed in, which reads
+    // up to the given number of bytes at the given offset, says how many it got, and only returns false on an error.
+    class BlockCache
+    {
+    public:
+        static constexpr size_t blockSize = 64 * 1024;
+        static constexpr size_t blockCount = 4;
+        static constexpr size_t readAheadBlocks = 2;
+
+        BlockCache(uint64_t inFileSize, std::function<bool(uint64_t, void*, size_t, size_t*)> fetcher) :
+            fileSize(inFileSize),
+            fetch(std::move(fetcher)),
+            lastFetchedBlock(UINT64_MAX),
+            useCounter(0),
+            hits(0),
+            misses(0)
+        { }
+
+        BlockCache(const BlockCache&) = delete;
+        BlockCache& operator=(const BlockCache&) = delete;
+
+        // Copies up to bytes from offset, and returns how many it did.  That's only short at the end of the file, or
+        // if a fetch failed, in which case failed is set as well.
+        size_t Read(uint64_t offset, void* dest, size_t bytes, bool* failed)
+        {
+            *failed = false;
+            if (offset >= fileSize)
+            {
+                return 0;
+            }
+            if (bytes > fileSize - offset)
+            {
+                bytes = static_cast<size_t>(fileSize - offset);
+            }
+
+            if (bytes >= blockSize)
+            {
+                misses++;
+                size_t bytesFetched = 0;
+                *failed = !fetch(offset, dest, bytes, &bytesFetched);
+                return bytesFetched;
+            }
+
+            size_t bytesCopied = 0;
+            while (bytesCopied < bytes)
+            {
+                const uint64_t position = offset + bytesCopied;
+                const uint64_t blockIndex = position / blockSize;
+
+                Block* block = FindBlock(blockIndex);
+                if (block != nullptr)
+                {
+                    hits++;
+                }
+                else
+                {
+                    misses++;
+                    block = LoadBlock(blockIndex);
+                    if (block == nullptr)
+                    {
+                        *failed = true;
+                        break;
+                    }
+                }
+
+                const size_t positionInBlock = static_cast<size_t>(position - blockIndex * blockSize);
+                if (positionInBlock >= block->length)
+                {
+                    // The file came up short of the size we were told
+                    break;
+                }
+
+                const size_t bytesToCopy = std::min<size_t>(bytes - bytesCopied, block->length - positionInBlock);
+                std::memcpy(static_cast<uint8_t*>(dest) + bytesCopied, block->data.data() + positionInBlock, bytesToCopy);
+                bytesCopied += bytesToCopy;
+            }
+            return bytesCopied;
+        }
+
+        // Hands over the hit and miss counts since the last call, for adding to the codec-wide totals.
+        void TakeCounts(unsigned long long* outHits, unsigned long long* outMisses)
+        {
+            *outHits = hits;
+            *outMisses = misses;
+            hits = 0;
+            misses = 0;
+        }
+
+    private:
+        struct Block
+        {
+            uint64_t index;
+            uint64_t lastUsed;
+            size_t length;
+            std::vector<uint8_t> data;
+        };
+
+        Block* FindBlock(uint64_t blockIndex)
+        {
+            for (Block& block : blocks)
+            {
+                if (block.index == blockIndex)
+                {
+                    block.lastUsed = ++useCounter;
+                    return &block;
+                }
+            }
+            return nullptr;
+        }
+
+        // The least recently used block, or a new one if there's still room for it.
+        Block* TakeBlock()
+        {
+            if (blocks.size() < blockCount)
+            {
+                blocks.reserve(blockCount);
+                blocks.push_back({ UINT64_MAX, 0, 0, std::vector<uint8_t>(blockSize) });
+                return &blocks.back();
+            }
+
+            Block* oldest = &blocks[0];
+            for (Block& block : blocks)
+            {
+                if (block.lastUsed < oldest->lastUsed)
+                {
+                    oldest = &block;
+                }
+            }
+            return oldest;
+        }
+
+        Block* LoadBlock(uint64_t blockIndex)
+        {
+            const uint64_t lastBlock = (fileSize - 1) / blockSize;
+
+            // Only read ahead once the reads are coming in order, and never into a block we've already got
+            size_t fetchBlocks = 1;
+            if (blockIndex == lastFetchedBlock + 1)
+            {
+                while (fetchBlocks < readAheadBlocks && blockIndex + fetchBlocks <= lastBlock && FindBlock(blockIndex + fetchBlocks) == nullptr)
+                {
+                    ++fetchBlocks;
+                }
+            }
+
+            const uint64_t start = blockIndex * blockSize;
+            const size_t fetchSize = static_cast<size_t>(std::min<uint64_t>(fetchBlocks * blockSize, fileSize - start));
+
+            Block* requested = nullptr;
+            size_t bytesFetched = 0;
+            if (fetchBlocks == 1)
+            {
+                requested = TakeBlock();
+                requested->index = UINT64_MAX;
+                if (!fetch(start, requested->data.data(), fetchSize, &bytesFetched))
+                {
+                    return nullptr;
+                }
+                requested->index = blockIndex;
+                requested->length = bytesFetched;
+                requested->lastUsed = ++useCounter;
+            }
+            else
+            {
+                readAheadScratch.resize(fetchBlocks * blockSize);
+                if (!fetch(start, readAheadScratch.data(), fetchSize, &bytesFetched))
+                {
+                    return nullptr;
+                }
+
+                // The requested block's marked most recent last, so it's the one that stays longest
+                for (size_t i = fetchBlocks; i-- > 0;)
+                {
+                    const size_t offsetInFetch = i * blockSize;
+                    Block* block = TakeBlock();
+                    block->index = blockIndex + i;
+                    block->length = (bytesFetched > offsetInFetch) ? std::min<size_t>(bytesFetched - offsetInFetch, blockSize) : 0;
+                    block->lastUsed = ++useCounter;
+                    std::memcpy(block->data.data(), readAheadScratch.data() + offsetInFetch, block->length);
+                    requested = block;
+                }
+            }
+
+            lastFetchedBlock = blockIndex + fetchBlocks - 1;
+            return requested;
+        }
+
+        const uint64_t fileSize;
+        const std::function<bool(uint64_t, void*, size_t, size_t*)> fetch;
+
+        std::vector<Block> blocks;
+        std::vector<uint8_t> readAheadScratch;
+        uint64_t lastFetchedBlock;
+        uint64_t useCounter;
+        unsigned long long hits;
+        unsigned long long misses;
+    };
+}
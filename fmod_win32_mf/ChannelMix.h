@@ -0,0 +1,397 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "SampleConvert.h"
+
+namespace mediaFoundation
+{
+    // Speaker bits as used by WAVEFORMATEXTENSIBLE and MF_MT_AUDIO_CHANNEL_MASK.  Interleaved channels are always in
+    // ascending bit order.  Spelled out here rather than taken from the Windows headers so this file stays portable.
+    namespace speakers
+    {
+        constexpr unsigned int frontLeft = 0x1;
+        constexpr unsigned int frontRight = 0x2;
+        constexpr unsigned int frontCenter = 0x4;
+        constexpr unsigned int lowFrequency = 0x8;
+        constexpr unsigned int backLeft = 0x10;
+        constexpr unsigned int backRight = 0x20;
+        constexpr unsigned int frontLeftOfCenter = 0x40;
+        constexpr unsigned int frontRightOfCenter = 0x80;
+        constexpr unsigned int backCenter = 0x100;
+        constexpr unsigned int sideLeft = 0x200;
+        constexpr unsigned int sideRight = 0x400;
+
+        // Everything above this is a height channel, which none of our target layouts have
+        constexpr unsigned int allPlanar = 0x7FF;
+    }
+
+    // Layouts we can mix down to.  Side rather than back channels are used for the surrounds, since those are what
+    // FMOD's own speaker modes call surround left/right.
+    enum class ChannelLayout
+    {
+        Passthrough,
+        Mono,
+        Stereo,
+        Quad,
+        Surround,
+        FivePointOne,
+        SevenPointOne
+    };
+
+    inline unsigned int ChannelLayoutMask(ChannelLayout layout)
+    {
+        using namespace speakers;
+        switch (layout)
+        {
+        case ChannelLayout::Mono:
+            return frontCenter;
+        case ChannelLayout::Stereo:
+            return frontLeft | frontRight;
+        case ChannelLayout::Quad:
+            return frontLeft | frontRight | sideLeft | sideRight;
+        case ChannelLayout::Surround:
+            return frontLeft | frontRight | frontCenter | sideLeft | sideRight;
+        case ChannelLayout::FivePointOne:
+            return frontLeft | frontRight | frontCenter | lowFrequency | sideLeft | sideRight;
+        case ChannelLayout::SevenPointOne:
+            return frontLeft | frontRight | frontCenter | lowFrequency | backLeft | backRight | sideLeft | sideRight;
+        default:
+            return 0;
+        }
+    }
+
+    inline unsigned int CountChannels(unsigned int mask)
+    {
+        unsigned int count = 0;
+        for (; mask != 0; mask &= mask - 1)
+        {
+            ++count;
+        }
+        return count;
+    }
+
+    // What a file with no (or a nonsensical) channel mask most likely means, going by the usual Windows defaults.
+    inline unsigned int DefaultChannelMask(unsigned int channels)
+    {
+        using namespace speakers;
+        switch (channels)
+        {
+        case 1:
+            return frontCenter;
+        case 2:
+            return frontLeft | frontRight;
+        case 3:
+            return frontLeft | frontRight | frontCenter;
+        case 4:
+            return frontLeft | frontRight | backLeft | backRight;
+        case 5:
+            return frontLeft | frontRight | frontCenter | backLeft | backRight;
+        case 6:
+            return frontLeft | frontRight | frontCenter | lowFrequency | backLeft | backRight;
+        case 8:
+            return frontLeft | frontRight | frontCenter | lowFrequency | backLeft | backRight | sideLeft | sideRight;
+        default:
+            return 0;
+        }
+    }
+
+    // Mixing coefficients from one channel layout to another.  Stored one input channel at a time, each as a column
+    // of maxOutputChannels output gains (zero padded), which is the shape the SIMD kernels want.
+    struct ChannelMatrix
+    {
+        static constexpr unsigned int maxOutputChannels = 8;
+
+        unsigned int inputChannels = 0;
+        unsigned int outputChannels = 0;
+        unsigned int outputMask = 0;
+        std::vector<float> columns;
+
+        bool IsActive() const
+        {
+            return inputChannels > 0;
+        }
+
+        float Get(unsigned int input, unsigned int output) const
+        {
+            return columns[input * maxOutputChannels + output];
+        }
+    };
+
+    namespace channelMixing
+    {
+        constexpr float minus3dB = 0.70710678f;
+
+        inline int ChannelIndex(unsigned int mask, unsigned int speaker)
+        {
+            return (mask & speaker) ? static_cast<int>(CountChannels(mask & (speaker - 1))) : -1;
+        }
+
+        // Adds an input speaker's contribution to the output, folding it into whichever neighbours the output
+        // layout does have if it's missing that speaker.  Roughly the ITU-R BS.775 downmix; LFE is dropped, as are
+        // height channels.
+        inline void Route(unsigned int speaker, float gain, unsigned int outputMask, float* column)
+        {
+            using namespace speakers;
+
+            const int index = ChannelIndex(outputMask, speaker);
+            if (index >= 0)
+            {
+                column[index] += gain;
+                return;
+            }
+
+            switch (speaker)
+            {
+            case frontLeft:
+            case frontRight:
+                Route(frontCenter, gain * minus3dB, outputMask, column);
+                break;
+            case frontCenter:
+                if ((outputMask & (frontLeft | frontRight)) == (frontLeft | frontRight))
+                {
+                    Route(frontLeft, gain * minus3dB, outputMask, column);
+                    Route(frontRight, gain * minus3dB, outputMask, column);
+                }
+                break;
+            case frontLeftOfCenter:
+                Route(frontLeft, gain, outputMask, column);
+                break;
+            case frontRightOfCenter:
+                Route(frontRight, gain, outputMask, column);
+                break;
+            case backLeft:
+                if (outputMask & sideLeft)
+                {
+                    Route(sideLeft, gain, outputMask, column);
+                }
+                else
+                {
+                    Route(frontLeft, gain * minus3dB, outputMask, column);
+                }
+                break;
+            case backRight:
+                if (outputMask & sideRight)
+                {
+                    Route(sideRight, gain, outputMask, column);
+                }
+                else
+                {
+                    Route(frontRight, gain * minus3dB, outputMask, column);
+                }
+                break;
+            case sideLeft:
+                if (outputMask & backLeft)
+                {
+                    Route(backLeft, gain, outputMask, column);
+                }
+                else
+                {
+                    Route(frontLeft, gain * minus3dB, outputMask, column);
+                }
+                break;
+            case sideRight:
+                if (outputMask & backRight)
+                {
+                    Route(backRight, gain, outputMask, column);
+                }
+                else
+                {
+                    Route(frontRight, gain * minus3dB, outputMask, column);
+                }
+                break;
+            case backCenter:
+                Route(backLeft, gain * minus3dB, outputMask, column);
+                Route(backRight, gain * minus3dB, outputMask, column);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    // Works out how to get from the input layout to the target one.  The result is inactive if there's nothing to
+    // gain: the input already matches, would need upmixing, or has a layout we can't make sense of.
+    inline ChannelMatrix BuildChannelMatrix(unsigned int inputChannels, unsigned int inputMask, ChannelLayout target)
+    {
+        ChannelMatrix matrix;
+
+        const unsigned int outputMask = ChannelLayoutMask(target);
+        const unsigned int outputChannels = CountChannels(outputMask);
+        if (outputMask == 0 || inputChannels < outputChannels)
+        {
+            return matrix;
+        }
+
+        if (CountChannels(inputMask) != inputChannels)
+        {
+            inputMask = DefaultChannelMask(inputChannels);
+            if (inputMask == 0)
+            {
+                return matrix;
+            }
+        }
+
+        std::vector<float> columns(static_cast<size_t>(inputChannels) * ChannelMatrix::maxOutputChannels, 0.0f);
+        unsigned int remainingMask = inputMask;
+        for (unsigned int input = 0; input < inputChannels; ++input)
+        {
+            const unsigned int speaker = remainingMask & (~remainingMask + 1);
+            remainingMask &= remainingMask - 1;
+
+            if (speaker & speakers::allPlanar)
+            {
+                channelMixing::Route(speaker, 1.0f, outputMask, &columns[static_cast<size_t>(input) * ChannelMatrix::maxOutputChannels]);
+            }
+        }
+
+        if (inputChannels == outputChannels)
+        {
+            // Same number of channels could still be a reordering; if it's just the identity, don't bother
+            bool isIdentity = true;
+            for (unsigned int input = 0; input < inputChannels && isIdentity; ++input)
+            {
+                for (unsigned int output = 0; output < outputChannels; ++output)
+                {
+                    if (columns[static_cast<size_t>(input) * ChannelMatrix::maxOutputChannels + output] != (input == output ? 1.0f : 0.0f))
+                    {
+                        isIdentity = false;
+                        break;
+                    }
+                }
+            }
+
+            if (isIdentity)
+            {
+                return matrix;
+            }
+        }
+
+        matrix.inputChannels = inputChannels;
+        matrix.outputChannels = outputChannels;
+        matrix.outputMask = outputMask;
+        matrix.columns = std::move(columns);
+        return matrix;
+    }
+
+    namespace mixKernels
+    {
+        typedef void (*MixFunc)(const float* src, float* dst, size_t frames, const ChannelMatrix& matrix);
+
+        inline void MixScalar(const float* src, float* dst, size_t frames, const ChannelMatrix& matrix)
+        {
+            const unsigned int inputs = matrix.inputChannels;
+            const unsigned int outputs = matrix.outputChannels;
+            const float* columns = matrix.columns.data();
+
+            for (size_t frame = 0; frame < frames; ++frame)
+            {
+                const float* in = src + frame * inputs;
+                float* out = dst + frame * outputs;
+                for (unsigned int output = 0; output < outputs; ++output)
+                {
+                    float sum = 0.0f;
+                    for (unsigned int input = 0; input < inputs; ++input)
+                    {
+                        sum += in[input] * columns[input * ChannelMatrix::maxOutputChannels + output];
+                    }
+                    out[output] = sum;
+                }
+            }
+        }
+
+        // The SIMD versions broadcast each input sample across a register and accumulate it times that input's column,
+        // which gives a whole output frame at once.  Full-width stores run past the end of the frame into the next
+        // one, which is fine because that gets written properly on the next iteration; only the last few frames,
+        // where that would run off the end of dst, go through a temporary.
+
+#if SAMPLE_CONVERT_X86
+        inline void MixSse(const float* src, float* dst, size_t frames, const ChannelMatrix& matrix)
+        {
+            const unsigned int inputs = matrix.inputChannels;
+            const unsigned int outputs = matrix.outputChannels;
+            const float* columns = matrix.columns.data();
+            const size_t totalOutput = frames * outputs;
+            const unsigned int storeWidth = outputs > 4 ? 8 : 4;
+
+            alignas(16) float tail[ChannelMatrix::maxOutputChannels];
+            for (size_t frame = 0; frame < frames; ++frame)
+            {
+                const float* in = src + frame * inputs;
+                __m128 low = _mm_setzero_ps();
+                __m128 high = _mm_setzero_ps();
+                for (unsigned int input = 0; input < inputs; ++input)
+                {
+                    const __m128 sample = _mm_set1_ps(in[input]);
+                    const float* column = columns + input * ChannelMatrix::maxOutputChannels;
+                    low = _mm_add_ps(low, _mm_mul_ps(sample, _mm_loadu_ps(column)));
+                    high = _mm_add_ps(high, _mm_mul_ps(sample, _mm_loadu_ps(column + 4)));
+                }
+
+                float* out = dst + frame * outputs;
+                float* target = (frame * outputs + storeWidth <= totalOutput) ? out : tail;
+                _mm_storeu_ps(target, low);
+                if (storeWidth > 4)
+                {
+                    _mm_storeu_ps(target + 4, high);
+                }
+                if (target == tail)
+                {
+                    std::memcpy(out, tail, outputs * sizeof(float));
+                }
+            }
+        }
+
+        SAMPLE_CONVERT_AVX2 inline void MixAvx2(const float* src, float* dst, size_t frames, const ChannelMatrix& matrix)
+        {
+            const unsigned int inputs = matrix.inputChannels;
+            const unsigned int outputs = matrix.outputChannels;
+            const float* columns = matrix.columns.data();
+            const size_t totalOutput = frames * outputs;
+
+            alignas(32) float tail[ChannelMatrix::maxOutputChannels];
+            for (size_t frame = 0; frame < frames; ++frame)
+            {
+                const float* in = src + frame * inputs;
+                __m256 sum = _mm256_setzero_ps();
+                for (unsigned int input = 0; input < inputs; ++input)
+                {
+                    const __m256 sample = _mm256_set1_ps(in[input]);
+                    sum = _mm256_add_ps(sum, _mm256_mul_ps(sample, _mm256_loadu_ps(columns + input * ChannelMatrix::maxOutputChannels)));
+                }
+
+                float* out = dst + frame * outputs;
+                if (frame * outputs + ChannelMatrix::maxOutputChannels <= totalOutput)
+                {
+                    _mm256_storeu_ps(out, sum);
+                }
+                else
+                {
+                    _mm256_store_ps(tail, sum);
+                    std::memcpy(out, tail, outputs * sizeof(float));
+                }
+            }
+        }
+#endif
+
+        inline MixFunc Best()
+        {
+#if SAMPLE_CONVERT_X86
+            static const MixFunc best = sampleKernels::CpuHasAvx2() ? MixAvx2 : MixSse;
+#else
+            static const MixFunc best = MixScalar;
+#endif
+            return best;
+        }
+    }
+
+    // Mixes frames of interleaved float from the matrix's input layout to its output layout.  src and dst must not
+    // overlap.
+    inline void MixChannels(const float* src, float* dst, size_t frames, const ChannelMatrix& matrix)
+    {
+        mixKernels::Best()(src, dst, frames, matrix);
+    }
+}
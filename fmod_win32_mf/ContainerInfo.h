@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Mp4Parser.h"
+#include "AsfParser.h"
+#include "LoopPoints.h"
+
+namespace mediaFoundation
+{
+    // What can be learned about a file from its container alone: its exact length, its tags, and the gapless and loop
+    // information in them.  This is the part of probing a file that doesn't need a decoder, or Media Foundation at
+    // all, so it reads through the same kind of Reader as the parsers it wraps.
+    class ContainerInfo
+    {
+    public:
+        typedef std::vector<std::pair<std::string, std::string>> TagList;
+
+        ContainerInfo() :
+            durationIn100ns(0),
+            seekPoints(0),
+            hasDuration(false)
+        { }
+
+        template <typename Reader>
+        void ReadMp4(Reader& reader)
+        {
+            Mp4SampleTable sampleTable;
+            if (sampleTable.Parse(reader) && sampleTable.GetTimescale() != 0)
+            {
+                durationIn100ns = sampleTable.GetDuration() * 10000000 / sampleTable.GetTimescale();
+                seekPoints = sampleTable.GetSampleCount();
+                hasDuration = true;
+            }
+
+            ReadMp4Tags(reader);
+        }
+
+        // Just the tags, for when the rest is already known.
+        template <typename Reader>
+        void ReadMp4Tags(Reader& reader)
+        {
+            mp4::ForEachFreeformTag(reader, [this](const std::string& name, const std::string& value) { AddTag(name, value); });
+        }
+
+        template <typename Reader>
+        void ReadAsf(Reader& reader)
+        {
+            AsfFileInfo fileInfo;
+            if (fileInfo.Parse(reader))
+            {
+                durationIn100ns = fileInfo.GetDuration();
+                seekPoints = fileInfo.HasFileIndex() ? fileInfo.GetPacketCount() : 0;
+                hasDuration = true;
+            }
+
+            ReadAsfTags(reader);
+        }
+
+        template <typename Reader>
+        void ReadAsfTags(Reader& reader)
+        {
+            asf::ForEachContentAttribute(reader, [this](const std::string& name, const std::string& value) { AddTag(name, value); });
+        }
+
+        // Checks the tags' gapless info against the container's length, once the decoded sampleRate is known, and drops
+        // it if it doesn't fit.  Meant to be called before anything below.
+        void FitTagsToLength(uint32_t sampleRate)
+        {
+            loopPoints.FitToLength(hasDuration ? LoopPoints::TimeToFrames(durationIn100ns, 10000000, sampleRate) : 0);
+        }
+
+        // The length of what's actually played at sampleRate, preferring the gapless length from the tags over the
+        // container's own, which includes the encoder's padding.
+        bool GetDuration(uint32_t sampleRate, uint64_t* outDurationIn100ns) const
+        {
+            if (loopPoints.GetContentFrames() > 0 && sampleRate != 0)
+            {
+                *outDurationIn100ns = loopPoints.GetContentFrames() * 10000000 / sampleRate;
+                return true;
+            }
+
+            if (!hasDuration)
+            {
+                return false;
+            }
+
+            *outDurationIn100ns = durationIn100ns;
+            return true;
+        }
+
+        // How many places the container's own index lets a seek land exactly: access units in an MP4, packets in an
+        // indexed ASF file.  0 if seeking will be left to Media Foundation.
+        uint64_t GetSeekPoints() const
+        {
+            return seekPoints;
+        }
+
+        const LoopPoints& GetLoopPoints() const
+        {
+            return loopPoints;
+        }
+
+        const TagList& GetTags() const
+        {
+            return tags;
+        }
+
+    private:
+        void AddTag(const std::string& name, const std::string& value)
+        {
+            loopPoints.ApplyTag(name, value);
+            tags.emplace_back(name, value);
+        }
+
+        uint64_t durationIn100ns;
+        uint64_t seekPoints;
+        bool hasDuration;
+        LoopPoints loopPoints;
+        TagList tags;
+    };
+}
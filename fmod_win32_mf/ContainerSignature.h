@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace mediaFoundation
+{
+    // A run of bytes at a fixed offset that identifies a container, with a mask for bit fields that vary.
+    struct ContainerSignature
+    {
+        const wchar_t* mimeType;
+        size_t offset;
+        size_t length;
+        uint8_t bytes[16];
+        uint8_t mask[16];
+    };
+
+    // For the common case of a plain ASCII tag, like an ftyp brand.
+    constexpr ContainerSignature AsciiSignature(const wchar_t* mimeType, size_t offset, const char* tag)
+    {
+        ContainerSignature signature = { mimeType, offset, 0, {}, {} };
+        for (; tag[signature.length] != '\0'; ++signature.length)
+        {
+            signature.bytes[signature.length] = static_cast<uint8_t>(tag[signature.length]);
+            signature.mask[signature.length] = 0xff;
+        }
+        return signature;
+    }
+
+    // Everything we'll take off FMOD's hands.  MP3, WAV and the like aren't here on purpose: Media Foundation could
+    // play them, but FMOD's own codecs already do.  Checked in order, first match wins.
+    constexpr ContainerSignature containerSignatures[] =
+    {
+        // MPEG-4 and 3GPP: "ftyp" and the major brand, after a box size that varies
+        AsciiSignature(L"audio/mp4", 4, "ftypM4A "),
+        AsciiSignature(L"audio/mp4", 4, "ftypM4B "),
+        AsciiSignature(L"audio/mp4", 4, "ftypM4P "),
+        AsciiSignature(L"audio/mp4", 4, "ftypmp42"),
+        AsciiSignature(L"audio/mp4", 4, "ftypmp41"),
+        AsciiSignature(L"audio/mp4", 4, "ftypisom"),
+        AsciiSignature(L"audio/mp4", 4, "ftypiso2"),
+        AsciiSignature(L"audio/mp4", 4, "ftypdash"),
+        AsciiSignature(L"audio/mp4", 4, "ftypF4A "),
+        AsciiSignature(L"audio/3gpp", 4, "ftyp3gp4"),
+        AsciiSignature(L"audio/3gpp", 4, "ftyp3gp5"),
+        AsciiSignature(L"audio/3gpp", 4, "ftyp3gp6"),
+        AsciiSignature(L"audio/3gpp2", 4, "ftyp3g2a"),
+
+        // ASF: the header object's GUID
+        { L"audio/x-ms-wma", 0, 16,
+            { 0x30, 0x26, 0xb2, 0x75, 0x8e, 0x66, 0xcf, 0x11, 0xa6, 0xd9, 0x00, 0xaa, 0x00, 0x62, 0xce, 0x6c },
+            { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff } },
+
+        // Raw AAC in ADTS frames: a 12-bit sync word, then layer 0, which is what tells it apart from MP3
+        { L"audio/aac", 0, 2, { 0xff, 0xf0 }, { 0xff, 0xf6 } },
+    };
+
+    constexpr size_t SignatureProbeSize()
+    {
+        size_t probeSize = 0;
+        for (const ContainerSignature& signature : containerSignatures)
+        {
+            probeSize = std::max<size_t>(probeSize, signature.offset + signature.length);
+        }
+        return probeSize;
+    }
+
+    const wchar_t* MatchSignature(const uint8_t* probe, size_t probeLength)
+    {
+        for (const ContainerSignature& signature : containerSignatures)
+        {
+            if (signature.offset + signature.length > probeLength)
+            {
+                continue;
+            }
+
+            bool matches = true;
+            for (size_t i = 0; i < signature.length && matches; ++i)
+            {
+                matches = (probe[signature.offset + i] & signature.mask[i]) == signature.bytes[i];
+            }
+            if (matches)
+            {
+                return signature.mimeType;
+            }
+        }
+        return nullptr;
+    }
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "PcmBlockPool.h"
+
+namespace mediaFoundation
+{
+    // The decoded sample read() is draining, with its PCM locked so that it can be copied straight to FMOD.
+    //
+    // A sample that arrives in one buffer is read in place, and the sample itself is held until we're done with it.
+    // Holding the buffer alone isn't enough: decoders hand out samples from a pool of their own, and the moment the
+    // last reference to a sample goes, its memory is up for the next decode, whoever still has hold of the buffer.
+    // A sample spread over several buffers is flattened into a block from the PcmBlockPool instead, after which the
+    // sample isn't needed and goes straight back.
+    //
+    // Sample and Buffer are anything shaped like IMFSample and IMFMediaBuffer.  Results are COM statuses, negative on
+    // failure.
+    template <typename Sample, typename Buffer>
+    class DecodedSample
+    {
+    public:
+        explicit DecodedSample(PcmBlockPool<Buffer>& blockPool) :
+            pool(blockPool),
+            sample(nullptr),
+            buffer(nullptr),
+            data(nullptr),
+            size(0),
+            pooled(false)
+        { }
+
+        DecodedSample(const DecodedSample&) = delete;
+        DecodedSample& operator=(const DecodedSample&) = delete;
+
+        ~DecodedSample()
+        {
+            Release();
+        }
+
+        // Takes over the reference to newSample, dropping whatever was held before.  On failure, nothing's held and
+        // the sample's been released.
+        long Hold(Sample* newSample)
+        {
+            Release();
+
+            sample = newSample;
+
+            unsigned long bufferCount = 0;
+            long result = sample->GetBufferCount(&bufferCount);
+            if (result >= 0)
+            {
+                if (bufferCount == 1)
+                {
+                    // The common case: the decoder's own buffer is already contiguous, so we can read it in place.
+                    result = sample->GetBufferByIndex(0, &buffer);
+                }
+                else
+                {
+                    // Rather than letting ConvertToContiguousBuffer() allocate a new buffer every time, flatten it into
+                    // one of our recycled blocks
+                    unsigned long sampleLength = 0;
+                    result = sample->GetTotalLength(&sampleLength);
+                    if (result >= 0)
+                    {
+                        buffer = pool.Acquire(sampleLength);
+                        result = (buffer != nullptr) ? 0 : outOfMemory;
+                    }
+                    if (result >= 0)
+                    {
+                        pooled = true;
+                        result = sample->CopyToBuffer(buffer);
+                    }
+                    if (result >= 0)
+                    {
+                        sample->Release();
+                        sample = nullptr;
+                    }
+                }
+            }
+
+            if (result >= 0)
+            {
+                result = buffer->Lock(&data, nullptr, &size);
+                if (result < 0)
+                {
+                    data = nullptr;
+                }
+            }
+
+            if (result < 0)
+            {
+                Release();
+            }
+            return result;
+        }
+
+        void Release()
+        {
+            if (buffer != nullptr)
+            {
+                if (data != nullptr)
+                {
+                    buffer->Unlock();
+                }
+
+                if (pooled)
+                {
+                    pool.Recycle(buffer);
+                }
+                else
+                {
+                    buffer->Release();
+                }
+            }
+            if (sample != nullptr)
+            {
+                sample->Release();
+            }
+
+            sample = nullptr;
+            buffer = nullptr;
+            data = nullptr;
+            size = 0;
+            pooled = false;
+        }
+
+        bool IsEmpty() const
+        {
+            return buffer == nullptr;
+        }
+
+        const uint8_t* GetData() const
+        {
+            return data;
+        }
+
+        size_t GetSize() const
+        {
+            return size;
+        }
+
+    private:
+        // E_OUTOFMEMORY, spelt out since there's no winerror.h here
+        static constexpr long outOfMemory = static_cast<int32_t>(0x8007000Eu);
+
+        PcmBlockPool<Buffer>& pool;
+        Sample* sample;
+        Buffer* buffer;
+        uint8_t* data;
+        unsigned long size;
+        bool pooled;
+    };
+}
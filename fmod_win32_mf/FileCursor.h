@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace mediaFoundation
+{
+    // Positional reads on top of a file that only has a current position, such as FMOD's.  Keeps track of where the
+    // file is, so that a read carrying on from where the last one ended doesn't seek first.  After a failure nobody
+    // knows where the file is, so the next read always seeks.
+    //
+    // Knows nothing about the file itself; the seek function moves it to the given offset, and the read function reads
+    // up to the given number of bytes from wherever it is, says how many it got, and only returns false on an error.
+    class FileCursor
+    {
+    public:
+        static constexpr uint64_t unknownPosition = UINT64_MAX;
+
+        FileCursor(uint64_t startPosition, std::function<bool(uint64_t)> seeker, std::function<bool(void*, size_t, size_t*)> reader) :
+            seek(std::move(seeker)),
+            read(std::move(reader)),
+            position(startPosition)
+        { }
+
+        FileCursor(const FileCursor&) = delete;
+        FileCursor& operator=(const FileCursor&) = delete;
+
+        bool Read(uint64_t offset, void* dest, size_t bytes, size_t* bytesRead)
+        {
+            *bytesRead = 0;
+            if (offset != position)
+            {
+                position = unknownPosition;
+                if (!seek(offset))
+                {
+                    return false;
+                }
+            }
+
+            const bool readSucceeded = read(dest, bytes, bytesRead);
+            position = readSucceeded ? offset + *bytesRead : unknownPosition;
+            return readSucceeded;
+        }
+
+        uint64_t GetPosition() const
+        {
+            return position;
+        }
+
+    private:
+        std::function<bool(uint64_t)> seek;
+        std::function<bool(void*, size_t, size_t*)> read;
+        uint64_t position;
+    };
+}
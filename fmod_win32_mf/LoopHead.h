@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace mediaFoundation
+{
+    // The first stretch of a stream's output from where it loops back to, kept so that a loop can be played out of
+    // memory while the decoder catches up.  Fills in as the output is played the first time through, and only once
+    // it's full is a seek ever played out of it.  After such a seek, Read() hands back the rest of it, and the decoder
+    // needs to carry on from the frame right after it.
+    //
+    // Frames are whatever blockAlign bytes the output's made of; nothing here looks inside them.
+    class LoopHead
+    {
+    public:
+        LoopHead() :
+            blockAlign(1),
+            capacity(0),
+            readPos(0),
+            startFrame(0)
+        { }
+
+        // Sets aside room for frames frames of output from startFrame on, throwing away anything kept so far.
+        void Start(uint64_t inStartFrame, size_t frames, size_t inBlockAlign)
+        {
+            blockAlign = inBlockAlign;
+            capacity = frames * blockAlign;
+            startFrame = inStartFrame;
+            data.clear();
+            data.reserve(capacity);
+            readPos = capacity;
+        }
+
+        bool IsFull() const
+        {
+            return capacity > 0 && data.size() == capacity;
+        }
+
+        // Called with everything that's played, starting at firstFrame, and keeps whatever carries on from what it's
+        // got so far.
+        void Capture(const uint8_t* output, uint64_t firstFrame, size_t frames)
+        {
+            if (data.size() == capacity)
+            {
+                return;
+            }
+
+            const uint64_t nextFrame = startFrame + data.size() / blockAlign;
+            if (nextFrame < firstFrame || nextFrame >= firstFrame + frames)
+            {
+                return;
+            }
+
+            const size_t skipBytes = static_cast<size_t>(nextFrame - firstFrame) * blockAlign;
+            const size_t bytesToKeep = std::min<size_t>(frames * blockAlign - skipBytes, capacity - data.size());
+            data.insert(data.end(), output + skipBytes, output + skipBytes + bytesToKeep);
+        }
+
+        // Copies up to maxFrames frames out, if a seek has put us in it.  Returns how many frames that was.
+        size_t Read(uint8_t* dest, size_t maxFrames)
+        {
+            if (readPos >= data.size())
+            {
+                return 0;
+            }
+
+            const size_t bytes = std::min<size_t>(maxFrames * blockAlign, data.size() - readPos);
+            std::memcpy(dest, data.data() + readPos, bytes);
+            readPos += bytes;
+            return bytes / blockAlign;
+        }
+
+        // Works out what a seek to targetFrame means for the loop head.  Returns true, with the frame the decoder
+        // needs to pick up from, if it's full and covers targetFrame, in which case Read() plays from there until it
+        // runs out.  Otherwise the decoder has to go to targetFrame as usual, and Read() hands back nothing.
+        bool SeekInto(uint64_t targetFrame, uint64_t* resumeFrame)
+        {
+            if (IsFull() && targetFrame >= startFrame && (targetFrame - startFrame) * blockAlign < data.size())
+            {
+                readPos = static_cast<size_t>(targetFrame - startFrame) * blockAlign;
+                *resumeFrame = startFrame + data.size() / blockAlign;
+                return true;
+            }
+
+            readPos = capacity;
+            return false;
+        }
+
+    private:
+        std::vector<uint8_t> data;
+        size_t blockAlign;
+        size_t capacity;
+        size_t readPos;     // Where Read() is up to after a seek into the loop head, and capacity, past anything it'll
+                            // ever hold, otherwise
+        uint64_t startFrame;
+    };
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace mediaFoundation
+{
+    // Gapless playback and loop information gathered from a file's tags, in frames at the decoded sample rate.  The
+    // container parsers hand over every string tag they find and this picks out the ones it knows:
+    //
+    //     iTunSMPB     iTunes' gapless info: hex fields for the encoder delay, end padding and real length
+    //     LOOPSTART    first frame of the loop (the RPG Maker convention, also used by plenty of game rips)
+    //     LOOPLENGTH   frames in the loop
+    //     LOOPEND      first frame after the loop, for taggers that write that instead of a length
+    //
+    // Loop points count from the first frame that's actually played, i.e. after the encoder delay.
+    //
+    // None of this is to be trusted: tags get copied between files, and can say anything at all.  Numbers past
+    // maxFrames are thrown out as they're read, and FitToLength() checks the rest against the container's own length.
+    class LoopPoints
+    {
+    public:
+        // About eight months at 48 kHz, and small enough to multiply by 10000000 (for 100 ns units) or any sample rate
+        // without overflowing
+        static constexpr uint64_t maxFrames = 1ull << 40;
+
+        LoopPoints() :
+            encoderDelay(0),
+            contentFrames(0),
+            totalFrames(0),
+            loopStart(0),
+            loopLength(0),
+            loopEnd(0),
+            hasLoopStart(false),
+            hasLoopLength(false),
+            hasLoopEnd(false)
+        { }
+
+        void ApplyTag(const std::string& name, const std::string& value)
+        {
+            if (NameIs(name, "iTunSMPB"))
+            {
+                ParseSmpb(value);
+            }
+            else if (NameIs(name, "LOOPSTART"))
+            {
+                hasLoopStart = ParseDecimal(value, &loopStart);
+            }
+            else if (NameIs(name, "LOOPLENGTH"))
+            {
+                hasLoopLength = ParseDecimal(value, &loopLength);
+            }
+            else if (NameIs(name, "LOOPEND"))
+            {
+                hasLoopEnd = ParseDecimal(value, &loopEnd);
+            }
+        }
+
+        // Checks what the tags say against the container, which holds containerFrames frames at the decoded rate, or 0
+        // if that isn't known.  Gapless info that doesn't fit, or can't be checked, is dropped; loops are kept inside
+        // whatever length is left.
+        void FitToLength(uint64_t containerFrames)
+        {
+            totalFrames = std::min<uint64_t>(containerFrames, maxFrames);
+            if (totalFrames == 0 || encoderDelay > totalFrames || contentFrames > totalFrames - encoderDelay)
+            {
+                encoderDelay = 0;
+                contentFrames = 0;
+            }
+        }
+
+        // How many frames time is at rate, where time counts in timescale units, rounded up and capped at maxFrames.
+        static uint64_t TimeToFrames(uint64_t time, uint64_t timescale, uint64_t rate)
+        {
+            if (timescale == 0)
+            {
+                return 0;
+            }
+
+            const uint64_t seconds = time / timescale;
+            if (seconds > maxFrames / std::max<uint64_t>(rate, 1))
+            {
+                return maxFrames;
+            }
+            return std::min<uint64_t>(seconds * rate + ((time % timescale) * rate + timescale - 1) / timescale, maxFrames);
+        }
+
+        // Priming frames at the start of the decoded stream that were never part of the original audio.
+        uint64_t GetEncoderDelay() const
+        {
+            return encoderDelay;
+        }
+
+        // Length of the original audio, or 0 if the tags didn't say.
+        uint64_t GetContentFrames() const
+        {
+            return contentFrames;
+        }
+
+        // The loop as [start, end), if the tags describe one that fits inside the audio.
+        bool GetLoop(uint64_t* start, uint64_t* end) const
+        {
+            if (!hasLoopStart || (!hasLoopLength && !hasLoopEnd))
+            {
+                return false;
+            }
+
+            // Both are capped at maxFrames, so this can't overflow
+            uint64_t loopStop = hasLoopLength ? loopStart + loopLength : loopEnd;
+            const uint64_t playedFrames = (contentFrames != 0) ? contentFrames : (totalFrames != 0) ? totalFrames - encoderDelay : 0;
+            if (playedFrames != 0 && loopStop > playedFrames)
+            {
+                loopStop = playedFrames;
+            }
+            if (loopStop <= loopStart)
+            {
+                return false;
+            }
+
+            *start = loopStart;
+            *end = loopStop;
+            return true;
+        }
+
+    private:
+        static bool NameIs(const std::string& name, const char* expected)
+        {
+            if (std::strlen(expected) != name.size())
+            {
+                return false;
+            }
+
+            for (size_t i = 0; i < name.size(); ++i)
+            {
+                if (std::toupper(static_cast<unsigned char>(name[i])) != std::toupper(static_cast<unsigned char>(expected[i])))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        static bool ParseDecimal(const std::string& value, uint64_t* result)
+        {
+            char* end = nullptr;
+            const unsigned long long parsed = std::strtoull(value.c_str(), &end, 10);
+            if (end == value.c_str() || parsed > maxFrames)
+            {
+                return false;
+            }
+
+            *result = parsed;
+            return true;
+        }
+
+        // " 00000000 00000840 000001CA 00000000001CDF76 ...": a zero field, then the delay, the padding and the
+        // original length, all in hex.  Padding falls out of the other two, so it isn't needed.
+        void ParseSmpb(const std::string& value)
+        {
+            uint64_t fields[4] = {};
+            const char* position = value.c_str();
+            for (uint64_t& field : fields)
+            {
+                char* end = nullptr;
+                field = std::strtoull(position, &end, 16);
+                if (end == position)
+                {
+                    return;
+                }
+                position = end;
+            }
+
+            if (fields[1] > maxFrames || fields[3] > maxFrames)
+            {
+                return;
+            }
+
+            encoderDelay = fields[1];
+            contentFrames = fields[3];
+        }
+
+        uint64_t encoderDelay;
+        uint64_t contentFrames;
+        uint64_t totalFrames;
+        uint64_t loopStart;
+        uint64_t loopLength;
+        uint64_t loopEnd;
+        bool hasLoopStart;
+        bool hasLoopLength;
+        bool hasLoopEnd;
+    };
+}
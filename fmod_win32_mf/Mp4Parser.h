@@ -0,0 +1,555 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+namespace mediaFoundation
+{
+    // Just enough of ISO/IEC 14496-12 to pull the sample table for an audio track out of an MP4/M4A file, without
+    // going anywhere near Media Foundation.  Everything is read through a Reader, which needs:
+    //
+    //     bool ReadAt(uint64_t offset, void* dest, size_t bytes);   // all or nothing
+    //     uint64_t GetSize();
+    namespace mp4
+    {
+        constexpr uint32_t FourCC(char a, char b, char c, char d)
+        {
+            return (static_cast<uint32_t>(static_cast<uint8_t>(a)) << 24) | (static_cast<uint32_t>(static_cast<uint8_t>(b)) << 16)
+                | (static_cast<uint32_t>(static_cast<uint8_t>(c)) << 8) | static_cast<uint32_t>(static_cast<uint8_t>(d));
+        }
+
+        inline uint16_t ReadU16(const uint8_t* data)
+        {
+            return static_cast<uint16_t>((data[0] << 8) | data[1]);
+        }
+
+        inline uint32_t ReadU32(const uint8_t* data)
+        {
+            return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) | (static_cast<uint32_t>(data[2]) << 8) | data[3];
+        }
+
+        inline uint64_t ReadU64(const uint8_t* data)
+        {
+            return (static_cast<uint64_t>(ReadU32(data)) << 32) | ReadU32(data + 4);
+        }
+
+        // Where a box's payload starts and ends, not counting its header.
+        struct Box
+        {
+            uint32_t type;
+            uint64_t start;
+            uint64_t end;
+        };
+
+        // Reads the header of the box at offset, which has to fit inside a parent ending at parentEnd.
+        template <typename Reader>
+        bool ReadBox(Reader& reader, uint64_t offset, uint64_t parentEnd, Box* box)
+        {
+            uint8_t header[16];
+            if (offset + 8 > parentEnd || !reader.ReadAt(offset, header, 8))
+            {
+                return false;
+            }
+
+            uint64_t size = ReadU32(header);
+            uint64_t headerSize = 8;
+            if (size == 1)
+            {
+                if (offset + 16 > parentEnd || !reader.ReadAt(offset + 8, header + 8, 8))
+                {
+                    return false;
+                }
+                size = ReadU64(header + 8);
+                headerSize = 16;
+            }
+            else if (size == 0)
+            {
+                // Runs to the end of whatever it's in
+                size = parentEnd - offset;
+            }
+
+            if (size < headerSize || size > parentEnd - offset)
+            {
+                return false;
+            }
+
+            box->type = ReadU32(header + 4);
+            box->start = offset + headerSize;
+            box->end = offset + size;
+            return true;
+        }
+
+        // Finds the first box of the given type among the children of [start, end).
+        template <typename Reader>
+        bool FindBox(Reader& reader, uint64_t start, uint64_t end, uint32_t type, Box* found)
+        {
+            Box box;
+            for (uint64_t offset = start; ReadBox(reader, offset, end, &box); offset = box.end)
+            {
+                if (box.type == type)
+                {
+                    *found = box;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Follows a path of nested box types down from [start, end).
+        template <typename Reader>
+        bool FindBoxPath(Reader& reader, uint64_t start, uint64_t end, std::initializer_list<uint32_t> path, Box* found)
+        {
+            Box box = { 0, start, end };
+            for (uint32_t type : path)
+            {
+                if (!FindBox(reader, box.start, box.end, type, &box))
+                {
+                    return false;
+                }
+            }
+            *found = box;
+            return true;
+        }
+
+        // Reads a whole box's payload.  Sample tables are the biggest thing we read, and even a few hours of AAC only
+        // comes to a few megabytes of those, so anything vastly bigger is taken to be garbage.
+        template <typename Reader>
+        bool ReadPayload(Reader& reader, const Box& box, std::vector<uint8_t>* payload)
+        {
+            constexpr uint64_t maxPayloadSize = 64 * 1024 * 1024;
+            const uint64_t size = box.end - box.start;
+            if (size > maxPayloadSize)
+            {
+                return false;
+            }
+
+            payload->resize(static_cast<size_t>(size));
+            return size == 0 || reader.ReadAt(box.start, payload->data(), payload->size());
+        }
+
+        // Checks a table box's payload has room for its version/flags, a 32-bit entry count and that many entries of
+        // entrySize bytes.  Returns the entry count, or -1 if it doesn't fit.
+        inline int64_t CheckEntryCount(const std::vector<uint8_t>& payload, size_t entrySize)
+        {
+            if (payload.size() < 8)
+            {
+                return -1;
+            }
+
+            const uint64_t count = ReadU32(payload.data() + 4);
+            if (count * entrySize > payload.size() - 8)
+            {
+                return -1;
+            }
+            return static_cast<int64_t>(count);
+        }
+
+        // Calls tag(name, value) for every iTunes-style freeform ('----') tag with a UTF-8 value, which is where
+        // iTunSMPB and the like live.  Anything with a value too big to be a sensible tag is skipped.
+        template <typename Reader, typename TagFunc>
+        void ForEachFreeformTag(Reader& reader, TagFunc tag)
+        {
+            constexpr uint64_t maxTagSize = 4096;
+
+            Box moov, meta, ilst;
+            if (!FindBox(reader, 0, reader.GetSize(), FourCC('m', 'o', 'o', 'v'), &moov)
+                || !FindBoxPath(reader, moov.start, moov.end, { FourCC('u', 'd', 't', 'a'), FourCC('m', 'e', 't', 'a') }, &meta))
+            {
+                return;
+            }
+
+            // MP4 files have version/flags ahead of meta's children, but QuickTime's leaves them out
+            uint8_t versionFlags[4];
+            uint64_t metaChildren = meta.start;
+            if (meta.end - meta.start >= sizeof(versionFlags) && reader.ReadAt(meta.start, versionFlags, sizeof(versionFlags)) && ReadU32(versionFlags) == 0)
+            {
+                metaChildren += sizeof(versionFlags);
+            }
+            if (!FindBox(reader, metaChildren, meta.end, FourCC('i', 'l', 's', 't'), &ilst))
+            {
+                return;
+            }
+
+            Box item;
+            std::vector<uint8_t> payload;
+            for (uint64_t offset = ilst.start; ReadBox(reader, offset, ilst.end, &item); offset = item.end)
+            {
+                if (item.type != FourCC('-', '-', '-', '-'))
+                {
+                    continue;
+                }
+
+                // 'name' has version/flags ahead of the name; 'data' has a type (1 being UTF-8) and a locale ahead of
+                // the value
+                std::string name;
+                std::string value;
+                bool haveValue = false;
+                Box field;
+                for (uint64_t fieldOffset = item.start; ReadBox(reader, fieldOffset, item.end, &field); fieldOffset = field.end)
+                {
+                    if (field.end - field.start > maxTagSize || !ReadPayload(reader, field, &payload))
+                    {
+                        continue;
+                    }
+
+                    if (field.type == FourCC('n', 'a', 'm', 'e') && payload.size() >= 4)
+                    {
+                        name.assign(payload.begin() + 4, payload.end());
+                    }
+                    else if (field.type == FourCC('d', 'a', 't', 'a') && payload.size() >= 8 && (ReadU32(payload.data()) & 0xffffff) == 1)
+                    {
+                        value.assign(payload.begin() + 8, payload.end());
+                        haveValue = true;
+                    }
+                }
+
+                if (!name.empty() && haveValue)
+                {
+                    tag(name, value);
+                }
+            }
+        }
+    }
+
+    // Sample timing for an MP4's first audio track, kept in roughly the form the file stores it in: runs of equal
+    // durations.  Finding the sample at a given time is a binary search over those runs, of which there are usually
+    // only one or two.  Media Foundation's source reader seeks by time, so where the samples are in the file (stsz,
+    // stco and stsc) is never needed, and isn't read.
+    class Mp4SampleTable
+    {
+    public:
+        Mp4SampleTable() :
+            timescale(0),
+            duration(0),
+            sampleCount(0),
+            aacObjectType(0),
+            aacChannelConfig(0),
+            aacSampleRate(0)
+        { }
+
+        template <typename Reader>
+        bool Parse(Reader& reader)
+        {
+            using namespace mp4;
+
+            Box moov;
+            if (!FindBox(reader, 0, reader.GetSize(), FourCC('m', 'o', 'o', 'v'), &moov))
+            {
+                return false;
+            }
+
+            Box trak;
+            for (uint64_t offset = moov.start; ReadBox(reader, offset, moov.end, &trak); offset = trak.end)
+            {
+                if (trak.type == FourCC('t', 'r', 'a', 'k') && IsAudioTrack(reader, trak))
+                {
+                    return ParseTrack(reader, trak);
+                }
+            }
+            return false;
+        }
+
+        uint32_t GetTimescale() const
+        {
+            return timescale;
+        }
+
+        // In timescale units.  This is the sum of every sample's duration, so exact to the sample.
+        uint64_t GetDuration() const
+        {
+            return duration;
+        }
+
+        uint32_t GetSampleCount() const
+        {
+            return sampleCount;
+        }
+
+        uint64_t GetSampleTime(uint32_t sample) const
+        {
+            const TimeRun& run = *FindRun(timeRuns, sample);
+            return run.startTime + static_cast<uint64_t>(sample - run.firstSample) * run.delta;
+        }
+
+        // The last sample starting at or before the given time.
+        uint32_t FindSampleAtTime(uint64_t time) const
+        {
+            if (time >= duration)
+            {
+                return sampleCount - 1;
+            }
+
+            auto run = std::upper_bound(timeRuns.begin(), timeRuns.end(), time, [](uint64_t value, const TimeRun& timeRun) { return value < timeRun.startTime; });
+            --run;
+            return run->firstSample + static_cast<uint32_t>((time - run->startTime) / run->delta);
+        }
+
+        // What the track's AAC decoder config says, as far as telling what a decoder will make of it: the audio object
+        // type (2 for plain AAC-LC), the channel configuration, and the core sample rate, before any SBR.  False if the
+        // track isn't AAC, or its config is too unusual to read.
+        bool GetAacConfig(uint32_t* objectType, uint32_t* channelConfig, uint32_t* sampleRate) const
+        {
+            if (aacObjectType == 0)
+            {
+                return false;
+            }
+
+            *objectType = aacObjectType;
+            *channelConfig = aacChannelConfig;
+            *sampleRate = aacSampleRate;
+            return true;
+        }
+
+    private:
+        struct TimeRun
+        {
+            uint32_t firstSample;
+            uint32_t delta;
+            uint64_t startTime;
+        };
+
+        template <typename Run>
+        static typename std::vector<Run>::const_iterator FindRun(const std::vector<Run>& runs, uint32_t sample)
+        {
+            auto run = std::upper_bound(runs.begin(), runs.end(), sample, [](uint32_t value, const Run& entry) { return value < entry.firstSample; });
+            return run - 1;
+        }
+
+        template <typename Reader>
+        static bool IsAudioTrack(Reader& reader, const mp4::Box& trak)
+        {
+            using namespace mp4;
+
+            Box hdlr;
+            uint8_t handler[12];
+            return FindBoxPath(reader, trak.start, trak.end, { FourCC('m', 'd', 'i', 'a'), FourCC('h', 'd', 'l', 'r') }, &hdlr)
+                && hdlr.end - hdlr.start >= sizeof(handler) && reader.ReadAt(hdlr.start, handler, sizeof(handler))
+                && ReadU32(handler + 8) == FourCC('s', 'o', 'u', 'n');
+        }
+
+        template <typename Reader>
+        bool ParseTrack(Reader& reader, const mp4::Box& trak)
+        {
+            using namespace mp4;
+
+            Box mdhd, stbl, stts;
+            if (!FindBoxPath(reader, trak.start, trak.end, { FourCC('m', 'd', 'i', 'a'), FourCC('m', 'd', 'h', 'd') }, &mdhd)
+                || !FindBoxPath(reader, trak.start, trak.end, { FourCC('m', 'd', 'i', 'a'), FourCC('m', 'i', 'n', 'f'), FourCC('s', 't', 'b', 'l') }, &stbl)
+                || !FindBox(reader, stbl.start, stbl.end, FourCC('s', 't', 't', 's'), &stts))
+            {
+                return false;
+            }
+
+            std::vector<uint8_t> payload;
+            if (!ReadPayload(reader, mdhd, &payload) || !ParseMediaHeader(payload)
+                || !ReadPayload(reader, stts, &payload) || !ParseTimeToSample(payload))
+            {
+                return false;
+            }
+
+            // The sample table's usable without this; it just means nobody gets told what's in it ahead of time
+            Box stsd;
+            if (FindBox(reader, stbl.start, stbl.end, FourCC('s', 't', 's', 'd'), &stsd) && ReadPayload(reader, stsd, &payload))
+            {
+                ParseSampleDescription(payload);
+            }
+            return true;
+        }
+
+        // Finds the elementary stream descriptor in the first sample entry, if that's an 'mp4a'.
+        void ParseSampleDescription(const std::vector<uint8_t>& payload)
+        {
+            // Version/flags and the entry count, then the entry: its size and type, the common sample entry fields and
+            // the version 0 sound description, 36 bytes in all, and then its child boxes.  QuickTime's version 1 and 2
+            // sound descriptions are longer, and aren't worth the trouble.
+            constexpr size_t entryOffset = 8;
+            constexpr size_t childOffset = entryOffset + 36;
+            if (payload.size() < childOffset || mp4::ReadU32(payload.data() + entryOffset + 4) != mp4::FourCC('m', 'p', '4', 'a')
+                || mp4::ReadU16(payload.data() + entryOffset + 16) != 0)
+            {
+                return;
+            }
+
+            const size_t entryEnd = std::min<size_t>(payload.size(), entryOffset + mp4::ReadU32(payload.data() + entryOffset));
+            for (size_t offset = childOffset; offset + 8 <= entryEnd;)
+            {
+                const uint32_t size = mp4::ReadU32(payload.data() + offset);
+                if (size < 8 || size > entryEnd - offset)
+                {
+                    return;
+                }
+                if (mp4::ReadU32(payload.data() + offset + 4) == mp4::FourCC('e', 's', 'd', 's'))
+                {
+                    ParseEsds(payload.data() + offset + 8, size - 8);
+                    return;
+                }
+                offset += size;
+            }
+        }
+
+        // ISO/IEC 14496-1 descriptors, nested: ES_Descriptor, then DecoderConfigDescriptor, then DecoderSpecificInfo,
+        // which for MPEG-4 audio is the AudioSpecificConfig.
+        void ParseEsds(const uint8_t* data, size_t size)
+        {
+            size_t position = 4;
+            size_t length = 0;
+            auto enterDescriptor = [data, size, &position, &length](uint8_t tag)
+            {
+                if (position >= size || data[position++] != tag)
+                {
+                    return false;
+                }
+
+                // The length is 7 bits a byte, top bit set on all but the last, in up to four bytes
+                length = 0;
+                for (int i = 0; i < 4 && position < size; ++i)
+                {
+                    const uint8_t lengthByte = data[position++];
+                    length = (length << 7) | (lengthByte & 0x7f);
+                    if ((lengthByte & 0x80) == 0)
+                    {
+                        return length <= size - position;
+                    }
+                }
+                return false;
+            };
+
+            // ES_ID, then flags for the optional fields that follow it
+            if (!enterDescriptor(0x03) || length < 3)
+            {
+                return;
+            }
+            const uint8_t esFlags = data[position + 2];
+            position += 3;
+            if (esFlags & 0x80)
+            {
+                position += 2;
+            }
+            if ((esFlags & 0x40) && position < size)
+            {
+                position += 1 + data[position];
+            }
+            if (esFlags & 0x20)
+            {
+                position += 2;
+            }
+
+            // Object type 0x40 is MPEG-4 audio; the stream type, buffer size and bitrates follow it
+            if (!enterDescriptor(0x04) || length < 13 || data[position] != 0x40)
+            {
+                return;
+            }
+            position += 13;
+
+            if (enterDescriptor(0x05))
+            {
+                ParseAudioSpecificConfig(data + position, length);
+            }
+        }
+
+        void ParseAudioSpecificConfig(const uint8_t* data, size_t size)
+        {
+            static constexpr uint32_t sampleRates[13] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+
+            size_t bitPosition = 0;
+            auto readBits = [data, size, &bitPosition](unsigned int count)
+            {
+                uint32_t value = 0;
+                for (unsigned int i = 0; i < count; ++i, ++bitPosition)
+                {
+                    const uint8_t byte = (bitPosition / 8 < size) ? data[bitPosition / 8] : 0;
+                    value = (value << 1) | ((byte >> (7 - bitPosition % 8)) & 1);
+                }
+                return value;
+            };
+
+            uint32_t objectType = readBits(5);
+            if (objectType == 31)
+            {
+                objectType = 32 + readBits(6);
+            }
+
+            const uint32_t frequencyIndex = readBits(4);
+            const uint32_t sampleRate = (frequencyIndex == 15) ? readBits(24) : (frequencyIndex < 13) ? sampleRates[frequencyIndex] : 0;
+            const uint32_t channelConfig = readBits(4);
+            if (bitPosition > size * 8 || objectType == 0 || sampleRate == 0)
+            {
+                return;
+            }
+
+            aacObjectType = objectType;
+            aacChannelConfig = channelConfig;
+            aacSampleRate = sampleRate;
+        }
+
+        bool ParseMediaHeader(const std::vector<uint8_t>& payload)
+        {
+            // Version 1 has 64-bit times ahead of the timescale; we don't care about any of them
+            if (payload.size() < 24)
+            {
+                return false;
+            }
+            const size_t timescaleOffset = (payload[0] == 1) ? 20 : 12;
+            if (payload.size() < timescaleOffset + 4)
+            {
+                return false;
+            }
+
+            timescale = mp4::ReadU32(payload.data() + timescaleOffset);
+            return timescale != 0;
+        }
+
+        bool ParseTimeToSample(const std::vector<uint8_t>& payload)
+        {
+            const int64_t entryCount = mp4::CheckEntryCount(payload, 8);
+            if (entryCount <= 0)
+            {
+                return false;
+            }
+
+            timeRuns.clear();
+            uint64_t samples = 0;
+            uint64_t time = 0;
+            for (int64_t entry = 0; entry < entryCount; ++entry)
+            {
+                const uint8_t* data = payload.data() + 8 + entry * 8;
+                const uint32_t count = mp4::ReadU32(data);
+                const uint32_t delta = mp4::ReadU32(data + 4);
+                if (count == 0)
+                {
+                    continue;
+                }
+                if (delta == 0)
+                {
+                    // Can't seek by time into samples that take no time
+                    return false;
+                }
+
+                timeRuns.push_back({ static_cast<uint32_t>(samples), delta, time });
+                samples += count;
+                time += static_cast<uint64_t>(count) * delta;
+                if (samples > UINT32_MAX)
+                {
+                    return false;
+                }
+            }
+
+            sampleCount = static_cast<uint32_t>(samples);
+            duration = time;
+            return sampleCount > 0;
+        }
+
+        uint32_t timescale;
+        uint64_t duration;
+        uint32_t sampleCount;
+        uint32_t aacObjectType;
+        uint32_t aacChannelConfig;
+        uint32_t aacSampleRate;
+
+        std::vector<TimeRun> timeRuns;
+    };
+}
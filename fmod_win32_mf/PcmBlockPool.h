@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace mediaFoundation
+{
+    // Recycles the fixed-size buffers that multi-buffer samples get flattened into, so that steady-state playback
+    // doesn't go to the heap at all.  Sized once at open() from the decoder's frame size.
+    //
+    // Block is anything shaped like IMFMediaBuffer: reference counted through Release(), with GetMaxLength() and
+    // SetCurrentLength().  New blocks come from the function passed in, which returns null if it couldn't make one.
+    template <typename Block>
+    class PcmBlockPool
+    {
+    public:
+        explicit PcmBlockPool(std::function<Block*(size_t)> creator) :
+            create(std::move(creator)),
+            blockSize(0),
+            allocations(0)
+        {
+            freeBlocks.reserve(maxFreeBlocks);
+        }
+
+        PcmBlockPool(const PcmBlockPool&) = delete;
+        PcmBlockPool& operator=(const PcmBlockPool&) = delete;
+
+        ~PcmBlockPool()
+        {
+            Clear();
+        }
+
+        void SetBlockSize(size_t newBlockSize)
+        {
+            if (newBlockSize > blockSize)
+            {
+                // Anything already pooled is now too small to be useful
+                Clear();
+                blockSize = newBlockSize;
+            }
+        }
+
+        size_t GetBlockSize() const
+        {
+            return blockSize;
+        }
+
+        // A block of at least minimumSize bytes, which grows the pool's block size if it has to, or null if a new
+        // block was needed and couldn't be made.
+        Block* Acquire(size_t minimumSize)
+        {
+            SetBlockSize(minimumSize);
+
+            if (!freeBlocks.empty())
+            {
+                Block* block = freeBlocks.back();
+                freeBlocks.pop_back();
+                return block;
+            }
+
+            Block* block = create(blockSize);
+            if (block != nullptr)
+            {
+                allocations++;
+            }
+            return block;
+        }
+
+        // Takes back a block from Acquire(), keeping it for next time if it's still big enough and there's room.
+        void Recycle(Block* block)
+        {
+            unsigned long maxLength = 0;
+            if (freeBlocks.size() < maxFreeBlocks && block->GetMaxLength(&maxLength) >= 0 && maxLength >= blockSize)
+            {
+                block->SetCurrentLength(0);
+                freeBlocks.push_back(block);
+            }
+            else
+            {
+                block->Release();
+            }
+        }
+
+        // How many blocks have had to be made over the pool's life.  Flat once playback has settled.
+        unsigned long long GetAllocationCount() const
+        {
+            return allocations;
+        }
+
+        static constexpr size_t maxFreeBlocks = 4;
+
+    private:
+        void Clear()
+        {
+            for (Block* block : freeBlocks)
+            {
+                block->Release();
+            }
+            freeBlocks.clear();
+        }
+
+        const std::function<Block*(size_t)> create;
+        size_t blockSize;
+        unsigned long long allocations;
+        std::vector<Block*> freeBlocks;
+    };
+}
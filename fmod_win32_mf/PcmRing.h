@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+namespace mediaFoundation
+{
+    // Lock-free single-producer/single-consumer ring of raw PCM bytes.  One thread may call Write(), one other thread
+    // may call Read(); neither ever blocks.  Deliberately free of anything Windows-specific.
+    class PcmRing
+    {
+    public:
+        explicit PcmRing(size_t minimumCapacity) :
+            capacity(RoundUpToPowerOfTwo(minimumCapacity)),
+            storage(new std::byte[capacity]),
+            writePos(0),
+            readPos(0)
+        { }
+
+        PcmRing(const PcmRing&) = delete;
+        PcmRing& operator=(const PcmRing&) = delete;
+
+        size_t GetCapacity() const
+        {
+            return capacity;
+        }
+
+        // Producer side.  Copies in as much of the data as there's room for and returns how much that was.
+        size_t Write(const void* data, size_t bytes)
+        {
+            const size_t write = writePos.load(std::memory_order_relaxed);
+            const size_t read = readPos.load(std::memory_order_acquire);
+
+            const size_t toWrite = bytes < capacity - (write - read) ? bytes : capacity - (write - read);
+            CopyIn(write & (capacity - 1), static_cast<const std::byte*>(data), toWrite);
+
+            writePos.store(write + toWrite, std::memory_order_release);
+            return toWrite;
+        }
+
+        // Consumer side.  Copies out up to the requested number of bytes and returns how many there actually were.
+        size_t Read(void* dest, size_t bytes)
+        {
+            const size_t read = readPos.load(std::memory_order_relaxed);
+            const size_t write = writePos.load(std::memory_order_acquire);
+
+            const size_t toRead = bytes < write - read ? bytes : write - read;
+            CopyOut(read & (capacity - 1), static_cast<std::byte*>(dest), toRead);
+
+            readPos.store(read + toRead, std::memory_order_release);
+            return toRead;
+        }
+
+        // Safe to call from the consumer; from the producer it's only a lower bound.
+        size_t GetReadableBytes() const
+        {
+            return writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_relaxed);
+        }
+
+        // Safe to call from the producer; from the consumer it's only a lower bound.
+        size_t GetWritableBytes() const
+        {
+            return capacity - (writePos.load(std::memory_order_relaxed) - readPos.load(std::memory_order_acquire));
+        }
+
+        // Drops everything in the ring.  Only valid while the producer is known to be idle.
+        void Reset()
+        {
+            readPos.store(writePos.load(std::memory_order_acquire), std::memory_order_release);
+        }
+
+    private:
+        static size_t RoundUpToPowerOfTwo(size_t value)
+        {
+            size_t result = 1;
+            while (result < value)
+            {
+                result <<= 1;
+            }
+            return result;
+        }
+
+        void CopyIn(size_t offset, const std::byte* data, size_t bytes)
+        {
+            // Split at the wraparound point, if there is one
+            const size_t firstPart = bytes < capacity - offset ? bytes : capacity - offset;
+            std::memcpy(storage.get() + offset, data, firstPart);
+            std::memcpy(storage.get(), data + firstPart, bytes - firstPart);
+        }
+
+        void CopyOut(size_t offset, std::byte* dest, size_t bytes) const
+        {
+            const size_t firstPart = bytes < capacity - offset ? bytes : capacity - offset;
+            std::memcpy(dest, storage.get() + offset, firstPart);
+            std::memcpy(dest + firstPart, storage.get(), bytes - firstPart);
+        }
+
+        const size_t capacity;
+        std::unique_ptr<std::byte[]> storage;
+
+        // Both positions only ever count upwards; masking with (capacity - 1) gives the actual offset.  Kept on
+        // separate cache lines so the two threads don't fight over them.
+        alignas(64) std::atomic<size_t> writePos;
+        alignas(64) std::atomic<size_t> readPos;
+    };
+}
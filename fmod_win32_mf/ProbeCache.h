@@ -0,0 +1,220 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace mediaFoundation
+{
+    // What ProbeFiles() remembers about a file between runs.  Fixed size, and written to disk exactly as it is here.
+    struct ProbeRecord
+    {
+        uint64_t key;                   // ProbeCache::MakeKey() of the file's path, size and modification time
+        uint64_t durationIn100ns;
+        uint64_t lengthPcm;             // Frames at sampleRate, gapless padding trimmed
+        uint32_t formatTag;
+        uint32_t channels;
+        uint32_t sampleRate;
+        uint32_t encoderDelay;          // Frames of priming the gapless info says to skip
+        uint32_t loopStart;             // Tagged loop, end exclusive, both 0 if there isn't one
+        uint32_t loopEnd;
+        uint32_t seekPoints;            // Places the container's own index can seek to exactly, 0 if it has none
+        uint32_t checksum;              // Over everything above
+    };
+
+    // Probe results, keyed by file, backed by an append-only file.  The file is a short header followed by
+    // ProbeRecords; a record is only ever appended whole, and one that didn't make it to disk whole (the process died
+    // halfway through writing it, say) fails its checksum and is dropped, along with anything after it.  Since the key
+    // covers the file's size and modification time, a file that changes just gets a new record, and the old one is
+    // never looked at again.
+    //
+    // Knows nothing about files itself: it's handed the old contents by Load(), and writes new records through the
+    // function passed in.  Lookups never take a lock, so every thread probing files can share one.
+    class ProbeCache
+    {
+    public:
+        static constexpr uint32_t fileMagic = 0x4350464D;     // "MFPC"
+        static constexpr uint32_t fileVersion = 1;
+        static constexpr size_t headerSize = 16;
+
+        // Past this many records the file is started over rather than loaded, which also clears out everything that
+        // was superseded along the way
+        static constexpr size_t maxRecords = 65536;
+        static constexpr size_t minCapacity = 16384;
+
+        ProbeCache(std::function<bool(const void*, size_t)> appender) :
+            append(std::move(appender)),
+            capacity(0),
+            count(0)
+        { }
+
+        ProbeCache(const ProbeCache&) = delete;
+        ProbeCache& operator=(const ProbeCache&) = delete;
+
+        // The header a new file should start with.
+        static void WriteHeader(uint8_t* dest)
+        {
+            const uint32_t header[4] = { fileMagic, fileVersion, static_cast<uint32_t>(sizeof(ProbeRecord)), 0 };
+            std::memcpy(dest, header, headerSize);
+        }
+
+        // Takes in the old file, and returns how much of it is good; anything past that should be cut off before
+        // anything else gets appended.  0 means the file isn't one of ours, or is too big, and should be started
+        // over.  Must be called before anything else, and only once.
+        size_t Load(const uint8_t* data, size_t size)
+        {
+            uint32_t header[4] = {};
+            if (size >= headerSize)
+            {
+                std::memcpy(header, data, headerSize);
+            }
+
+            const bool headerGood = header[0] == fileMagic && header[1] == fileVersion && header[2] == sizeof(ProbeRecord);
+            const size_t recordCount = headerGood ? (size - headerSize) / sizeof(ProbeRecord) : 0;
+            const bool keep = headerGood && recordCount <= maxRecords;
+
+            // Never more than half full, so it starts out at most a quarter full, with room to add as many again
+            capacity = minCapacity;
+            while (keep && capacity < recordCount * 4)
+            {
+                capacity *= 2;
+            }
+            slots = std::make_unique<Slot[]>(capacity);
+            count = 0;
+
+            if (!keep)
+            {
+                return 0;
+            }
+
+            size_t goodSize = headerSize;
+            for (size_t i = 0; i < recordCount; ++i)
+            {
+                ProbeRecord record;
+                std::memcpy(&record, data + goodSize, sizeof(record));
+                if (record.checksum != Checksum(record))
+                {
+                    break;
+                }
+
+                Insert(record);
+                goodSize += sizeof(record);
+            }
+            return goodSize;
+        }
+
+        bool Find(uint64_t key, ProbeRecord* outRecord) const
+        {
+            for (size_t i = 0, slot = key & (capacity - 1); i < capacity; ++i, slot = (slot + 1) & (capacity - 1))
+            {
+                const uint32_t state = slots[slot].state.load(std::memory_order_acquire);
+                if (state == Empty)
+                {
+                    return false;
+                }
+                if (state == Ready && slots[slot].record.key == key)
+                {
+                    *outRecord = slots[slot].record;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Remembers a record, here and on disk.  Does nothing if there's one for the same key already, or if the
+        // table is half full; the next Load() makes room.
+        void Add(ProbeRecord record)
+        {
+            record.checksum = Checksum(record);
+            if (Insert(record))
+            {
+                std::lock_guard<std::mutex> lock(appendLock);
+                append(&record, sizeof(record));
+            }
+        }
+
+        // Case-insensitive for ASCII, same as the paths it's given.
+        static uint64_t MakeKey(const wchar_t* path, uint64_t fileSize, uint64_t modifiedTime)
+        {
+            uint64_t hash = 14695981039346656037ull;
+            for (; *path != L'\0'; ++path)
+            {
+                const wchar_t c = (*path >= L'a' && *path <= L'z') ? (*path - L'a' + L'A') : *path;
+                hash = (hash ^ static_cast<uint64_t>(c)) * 1099511628211ull;
+            }
+            for (uint64_t value : { fileSize, modifiedTime })
+            {
+                for (int i = 0; i < 8; ++i)
+                {
+                    hash = (hash ^ ((value >> (i * 8)) & 0xFF)) * 1099511628211ull;
+                }
+            }
+            return hash;
+        }
+
+    private:
+        enum SlotState : uint32_t
+        {
+            Empty,
+            Writing,
+            Ready
+        };
+
+        // A record is written into its slot once, before the slot's marked ready, and never touched again
+        struct Slot
+        {
+            std::atomic<uint32_t> state;
+            ProbeRecord record;
+        };
+
+        static uint32_t Checksum(const ProbeRecord& record)
+        {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&record);
+            uint32_t hash = 2166136261u;
+            for (size_t i = 0; i < offsetof(ProbeRecord, checksum); ++i)
+            {
+                hash = (hash ^ bytes[i]) * 16777619u;
+            }
+            return hash;
+        }
+
+        bool Insert(const ProbeRecord& record)
+        {
+            for (size_t i = 0, slot = record.key & (capacity - 1); i < capacity; ++i, slot = (slot + 1) & (capacity - 1))
+            {
+                uint32_t state = slots[slot].state.load(std::memory_order_acquire);
+                if (state == Empty)
+                {
+                    // Past half full, runs of taken slots get long enough to make every lookup that misses slow
+                    if (count.fetch_add(1, std::memory_order_relaxed) >= capacity / 2)
+                    {
+                        count.fetch_sub(1, std::memory_order_relaxed);
+                        return false;
+                    }
+                    if (slots[slot].state.compare_exchange_strong(state, Writing, std::memory_order_acquire))
+                    {
+                        slots[slot].record = record;
+                        slots[slot].state.store(Ready, std::memory_order_release);
+                        return true;
+                    }
+                    count.fetch_sub(1, std::memory_order_relaxed);
+                }
+                if (state == Ready && slots[slot].record.key == record.key)
+                {
+                    return false;
+                }
+            }
+            return false;
+        }
+
+        const std::function<bool(const void*, size_t)> append;
+        std::mutex appendLock;
+        std::unique_ptr<Slot[]> slots;
+        size_t capacity;
+        std::atomic<size_t> count;
+    };
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mediaFoundation
+{
+    // The last few hundred reads made of a stream: where, how much, and how long each took, for seeing what a media
+    // source actually asks of a file rather than just how much in total.  Older reads are overwritten, but still
+    // counted.  Not thread-safe; whoever's reading the stream records under its own lock.
+    class ReadTrace
+    {
+    public:
+        static constexpr size_t capacity = 256;
+
+        struct Entry
+        {
+            uint64_t offset;
+            uint64_t nanoseconds;
+            uint32_t bytes;
+        };
+
+        struct Summary
+        {
+            uint64_t reads;             // All of them, kept or not
+            uint64_t bytes;             // From here on, only over the reads kept
+            uint64_t medianNanoseconds;
+            uint64_t worstNanoseconds;
+            uint64_t sequentialReads;   // Carrying on from where the read before ended
+        };
+
+        ReadTrace() :
+            entries(),
+            count(0)
+        { }
+
+        void Record(uint64_t offset, size_t bytes, uint64_t nanoseconds)
+        {
+            entries[count % capacity] = { offset, nanoseconds, static_cast<uint32_t>(std::min<size_t>(bytes, UINT32_MAX)) };
+            ++count;
+        }
+
+        uint64_t GetCount() const
+        {
+            return count;
+        }
+
+        // Oldest first
+        template <typename Func>
+        void ForEach(Func func) const
+        {
+            const uint64_t first = (count > capacity) ? count - capacity : 0;
+            for (uint64_t i = first; i < count; ++i)
+            {
+                func(entries[i % capacity]);
+            }
+        }
+
+        Summary Summarise() const
+        {
+            Summary summary = { count, 0, 0, 0, 0 };
+            std::vector<uint64_t> times;
+            uint64_t lastEnd = UINT64_MAX;
+            ForEach([&](const Entry& entry)
+            {
+                summary.bytes += entry.bytes;
+                summary.sequentialReads += (entry.offset == lastEnd) ? 1 : 0;
+                lastEnd = entry.offset + entry.bytes;
+                times.push_back(entry.nanoseconds);
+            });
+
+            if (!times.empty())
+            {
+                std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+                summary.medianNanoseconds = times[times.size() / 2];
+                summary.worstNanoseconds = *std::max_element(times.begin(), times.end());
+            }
+            return summary;
+        }
+
+    private:
+        std::array<Entry, capacity> entries;
+        uint64_t count;
+    };
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <numeric>
+#include <vector>
+
+#include "SampleConvert.h"
+
+namespace mediaFoundation
+{
+    namespace resampleKernels
+    {
+        typedef float (*DotFunc)(const float* a, const float* b, size_t count);
+
+        inline float DotScalar(const float* a, const float* b, size_t count)
+        {
+            float sum = 0.0f;
+            for (size_t i = 0; i < count; ++i)
+            {
+                sum += a[i] * b[i];
+            }
+            return sum;
+        }
+
+        // The SIMD versions assume count is a multiple of 16, which the filter length always is.
+#if SAMPLE_CONVERT_X86
+        inline float DotSse(const float* a, const float* b, size_t count)
+        {
+            __m128 sum0 = _mm_setzero_ps();
+            __m128 sum1 = _mm_setzero_ps();
+            __m128 sum2 = _mm_setzero_ps();
+            __m128 sum3 = _mm_setzero_ps();
+            for (size_t i = 0; i < count; i += 16)
+            {
+                sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+                sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+                sum2 = _mm_add_ps(sum2, _mm_mul_ps(_mm_loadu_ps(a + i + 8), _mm_loadu_ps(b + i + 8)));
+                sum3 = _mm_add_ps(sum3, _mm_mul_ps(_mm_loadu_ps(a + i + 12), _mm_loadu_ps(b + i + 12)));
+            }
+
+            const __m128 sum = _mm_add_ps(_mm_add_ps(sum0, sum1), _mm_add_ps(sum2, sum3));
+            const __m128 pairs = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+        }
+
+        SAMPLE_CONVERT_AVX2 inline float DotAvx2(const float* a, const float* b, size_t count)
+        {
+            __m256 sum0 = _mm256_setzero_ps();
+            __m256 sum1 = _mm256_setzero_ps();
+            for (size_t i = 0; i < count; i += 16)
+            {
+                sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+                sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+            }
+
+            const __m256 sum = _mm256_add_ps(sum0, sum1);
+            const __m128 quad = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+            const __m128 pairs = _mm_add_ps(quad, _mm_movehl_ps(quad, quad));
+            return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+        }
+#endif
+
+        inline DotFunc Best()
+        {
+#if SAMPLE_CONVERT_X86
+            static const DotFunc best = sampleKernels::CpuHasAvx2() ? DotAvx2 : DotSse;
+#else
+            static const DotFunc best = DotScalar;
+#endif
+            return best;
+        }
+    }
+
+    // Rational-ratio polyphase resampler for interleaved float.  The output rate has to be an exact fraction L/M of the
+    // input rate with L no bigger than maxPhases, which covers every pair of rates anybody actually uses.  The filter
+    // is a Kaiser-windowed sinc of tapsPerPhase input samples, good for about 90 dB of image/alias rejection with
+    // the passband running out to roughly 82% of the lower of the two Nyquist frequencies.
+    //
+    // Input goes in with Push() and comes back out with Pull(); output is aligned with the input, so the filter's
+    // delay is already accounted for.  Not thread-safe.
+    class PolyphaseResampler
+    {
+    public:
+        static constexpr unsigned int tapsPerPhase = 64;
+        static constexpr unsigned int maxPhases = 1024;
+
+        // How much used-up input Push() lets pile up at the front of the history before moving the rest down.
+        static constexpr size_t compactThreshold = 8192;
+
+        PolyphaseResampler() :
+            channels(0),
+            inputRate(0),
+            outputRate(0),
+            interpolation(0),
+            decimation(0),
+            phase(0),
+            readPos(0)
+        { }
+
+        // Returns false, leaving the resampler inactive, if the ratio is one we can't do.  That's anything needing
+        // more than maxPhases phases, or downsampling by more than 2:1, where the fixed filter length can't give a
+        // steep enough cutoff.
+        bool Configure(unsigned int channelCount, unsigned int fromRate, unsigned int toRate)
+        {
+            channels = 0;
+            if (channelCount == 0 || fromRate == 0 || toRate == 0 || fromRate == toRate || toRate * 2 < fromRate)
+            {
+                return false;
+            }
+
+            const unsigned int divisor = std::gcd(fromRate, toRate);
+            if (toRate / divisor > maxPhases)
+            {
+                return false;
+            }
+
+            channels = channelCount;
+            inputRate = fromRate;
+            outputRate = toRate;
+            interpolation = toRate / divisor;
+            decimation = fromRate / divisor;
+            BuildFilter();
+            Reset();
+            return true;
+        }
+
+        bool IsActive() const
+        {
+            return channels > 0;
+        }
+
+        unsigned int GetOutputRate() const
+        {
+            return outputRate;
+        }
+
+        // Forgets all buffered input, e.g. after a seek.
+        void Reset()
+        {
+            history.assign(channels, std::vector<float>(tapsPerPhase / 2 - 1, 0.0f));
+            phase = 0;
+            readPos = 0;
+        }
+
+        void Push(const float* input, size_t frames)
+        {
+            if (!IsActive())
+            {
+                return;
+            }
+
+            // Only worth moving what's left down once there's a decent amount in front of it, and at least as much as
+            // there is to move
+            const bool compact = readPos >= compactThreshold && readPos * 2 >= history[0].size();
+
+            for (unsigned int channel = 0; channel < channels; ++channel)
+            {
+                std::vector<float>& channelHistory = history[channel];
+                if (compact)
+                {
+                    channelHistory.erase(channelHistory.begin(), channelHistory.begin() + readPos);
+                }
+
+                const size_t start = channelHistory.size();
+                channelHistory.resize(start + frames);
+                for (size_t frame = 0; frame < frames; ++frame)
+                {
+                    channelHistory[start + frame] = input[frame * channels + channel];
+                }
+            }
+
+            if (compact)
+            {
+                readPos = 0;
+            }
+        }
+
+        // Pads the end of the input with enough silence for everything pushed so far to make it out of the filter.
+        void Flush()
+        {
+            const std::vector<float> silence(static_cast<size_t>(tapsPerPhase / 2) * channels, 0.0f);
+            Push(silence.data(), tapsPerPhase / 2);
+        }
+
+        // Produces up to maxFrames frames of output.  Returns fewer (possibly none) once it needs more input.
+        size_t Pull(float* output, size_t maxFrames)
+        {
+            if (!IsActive())
+            {
+                return 0;
+            }
+
+            const resampleKernels::DotFunc dot = resampleKernels::Best();
+            const size_t available = history[0].size();
+
+            size_t produced = 0;
+            while (produced < maxFrames && readPos + tapsPerPhase <= available)
+            {
+                const float* coefficients = filter.data() + static_cast<size_t>(phase) * tapsPerPhase;
+                for (unsigned int channel = 0; channel < channels; ++channel)
+                {
+                    output[produced * channels + channel] = dot(coefficients, history[channel].data() + readPos, tapsPerPhase);
+                }
+                ++produced;
+
+                phase += decimation;
+                readPos += phase / interpolation;
+                phase %= interpolation;
+            }
+            return produced;
+        }
+
+    private:
+        static double BesselI0(double x)
+        {
+            // Power series; converges fast enough for the beta values a Kaiser window ever uses
+            double sum = 1.0;
+            double term = 1.0;
+            for (int k = 1; k < 50; ++k)
+            {
+                term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                sum += term;
+                if (term < sum * 1e-12)
+                {
+                    break;
+                }
+            }
+            return sum;
+        }
+
+        void BuildFilter()
+        {
+            constexpr double pi = 3.14159265358979323846;
+            constexpr double beta = 8.96;
+
+            // Cutoff in cycles per input sample, pulled in from the lower Nyquist frequency by half the transition
+            // band this many taps can manage at this much attenuation.
+            const double transitionWidth = (90.0 - 7.95) / (14.36 * tapsPerPhase);
+            const double nyquist = 0.5 * std::fmin(1.0, static_cast<double>(outputRate) / inputRate);
+            const double cutoff = nyquist - transitionWidth / 2.0;
+            const double halfLength = tapsPerPhase / 2.0;
+            const double windowScale = 1.0 / BesselI0(beta);
+
+            filter.resize(static_cast<size_t>(interpolation) * tapsPerPhase);
+            for (unsigned int p = 0; p < interpolation; ++p)
+            {
+                float* coefficients = filter.data() + static_cast<size_t>(p) * tapsPerPhase;
+                double sum = 0.0;
+                for (unsigned int k = 0; k < tapsPerPhase; ++k)
+                {
+                    // How far this tap's input sample is from the point being interpolated
+                    const double offset = (halfLength - 1.0 - k) + static_cast<double>(p) / interpolation;
+                    const double x = 2.0 * cutoff * offset;
+                    const double sinc = (x == 0.0) ? 1.0 : std::sin(pi * x) / (pi * x);
+                    const double ratio = offset / halfLength;
+                    const double window = (ratio * ratio < 1.0) ? BesselI0(beta * std::sqrt(1.0 - ratio * ratio)) * windowScale : 0.0;
+
+                    const double value = 2.0 * cutoff * sinc * window;
+                    coefficients[k] = static_cast<float>(value);
+                    sum += value;
+                }
+
+                // Unity gain at DC for every phase, or there's a low-level whine at the phase rate
+                for (unsigned int k = 0; k < tapsPerPhase; ++k)
+                {
+                    coefficients[k] = static_cast<float>(coefficients[k] / sum);
+                }
+            }
+        }
+
+        unsigned int channels;
+        unsigned int inputRate;
+        unsigned int outputRate;
+        unsigned int interpolation;
+        unsigned int decimation;
+
+        // Coefficients for each phase in turn, in the same order as the input samples they apply to
+        std::vector<float> filter;
+
+        // Input per channel; readPos is the first sample of the next output's window, and everything before it is
+        // finished with.  The history starts out with enough silence that the first output lines up with the first
+        // input.
+        std::vector<std::vector<float>> history;
+        unsigned int phase;
+        size_t readPos;
+    };
+}
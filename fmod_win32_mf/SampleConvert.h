@@ -0,0 +1,518 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SAMPLE_CONVERT_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC lets any function use any intrinsic; GCC and Clang need to be told which functions are allowed AVX2.
+#if defined(SAMPLE_CONVERT_X86) && !defined(_MSC_VER)
+#define SAMPLE_CONVERT_AVX2 __attribute__((target("avx2")))
+#else
+#define SAMPLE_CONVERT_AVX2
+#endif
+
+namespace mediaFoundation
+{
+    // Interleaved PCM sample representations that the codec knows how to convert between.  Integer types are signed
+    // except for U8, which is how WAVE-style 8-bit PCM has always been stored.  S24 is packed, 3 bytes per sample.
+    enum class SampleType
+    {
+        None,
+        U8,
+        S16,
+        S24,
+        S32,
+        Float
+    };
+
+    inline size_t BytesPerSample(SampleType type)
+    {
+        switch (type)
+        {
+        case SampleType::U8:
+            return 1;
+        case SampleType::S16:
+            return 2;
+        case SampleType::S24:
+            return 3;
+        case SampleType::S32:
+        case SampleType::Float:
+            return 4;
+        default:
+            return 0;
+        }
+    }
+
+    namespace sampleKernels
+    {
+        // Scalar versions.  These define the exact behaviour that the SIMD versions have to match: float is scaled by
+        // 2^(bits-1), rounded to nearest-even and saturated on the way back to integer.
+
+        inline int32_t SaturatingRound(float value, float limit)
+        {
+            if (!(value > -limit))
+            {
+                // Also catches NaN
+                return static_cast<int32_t>(-limit);
+            }
+            if (value >= limit - 1.0f)
+            {
+                return static_cast<int32_t>(limit - 1.0f);
+            }
+
+            // Round half to even, same as the SSE conversion with the default rounding mode
+            float rounded = static_cast<float>(static_cast<int32_t>(value));
+            const float remainder = value - rounded;
+            if (remainder > 0.5f || (remainder == 0.5f && (static_cast<int32_t>(rounded) & 1)))
+            {
+                rounded += 1.0f;
+            }
+            else if (remainder < -0.5f || (remainder == -0.5f && (static_cast<int32_t>(rounded) & 1)))
+            {
+                rounded -= 1.0f;
+            }
+            return static_cast<int32_t>(rounded);
+        }
+
+        inline int32_t LoadS24(const uint8_t* src)
+        {
+            // Put the sample in the top three bytes, then let the arithmetic shift sign-extend it
+            const uint32_t raw = (static_cast<uint32_t>(src[0]) << 8) | (static_cast<uint32_t>(src[1]) << 16) | (static_cast<uint32_t>(src[2]) << 24);
+            return static_cast<int32_t>(raw) >> 8;
+        }
+
+        inline void StoreS24(uint8_t* dst, int32_t value)
+        {
+            dst[0] = static_cast<uint8_t>(value);
+            dst[1] = static_cast<uint8_t>(value >> 8);
+            dst[2] = static_cast<uint8_t>(value >> 16);
+        }
+
+        inline void S16ToFloatScalar(const void* src, void* dst, size_t count)
+        {
+            const int16_t* in = static_cast<const int16_t*>(src);
+            float* out = static_cast<float*>(dst);
+            for (size_t i = 0; i < count; i++)
+            {
+                out[i] = in[i] * (1.0f / 32768.0f);
+            }
+        }
+
+        inline void FloatToS16Scalar(const void* src, void* dst, size_t count)
+        {
+            const float* in = static_cast<const float*>(src);
+            int16_t* out = static_cast<int16_t*>(dst);
+            for (size_t i = 0; i < count; i++)
+            {
+                out[i] = static_cast<int16_t>(SaturatingRound(in[i] * 32768.0f, 32768.0f));
+            }
+        }
+
+        inline void S24ToS32Scalar(const void* src, void* dst, size_t count)
+        {
+            const uint8_t* in = static_cast<const uint8_t*>(src);
+            int32_t* out = static_cast<int32_t*>(dst);
+            for (size_t i = 0; i < count; i++)
+            {
+                out[i] = static_cast<int32_t>(static_cast<uint32_t>(LoadS24(in + i * 3)) << 8);
+            }
+        }
+
+        inline void S32ToS24Scalar(const void* src, void* dst, size_t count)
+        {
+            // Truncates, which is what dropping the low byte of a 32-bit sample has always meant
+            const int32_t* in = static_cast<const int32_t*>(src);
+            uint8_t* out = static_cast<uint8_t*>(dst);
+            for (size_t i = 0; i < count; i++)
+            {
+                StoreS24(out + i * 3, in[i] >> 8);
+            }
+        }
+
+        inline void S24ToFloatScalar(const void* src, void* dst, size_t count)
+        {
+            const uint8_t* in = static_cast<const uint8_t*>(src);
+            float* out = static_cast<float*>(dst);
+            for (size_t i = 0; i < count; i++)
+            {
+                out[i] = LoadS24(in + i * 3) * (1.0f / 8388608.0f);
+            }
+        }
+
+        inline void FloatToS24Scalar(const void* src, void* dst, size_t count)
+        {
+            const float* in = static_cast<const float*>(src);
+            uint8_t* out = static_cast<uint8_t*>(dst);
+            for (size_t i = 0; i < count; i++)
+            {
+                StoreS24(out + i * 3, SaturatingRound(in[i] * 8388608.0f, 8388608.0f));
+            }
+        }
+
+        inline void S32ToFloatScalar(const void* src, void* dst, size_t count)
+        {
+            const int32_t* in = static_cast<const int32_t*>(src);
+            float* out = static_cast<float*>(dst);
+            for (size_t i = 0; i < count; i++)
+            {
+                out[i] = static_cast<float>(in[i]) * (1.0f / 2147483648.0f);
+            }
+        }
+
+        inline void U8ToS16Scalar(const void* src, void* dst, size_t count)
+        {
+            const uint8_t* in = static_cast<const uint8_t*>(src);
+            int16_t* out = static_cast<int16_t*>(dst);
+            for (size_t i = 0; i < count; i++)
+            {
+                out[i] = static_cast<int16_t>((in[i] - 128) * 256);
+            }
+        }
+
+#if SAMPLE_CONVERT_X86
+        // SSE2 is guaranteed on anything x64, so these need no runtime check.  Each handles the bulk of the buffer
+        // and leaves the tail to the scalar version.
+
+        inline void S16ToFloatSse2(const void* src, void* dst, size_t count)
+        {
+            const int16_t* in = static_cast<const int16_t*>(src);
+            float* out = static_cast<float*>(dst);
+            const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+                // Interleave with itself, then shift back down to sign-extend each half
+                const __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+                const __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+                _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+                _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+            }
+            S16ToFloatScalar(in + i, out + i, count - i);
+        }
+
+        inline void FloatToS16Sse2(const void* src, void* dst, size_t count)
+        {
+            const float* in = static_cast<const float*>(src);
+            int16_t* out = static_cast<int16_t*>(dst);
+            const __m128 scale = _mm_set1_ps(32768.0f);
+            const __m128 lowest = _mm_set1_ps(-32768.0f);
+            const __m128 highest = _mm_set1_ps(32767.0f);
+
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                // Clamping in float first keeps the conversion itself from overflowing; max/min with the constant as
+                // the second operand also turns NaN into the lower bound, same as the scalar path.
+                __m128 low = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+                __m128 high = _mm_mul_ps(_mm_loadu_ps(in + i + 4), scale);
+                low = _mm_min_ps(_mm_max_ps(low, lowest), highest);
+                high = _mm_min_ps(_mm_max_ps(high, lowest), highest);
+                const __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(low), _mm_cvtps_epi32(high));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+            }
+            FloatToS16Scalar(in + i, out + i, count - i);
+        }
+
+        inline void S32ToFloatSse2(const void* src, void* dst, size_t count)
+        {
+            const int32_t* in = static_cast<const int32_t*>(src);
+            float* out = static_cast<float*>(dst);
+            const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+                _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(samples), scale));
+            }
+            S32ToFloatScalar(in + i, out + i, count - i);
+        }
+
+        inline void U8ToS16Sse2(const void* src, void* dst, size_t count)
+        {
+            const uint8_t* in = static_cast<const uint8_t*>(src);
+            int16_t* out = static_cast<int16_t*>(dst);
+            const __m128i signFlip = _mm_set1_epi8(static_cast<char>(0x80));
+            const __m128i zero = _mm_setzero_si128();
+
+            size_t i = 0;
+            for (; i + 16 <= count; i += 16)
+            {
+                // Flipping the top bit turns unsigned 8-bit into signed; pairing each byte with a zero below it is
+                // then the same as shifting it up by 8.
+                const __m128i samples = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), signFlip);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi8(zero, samples));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpackhi_epi8(zero, samples));
+            }
+            U8ToS16Scalar(in + i, out + i, count - i);
+        }
+
+        // AVX2 versions.  Packed 24-bit only gets a SIMD path here, since it needs a byte shuffle to be worth doing.
+
+        SAMPLE_CONVERT_AVX2 inline void S16ToFloatAvx2(const void* src, void* dst, size_t count)
+        {
+            const int16_t* in = static_cast<const int16_t*>(src);
+            float* out = static_cast<float*>(dst);
+            const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                const __m256i samples = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+                _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(samples), scale));
+            }
+            S16ToFloatScalar(in + i, out + i, count - i);
+        }
+
+        SAMPLE_CONVERT_AVX2 inline void FloatToS16Avx2(const void* src, void* dst, size_t count)
+        {
+            const float* in = static_cast<const float*>(src);
+            int16_t* out = static_cast<int16_t*>(dst);
+            const __m256 scale = _mm256_set1_ps(32768.0f);
+            const __m256 lowest = _mm256_set1_ps(-32768.0f);
+            const __m256 highest = _mm256_set1_ps(32767.0f);
+
+            size_t i = 0;
+            for (; i + 16 <= count; i += 16)
+            {
+                __m256 low = _mm256_mul_ps(_mm256_loadu_ps(in + i), scale);
+                __m256 high = _mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale);
+                low = _mm256_min_ps(_mm256_max_ps(low, lowest), highest);
+                high = _mm256_min_ps(_mm256_max_ps(high, lowest), highest);
+                // packs works within each 128-bit lane, so the result needs its middle quarters swapping back
+                const __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(low), _mm256_cvtps_epi32(high));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permute4x64_epi64(packed, 0xd8));
+            }
+            FloatToS16Scalar(in + i, out + i, count - i);
+        }
+
+        // Loads 8 packed 24-bit samples into the top three bytes of each 32-bit lane.  Reads 28 bytes from src.
+        SAMPLE_CONVERT_AVX2 inline __m256i LoadS24AsS32Avx2(const uint8_t* src)
+        {
+            const __m256i bytes = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 12)), 1);
+            const __m256i spread = _mm256_setr_epi8(
+                -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+                -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+            return _mm256_shuffle_epi8(bytes, spread);
+        }
+
+        // Stores the top three bytes of each 32-bit lane as 8 packed 24-bit samples.  Writes 28 bytes to dst.
+        SAMPLE_CONVERT_AVX2 inline void StoreS32AsS24Avx2(uint8_t* dst, __m256i samples)
+        {
+            const __m256i gather = _mm256_setr_epi8(
+                1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1,
+                1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1);
+            const __m256i packed = _mm256_shuffle_epi8(samples, gather);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm256_castsi256_si128(packed));
+            // Overwrites the 4 junk bytes from the low half
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 12), _mm256_extracti128_si256(packed, 1));
+        }
+
+        // The 24-bit loops stop 2 samples early so that the 28-byte loads and stores stay inside the buffers.
+
+        SAMPLE_CONVERT_AVX2 inline void S24ToS32Avx2(const void* src, void* dst, size_t count)
+        {
+            const uint8_t* in = static_cast<const uint8_t*>(src);
+            int32_t* out = static_cast<int32_t*>(dst);
+
+            size_t i = 0;
+            for (; i + 10 <= count; i += 8)
+            {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), LoadS24AsS32Avx2(in + i * 3));
+            }
+            S24ToS32Scalar(in + i * 3, out + i, count - i);
+        }
+
+        SAMPLE_CONVERT_AVX2 inline void S32ToS24Avx2(const void* src, void* dst, size_t count)
+        {
+            const int32_t* in = static_cast<const int32_t*>(src);
+            uint8_t* out = static_cast<uint8_t*>(dst);
+
+            size_t i = 0;
+            for (; i + 10 <= count; i += 8)
+            {
+                StoreS32AsS24Avx2(out + i * 3, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)));
+            }
+            S32ToS24Scalar(in + i, out + i * 3, count - i);
+        }
+
+        SAMPLE_CONVERT_AVX2 inline void S24ToFloatAvx2(const void* src, void* dst, size_t count)
+        {
+            const uint8_t* in = static_cast<const uint8_t*>(src);
+            float* out = static_cast<float*>(dst);
+            // The samples come out of the load scaled up by 256, so fold that into the scale
+            const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+
+            size_t i = 0;
+            for (; i + 10 <= count; i += 8)
+            {
+                _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(LoadS24AsS32Avx2(in + i * 3)), scale));
+            }
+            S24ToFloatScalar(in + i * 3, out + i, count - i);
+        }
+
+        SAMPLE_CONVERT_AVX2 inline void FloatToS24Avx2(const void* src, void* dst, size_t count)
+        {
+            const float* in = static_cast<const float*>(src);
+            uint8_t* out = static_cast<uint8_t*>(dst);
+            const __m256 scale = _mm256_set1_ps(8388608.0f);
+            const __m256 lowest = _mm256_set1_ps(-8388608.0f);
+            const __m256 highest = _mm256_set1_ps(8388607.0f);
+
+            size_t i = 0;
+            for (; i + 10 <= count; i += 8)
+            {
+                __m256 samples = _mm256_mul_ps(_mm256_loadu_ps(in + i), scale);
+                samples = _mm256_min_ps(_mm256_max_ps(samples, lowest), highest);
+                // Shift up so the sample sits in the top three bytes, which is where the store expects it
+                StoreS32AsS24Avx2(out + i * 3, _mm256_slli_epi32(_mm256_cvtps_epi32(samples), 8));
+            }
+            FloatToS24Scalar(in + i, out + i * 3, count - i);
+        }
+
+        SAMPLE_CONVERT_AVX2 inline void S32ToFloatAvx2(const void* src, void* dst, size_t count)
+        {
+            const int32_t* in = static_cast<const int32_t*>(src);
+            float* out = static_cast<float*>(dst);
+            const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                const __m256i samples = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+                _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(samples), scale));
+            }
+            S32ToFloatScalar(in + i, out + i, count - i);
+        }
+
+        SAMPLE_CONVERT_AVX2 inline void U8ToS16Avx2(const void* src, void* dst, size_t count)
+        {
+            const uint8_t* in = static_cast<const uint8_t*>(src);
+            int16_t* out = static_cast<int16_t*>(dst);
+            const __m256i bias = _mm256_set1_epi16(128);
+
+            size_t i = 0;
+            for (; i + 16 <= count; i += 16)
+            {
+                const __m256i samples = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_slli_epi16(_mm256_sub_epi16(samples, bias), 8));
+            }
+            U8ToS16Scalar(in + i, out + i, count - i);
+        }
+
+        inline bool CpuHasAvx2()
+        {
+#if defined(_MSC_VER)
+            int cpuInfo[4] = {};
+            __cpuid(cpuInfo, 0);
+            if (cpuInfo[0] < 7)
+            {
+                return false;
+            }
+
+            // The CPU supporting AVX isn't enough; the OS also has to be saving the YMM registers on context switch
+            __cpuid(cpuInfo, 1);
+            const bool osSavesYmm = (cpuInfo[2] & (1 << 27)) && (cpuInfo[2] & (1 << 28)) && ((_xgetbv(0) & 0x6) == 0x6);
+            if (!osSavesYmm)
+            {
+                return false;
+            }
+
+            __cpuidex(cpuInfo, 7, 0);
+            return (cpuInfo[1] & (1 << 5)) != 0;
+#else
+            return __builtin_cpu_supports("avx2");
+#endif
+        }
+#endif
+    }
+
+    typedef void (*SampleConvertFunc)(const void* src, void* dst, size_t count);
+
+    // The best implementation of each conversion for the CPU we're running on, picked once on first use.
+    struct SampleConverters
+    {
+        SampleConvertFunc s16ToFloat;
+        SampleConvertFunc floatToS16;
+        SampleConvertFunc s24ToS32;
+        SampleConvertFunc s32ToS24;
+        SampleConvertFunc s24ToFloat;
+        SampleConvertFunc floatToS24;
+        SampleConvertFunc s32ToFloat;
+        SampleConvertFunc u8ToS16;
+
+        static SampleConverters Scalar()
+        {
+            using namespace sampleKernels;
+            return { S16ToFloatScalar, FloatToS16Scalar, S24ToS32Scalar, S32ToS24Scalar, S24ToFloatScalar, FloatToS24Scalar, S32ToFloatScalar, U8ToS16Scalar };
+        }
+
+#if SAMPLE_CONVERT_X86
+        static SampleConverters Sse2()
+        {
+            using namespace sampleKernels;
+            return { S16ToFloatSse2, FloatToS16Sse2, S24ToS32Scalar, S32ToS24Scalar, S24ToFloatScalar, FloatToS24Scalar, S32ToFloatSse2, U8ToS16Sse2 };
+        }
+
+        static SampleConverters Avx2()
+        {
+            using namespace sampleKernels;
+            return { S16ToFloatAvx2, FloatToS16Avx2, S24ToS32Avx2, S32ToS24Avx2, S24ToFloatAvx2, FloatToS24Avx2, S32ToFloatAvx2, U8ToS16Avx2 };
+        }
+#endif
+
+        static const SampleConverters& Best()
+        {
+#if SAMPLE_CONVERT_X86
+            static const SampleConverters best = sampleKernels::CpuHasAvx2() ? Avx2() : Sse2();
+#else
+            static const SampleConverters best = Scalar();
+#endif
+            return best;
+        }
+
+        SampleConvertFunc Find(SampleType from, SampleType to) const
+        {
+            if (from == SampleType::S16 && to == SampleType::Float) return s16ToFloat;
+            if (from == SampleType::Float && to == SampleType::S16) return floatToS16;
+            if (from == SampleType::S24 && to == SampleType::S32) return s24ToS32;
+            if (from == SampleType::S32 && to == SampleType::S24) return s32ToS24;
+            if (from == SampleType::S24 && to == SampleType::Float) return s24ToFloat;
+            if (from == SampleType::Float && to == SampleType::S24) return floatToS24;
+            if (from == SampleType::S32 && to == SampleType::Float) return s32ToFloat;
+            if (from == SampleType::U8 && to == SampleType::S16) return u8ToS16;
+            return nullptr;
+        }
+    };
+
+    // Converts count individual samples (not frames).  Returns false if there's no kernel for that pair of types.
+    inline bool ConvertSamples(SampleType from, const void* src, SampleType to, void* dst, size_t count)
+    {
+        if (from == to)
+        {
+            std::memcpy(dst, src, count * BytesPerSample(from));
+            return true;
+        }
+
+        SampleConvertFunc convert = SampleConverters::Best().Find(from, to);
+        if (convert == nullptr)
+        {
+            return false;
+        }
+
+        convert(src, dst, count);
+        return true;
+    }
+}
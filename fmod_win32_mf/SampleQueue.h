@@ -0,0 +1,244 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+namespace mediaFoundation
+{
+    // The bookkeeping behind an asynchronous source reader: keeps up to maxQueued samples requested ahead of whoever
+    // is consuming them, and lets the consumer block only when there's genuinely nothing there yet.  Knows nothing
+    // about Media Foundation itself; the reader is driven through the functions passed in, and reports back through
+    // OnSampleRead() and OnFlushed(), from whatever thread it likes.
+    //
+    // At most one read is ever in flight.  The source reader allows more, but one at a time is all it takes to keep
+    // the decoder busy, and it keeps flushing simple.
+    template <typename Sample>
+    class SampleQueue
+    {
+    public:
+        struct Entry
+        {
+            Sample sample;
+            long long timestamp;
+            unsigned long flags;
+        };
+
+        enum class Status
+        {
+            Ok,
+            EndOfStream,
+            Failed
+        };
+
+        // requestSample starts a single asynchronous read and returns false if it couldn't.  requestFlush starts
+        // cancelling any read in flight, to be confirmed with OnFlushed(), and likewise returns false if it couldn't.
+        // releaseSample disposes of samples that get thrown away.
+        SampleQueue(size_t queueDepth, std::function<bool()> requester, std::function<bool()> flusher, std::function<void(Sample)> releaser) :
+            maxQueued(queueDepth),
+            requestSample(std::move(requester)),
+            requestFlush(std::move(flusher)),
+            releaseSample(std::move(releaser)),
+            readInFlight(false),
+            requesting(false),
+            flushing(false),
+            closed(false),
+            reachedEnd(false),
+            failed(false)
+        { }
+
+        SampleQueue(const SampleQueue&) = delete;
+        SampleQueue& operator=(const SampleQueue&) = delete;
+
+        ~SampleQueue()
+        {
+            DropQueued();
+        }
+
+        // Reader side.  Hands over a completed read; the queue takes ownership of the sample, if there is one.
+        void OnSampleRead(bool succeeded, const Entry& entry, bool endOfStream)
+        {
+            std::unique_lock<std::mutex> lock(queueLock);
+            readInFlight = false;
+
+            if (flushing || !succeeded)
+            {
+                // Either a read that was cancelled out from under us, which nobody wants any more, or one that went
+                // wrong, in which case the consumer needs to hear about it.  The sample's released first, since once
+                // Flush() sees this read's done it may return, and the queue be destroyed, as soon as we let go.
+                failed = failed || !flushing;
+                Release(entry.sample);
+                queueSignal.notify_all();
+                return;
+            }
+
+            queued.push_back(entry);
+            reachedEnd = endOfStream;
+            queueSignal.notify_all();
+            RequestMore(lock);
+        }
+
+        // Reader side.  Confirms a flush started by requestFlush has finished, along with any read it cancelled.  The
+        // consumer may destroy the queue as soon as it sees this, so the signal has to go out before the lock is let
+        // go.
+        void OnFlushed()
+        {
+            std::lock_guard<std::mutex> lock(queueLock);
+            flushing = false;
+
+            // A read still being requested wasn't the reader's to cancel.  Flush() never lets that happen, but it's
+            // not for the reader to say otherwise.
+            if (!requesting)
+            {
+                readInFlight = false;
+            }
+            queueSignal.notify_all();
+        }
+
+        // Consumer side.  Waits for the next entry, starting reads as needed.  Entries are handed over in the order
+        // they were read, including the one flagged as the end of the stream; only once that's been taken does this
+        // start returning EndOfStream.
+        Status Pop(Entry* entry)
+        {
+            std::unique_lock<std::mutex> lock(queueLock);
+            RequestMore(lock);
+            queueSignal.wait(lock, [this] { return !queued.empty() || failed || (reachedEnd && !readInFlight); });
+
+            if (!queued.empty())
+            {
+                *entry = queued.front();
+                queued.pop_front();
+                RequestMore(lock);
+                return Status::Ok;
+            }
+            return failed ? Status::Failed : Status::EndOfStream;
+        }
+
+        // Consumer side.  Throws away everything queued and cancels the read in flight, if any, waiting until the
+        // reader has confirmed it.  Afterwards, the reader is idle, so it's safe to seek it; reading starts up
+        // again with the next Pop().
+        void Flush()
+        {
+            std::unique_lock<std::mutex> lock(queueLock);
+
+            // Stops any more reads being started.  One that's already being requested, from the reader's own thread,
+            // has to be let through first: until requestSample() returns, the reader may not know about it yet, so a
+            // flush now could be over before the read even starts.
+            flushing = true;
+            queueSignal.wait(lock, [this] { return !requesting; });
+            reachedEnd = false;
+            failed = false;
+
+            if (readInFlight)
+            {
+                lock.unlock();
+                const bool flushStarted = requestFlush();
+                lock.lock();
+
+                if (!flushStarted)
+                {
+                    // No way to cancel it, so just wait it out; OnSampleRead() will throw it away since we're still
+                    // flushing
+                    queueSignal.wait(lock, [this] { return !readInFlight; });
+                }
+                else
+                {
+                    queueSignal.wait(lock, [this] { return !flushing; });
+                }
+            }
+            flushing = false;
+
+            std::deque<Entry> dropped;
+            dropped.swap(queued);
+            lock.unlock();
+
+            for (const Entry& droppedEntry : dropped)
+            {
+                Release(droppedEntry.sample);
+            }
+        }
+
+        // Consumer side.  Flushes, and makes sure no more reads are ever requested, for when the reader is about to go
+        // away.  Anything the reader still has to say after this is quietly dropped.
+        void Close()
+        {
+            {
+                std::lock_guard<std::mutex> lock(queueLock);
+                closed = true;
+            }
+            Flush();
+        }
+
+        // Consumer side.  Starts reading ahead without waiting for the first Pop(), e.g. straight after a seek.
+        void Prime()
+        {
+            std::unique_lock<std::mutex> lock(queueLock);
+            RequestMore(lock);
+        }
+
+        size_t GetQueuedCount()
+        {
+            std::lock_guard<std::mutex> lock(queueLock);
+            return queued.size();
+        }
+
+    private:
+        // Starts another read if there's room for it and nothing's stopping us.  Called with the lock held, but
+        // drops it around the request itself in case the reader decides to call back on this same thread; if it
+        // did, and that read's already done, this goes round again rather than leave the queue idle.
+        void RequestMore(std::unique_lock<std::mutex>& lock)
+        {
+            while (!readInFlight && !requesting && !flushing && !closed && !reachedEnd && !failed && queued.size() < maxQueued)
+            {
+                readInFlight = true;
+                requesting = true;
+                lock.unlock();
+                const bool requested = requestSample();
+                lock.lock();
+
+                requesting = false;
+                if (!requested)
+                {
+                    readInFlight = false;
+                    failed = true;
+                }
+                queueSignal.notify_all();
+            }
+        }
+
+        void Release(Sample sample)
+        {
+            if (sample)
+            {
+                releaseSample(sample);
+            }
+        }
+
+        void DropQueued()
+        {
+            for (const Entry& entry : queued)
+            {
+                Release(entry.sample);
+            }
+            queued.clear();
+        }
+
+        const size_t maxQueued;
+        const std::function<bool()> requestSample;
+        const std::function<bool()> requestFlush;
+        const std::function<void(Sample)> releaseSample;
+
+        std::mutex queueLock;
+        std::condition_variable queueSignal;
+        std::deque<Entry> queued;
+        bool readInFlight;
+        bool requesting;                // Between RequestMore() marking a read in flight and requestSample() returning
+        bool flushing;
+        bool closed;
+        bool reachedEnd;
+        bool failed;
+    };
+}
@@ -1,6 +1,15 @@
 #pragma comment(lib, "fmod_vc.lib")
 
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <sstream>
 #include <ios>
 #include <format>
@@ -16,6 +25,23 @@
 #include <propkey.h>
 
 #include "include/fmod.hpp"
+#include "PcmRing.h"
+#include "SampleConvert.h"
+#include "ChannelMix.h"
+#include "Resampler.h"
+#include "SampleQueue.h"
+#include "Mp4Parser.h"
+#include "AsfParser.h"
+#include "LoopPoints.h"
+#include "ContainerInfo.h"
+#include "ProbeCache.h"
+#include "BlockCache.h"
+#include "PcmBlockPool.h"
+#include "DecodedSample.h"
+#include "FileCursor.h"
+#include "ContainerSignature.h"
+#include "LoopHead.h"
+#include "ReadTrace.h"
 
 // Forward declaration
 void RpgsPatchLog(const char* functionName, const std::string& message);
@@ -28,40 +54,138 @@ void RpgsPatchLog(const char* functionName, const std::string& message);
 
 namespace mediaFoundation
 {
-    FILETIME GetCurrentFileTime()
+    // Process-wide counters, mostly useful for confirming that the hot paths aren't doing anything they shouldn't.
+    // Exposed to the outside world through GetCodecStats().
+    struct CodecStats
     {
-        FILETIME curFileTime;
-        SYSTEMTIME sysTime;
-        GetSystemTime(&sysTime);
-        SystemTimeToFileTime(&sysTime, &curFileTime);
-        return curFileTime;
+        std::atomic<unsigned long long> pcmBlockAllocations;
+        std::atomic<unsigned long long> seeks;
+        std::atomic<unsigned long long> seekFramesDiscarded;
+        std::atomic<unsigned long long> loopHeadHits;
+        std::atomic<unsigned long long> decodersCreated;
+        std::atomic<unsigned long long> decodersReused;
+        std::atomic<unsigned long long> probes;
+        std::atomic<unsigned long long> probeRejects;
+        std::atomic<unsigned long long> probeNanoseconds;
+        std::atomic<unsigned long long> probeCacheHits;
+        std::atomic<unsigned long long> deferredOpens;
+        std::atomic<unsigned long long> deferredPipelinesBuilt;
+        std::atomic<unsigned long long> fileReads;
+        std::atomic<unsigned long long> fileSeeks;
+        std::atomic<unsigned long long> readCacheHits;
+        std::atomic<unsigned long long> readCacheMisses;
+        std::atomic<unsigned long long> memoryStreams;
+        std::atomic<unsigned long long> memoryStreamsShared;
+        std::atomic<unsigned long long> firstSamples;
+        std::atomic<unsigned long long> openToFirstSampleNanoseconds;
+        std::atomic<unsigned long long> streamReads;
+        std::atomic<unsigned long long> streamReadNanoseconds;
+    };
+    CodecStats stats = {};
+
+    // Tunables the host can poke through SetCodecSetting().  These are read at open(), so a change only applies to
+    // sounds opened afterwards.
+    struct CodecSettings
+    {
+        std::atomic<unsigned int> decodeAheadMs;
+        std::atomic<bool> floatOutput;
+        std::atomic<int> channelLayout;
+        std::atomic<unsigned int> resampleRate;
+        std::atomic<bool> asyncReader;
+        std::atomic<unsigned int> loopHeadMs;
+        std::atomic<unsigned int> decoderPoolSize;
+        std::atomic<bool> lazyOpen;
+        std::atomic<unsigned int> memoryStreamKb;
+    };
+    CodecSettings settings = {};
+
+    // Files small enough to be read whole, kept while any sound is still using them.  FMOD never tells us a file's
+    // path, so copies of the same file are found by their contents: the key only narrows it down, and a match is
+    // compared in full before it's shared.
+    std::mutex fileContentsLock;
+    std::unordered_multimap<uint64_t, std::weak_ptr<const std::vector<uint8_t>>> sharedFileContents;
+
+    // The size, and the first and last few KiB, which between them take in the headers of anything we play.
+    uint64_t MakeFileContentsKey(const std::vector<uint8_t>& contents)
+    {
+        constexpr size_t hashedBytes = 4096;
+        uint64_t hash = 14695981039346656037ull ^ contents.size();
+        const size_t headBytes = std::min<size_t>(contents.size(), hashedBytes);
+        const size_t tailStart = contents.size() - std::min<size_t>(contents.size() - headBytes, hashedBytes);
+        for (size_t i = 0; i < headBytes; ++i)
+        {
+            hash = (hash ^ contents[i]) * 1099511628211ull;
+        }
+        for (size_t i = tailStart; i < contents.size(); ++i)
+        {
+            hash = (hash ^ contents[i]) * 1099511628211ull;
+        }
+        return hash;
     }
 
-    class FmodReadStream : public IStream
+    // Reads the whole file in one go, and hands back the copy another sound already has if it's the same file.
+    // nullptr if the read fails, in which case the file's left to be streamed as usual.
+    std::shared_ptr<const std::vector<uint8_t>> LoadFileContents(FMOD_CODEC_STATE* codec)
     {
-    public:
-        FmodReadStream(FMOD_CODEC_STATE* inCodec) :
-            codec(inCodec),
-            referenceCount(1),
-            currentReadPos(0)
+        std::shared_ptr<std::vector<uint8_t>> contents = std::make_shared<std::vector<uint8_t>>(codec->filesize);
+
+        stats.fileReads++;
+        unsigned int bytesRead = 0;
+        if (codec->fileseek(codec->filehandle, 0, nullptr) != FMOD_OK
+            || codec->fileread(codec->filehandle, contents->data(), codec->filesize, &bytesRead, nullptr) != FMOD_OK
+            || bytesRead != codec->filesize)
         {
-            streamStats.pwcsName = nullptr;
-            streamStats.type = STGTY_STREAM;
-            streamStats.cbSize.HighPart = 0;
-            streamStats.cbSize.LowPart = codec->filesize;
+            codec->fileseek(codec->filehandle, 0, nullptr);
+            return nullptr;
+        }
+        stats.memoryStreams++;
+
+        const uint64_t key = MakeFileContentsKey(*contents);
 
-            FILETIME curFileTime = GetCurrentFileTime();
+        // Comparing a few MiB takes a while, so it's done without holding up every other sound being opened.  Two
+        // copies of one file opened at the same moment may both miss, and both be kept; that's only memory.
+        std::vector<std::shared_ptr<const std::vector<uint8_t>>> candidates;
+        {
+            std::lock_guard<std::mutex> lock(fileContentsLock);
+            const auto matchingKeys = sharedFileContents.equal_range(key);
+            for (auto candidate = matchingKeys.first; candidate != matchingKeys.second; ++candidate)
+            {
+                std::shared_ptr<const std::vector<uint8_t>> existing = candidate->second.lock();
+                if (existing != nullptr)
+                {
+                    candidates.push_back(std::move(existing));
+                }
+            }
+        }
 
-            streamStats.mtime = curFileTime;
-            streamStats.ctime = curFileTime;
-            streamStats.atime = curFileTime;
-            streamStats.grfMode = STGM_READ;
-            streamStats.grfLocksSupported = 0;
+        for (const std::shared_ptr<const std::vector<uint8_t>>& existing : candidates)
+        {
+            if (*existing == *contents)
+            {
+                stats.memoryStreamsShared++;
+                return existing;
+            }
         }
 
+        // Clear out whatever nobody's using any more while we're here
+        std::lock_guard<std::mutex> lock(fileContentsLock);
+        std::erase_if(sharedFileContents, [](const auto& entry) { return entry.second.expired(); });
+        sharedFileContents.emplace(key, contents);
+        return contents;
+    }
+
+    // What BeginRead() leaves for EndRead() to pick up.
+    class ByteStreamReadResult : public IUnknown
+    {
+    public:
+        ByteStreamReadResult(ULONG inBytesRead) :
+            bytesRead(inBytesRead),
+            referenceCount(1)
+        { }
+
         virtual HRESULT QueryInterface(REFIID riid, void** returnObj) override
         {
-            if (riid == IID_IStream || riid == IID_ISequentialStream || riid == IID_IUnknown)
+            if (riid == IID_IUnknown)
             {
                 *returnObj = this;
                 AddRef();
@@ -75,552 +199,2420 @@ namespace mediaFoundation
 
         virtual ULONG AddRef() override
         {
-            referenceCount++;
-            return 0;
+            return ++referenceCount;
         }
 
         virtual ULONG Release() override
         {
-            referenceCount--;
-            if (referenceCount == 0)
+            const ULONG remaining = --referenceCount;
+            if (remaining == 0)
             {
                 delete this;
             }
-            return 0;
+            return remaining;
         }
 
-        virtual HRESULT Read(void* buffer, ULONG bytesToRead, ULONG* bytesRead) override
-        {
-            unsigned int bytesReadAsInt = 0;
-            FMOD_RESULT readResult = codec->fileread(codec->filehandle, buffer, bytesToRead, &bytesReadAsInt, nullptr);
+        const ULONG bytesRead;
 
-            if (bytesRead != nullptr)
-            {
-                *bytesRead = bytesReadAsInt;
-            }
+    private:
+        virtual ~ByteStreamReadResult() = default;
+
+        std::atomic<ULONG> referenceCount;
+    };
+
+    // Media Foundation's view of the file, handed straight to the source resolver.  Served from fileContents if the
+    // whole file was read up front, and through the block cache otherwise.  The media source reads from Media
+    // Foundation's work queue threads, and setPosition() and the decode-ahead worker can get at it too, so anything
+    // touching the position or the file happens under readLock.
+    class FmodReadStream : public IMFByteStream
+    {
+    public:
+        FmodReadStream(FMOD_CODEC_STATE* inCodec, std::shared_ptr<const std::vector<uint8_t>> inFileContents) :
+            codec(inCodec),
+            referenceCount(1),
+            currentReadPos(0),
+            fileContents(std::move(inFileContents)),
+            fileCursor(0, [this](uint64_t offset) { return SeekFile(offset); }, [this](void* dest, size_t bytes, size_t* bytesRead) { return ReadFile(dest, bytes, bytesRead); }),
+            blockCache(inCodec->filesize, [this](uint64_t offset, void* dest, size_t bytes, size_t* bytesFetched) { return FetchBlock(offset, dest, bytes, bytesFetched); })
+        { }
 
-            currentReadPos += bytesReadAsInt;
-            if (readResult == FMOD_OK)
+        virtual HRESULT QueryInterface(REFIID riid, void** returnObj) override
+        {
+            if (riid == IID_IMFByteStream || riid == IID_IUnknown)
             {
+                *returnObj = this;
+                AddRef();
                 return S_OK;
             }
-            else if (readResult == FMOD_ERR_FILE_EOF)
-            {
-                PATCH_LOG("Reached end-of-file.");
-                return S_FALSE;
-            }
             else
             {
-                return STG_E_INVALIDPOINTER;
+                return E_NOINTERFACE;
             }
         }
 
-        virtual HRESULT Write(const void* buffer, ULONG bytesToWrite, ULONG* bytesWritten) override
+        virtual ULONG AddRef() override
+        {
+            return ++referenceCount;
+        }
+
+        virtual ULONG Release() override
         {
-            // Read-only
-            if (bytesWritten != nullptr)
+            // Called from Media Foundation's work queue threads as well as ours
+            const ULONG remaining = --referenceCount;
+            if (remaining == 0)
             {
-                bytesWritten = 0;
+                delete this;
             }
+            return remaining;
+        }
+
+        virtual HRESULT GetCapabilities(DWORD* capabilities) override
+        {
+            // Local and quick to seek, so the media source is free to read however suits it
+            *capabilities = MFBYTESTREAM_IS_READABLE | MFBYTESTREAM_IS_SEEKABLE | MFBYTESTREAM_DOES_NOT_USE_NETWORK;
+            return S_OK;
+        }
+
+        virtual HRESULT GetLength(QWORD* length) override
+        {
+            *length = codec->filesize;
+            return S_OK;
+        }
+
+        virtual HRESULT SetLength(QWORD length) override
+        {
+            // Read-only
+            return E_NOTIMPL;
+        }
+
+        virtual HRESULT GetCurrentPosition(QWORD* position) override
+        {
+            std::lock_guard<std::mutex> lock(readLock);
+            *position = currentReadPos;
             return S_OK;
         }
 
-        virtual HRESULT Clone(IStream** newStream) override
+        virtual HRESULT SetCurrentPosition(QWORD position) override
         {
-            // Don't even want to think about cajoling FMOD into giving us a new handle for the same file
-            newStream = nullptr;
-            return STG_E_INVALIDFUNCTION;
+            std::lock_guard<std::mutex> lock(readLock);
+            return MoveTo(position);
         }
 
-        virtual HRESULT Commit(DWORD commitFlags) override
+        virtual HRESULT IsEndOfStream(BOOL* endOfStream) override
         {
-            // Read-only, so we don't need to do anything
+            std::lock_guard<std::mutex> lock(readLock);
+            *endOfStream = (currentReadPos >= codec->filesize) ? TRUE : FALSE;
             return S_OK;
         }
 
-        virtual HRESULT CopyTo(IStream* otherStream, ULARGE_INTEGER bytesToCopy, ULARGE_INTEGER* bytesRead, ULARGE_INTEGER* bytesWritten) override
+        // For the container parsers, once Media Foundation has the stream.  Reads at offset without touching the
+        // position Media Foundation reads from, so it's safe whatever else is reading.
+        bool ReadAt(uint64_t offset, void* dest, size_t bytes)
         {
-            if (bytesToCopy.HighPart > 0)
+            if (offset + bytes > codec->filesize)
             {
-                // FMOD codec fileread and IStream::Write don't support 64-bit sizes
-                return STG_E_MEDIUMFULL;
+                return false;
             }
 
-            FmodReadStream* otherFmodStream = dynamic_cast<FmodReadStream*>(otherStream);
-            if (otherFmodStream != nullptr)
+            std::lock_guard<std::mutex> lock(readLock);
+            if (fileContents != nullptr)
             {
-                // We can't write to another one of this stream
-                return STG_E_INVALIDPOINTER;
+                return ReadFromContents(offset, dest, bytes) == bytes;
             }
 
-            std::byte* copyBuffer = new std::byte[bytesToCopy.LowPart];
+            bool readFailed = false;
+            return blockCache.Read(offset, dest, bytes, &readFailed) == bytes && !readFailed;
+        }
+
+        uint64_t GetSize() const
+        {
+            return codec->filesize;
+        }
 
-            HRESULT copyResult = S_OK;
+        virtual HRESULT Read(BYTE* buffer, ULONG bytesToRead, ULONG* bytesRead) override
+        {
+            const auto readStart = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> lock(readLock);
 
-            unsigned int copyBytesRead = 0;
-            unsigned int copyBytesWritten = 0;
-            FMOD_RESULT readResult = codec->fileread(codec->filehandle, copyBuffer, bytesToCopy.LowPart, &copyBytesRead, nullptr);
-            if (readResult == FMOD_OK || readResult == FMOD_ERR_FILE_EOF)
+            bool readFailed = false;
+            ULONG bytesCopied = 0;
+            if (fileContents != nullptr)
             {
-                ULONG longWritten = 0;
-                copyResult = otherStream->Write(copyBuffer, copyBytesRead, &longWritten);
-                copyBytesWritten = longWritten;
-
-                // put the seek head back where it was
-                codec->fileseek(codec->filehandle, currentReadPos, nullptr);
+                bytesCopied = static_cast<ULONG>(ReadFromContents(currentReadPos, buffer, bytesToRead));
             }
             else
             {
-                copyResult = STG_E_MEDIUMFULL;
+                bytesCopied = static_cast<ULONG>(blockCache.Read(currentReadPos, buffer, bytesToRead, &readFailed));
+
+                unsigned long long cacheHits = 0;
+                unsigned long long cacheMisses = 0;
+                blockCache.TakeCounts(&cacheHits, &cacheMisses);
+                stats.readCacheHits += cacheHits;
+                stats.readCacheMisses += cacheMisses;
             }
 
             if (bytesRead != nullptr)
             {
-                bytesRead->HighPart = 0;
-                bytesRead->LowPart = copyBytesRead;
+                *bytesRead = bytesCopied;
+            }
+
+            const uint64_t readNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - readStart).count();
+#if _DEBUG
+            trace.Record(currentReadPos, bytesCopied, readNanoseconds);
+#endif
+            currentReadPos += bytesCopied;
+
+            stats.streamReads++;
+            stats.streamReadNanoseconds += readNanoseconds;
+
+            if (readFailed)
+            {
+                PATCH_LOG("Read from FMOD's file failed.");
+                return E_FAIL;
             }
-            if (bytesWritten != nullptr)
+            else if (bytesCopied < bytesToRead)
             {
-                bytesWritten->HighPart = 0;
-                bytesWritten->LowPart = copyBytesWritten;
+                PATCH_LOG("Reached end-of-file.");
             }
+            return S_OK;
+        }
+
+        // Everything we read from is either in memory or FMOD's own file, so there's nothing to be gained from handing
+        // the read to another thread just so this one can wait on it.  It's done before returning, and the callback
+        // told through the work queue as usual.
+        virtual HRESULT BeginRead(BYTE* buffer, ULONG bytesToRead, IMFAsyncCallback* callback, IUnknown* callerState) override
+        {
+            ULONG bytesRead = 0;
+            const HRESULT readResult = Read(buffer, bytesToRead, &bytesRead);
 
-            if (SUCCEEDED(copyResult))
+            ByteStreamReadResult* readState = new ByteStreamReadResult(bytesRead);
+            IMFAsyncResult* asyncResult = nullptr;
+            HRESULT result = MFCreateAsyncResult(readState, callback, callerState, &asyncResult);
+            readState->Release();
+
+            if (SUCCEEDED(result))
             {
-                PATCH_LOG("Successful stream copy.");
+                asyncResult->SetStatus(readResult);
+                result = MFInvokeCallback(asyncResult);
+                asyncResult->Release();
             }
-            else
+            return result;
+        }
+
+        virtual HRESULT EndRead(IMFAsyncResult* asyncResult, ULONG* bytesRead) override
+        {
+            // Only ever given back the results BeginRead() made
+            IUnknown* readState = nullptr;
+            HRESULT result = asyncResult->GetObject(&readState);
+            if (SUCCEEDED(result))
             {
-                PATCH_LOG(std::format("Stream copy failed!  Read error: {}; Write error: {}", static_cast<unsigned int>(readResult), copyResult));
+                *bytesRead = static_cast<ByteStreamReadResult*>(readState)->bytesRead;
+                readState->Release();
+                result = asyncResult->GetStatus();
             }
+            return result;
+        }
 
-            delete[] copyBuffer;
-            return copyResult;
+        virtual HRESULT Write(const BYTE* buffer, ULONG bytesToWrite, ULONG* bytesWritten) override
+        {
+            // Read-only
+            return E_NOTIMPL;
         }
 
-        virtual HRESULT LockRegion(ULARGE_INTEGER offset, ULARGE_INTEGER size, DWORD lockType) override
+        virtual HRESULT BeginWrite(const BYTE* buffer, ULONG bytesToWrite, IMFAsyncCallback* callback, IUnknown* callerState) override
         {
-            return STG_E_INVALIDFUNCTION;
+            return E_NOTIMPL;
         }
 
-        virtual HRESULT Revert() override
+        virtual HRESULT EndWrite(IMFAsyncResult* asyncResult, ULONG* bytesWritten) override
         {
-            return S_OK;
+            return E_NOTIMPL;
         }
 
-        virtual HRESULT Seek(LARGE_INTEGER seekMove, DWORD seekRelativeType, ULARGE_INTEGER* newPosition) override
+        virtual HRESULT Seek(MFBYTESTREAM_SEEK_ORIGIN seekOrigin, LONGLONG seekOffset, DWORD seekFlags, QWORD* newPosition) override
         {
-            if (seekMove.HighPart > 0)
+            std::lock_guard<std::mutex> lock(readLock);
+
+            // Reads are all done by the time BeginRead() returns, so there's never anything pending to cancel
+            LONGLONG target = seekOffset;
+            if (seekOrigin == msoCurrent)
             {
-                // Can't handle 64-bit offsets
-                newPosition = nullptr;
-                return STG_E_INVALIDFUNCTION;
+                target += static_cast<LONGLONG>(currentReadPos);
             }
-
-            unsigned int newPos = currentReadPos;
-
-            switch (seekRelativeType)
+            else if (seekOrigin != msoBegin)
             {
-            case STREAM_SEEK_SET:
-                {
-                    newPos = seekMove.LowPart;
-                    break;
-                }
-            case STREAM_SEEK_CUR:
-                {
-                    newPos += seekMove.LowPart;
-                    break;
-                }
-            case STREAM_SEEK_END:
-                {
-                    newPos = codec->filesize - seekMove.LowPart;
-                    break;
-                }
-            default:
-                {
-                    newPosition = nullptr;
-                    return STG_E_INVALIDFUNCTION;
-                }
+                return E_INVALIDARG;
             }
 
-            if (newPos > codec->filesize)
+            if (target < 0)
             {
-                newPosition = nullptr;
-                return STG_E_INVALIDFUNCTION;
+                return E_INVALIDARG;
             }
 
-            FMOD_RESULT seekResult = codec->fileseek(codec->filehandle, newPos, nullptr);
-            if (seekResult != FMOD_OK)
+            HRESULT result = MoveTo(static_cast<QWORD>(target));
+            if (SUCCEEDED(result) && newPosition != nullptr)
             {
-                PATCH_LOG(std::format("Seek operation failed: {}", static_cast<unsigned int>(seekResult)));
-                return STG_E_INVALIDFUNCTION;
+                *newPosition = currentReadPos;
             }
+            return result;
+        }
 
-            currentReadPos = newPos;
+        virtual HRESULT Flush() override
+        {
+            return S_OK;
+        }
 
-            if (newPosition != nullptr)
-            {
-                newPosition->HighPart = 0;
-                newPosition->LowPart = newPos;
-            }
+        virtual HRESULT Close() override
+        {
             return S_OK;
         }
 
-        virtual HRESULT SetSize(ULARGE_INTEGER newSize) override
+    private:
+#if _DEBUG
+        // What Media Foundation made of the stream, for comparing against the reads the block cache made of the file
+        virtual ~FmodReadStream()
+        {
+            const ReadTrace::Summary summary = trace.Summarise();
+            PATCH_LOG(std::format("{} reads from Media Foundation.  The last {}: {} bytes, {} carrying on from the one before, median {} ns, worst {} ns.",
+                summary.reads, std::min<uint64_t>(summary.reads, ReadTrace::capacity), summary.bytes, summary.sequentialReads, summary.medianNanoseconds, summary.worstNanoseconds));
+        }
+#else
+        virtual ~FmodReadStream() = default;
+#endif
+
+        // With readLock held.  Only moves where the next read comes from; FMOD's file stays where it is until a read
+        // actually needs it somewhere else.
+        HRESULT MoveTo(QWORD position)
         {
-            if (newSize.HighPart > 0)
+            if (position > codec->filesize)
             {
-                // We don't want Windows thinking we can support larger sizes than we actually can
-                return STG_E_MEDIUMFULL;
+                return E_INVALIDARG;
             }
 
-            // We don't actually have memory allocated for ourselves, so just pretend we did it.
+            currentReadPos = position;
             return S_OK;
         }
 
-        virtual HRESULT Stat(STATSTG* outStats, DWORD statFlag) override
+        size_t ReadFromContents(uint64_t offset, void* dest, size_t bytes) const
         {
-            *outStats = streamStats;
-
-            if (statFlag | STATFLAG_NONAME)
+            if (offset >= fileContents->size())
             {
-                outStats->pwcsName = nullptr;
+                return 0;
             }
 
-            return S_OK;
+            const size_t bytesToCopy = std::min<size_t>(bytes, fileContents->size() - offset);
+            std::memcpy(dest, fileContents->data() + offset, bytesToCopy);
+            return bytesToCopy;
         }
 
-        virtual HRESULT UnlockRegion(ULARGE_INTEGER offset, ULARGE_INTEGER size, DWORD lockType) override
+        // Where the block cache's reads go.  A seek can cost FMOD's buffered file layer its buffer, so the cursor only
+        // makes one when a read doesn't carry on from where the last ended.
+        bool FetchBlock(uint64_t offset, void* dest, size_t bytes, size_t* bytesFetched)
         {
-            return STG_E_INVALIDFUNCTION;
+            stats.fileReads++;
+            return fileCursor.Read(offset, dest, bytes, bytesFetched);
+        }
+
+        // FMOD's file callbacks, for the cursor.  They only do 32-bit positions.
+        bool SeekFile(uint64_t offset)
+        {
+            stats.fileSeeks++;
+            return codec->fileseek(codec->filehandle, static_cast<unsigned int>(offset), nullptr) == FMOD_OK;
+        }
+
+        bool ReadFile(void* dest, size_t bytes, size_t* bytesRead)
+        {
+            unsigned int bytesReadAsInt = 0;
+            const FMOD_RESULT readResult = codec->fileread(codec->filehandle, dest, static_cast<unsigned int>(bytes), &bytesReadAsInt, nullptr);
+            *bytesRead = bytesReadAsInt;
+            return readResult == FMOD_OK || readResult == FMOD_ERR_FILE_EOF;
         }
 
-    private:
         FMOD_CODEC_STATE* codec;
-        ULONG referenceCount;
-        unsigned int currentReadPos;
-        STATSTG streamStats;
+        std::atomic<ULONG> referenceCount;
+        std::mutex readLock;
+        QWORD currentReadPos;
+        std::shared_ptr<const std::vector<uint8_t>> fileContents;
+        FileCursor fileCursor;
+        BlockCache blockCache;
+#if _DEBUG
+        ReadTrace trace;
+#endif
     };
 
-    class MfObjects
+    // Gives the container parsers random access to the file through FMOD's callbacks.  Moves the file position
+    // around, so only for use before Media Foundation has been handed the stream.  If the whole file's already been
+    // read into memory, reads come from there instead.
+    class CodecFileReader
     {
     public:
-        MfObjects() :
-            fmodStream(nullptr),
-            mfFmodStream(nullptr),
-            mfResolver(nullptr),
-            mfMedia(nullptr),
-            mfReader(nullptr),
-            mfBuffer(nullptr),
-            lastReadTimestamp(0),
-            currentBufferPos(0)
+        CodecFileReader(FMOD_CODEC_STATE* inCodec, const std::vector<uint8_t>* inContents = nullptr) :
+            codec(inCodec),
+            contents(inContents)
         { }
 
-        virtual ~MfObjects()
+        bool ReadAt(uint64_t offset, void* dest, size_t bytes)
         {
-            if (mfBuffer != nullptr)
-            {
-                mfBuffer->Release();
-            }
-            if (mfReader != nullptr)
-            {
-                mfReader->Release();
-            }
-            if (mfMedia != nullptr)
-            {
-                mfMedia->Release();
-            }
-            if (mfResolver != nullptr)
-            {
-                mfResolver->Release();
-            }
-            if (mfFmodStream != nullptr)
+            // FMOD's file callbacks only do 32-bit positions
+            if (offset + bytes > codec->filesize)
             {
-                mfFmodStream->Release();
+                return false;
             }
-            if (fmodStream != nullptr)
+
+            if (contents != nullptr)
             {
-                fmodStream->Release();
+                std::memcpy(dest, contents->data() + offset, bytes);
+                return true;
             }
+
+            unsigned int bytesRead = 0;
+            return codec->fileseek(codec->filehandle, static_cast<unsigned int>(offset), nullptr) == FMOD_OK
+                && codec->fileread(codec->filehandle, dest, static_cast<unsigned int>(bytes), &bytesRead, nullptr) == FMOD_OK
+                && bytesRead == bytes;
         }
 
-        FmodReadStream* fmodStream;
-        IMFByteStream* mfFmodStream;
-        IMFSourceResolver* mfResolver;
-        IMFMediaSource* mfMedia;
-        IMFSourceReader* mfReader;
-        IMFMediaBuffer* mfBuffer;
+        uint64_t GetSize() const
+        {
+            return codec->filesize;
+        }
 
-        LONGLONG lastReadTimestamp;
-        unsigned int currentBufferPos;
+    private:
+        FMOD_CODEC_STATE* codec;
+        const std::vector<uint8_t>* contents;
     };
 
-    HRESULT ConfigureAudioStream(IMFSourceReader* reader)
+    // And again for a file FMOD has never seen, for probing.  Reads are positioned, so nothing's shared between them
+    // and any number of threads could use one, though the probe only ever gives each file a thread of its own.
+    class Win32FileReader
     {
-        IMFMediaType* partialAudioType = nullptr;
+    public:
+        Win32FileReader(const WCHAR* path) :
+            file(CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr)),
+            size(0),
+            modifiedTime(0)
+        {
+            LARGE_INTEGER fileSize;
+            FILETIME lastWrite;
+            if (file != INVALID_HANDLE_VALUE && GetFileSizeEx(file, &fileSize) && GetFileTime(file, nullptr, nullptr, &lastWrite))
+            {
+                size = static_cast<uint64_t>(fileSize.QuadPart);
+                modifiedTime = (static_cast<uint64_t>(lastWrite.dwHighDateTime) << 32) | lastWrite.dwLowDateTime;
+            }
+        }
 
-        HRESULT result = reader->SetStreamSelection((DWORD)MF_SOURCE_READER_ALL_STREAMS, FALSE);
-        if (SUCCEEDED(result))
+        ~Win32FileReader()
         {
-            result = reader->SetStreamSelection((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, TRUE);
+            if (file != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(file);
+            }
         }
 
-        if (SUCCEEDED(result))
+        Win32FileReader(const Win32FileReader&) = delete;
+        Win32FileReader& operator=(const Win32FileReader&) = delete;
+
+        bool IsOpen() const
         {
-            result = MFCreateMediaType(&partialAudioType);
+            return file != INVALID_HANDLE_VALUE;
         }
 
-        if (SUCCEEDED(result))
+        bool ReadAt(uint64_t offset, void* dest, size_t bytes)
         {
-            result = partialAudioType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio);
+            if (offset + bytes > size || bytes > MAXDWORD)
+            {
+                return false;
+            }
+
+            OVERLAPPED position = {};
+            position.Offset = static_cast<DWORD>(offset);
+            position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            DWORD bytesRead = 0;
+            return ReadFile(file, dest, static_cast<DWORD>(bytes), &bytesRead, &position) && bytesRead == bytes;
         }
 
-        if (SUCCEEDED(result))
+        uint64_t GetSize() const
         {
-            result = partialAudioType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_PCM);
+            return size;
         }
 
-        if (SUCCEEDED(result))
+        uint64_t GetModifiedTime() const
         {
-            // setting partial type on the reader will load the correct decoder
-            result = reader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, nullptr, partialAudioType);
+            return modifiedTime;
         }
 
-        if (FAILED(result))
+    private:
+        HANDLE file;
+        uint64_t size;
+        uint64_t modifiedTime;
+    };
+
+    // The parts of a media type that the codec callbacks actually care about.  Resolved once at open() (and again
+    // whenever the decoder changes its mind) instead of going back to the media type on every callback.
+    struct AudioFormat
+    {
+        UINT32 channels;
+        UINT32 bitsPerSample;
+        UINT32 sampleRate;
+        UINT32 blockAlign;
+        UINT32 bytesPerSec;
+        UINT32 samplesPerBlock;
+        UINT32 channelMask;
+        SampleType sampleType;
+    };
+
+    SampleType SampleTypeOf(UINT32 bitsPerSample, bool isFloat)
+    {
+        if (isFloat)
         {
-            PATCH_LOG(std::format("Failed to configure audio stream: {}", result));
+            return bitsPerSample == 32 ? SampleType::Float : SampleType::None;
         }
 
-        if (partialAudioType != nullptr)
+        switch (bitsPerSample)
         {
-            partialAudioType->Release();
+        case 8:
+            return SampleType::U8;
+        case 16:
+            return SampleType::S16;
+        case 24:
+            return SampleType::S24;
+        case 32:
+            return SampleType::S32;
+        default:
+            return SampleType::None;
         }
-
-        return result;
     }
 
-    /*
-    void FillOutMetadata(FMOD_CODEC_STATE* codec, MfObjects* mfObjects)
+    bool CanConvertToFloat(SampleType type)
     {
-        void* voidSource = nullptr;
-        void* voidStore = nullptr;
-        void* voidMetadata = nullptr;
-
-        IMFMediaSource* mediaSource = nullptr;
-        IPropertyStore* propertyStore = nullptr;
+        return type == SampleType::Float || SampleConverters::Best().Find(type, SampleType::Float) != nullptr;
+    }
 
-        HRESULT winLibResult = mfObjects->mfReader->GetServiceForStream(MF_SOURCE_READER_FIRST_AUDIO_STREAM, MF_MEDIASOURCE_SERVICE, IID_IMFMediaSource, &voidSource);
-        if (SUCCEEDED(winLibResult))
+    // Works out what we should be handing to FMOD for a given decoder output.  8-bit PCM from Media Foundation is
+    // unsigned, which FMOD doesn't do, so that always gets widened.  Otherwise, the decoder's output is passed through
+    // untouched unless float has been asked for and the decoder couldn't provide it, or we're remixing or resampling,
+    // which are always done in float.
+    AudioFormat MakeOutputFormat(const AudioFormat& decodedFormat, bool wantFloat, const ChannelMatrix& channelMix, const PolyphaseResampler& resampler)
+    {
+        SampleType outputType = decodedFormat.sampleType;
+        if (channelMix.IsActive() || resampler.IsActive())
         {
-            mediaSource = static_cast<IMFMediaSource*>(voidSource);
-            winLibResult = MFGetService(mediaSource, MF_PROPERTY_HANDLER_SERVICE, IID_IPropertyStore, &voidStore);
+            outputType = SampleType::Float;
+        }
+        else if (outputType == SampleType::U8)
+        {
+            outputType = SampleType::S16;
+        }
+        else if (wantFloat && CanConvertToFloat(outputType))
+        {
+            outputType = SampleType::Float;
         }
 
-        DWORD metadataPropCount = 0;
-        if (SUCCEEDED(winLibResult))
+        AudioFormat outputFormat = decodedFormat;
+        if (channelMix.IsActive())
         {
-            propertyStore = static_cast<IPropertyStore*>(voidStore);
+            outputFormat.channels = channelMix.outputChannels;
+            outputFormat.channelMask = channelMix.outputMask;
+        }
+        if (resampler.IsActive())
+        {
+            outputFormat.sampleRate = resampler.GetOutputRate();
+        }
 
-            winLibResult = propertyStore->GetCount(&metadataPropCount);
+        outputFormat.sampleType = outputType;
+        outputFormat.bitsPerSample = static_cast<UINT32>(BytesPerSample(outputType) * 8);
+        outputFormat.blockAlign = static_cast<UINT32>(BytesPerSample(outputType) * outputFormat.channels);
+        outputFormat.bytesPerSec = outputFormat.blockAlign * outputFormat.sampleRate;
+        return outputFormat;
+    }
+
+    // Maps the speaker mode the host asked for onto one of the layouts we can mix to.  FMOD has no layout beyond 7.1
+    // that we'd ever have a source for, so 7.1.4 just means 7.1 here.
+    ChannelLayout ChannelLayoutForSpeakerMode(int speakerMode)
+    {
+        switch (speakerMode)
+        {
+        case FMOD_SPEAKERMODE_MONO:
+            return ChannelLayout::Mono;
+        case FMOD_SPEAKERMODE_STEREO:
+            return ChannelLayout::Stereo;
+        case FMOD_SPEAKERMODE_QUAD:
+            return ChannelLayout::Quad;
+        case FMOD_SPEAKERMODE_SURROUND:
+            return ChannelLayout::Surround;
+        case FMOD_SPEAKERMODE_5POINT1:
+            return ChannelLayout::FivePointOne;
+        case FMOD_SPEAKERMODE_7POINT1:
+        case FMOD_SPEAKERMODE_7POINT1POINT4:
+            return ChannelLayout::SevenPointOne;
+        default:
+            return ChannelLayout::Passthrough;
         }
+    }
 
-        if (SUCCEEDED(winLibResult))
+    HRESULT QueryAudioFormat(IMFSourceReader* reader, AudioFormat* outFormat)
+    {
+        IMFMediaType* audioType = nullptr;
+        HRESULT result = reader->GetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, &audioType);
+        if (FAILED(result))
+        {
+            PATCH_LOG("Failed to get audio type from the source reader.");
+            return result;
+        }
+
+        outFormat->channels = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_NUM_CHANNELS, 0);
+        outFormat->bitsPerSample = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_BITS_PER_SAMPLE, 0);
+        outFormat->sampleRate = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_SAMPLES_PER_SECOND, 0);
+        outFormat->blockAlign = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_BLOCK_ALIGNMENT, outFormat->channels * outFormat->bitsPerSample / 8);
+        outFormat->bytesPerSec = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_AVG_BYTES_PER_SECOND, outFormat->blockAlign * outFormat->sampleRate);
+        outFormat->samplesPerBlock = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_SAMPLES_PER_BLOCK, 0);
+        outFormat->channelMask = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_CHANNEL_MASK, 0);
+
+        GUID subtype = GUID_NULL;
+        audioType->GetGUID(MF_MT_SUBTYPE, &subtype);
+        outFormat->sampleType = SampleTypeOf(outFormat->bitsPerSample, subtype == MFAudioFormat_Float);
+
+        audioType->Release();
+
+        //PATCH_LOG(std::format("{} Hz, {} channels, {} bits", outFormat->sampleRate, outFormat->channels, outFormat->bitsPerSample));
+        return S_OK;
+    }
+
+    // Where each stream's PcmBlockPool gets new blocks from
+    IMFMediaBuffer* CreatePcmBlock(size_t size)
+    {
+        IMFMediaBuffer* block = nullptr;
+        if (FAILED(MFCreateMemoryBuffer(static_cast<DWORD>(size), &block)))
+        {
+            return nullptr;
+        }
+
+        stats.pcmBlockAllocations++;
+        return block;
+    }
+
+    // The Media Foundation objects that open() would otherwise build from scratch every time, kept for the life of
+    // the process.  The source resolver is free-threaded, so one does for everybody.  Decoders aren't, so they're
+    // lent out to one stream at a time: close() hands its decoder back, flushed and with its media types cleared,
+    // and the next open() of the same format picks it up instead of going through MFTEnumEx() and a fresh COM
+    // activation.  At most settings.decoderPoolSize decoders are kept idle.
+    class MfObjectCache
+    {
+    public:
+        MfObjectCache() :
+            resolver(nullptr)
+        { }
+
+        // AddRef'd, same as from MFCreateSourceResolver()
+        HRESULT GetResolver(IMFSourceResolver** outResolver)
+        {
+            std::lock_guard<std::mutex> lock(cacheLock);
+            if (resolver == nullptr)
+            {
+                HRESULT result = MFCreateSourceResolver(&resolver);
+                if (FAILED(result))
+                {
+                    return result;
+                }
+            }
+
+            resolver->AddRef();
+            *outResolver = resolver;
+            return S_OK;
+        }
+
+        // A decoder that takes inputSubtype, with no media types set.
+        HRESULT BorrowDecoder(REFGUID inputSubtype, IMFTransform** outDecoder)
+        {
+            {
+                std::lock_guard<std::mutex> lock(cacheLock);
+                for (auto idle = idleDecoders.begin(); idle != idleDecoders.end(); ++idle)
+                {
+                    if (idle->inputSubtype == inputSubtype)
+                    {
+                        *outDecoder = idle->decoder;
+                        idleDecoders.erase(idle);
+                        stats.decodersReused++;
+                        return S_OK;
+                    }
+                }
+            }
+
+            return CreateDecoder(inputSubtype, outDecoder);
+        }
+
+        // Takes back a decoder from BorrowDecoder(), once nothing else is using it.
+        void ReturnDecoder(REFGUID inputSubtype, IMFTransform* decoder)
+        {
+            decoder->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, 0);
+            decoder->SetOutputType(0, nullptr, 0);
+            decoder->SetInputType(0, nullptr, 0);
+
+            std::unique_lock<std::mutex> lock(cacheLock);
+            idleDecoders.push_back({ inputSubtype, decoder });
+
+            // Oldest first, should there be too many
+            std::vector<IMFTransform*> surplus;
+            while (idleDecoders.size() > settings.decoderPoolSize)
+            {
+                surplus.push_back(idleDecoders.front().decoder);
+                idleDecoders.erase(idleDecoders.begin());
+            }
+            lock.unlock();
+
+            for (IMFTransform* surplusDecoder : surplus)
+            {
+                surplusDecoder->Release();
+            }
+        }
+
+        // Lets go of everything.  Has to happen before MFShutdown(), so it can't be left to the destructor.
+        void Clear()
+        {
+            std::lock_guard<std::mutex> lock(cacheLock);
+            for (const IdleDecoder& idle : idleDecoders)
+            {
+                idle.decoder->Release();
+            }
+            idleDecoders.clear();
+
+            if (resolver != nullptr)
+            {
+                resolver->Release();
+                resolver = nullptr;
+            }
+        }
+
+    private:
+        struct IdleDecoder
+        {
+            GUID inputSubtype;
+            IMFTransform* decoder;
+        };
+
+        static HRESULT CreateDecoder(REFGUID inputSubtype, IMFTransform** outDecoder)
+        {
+            const MFT_REGISTER_TYPE_INFO inputType = { MFMediaType_Audio, inputSubtype };
+            IMFActivate** activates = nullptr;
+            UINT32 activateCount = 0;
+
+            HRESULT result = MFTEnumEx(MFT_CATEGORY_AUDIO_DECODER, MFT_ENUM_FLAG_SYNCMFT | MFT_ENUM_FLAG_LOCALMFT | MFT_ENUM_FLAG_SORTANDFILTER, &inputType, nullptr, &activates, &activateCount);
+            if (SUCCEEDED(result) && activateCount == 0)
+            {
+                result = MF_E_TOPO_CODEC_NOT_FOUND;
+            }
+
+            if (SUCCEEDED(result))
+            {
+                result = activates[0]->ActivateObject(IID_PPV_ARGS(outDecoder));
+            }
+            if (SUCCEEDED(result))
+            {
+                stats.decodersCreated++;
+            }
+
+            for (UINT32 i = 0; i < activateCount; ++i)
+            {
+                activates[i]->Release();
+            }
+            CoTaskMemFree(activates);
+            return result;
+        }
+
+        std::mutex cacheLock;
+        IMFSourceResolver* resolver;
+        std::vector<IdleDecoder> idleDecoders;
+    };
+    MfObjectCache objectCache;
+
+    typedef SampleQueue<IMFSample*> MfSampleQueue;
+
+    // Receives an asynchronous source reader's completions and hands them on to the sample queue.  Keeps its own
+    // reference to the queue, since the reader is free to hang on to us for a while after the MfObjects is gone.
+    class SourceReaderCallback : public IMFSourceReaderCallback
+    {
+    public:
+        SourceReaderCallback(std::shared_ptr<MfSampleQueue> inQueue) :
+            queue(std::move(inQueue)),
+            referenceCount(1)
+        { }
+
+        virtual HRESULT QueryInterface(REFIID riid, void** returnObj) override
+        {
+            if (riid == IID_IMFSourceReaderCallback || riid == IID_IUnknown)
+            {
+                *returnObj = this;
+                AddRef();
+                return S_OK;
+            }
+            else
+            {
+                return E_NOINTERFACE;
+            }
+        }
+
+        virtual ULONG AddRef() override
+        {
+            return ++referenceCount;
+        }
+
+        virtual ULONG Release() override
+        {
+            // Called from Media Foundation's work queue threads as well as ours
+            const ULONG remaining = --referenceCount;
+            if (remaining == 0)
+            {
+                delete this;
+            }
+            return remaining;
+        }
+
+        virtual HRESULT OnReadSample(HRESULT status, DWORD streamIndex, DWORD streamFlags, LONGLONG timestamp, IMFSample* sample) override
+        {
+            if (FAILED(status))
+            {
+                PATCH_LOG(std::format("Asynchronous sample read failed: {}", status));
+            }
+
+            // The reader lets go of the sample once we return, so the queue needs its own reference
+            if (sample != nullptr)
+            {
+                sample->AddRef();
+            }
+
+            queue->OnSampleRead(SUCCEEDED(status), { sample, timestamp, streamFlags }, (streamFlags & MF_SOURCE_READERF_ENDOFSTREAM) != 0);
+            return S_OK;
+        }
+
+        virtual HRESULT OnFlush(DWORD streamIndex) override
+        {
+            queue->OnFlushed();
+            return S_OK;
+        }
+
+        virtual HRESULT OnEvent(DWORD streamIndex, IMFMediaEvent* mediaEvent) override
+        {
+            return S_OK;
+        }
+
+    private:
+        virtual ~SourceReaderCallback() = default;
+
+        std::shared_ptr<MfSampleQueue> queue;
+        std::atomic<ULONG> referenceCount;
+    };
+
+    class MfObjects
+    {
+    public:
+        MfObjects() :
+            fmodStream(nullptr),
+            mfResolver(nullptr),
+            mfDecoder(nullptr),
+            mfDecoderSubtype(GUID_NULL),
+            mfMedia(nullptr),
+            mfReader(nullptr),
+            mimeType(nullptr),
+            wantFloat(false),
+            pipelineDeferred(false),
+            pipelineResult(S_OK),
+            pcmPool(CreatePcmBlock),
+            decodedSample(pcmPool),
+            format(),
+            outputFormat(),
+            resamplerFlushed(false),
+            seekTarget(-1),
+            asfIndexAttempted(false),
+            fileSize(0),
+            lastReadTimestamp(0),
+            currentBufferPos(0),
+            decodeStopRequested(false),
+            decodePauseRequested(false),
+            decodeParked(false),
+            decodeEndOfStream(false),
+            decodeResult(S_OK),
+            decodePendingSeek(-1),
+            timelineOffset(0),
+            contentEndFrame(0),
+            hasLoop(false),
+            loopStartFrame(0),
+            loopEndFrame(0),
+            playbackFrame(0),
+            openTime(std::chrono::steady_clock::now()),
+            firstSamplesTimed(false)
+        { }
+
+        virtual ~MfObjects()
+        {
+            // The worker has to be gone before we start pulling objects out from under it
+            StopDecodeAhead();
+
+            // Likewise, the reader mustn't be left with a read in flight
+            if (sampleQueue != nullptr)
+            {
+                sampleQueue->Close();
+            }
+
+            ReleaseBuffer();
+            ULONG readerReferences = 0;
+            if (mfReader != nullptr)
+            {
+                readerReferences = mfReader->Release();
+            }
+            if (mfMedia != nullptr)
+            {
+                mfMedia->Shutdown();
+                mfMedia->Release();
+            }
+            if (mfResolver != nullptr)
+            {
+                mfResolver->Release();
+            }
+            if (mfDecoder != nullptr)
+            {
+                // Only once the reader's really gone is the decoder ours again.  If something still holds the reader,
+                // it may still be feeding the decoder, so it can't go back in the pool for another stream.
+                if (readerReferences == 0)
+                {
+                    objectCache.ReturnDecoder(mfDecoderSubtype, mfDecoder);
+                }
+                else
+                {
+                    PATCH_LOG(std::format("Source reader still has {} references; not pooling its decoder.", readerReferences));
+                    mfDecoder->Release();
+                }
+            }
+            if (fmodStream != nullptr)
+            {
+                fmodStream->Release();
+            }
+        }
+
+        // Takes ownership of a freshly-decoded sample and locks its PCM so that read() can copy straight out of it.
+        HRESULT AcquireBuffer(IMFSample* sample)
+        {
+            ReleaseBuffer();
+
+            const size_t blockSize = pcmPool.GetBlockSize();
+            const HRESULT result = decodedSample.Hold(sample);
+            if (pcmPool.GetBlockSize() != blockSize)
+            {
+                PATCH_LOG(std::format("Decoded sample outgrew PCM block size of {} bytes.", blockSize));
+            }
+            return result;
+        }
+
+        void ReleaseBuffer()
+        {
+            decodedSample.Release();
+            currentBufferPos = 0;
+        }
+
+        // Pulls the next decoded sample from the reader into our buffer.  At the end of the stream, the buffer is left
+        // empty and endOfStream is set.  The buffer can also legitimately come back empty for things like stream ticks.
+        HRESULT DecodeNextSample(LONGLONG* sampleTimestamp, bool* endOfStream)
+        {
+            *endOfStream = false;
+
+            DWORD sampleReadFlags = 0;
+            IMFSample* sample = nullptr;
+            HRESULT result = ReadNextSample(&sampleReadFlags, sampleTimestamp, &sample);
+
+            if (FAILED(result))
+            {
+                PATCH_LOG(std::format("Failed to read sample: {}", result));
+                return result;
+            }
+
+            if (sampleReadFlags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED)
+            {
+                // The conversion, the channel mix, the resampler and every buffer along the way were sized for the
+                // format we had at open(), and FMOD can't be told about a new one.  A notification that changes
+                // nothing is fine; anything else is the end of the stream as far as we're concerned.
+                AudioFormat newFormat = {};
+                result = QueryAudioFormat(mfReader, &newFormat);
+                if (SUCCEEDED(result) && (newFormat.channels != format.channels || newFormat.sampleRate != format.sampleRate
+                    || newFormat.blockAlign != format.blockAlign || newFormat.sampleType != format.sampleType))
+                {
+                    PATCH_LOG(std::format("Decoder switched to {} channels at {} Hz mid-stream!", newFormat.channels, newFormat.sampleRate));
+                    result = MF_E_INVALIDMEDIATYPE;
+                }
+                if (FAILED(result))
+                {
+                    if (sample != nullptr)
+                    {
+                        sample->Release();
+                    }
+                    return result;
+                }
+            }
+
+            if (sampleReadFlags & MF_SOURCE_READERF_ENDOFSTREAM)
+            {
+                if (sample != nullptr)
+                {
+                    sample->Release();
+                }
+                *endOfStream = true;
+                return S_OK;
+            }
+
+            if (sample == nullptr)
+            {
+                return S_OK;
+            }
+
+            // We keep a reference to the sample itself, not just its buffer, for as long as we're reading from it.
+            // Decoders are allowed to hand out samples from a recycling pool, and a pooled sample only goes back
+            // into circulation once its last reference is released.  Dropping the sample while still holding onto
+            // its buffer is what used to blow up inside Media Foundation; holding both keeps the memory ours.
+            result = AcquireBuffer(sample);
+            if (FAILED(result))
+            {
+                PATCH_LOG(std::format("Failed to lock sample buffer: {}", result));
+                return result;
+            }
+
+            if (seekTarget >= 0)
+            {
+                DiscardUpToSeekTarget(sampleTimestamp);
+            }
+            return S_OK;
+        }
+
+        // Media Foundation seeks land on a packet boundary at or before where we asked, and for AAC and WMA that can
+        // be a good few thousand frames early.  Rather than play those, we skip past them in the decoded PCM, so
+        // playback picks up at exactly the frame that was asked for.  sampleTimestamp comes out as the time of the
+        // first frame that's actually left.
+        void DiscardUpToSeekTarget(LONGLONG* sampleTimestamp)
+        {
+            const LONGLONG earlyBy = seekTarget - *sampleTimestamp;
+            if (earlyBy <= 0)
+            {
+                // Landed on it, or (rarely) after it, in which case there's nothing we can do but carry on from here
+                seekTarget = -1;
+                return;
+            }
+
+            const UINT64 framesToDiscard = (static_cast<UINT64>(earlyBy) * format.sampleRate + 5000000) / 10000000;
+            const UINT32 bufferedFrames = GetBufferedFrames();
+            if (framesToDiscard >= bufferedFrames)
+            {
+                // All of this sample is before the target; keep going with the next one
+                stats.seekFramesDiscarded += bufferedFrames;
+                ReleaseBuffer();
+                return;
+            }
+
+            currentBufferPos += static_cast<unsigned int>(framesToDiscard) * format.blockAlign;
+            *sampleTimestamp = seekTarget;
+            stats.seekFramesDiscarded += framesToDiscard;
+            seekTarget = -1;
+        }
+
+        // Has the next samples decoded trimmed so that they start at exactly the given time.  Only to be called while
+        // nothing else is decoding, i.e. with the decode-ahead worker paused.
+        void SetSeekTarget(LONGLONG target)
+        {
+            seekTarget = target;
+        }
+
+        // Where to actually ask the reader to seek to, for playback to start at target.  Left to itself, the MPEG-4
+        // source has to work out which access unit that lands in from its own tables, and where it ends up varies.
+        // With the sample table in hand, we can point it right at the start of the access unit a little before the
+        // one holding the target, which gives the AAC decoder the one frame of pre-roll it needs for its overlap and
+        // leaves the rest to DiscardUpToSeekTarget().
+        //
+        // The ASF source is the same story, except that without an index object it has nothing to go on but the
+        // bitrate.  Landing on an indexed point at or before the target means it at least can't overshoot.
+        LONGLONG GetSeekLandingTime(LONGLONG target) const
+        {
+            uint64_t entryTime = 0;
+            uint64_t entryPacket = 0;
+            if (asfFileInfo != nullptr && asfFileInfo->FindIndexEntry(static_cast<UINT64>(target), &entryTime, &entryPacket))
+            {
+                return static_cast<LONGLONG>(entryTime);
+            }
+
+            if (mp4SampleTable == nullptr)
+            {
+                return target;
+            }
+
+            const UINT64 timescale = mp4SampleTable->GetTimescale();
+            uint32_t sample = mp4SampleTable->FindSampleAtTime(static_cast<UINT64>(target) * timescale / 10000000);
+            sample -= min(sample, mp4SeekPrerollSamples);
+
+            // Rounded up, so that it can't be mistaken for a time in the access unit before
+            return static_cast<LONGLONG>((mp4SampleTable->GetSampleTime(sample) * 10000000 + timescale - 1) / timescale);
+        }
+
+        // The stream's exact length, if we know it better than Media Foundation does.
+        bool GetExactDuration(LONGLONG* durationIn100ns) const
+        {
+            if (loopPoints.GetContentFrames() > 0)
+            {
+                *durationIn100ns = static_cast<LONGLONG>(loopPoints.GetContentFrames() * 10000000 / format.sampleRate);
+                return true;
+            }
+
+            if (asfFileInfo != nullptr)
+            {
+                *durationIn100ns = static_cast<LONGLONG>(asfFileInfo->GetDuration());
+                return true;
+            }
+
+            if (mp4SampleTable == nullptr)
+            {
+                return false;
+            }
+
+            *durationIn100ns = static_cast<LONGLONG>(mp4SampleTable->GetDuration() * 10000000 / mp4SampleTable->GetTimescale());
+            return true;
+        }
+
+        // WMA files that came without an index get one sampled from their packet headers, the first time they're
+        // seeked.  Done here rather than at open() since plenty of sounds never seek, and it's a read per index entry.
+        // Reads with FmodReadStream::ReadAt(), which leaves the position Media Foundation reads from alone.
+        void EnsureSeekIndex()
+        {
+            if (asfFileInfo == nullptr || asfFileInfo->HasIndex() || asfIndexAttempted)
+            {
+                return;
+            }
+
+            asfIndexAttempted = true;
+            if (asfFileInfo->BuildSampledIndex(*fmodStream))
+            {
+                PATCH_LOG(std::format("Built sampled ASF index from {} packets.", asfFileInfo->GetPacketCount()));
+            }
+            else
+            {
+                PATCH_LOG("Couldn't sample an ASF index; seeking will be left to Media Foundation.");
+            }
+        }
+
+        // Moves the reader so that the next frame played is the one at target.  Only to be called with the reader
+        // otherwise idle: from setPosition() with decode-ahead paused, or from the decode-ahead worker itself.
+        HRESULT SeekReader(LONGLONG target)
+        {
+            CancelPendingReads();
+            EnsureSeekIndex();
+
+            // Everything outside counts from the end of the encoder delay
+            target += timelineOffset;
+
+            PROPVARIANT positionVariant;
+            HRESULT result = InitPropVariantFromInt64(GetSeekLandingTime(target), &positionVariant);
+            if (SUCCEEDED(result))
+            {
+                result = mfReader->SetCurrentPosition(GUID_NULL, positionVariant);
+                PropVariantClear(&positionVariant);
+                stats.seeks++;
+            }
+
+            // Whatever's left of the sample we were draining belongs to the old position, and whatever comes next gets
+            // trimmed to start right where we were asked to go
+            ReleaseBuffer();
+            SetSeekTarget(SUCCEEDED(result) ? target : -1);
+
+            // An asynchronous reader can get going on the new position straight away, rather than waiting to be
+            // asked
+            if (SUCCEEDED(result) && sampleQueue != nullptr)
+            {
+                sampleQueue->Prime();
+            }
+            return result;
+        }
+
+        // Works out where the tags' gapless and loop information puts things in the output, once the output format
+        // is settled.  The encoder delay gets skipped the same way as a seek's overshoot, and every position FMOD
+        // sees counts from the end of it.  Has to happen before anything's decoded.
+        void ApplyLoopPoints()
+        {
+            const UINT64 decodedRate = format.sampleRate;
+            const UINT64 outputRate = outputFormat.sampleRate;
+
+            // The container's length is the only thing to check the tags against
+            UINT64 containerFrames = 0;
+            if (mp4SampleTable != nullptr)
+            {
+                containerFrames = LoopPoints::TimeToFrames(mp4SampleTable->GetDuration(), mp4SampleTable->GetTimescale(), decodedRate);
+            }
+            else if (asfFileInfo != nullptr)
+            {
+                containerFrames = LoopPoints::TimeToFrames(asfFileInfo->GetDuration(), 10000000, decodedRate);
+            }
+            loopPoints.FitToLength(containerFrames);
+
+            timelineOffset = static_cast<LONGLONG>(loopPoints.GetEncoderDelay() * 10000000 / decodedRate);
+            contentEndFrame = loopPoints.GetContentFrames() * outputRate / decodedRate;
+
+            uint64_t loopStart = 0;
+            uint64_t loopEnd = 0;
+            hasLoop = loopPoints.GetLoop(&loopStart, &loopEnd);
+            if (hasLoop)
+            {
+                loopStartFrame = loopStart * outputRate / decodedRate;
+                loopEndFrame = loopEnd * outputRate / decodedRate;
+            }
+
+            lastReadTimestamp = timelineOffset;
+            if (timelineOffset > 0)
+            {
+                SetSeekTarget(timelineOffset);
+            }
+        }
+
+        // Sets aside room for loopHeadMs of output from where FMOD will loop back to: the tagged loop start, or else
+        // the very start.  It fills in as it's played.  Not used when resampling, since the resampler would start
+        // back up from silence where the loop head ran out.
+        void StartLoopHead(unsigned int loopHeadMs)
+        {
+            if (resampler.IsActive())
+            {
+                return;
+            }
+
+            const size_t frames = static_cast<size_t>(outputFormat.bytesPerSec) * loopHeadMs / 1000 / outputFormat.blockAlign;
+            loopHead.Start(hasLoop ? loopStartFrame : 0, frames, outputFormat.blockAlign);
+        }
+
+        // Called with everything read() hands back, starting at firstFrame, so that the loop head fills up the first
+        // time playback goes through it.
+        void CaptureLoopHead(const BYTE* data, UINT64 firstFrame, size_t frames)
+        {
+            loopHead.Capture(data, firstFrame, frames);
+        }
+
+        // Copies up to maxFrames frames out of the loop head, if a seek has put us in it.  Returns how many frames
+        // that was.
+        UINT32 ReadLoopHead(BYTE* dest, UINT32 maxFrames)
+        {
+            return static_cast<UINT32>(loopHead.Read(dest, maxFrames));
+        }
+
+        // Works out what a seek to targetFrame means for the loop head.  Returns true, with the time the reader needs
+        // to pick up from, if the loop head is full and covers it, in which case read() will play from there until
+        // the loop head runs out.  Otherwise, the reader has to be moved to targetFrame as usual.
+        bool SeekIntoLoopHead(UINT64 targetFrame, LONGLONG* resumeTime)
+        {
+            uint64_t resumeFrame = 0;
+            if (!loopHead.SeekInto(targetFrame, &resumeFrame))
+            {
+                return false;
+            }
+
+            *resumeTime = static_cast<LONGLONG>(resumeFrame * 10000000 / outputFormat.sampleRate);
+            stats.loopHeadHits++;
+            return true;
+        }
+
+        // Gets the next sample straight from the reader, or out of the queue if the reader's running asynchronously.
+        // Either way, only blocks if there isn't one ready yet.
+        HRESULT ReadNextSample(DWORD* sampleReadFlags, LONGLONG* sampleTimestamp, IMFSample** sample)
+        {
+            if (sampleQueue == nullptr)
+            {
+                return mfReader->ReadSample((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, 0, nullptr, sampleReadFlags, sampleTimestamp, sample);
+            }
+
+            MfSampleQueue::Entry entry = {};
+            switch (sampleQueue->Pop(&entry))
+            {
+            case MfSampleQueue::Status::Ok:
+                {
+                    *sampleReadFlags = entry.flags;
+                    *sampleTimestamp = entry.timestamp;
+                    *sample = entry.sample;
+                    return S_OK;
+                }
+            case MfSampleQueue::Status::EndOfStream:
+                {
+                    *sampleReadFlags = MF_SOURCE_READERF_ENDOFSTREAM;
+                    *sample = nullptr;
+                    return S_OK;
+                }
+            default:
+                // The callback has already logged whatever went wrong
+                return E_FAIL;
+            }
+        }
+
+        // Sets up the queue for an asynchronous reader to feed, and returns the callback to create the reader with.
+        // Requests don't start until something actually wants a sample, so it doesn't matter that mfReader won't
+        // exist until after this.
+        SourceReaderCallback* CreateReaderCallback()
+        {
+            sampleQueue = std::make_shared<MfSampleQueue>(asyncQueueDepth,
+                [this] { return SUCCEEDED(mfReader->ReadSample((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, 0, nullptr, nullptr, nullptr, nullptr)); },
+                [this] { return SUCCEEDED(mfReader->Flush((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM)); },
+                [](IMFSample* sample) { sample->Release(); });
+            return new SourceReaderCallback(sampleQueue);
+        }
+
+        // An asynchronous reader has to be idle before it can be seeked.  Does nothing for a synchronous one.
+        void CancelPendingReads()
+        {
+            if (sampleQueue != nullptr)
+            {
+                sampleQueue->Flush();
+            }
+        }
+
+        bool IsDecodingAhead() const
+        {
+            return decodeRing != nullptr;
+        }
+
+        // Copies up to maxFrames frames out of the current sample into dest, converting them to the output format on
+        // the way if need be.  Returns how many frames that was.
+        UINT32 EmitFrames(BYTE* dest, UINT32 maxFrames)
+        {
+            if (channelMix.IsActive())
+            {
+                return EmitMixedFrames(reinterpret_cast<float*>(dest), maxFrames);
+            }
+
+            const UINT32 frames = min(maxFrames, GetBufferedFrames());
+            const BYTE* source = decodedSample.GetData() + currentBufferPos;
+
+            if (format.channels != outputFormat.channels)
+            {
+                std::memset(dest, 0, frames * outputFormat.blockAlign);
+            }
+            else if (format.sampleType == outputFormat.sampleType)
+            {
+                std::memcpy(dest, source, frames * format.blockAlign);
+            }
+            else if (!ConvertSamples(format.sampleType, source, outputFormat.sampleType, dest, static_cast<size_t>(frames) * format.channels))
+            {
+                // Not a conversion we know how to do; silence beats noise
+                std::memset(dest, 0, frames * outputFormat.blockAlign);
+            }
+
+            currentBufferPos += frames * format.blockAlign;
+            return frames;
+        }
+
+        // Whole frames left in the current sample.  Any partial frame at the end is discarded.
+        UINT32 GetBufferedFrames() const
+        {
+            return format.blockAlign > 0 ? static_cast<UINT32>((decodedSample.GetSize() - currentBufferPos) / format.blockAlign) : 0;
+        }
+
+        bool NeedsConversion() const
+        {
+            return format.sampleType != outputFormat.sampleType || channelMix.IsActive();
+        }
+
+        // Remixes the decoder's channels down to the output layout.  Anything that isn't float already gets converted
+        // into mixScratch first, a chunk at a time.
+        UINT32 EmitMixedFrames(float* dest, UINT32 maxFrames)
+        {
+            const UINT32 frames = min(min(maxFrames, GetBufferedFrames()), conversionChunkFrames);
+            const BYTE* source = decodedSample.GetData() + currentBufferPos;
+
+            if (format.channels != channelMix.inputChannels)
+            {
+                std::memset(dest, 0, frames * outputFormat.blockAlign);
+            }
+            else if (format.sampleType == SampleType::Float)
+            {
+                MixChannels(reinterpret_cast<const float*>(source), dest, frames, channelMix);
+            }
+            else if (ConvertSamples(format.sampleType, source, SampleType::Float, mixScratch.data(), static_cast<size_t>(frames) * format.channels))
+            {
+                MixChannels(mixScratch.data(), dest, frames, channelMix);
+            }
+            else
+            {
+                std::memset(dest, 0, frames * outputFormat.blockAlign);
+            }
+
+            currentBufferPos += frames * format.blockAlign;
+            return frames;
+        }
+
+        // Sets up remixing to the given layout, if the decoder's output calls for it.  Must happen before the output
+        // format is worked out.
+        void SetChannelLayout(ChannelLayout layout)
+        {
+            if (layout == ChannelLayout::Passthrough || !CanConvertToFloat(format.sampleType))
+            {
+                return;
+            }
+
+            channelMix = BuildChannelMatrix(format.channels, format.channelMask, layout);
+            if (channelMix.IsActive())
+            {
+                mixScratch.resize(static_cast<size_t>(conversionChunkFrames) * channelMix.inputChannels);
+            }
+        }
+
+        // Sets up resampling to the given rate, if it's one we can do and isn't what the decoder already gives us.
+        // Must happen after SetChannelLayout(), and is only any use if we're going to be decoding ahead, since that's
+        // the only place the resampler is run.
+        void SetResampleRate(UINT32 rate)
+        {
+            if (rate == 0 || rate == format.sampleRate || !CanConvertToFloat(format.sampleType))
+            {
+                return;
+            }
+
+            const UINT32 channels = channelMix.IsActive() ? channelMix.outputChannels : format.channels;
+            if (resampler.Configure(channels, format.sampleRate, rate))
+            {
+                resampleInput.resize(static_cast<size_t>(conversionChunkFrames) * channels);
+            }
+            else
+            {
+                PATCH_LOG(std::format("Can't resample {} Hz to {} Hz; leaving it to FMOD.", format.sampleRate, rate));
+            }
+        }
+
+        // Spins up a worker that keeps decodeAheadMs worth of PCM decoded ahead of read().  From then on, the worker
+        // owns the reader and the sample buffer; read() only ever touches the ring.
+        void StartDecodeAhead(unsigned int decodeAheadMs)
+        {
+            decodeRing = std::make_unique<PcmRing>(static_cast<size_t>(outputFormat.bytesPerSec) * decodeAheadMs / 1000);
+            decodeScratch.resize(static_cast<size_t>(conversionChunkFrames) * outputFormat.blockAlign);
+            decodeThread = std::thread(&MfObjects::DecodeAheadLoop, this);
+        }
+
+        void StopDecodeAhead()
+        {
+            if (decodeThread.joinable())
+            {
+                {
+                    std::lock_guard<std::mutex> lock(decodeControlLock);
+                    decodeStopRequested = true;
+                }
+                decodeControlSignal.notify_all();
+                decodeThread.join();
+            }
+        }
+
+        // Parks the worker so that the caller can safely use the reader, e.g. to seek.  Must be paired with
+        // ResumeDecodeAhead().  Does nothing if we aren't decoding ahead.  A seek left for the worker that it hasn't
+        // got round to yet is forgotten about.
+        void PauseDecodeAhead()
+        {
+            if (!IsDecodingAhead())
+            {
+                return;
+            }
+
+            std::unique_lock<std::mutex> lock(decodeControlLock);
+            decodePauseRequested = true;
+            decodeControlSignal.notify_all();
+            decodeControlSignal.wait(lock, [this] { return decodeParked; });
+            decodePendingSeek = -1;
+        }
+
+        // Like PauseDecodeAhead() followed by ResumeDecodeAhead(), except that the worker moves the reader to target
+        // itself before it carries on, so that the caller doesn't have to wait for it.
+        void SeekDecodeAhead(LONGLONG target)
+        {
+            PauseDecodeAhead();
+            {
+                std::lock_guard<std::mutex> lock(decodeControlLock);
+                decodePendingSeek = target;
+            }
+            ResumeDecodeAhead();
+        }
+
+        // Throws away everything that was decoded ahead and lets the worker carry on from wherever the reader is now.
+        void ResumeDecodeAhead()
+        {
+            if (!IsDecodingAhead())
+            {
+                return;
+            }
+
+            decodeRing->Reset();
+            decodeEndOfStream = false;
+            decodeResult = S_OK;
+
+            if (resampler.IsActive())
+            {
+                resampler.Reset();
+                resamplerFlushed = false;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(decodeControlLock);
+                decodePauseRequested = false;
+            }
+            decodeControlSignal.notify_all();
+        }
+
+        FmodReadStream* fmodStream;
+        IMFSourceResolver* mfResolver;
+
+        // The decoder, if it came from the pool rather than being loaded by the reader itself
+        IMFTransform* mfDecoder;
+        GUID mfDecoderSubtype;
+        IMFMediaSource* mfMedia;
+        IMFSourceReader* mfReader;
+
+        // What the pipeline gets built from.  When open() could tell what the decoder would make of the file from
+        // its header alone, it leaves building it to whichever of read() and setPosition() comes first, and
+        // pipelineDeferred is set until then.  If that goes wrong, pipelineResult says so from then on.
+        const WCHAR* mimeType;
+        bool wantFloat;
+        bool pipelineDeferred;
+        HRESULT pipelineResult;
+
+        // The sample currently being drained by read().  The pool has to outlive it.
+        PcmBlockPool<IMFMediaBuffer> pcmPool;
+        DecodedSample<IMFSample, IMFMediaBuffer> decodedSample;
+
+        // What the decoder is giving us, and what we're giving FMOD.  Both are fixed once the pipeline's built, so
+        // the decode-ahead worker and FMOD's thread can read them without a lock; DecodeNextSample() fails the stream
+        // rather than let the decoder change format under us.
+        AudioFormat format;
+        AudioFormat outputFormat;
+
+        // Only active when the decoder's channels are being remixed to a different layout
+        ChannelMatrix channelMix;
+        std::vector<float> mixScratch;
+
+        // Only active when decoding ahead with a resample rate set.  Belongs to the worker.
+        PolyphaseResampler resampler;
+        std::vector<float> resampleInput;
+        bool resamplerFlushed;
+
+        // Where the last seek was really meant to land, until the decoder has caught up with it; -1 otherwise.
+        // Belongs to whoever's decoding.
+        LONGLONG seekTarget;
+
+        // Only there when the reader was created in asynchronous mode
+        std::shared_ptr<MfSampleQueue> sampleQueue;
+
+        // The audio track's sample table, for M4A files where it could be parsed
+        std::unique_ptr<Mp4SampleTable> mp4SampleTable;
+
+        // The same for WMA files, with the index either from the file or sampled on the first seek
+        std::unique_ptr<AsfFileInfo> asfFileInfo;
+        bool asfIndexAttempted;
+        uint64_t fileSize;
+
+        LONGLONG lastReadTimestamp;
+        unsigned int currentBufferPos;
+
+        // Decode-ahead state.  Everything here other than the ring and the two flags is guarded by decodeControlLock.
+        std::unique_ptr<PcmRing> decodeRing;
+        std::vector<BYTE> decodeScratch;
+        std::thread decodeThread;
+        std::mutex decodeControlLock;
+        std::condition_variable decodeControlSignal;
+        bool decodeStopRequested;
+        bool decodePauseRequested;
+        bool decodeParked;
+        std::atomic<bool> decodeEndOfStream;
+        // Why the worker stopped, if it failed
+        std::atomic<HRESULT> decodeResult;
+
+        // A seek for the worker to do before it next decodes anything, or -1
+        LONGLONG decodePendingSeek;
+
+        // The first stretch of output, while it's filling and after.  Belongs to whoever's calling read() and
+        // setPosition().
+        LoopHead loopHead;
+
+        // Gapless and loop information from the tags.  timelineOffset is the encoder delay, which the decoder's
+        // timestamps include but nothing FMOD sees does.  The rest is in output frames; contentEndFrame is 0 if the
+        // length isn't known.  playbackFrame is where read() is up to.  All of it belongs to whoever's calling
+        // read() and setPosition().
+        LoopPoints loopPoints;
+        LONGLONG timelineOffset;
+        UINT64 contentEndFrame;
+        bool hasLoop;
+        UINT64 loopStartFrame;
+        UINT64 loopEndFrame;
+        UINT64 playbackFrame;
+
+        // For timing how long it takes from open() to the first samples handed to FMOD.  Belongs to read().
+        std::chrono::steady_clock::time_point openTime;
+        bool firstSamplesTimed;
+
+        void NoteSamplesRead(unsigned int samplesRead)
+        {
+            if (!firstSamplesTimed && samplesRead > 0)
+            {
+                firstSamplesTimed = true;
+                stats.firstSamples++;
+                stats.openToFirstSampleNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - openTime).count();
+            }
+        }
+
+    private:
+        // How long the worker naps when the ring is full or there's nothing left to decode
+        static constexpr std::chrono::milliseconds decodeAheadIdleInterval{5};
+
+        // How many samples an asynchronous reader is allowed to get ahead by
+        static constexpr size_t asyncQueueDepth = 4;
+
+        // Access units to back up by when seeking an M4A: one for the decoder's overlap, plus one for any encoder
+        // delay the source has shifted the timestamps by
+        static constexpr uint32_t mp4SeekPrerollSamples = 2;
+
+        // Conversion and remixing that needs an intermediate buffer is done in chunks of at most this many frames
+        static constexpr UINT32 conversionChunkFrames = 4096;
+
+        void DecodeAheadLoop()
+        {
+            // MF objects are free-threaded, but COM still has to be initialized on any thread that uses them
+            HRESULT comResult = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+            std::unique_lock<std::mutex> lock(decodeControlLock);
+            while (!decodeStopRequested)
+            {
+                if (decodePauseRequested)
+                {
+                    decodeParked = true;
+                    decodeControlSignal.notify_all();
+                    decodeControlSignal.wait(lock, [this] { return decodeStopRequested || !decodePauseRequested; });
+                    decodeParked = false;
+                    continue;
+                }
+
+                if (decodePendingSeek >= 0)
+                {
+                    const LONGLONG target = decodePendingSeek;
+                    decodePendingSeek = -1;
+
+                    lock.unlock();
+                    const HRESULT seekResult = SeekReader(target);
+                    if (FAILED(seekResult))
+                    {
+                        PATCH_LOG("Decode-ahead seek failed.");
+                        decodeResult = seekResult;
+                    }
+                    lock.lock();
+                    continue;
+                }
+
+                lock.unlock();
+                const bool madeProgress = DecodeAheadStep();
+                lock.lock();
+
+                if (!madeProgress)
+                {
+                    // Give read() a chance to catch up, but wake up straight away if somebody needs us
+                    decodeControlSignal.wait_for(lock, decodeAheadIdleInterval, [this] { return decodeStopRequested || decodePauseRequested; });
+                }
+            }
+            lock.unlock();
+
+            if (SUCCEEDED(comResult))
+            {
+                CoUninitialize();
+            }
+        }
+
+        // Does one unit of work for the decode-ahead worker.  Returns false if there was nothing useful to do.
+        bool DecodeAheadStep()
+        {
+            if (decodeEndOfStream || FAILED(decodeResult))
+            {
+                return false;
+            }
+
+            if (resampler.IsActive())
+            {
+                return ResampleAheadStep();
+            }
+
+            if (decodedSample.IsEmpty())
+            {
+                bool endOfStream = false;
+                if (!FetchDecodeAheadSample(&endOfStream))
+                {
+                    return false;
+                }
+                if (endOfStream)
+                {
+                    decodeEndOfStream = true;
+                    return false;
+                }
+                return true;
+            }
+
+            // Straight from the decoder's buffer only if its frames are exactly the ring's; whole frames only, so
+            // that read() never finds half of one at the front of the ring
+            size_t bytesWritten = 0;
+            if (!NeedsConversion() && format.blockAlign == outputFormat.blockAlign)
+            {
+                const size_t frameBytes = min(static_cast<size_t>(GetBufferedFrames()) * format.blockAlign, decodeRing->GetWritableBytes());
+                bytesWritten = decodeRing->Write(decodedSample.GetData() + currentBufferPos, frameBytes - frameBytes % format.blockAlign);
+                currentBufferPos += static_cast<unsigned int>(bytesWritten);
+            }
+            else
+            {
+                const UINT32 writableFrames = static_cast<UINT32>(decodeRing->GetWritableBytes() / outputFormat.blockAlign);
+                const UINT32 frames = EmitFrames(decodeScratch.data(), min(writableFrames, conversionChunkFrames));
+                bytesWritten = decodeRing->Write(decodeScratch.data(), static_cast<size_t>(frames) * outputFormat.blockAlign);
+            }
+
+            if (GetBufferedFrames() == 0)
+            {
+                ReleaseBuffer();
+                return true;
+            }
+            return bytesWritten > 0;
+        }
+
+        // DecodeAheadStep() for when we're resampling.  Output is drained from the resampler into the ring, and only
+        // once it's run dry does it get fed another chunk of decoded (and possibly converted and remixed) input.
+        bool ResampleAheadStep()
+        {
+            const size_t writableFrames = decodeRing->GetWritableBytes() / outputFormat.blockAlign;
+            const size_t producedFrames = resampler.Pull(reinterpret_cast<float*>(decodeScratch.data()), min(writableFrames, static_cast<size_t>(conversionChunkFrames)));
+            if (producedFrames > 0)
+            {
+                decodeRing->Write(decodeScratch.data(), producedFrames * outputFormat.blockAlign);
+                return true;
+            }
+            if (writableFrames == 0)
+            {
+                return false;
+            }
+
+            if (resamplerFlushed)
+            {
+                // Everything's made it out the other end
+                decodeEndOfStream = true;
+                return false;
+            }
+
+            if (decodedSample.IsEmpty())
+            {
+                bool endOfStream = false;
+                if (!FetchDecodeAheadSample(&endOfStream))
+                {
+                    return false;
+                }
+                if (endOfStream)
+                {
+                    resampler.Flush();
+                    resamplerFlushed = true;
+                }
+                return true;
+            }
+
+            const UINT32 frames = EmitFrames(reinterpret_cast<BYTE*>(resampleInput.data()), conversionChunkFrames);
+            resampler.Push(resampleInput.data(), frames);
+            if (GetBufferedFrames() == 0)
+            {
+                ReleaseBuffer();
+            }
+            return true;
+        }
+
+        // Gets the worker its next sample from the reader.  Returns false (and flags the failure for read()) if that
+        // goes wrong.
+        bool FetchDecodeAheadSample(bool* endOfStream)
+        {
+            // The worker runs ahead of read(), so the sample timestamps are of no use to anybody; read() keeps track
+            // of where playback actually is.
+            LONGLONG sampleTimestamp = 0;
+            const HRESULT result = DecodeNextSample(&sampleTimestamp, endOfStream);
+            if (FAILED(result))
+            {
+                decodeResult = result;
+                return false;
+            }
+            if (*endOfStream)
+            {
+                PATCH_LOG("Decode-ahead reached end of stream.");
+            }
+            return true;
+        }
+    };
+
+    // In asynchronous mode, the reader decodes on Media Foundation's own threads, and ReadSample() just returns
+    // whatever it already has queued up.  Falls back to a plain synchronous reader if the attributes can't be set up.
+    HRESULT CreateSourceReader(MfObjects* mfObjects, bool async)
+    {
+        IMFAttributes* readerAttributes = nullptr;
+        if (async)
+        {
+            HRESULT result = MFCreateAttributes(&readerAttributes, 1);
+            if (SUCCEEDED(result))
+            {
+                SourceReaderCallback* callback = mfObjects->CreateReaderCallback();
+                result = readerAttributes->SetUnknown(MF_SOURCE_READER_ASYNC_CALLBACK, callback);
+                callback->Release();
+            }
+
+            if (FAILED(result))
+            {
+                PATCH_LOG(std::format("Couldn't set up asynchronous reader: {}", result));
+                mfObjects->sampleQueue.reset();
+                if (readerAttributes != nullptr)
+                {
+                    readerAttributes->Release();
+                    readerAttributes = nullptr;
+                }
+            }
+        }
+
+        HRESULT result = MFCreateSourceReaderFromMediaSource(mfObjects->mfMedia, readerAttributes, &(mfObjects->mfReader));
+
+        if (readerAttributes != nullptr)
+        {
+            readerAttributes->Release();
+        }
+        return result;
+    }
+
+    // outputSubtype should be MFAudioFormat_PCM or MFAudioFormat_Float.
+    HRESULT ConfigureAudioStream(IMFSourceReader* reader, REFGUID outputSubtype)
+    {
+        IMFMediaType* partialAudioType = nullptr;
+
+        HRESULT result = reader->SetStreamSelection((DWORD)MF_SOURCE_READER_ALL_STREAMS, FALSE);
+        if (SUCCEEDED(result))
+        {
+            result = reader->SetStreamSelection((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, TRUE);
+        }
+
+        if (SUCCEEDED(result))
+        {
+            result = MFCreateMediaType(&partialAudioType);
+        }
+
+        if (SUCCEEDED(result))
+        {
+            result = partialAudioType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio);
+        }
+
+        if (SUCCEEDED(result))
+        {
+            result = partialAudioType->SetGUID(MF_MT_SUBTYPE, outputSubtype);
+        }
+
+        if (SUCCEEDED(result))
+        {
+            // setting partial type on the reader will load the correct decoder
+            result = reader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, nullptr, partialAudioType);
+        }
+
+        if (FAILED(result))
+        {
+            PATCH_LOG(std::format("Failed to configure audio stream: {}", result));
+        }
+
+        if (partialAudioType != nullptr)
+        {
+            partialAudioType->Release();
+        }
+
+        return result;
+    }
+
+    // Finds the decoder an output type with the given subtype, and sets it.
+    HRESULT SetDecoderOutputType(IMFTransform* decoder, REFGUID outputSubtype)
+    {
+        for (DWORD typeIndex = 0; ; ++typeIndex)
+        {
+            IMFMediaType* outputType = nullptr;
+            HRESULT result = decoder->GetOutputAvailableType(0, typeIndex, &outputType);
+            if (FAILED(result))
+            {
+                // Including MF_E_NO_MORE_TYPES, if it just doesn't do this subtype
+                return result;
+            }
+
+            GUID subtype = GUID_NULL;
+            if (SUCCEEDED(outputType->GetGUID(MF_MT_SUBTYPE, &subtype)) && subtype == outputSubtype)
+            {
+                result = decoder->SetOutputType(0, outputType, 0);
+                outputType->Release();
+                return result;
+            }
+            outputType->Release();
+        }
+    }
+
+    // ConfigureAudioStream(), but with a decoder of our choosing rather than whichever one the reader would load.
+    // The stream is left compressed, and the decoder added on the end with its types already set, so the reader has
+    // nothing left to negotiate.
+    HRESULT ConfigureAudioStreamWithDecoder(IMFSourceReader* reader, IMFTransform* decoder, REFGUID outputSubtype)
+    {
+        IMFSourceReaderEx* readerEx = nullptr;
+        IMFMediaType* nativeType = nullptr;
+
+        HRESULT result = reader->QueryInterface(IID_PPV_ARGS(&readerEx));
+        if (SUCCEEDED(result))
+        {
+            result = reader->SetStreamSelection((DWORD)MF_SOURCE_READER_ALL_STREAMS, FALSE);
+        }
+        if (SUCCEEDED(result))
+        {
+            result = reader->SetStreamSelection((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, TRUE);
+        }
+        if (SUCCEEDED(result))
+        {
+            result = reader->GetNativeMediaType((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, 0, &nativeType);
+        }
+        if (SUCCEEDED(result))
+        {
+            result = reader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, nullptr, nativeType);
+        }
+        if (SUCCEEDED(result))
+        {
+            result = decoder->SetInputType(0, nativeType, 0);
+        }
+        if (SUCCEEDED(result))
+        {
+            result = SetDecoderOutputType(decoder, outputSubtype);
+        }
+        if (SUCCEEDED(result))
+        {
+            result = readerEx->AddTransformForStream((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, decoder);
+        }
+
+        if (FAILED(result) && readerEx != nullptr)
+        {
+            readerEx->RemoveAllTransformsForStream((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM);
+        }
+
+        if (nativeType != nullptr)
+        {
+            nativeType->Release();
+        }
+        if (readerEx != nullptr)
+        {
+            readerEx->Release();
+        }
+        return result;
+    }
+
+    // Borrows a decoder for the stream's format from the pool and sets the stream up with it, asking for float if
+    // wantFloat and falling back to PCM.  On success, the decoder goes back to the pool when mfObjects is destroyed.
+    HRESULT ConfigureAudioStreamFromPool(MfObjects* mfObjects, bool wantFloat)
+    {
+        IMFMediaType* nativeType = nullptr;
+        GUID inputSubtype = GUID_NULL;
+        HRESULT result = mfObjects->mfReader->GetNativeMediaType((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, 0, &nativeType);
+        if (SUCCEEDED(result))
+        {
+            result = nativeType->GetGUID(MF_MT_SUBTYPE, &inputSubtype);
+            nativeType->Release();
+        }
+
+        IMFTransform* decoder = nullptr;
+        if (SUCCEEDED(result))
+        {
+            result = objectCache.BorrowDecoder(inputSubtype, &decoder);
+        }
+
+        if (SUCCEEDED(result))
+        {
+            result = wantFloat ? ConfigureAudioStreamWithDecoder(mfObjects->mfReader, decoder, MFAudioFormat_Float) : E_FAIL;
+            if (FAILED(result))
+            {
+                result = ConfigureAudioStreamWithDecoder(mfObjects->mfReader, decoder, MFAudioFormat_PCM);
+            }
+
+            if (SUCCEEDED(result))
+            {
+                mfObjects->mfDecoder = decoder;
+                mfObjects->mfDecoderSubtype = inputSubtype;
+            }
+            else
+            {
+                // No telling what state it's been left in, so it doesn't go back in the pool
+                decoder->Release();
+            }
+        }
+
+        return result;
+    }
+
+    // Works out how big a single decoded sample is likely to be, so that the PCM pool can be sized up front.
+    DWORD EstimateDecodedBlockSize(IMFSourceReader* reader, const AudioFormat& format)
+    {
+        // AAC frames decode to 1024 samples (2048 with SBR); WMA packets vary, but rarely go past 4096.
+        static const UINT32 defaultFramesPerBlock = 4096;
+
+        UINT32 framesPerBlock = 0;
+        IMFMediaType* nativeType = nullptr;
+        if (SUCCEEDED(reader->GetNativeMediaType((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, 0, &nativeType)))
+        {
+            framesPerBlock = MFGetAttributeUINT32(nativeType, MF_MT_AUDIO_SAMPLES_PER_BLOCK, 0);
+            nativeType->Release();
+        }
+
+        return max(framesPerBlock, defaultFramesPerBlock) * format.blockAlign;
+    }
+
+    /*
+    void FillOutMetadata(FMOD_CODEC_STATE* codec, MfObjects* mfObjects)
+    {
+        void* voidSource = nullptr;
+        void* voidStore = nullptr;
+        void* voidMetadata = nullptr;
+
+        IMFMediaSource* mediaSource = nullptr;
+        IPropertyStore* propertyStore = nullptr;
+
+        HRESULT winLibResult = mfObjects->mfReader->GetServiceForStream(MF_SOURCE_READER_FIRST_AUDIO_STREAM, MF_MEDIASOURCE_SERVICE, IID_IMFMediaSource, &voidSource);
+        if (SUCCEEDED(winLibResult))
+        {
+            mediaSource = static_cast<IMFMediaSource*>(voidSource);
+            winLibResult = MFGetService(mediaSource, MF_PROPERTY_HANDLER_SERVICE, IID_IPropertyStore, &voidStore);
+        }
+
+        DWORD metadataPropCount = 0;
+        if (SUCCEEDED(winLibResult))
+        {
+            propertyStore = static_cast<IPropertyStore*>(voidStore);
+
+            winLibResult = propertyStore->GetCount(&metadataPropCount);
+        }
+
+        if (SUCCEEDED(winLibResult))
         {
             for (DWORD i = 0; i < metadataPropCount; i++)
             {
-                PROPERTYKEY key;
-                winLibResult = propertyStore->GetAt(i, &key);
-                if (FAILED(winLibResult))
+                PROPERTYKEY key;
+                winLibResult = propertyStore->GetAt(i, &key);
+                if (FAILED(winLibResult))
+                {
+                    break;
+                }
+
+                PROPVARIANT valueVariant;
+                winLibResult = propertyStore->GetValue(key, &valueVariant);
+                if (FAILED(winLibResult))
+                {
+                    break;
+                }
+
+                const char* metadatumName = nullptr;
+                void* metadatum = nullptr;
+                unsigned int metadatumLength = 0;
+                FMOD_TAGDATATYPE metadatumType = FMOD_TAGDATATYPE_MAX;
+
+                if (key == PKEY_Title)
+                {
+                    metadatumName = "Title";
+                    PropVariantToStringAlloc(valueVariant, reinterpret_cast<PWSTR*>(&metadatum));
+                    metadatumType = FMOD_TAGDATATYPE_STRING_UTF16;
+                }
+                else if (key == PKEY_Music_Artist)
+                {
+
+                }
+
+                char* nonConstName = nullptr;
+                if (metadatumName != nullptr)
+                {
+                    // metadata() wants a non-const for the name, and allocation in each case is fluff.
+                    const size_t nameLen = sizeof(metadatumName);
+                    nonConstName = new char[nameLen];
+                    std::memcpy(nonConstName, metadatumName, nameLen);
+                }
+
+                codec->metadata(codec, FMOD_TAGTYPE_USER, nonConstName, metadatum, metadatumLength, metadatumType, 1);
+
+                PropVariantClear(&valueVariant);
+            }
+        }
+
+        if (mediaSource != nullptr)
+        {
+            mediaSource->Release();
+        }
+        if (propertyStore != nullptr)
+        {
+            propertyStore->Release();
+        }
+    }
+    */
+
+    // Works out what kind of file this is from its first few bytes.  FMOD offers every file to every codec, so this
+    // runs for every file nothing ahead of us claimed, and has to say no to them cheaply: one read, no seeks, nothing
+    // on the heap.  FMOD rewinds the file before offering it to each codec, so it only needs putting back if we're
+    // keeping it.  Returns nullptr if it's nothing we know.
+    const WCHAR* FindMimeType(FMOD_CODEC_STATE* codec)
+    {
+        constexpr size_t probeSize = SignatureProbeSize();
+        const auto probeStart = std::chrono::steady_clock::now();
+
+        uint8_t probe[probeSize];
+        unsigned int bytesRead = 0;
+        FMOD_RESULT readResult = codec->fileread(codec->filehandle, probe, probeSize, &bytesRead, nullptr);
+
+        const WCHAR* mimeType = nullptr;
+        if (readResult == FMOD_OK || readResult == FMOD_ERR_FILE_EOF)
+        {
+            mimeType = MatchSignature(probe, bytesRead);
+        }
+
+        stats.probes++;
+        stats.probeNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - probeStart).count();
+
+        if (mimeType != nullptr)
+        {
+            // put the file back
+            codec->fileseek(codec->filehandle, 0, nullptr);
+            return mimeType;
+        }
+
+        stats.probeRejects++;
+        if (readResult != FMOD_OK && readResult != FMOD_ERR_FILE_EOF)
+        {
+            PATCH_LOG("Could not read from audio file!");
+            return nullptr;
+        }
+
+#if _DEBUG
+        std::stringstream signatureInHex;
+        for (unsigned int i = 0; i < bytesRead; i++)
+        {
+            signatureInHex << std::format("{:02x}", probe[i]);
+        }
+        PATCH_LOG(std::format("Could not find signature to match {}", signatureInHex.str()));
+#endif
+        return nullptr;
+    }
+
+    // A made-up file name for the source resolver to choose a byte stream handler by.  FmodReadStream has no
+    // attributes to carry MF_BYTESTREAM_CONTENT_TYPE, so the extension is what tells the resolver the format.
+    const WCHAR* GetResolverUrl(const WCHAR* mimeType)
+    {
+        if (std::wcscmp(mimeType, L"audio/x-ms-wma") == 0)
+        {
+            return L"fmod.wma";
+        }
+        else if (std::wcscmp(mimeType, L"audio/3gpp2") == 0)
+        {
+            return L"fmod.3g2";
+        }
+        else if (std::wcscmp(mimeType, L"audio/3gpp") == 0)
+        {
+            return L"fmod.3gp";
+        }
+        else if (std::wcscmp(mimeType, L"audio/aac") == 0)
+        {
+            return L"fmod.aac";
+        }
+        else
+        {
+            return L"fmod.m4a";
+        }
+    }
+
+    // Everything between having the file and being able to decode it: the media source on top of our byte stream,
+    // and a source reader with its audio stream set up and its format read into mfObjects->format.
+    HRESULT BuildPipeline(MfObjects* mfObjects)
+    {
+        HRESULT winLibResult = objectCache.GetResolver(&(mfObjects->mfResolver));
+
+        if (SUCCEEDED(winLibResult))
+        {
+            PATCH_LOG("Source resolver ready.");
+
+            MF_OBJECT_TYPE objType;
+            IUnknown* unknownMedia;
+            winLibResult = mfObjects->mfResolver->CreateObjectFromByteStream(mfObjects->fmodStream, GetResolverUrl(mfObjects->mimeType), MF_RESOLUTION_MEDIASOURCE | MF_RESOLUTION_READ, nullptr, &objType, &unknownMedia);
+
+            if (SUCCEEDED(winLibResult))
+            {
+                winLibResult = unknownMedia->QueryInterface(IID_PPV_ARGS(&(mfObjects->mfMedia)));
+
+                unknownMedia->Release();
+            }
+        }
+
+        if (SUCCEEDED(winLibResult))
+        {
+            PATCH_LOG("Media source prepared.");
+
+            winLibResult = CreateSourceReader(mfObjects, settings.asyncReader);
+        }
+
+        if (SUCCEEDED(winLibResult))
+        {
+            PATCH_LOG("Source reader created.");
+
+            bool configured = false;
+            if (settings.decoderPoolSize > 0)
+            {
+                configured = SUCCEEDED(ConfigureAudioStreamFromPool(mfObjects, mfObjects->wantFloat));
+                if (!configured)
                 {
-                    break;
+                    PATCH_LOG("Couldn't use a pooled decoder; letting the reader load its own.");
                 }
+            }
 
-                PROPVARIANT valueVariant;
-                winLibResult = propertyStore->GetValue(key, &valueVariant);
+            if (!configured && mfObjects->wantFloat)
+            {
+                winLibResult = ConfigureAudioStream(mfObjects->mfReader, MFAudioFormat_Float);
                 if (FAILED(winLibResult))
                 {
-                    break;
+                    PATCH_LOG("Decoder can't do float output; falling back to PCM.");
                 }
+            }
 
-                const char* metadatumName = nullptr;
-                void* metadatum = nullptr;
-                unsigned int metadatumLength = 0;
-                FMOD_TAGDATATYPE metadatumType = FMOD_TAGDATATYPE_MAX;
-
-                if (key == PKEY_Title)
-                {
-                    metadatumName = "Title";
-                    PropVariantToStringAlloc(valueVariant, reinterpret_cast<PWSTR*>(&metadatum));
-                    metadatumType = FMOD_TAGDATATYPE_STRING_UTF16;
-                }
-                else if (key == PKEY_Music_Artist)
-                {
+            if (!configured && (!mfObjects->wantFloat || FAILED(winLibResult)))
+            {
+                winLibResult = ConfigureAudioStream(mfObjects->mfReader, MFAudioFormat_PCM);
+            }
+        }
 
-                }
+        if (SUCCEEDED(winLibResult))
+        {
+            PATCH_LOG("Audio stream configured.");
 
-                char* nonConstName = nullptr;
-                if (metadatumName != nullptr)
-                {
-                    // metadata() wants a non-const for the name, and allocation in each case is fluff.
-                    const size_t nameLen = sizeof(metadatumName);
-                    nonConstName = new char[nameLen];
-                    std::memcpy(nonConstName, metadatumName, nameLen);
-                }
+            winLibResult = QueryAudioFormat(mfObjects->mfReader, &(mfObjects->format));
+        }
 
-                codec->metadata(codec, FMOD_TAGTYPE_USER, nonConstName, metadatum, metadatumLength, metadatumType, 1);
+        return winLibResult;
+    }
 
-                PropVariantClear(&valueVariant);
+    // What the decoder is going to hand us, worked out from the container header, for the files where that can be
+    // done with confidence: plain AAC-LC, or WMA 1 or 2, in mono or stereo.  AAC at 24 kHz and under might have SBR
+    // hiding in it, which would double the rate and maybe the channels too, so that's left to the decoder to say.
+    // Also needs an exact duration, since getLength() has nothing else to go on until the pipeline's built.
+    bool PredictDecodedFormat(const MfObjects* mfObjects, AudioFormat* outFormat)
+    {
+        UINT32 channels = 0;
+        UINT32 sampleRate = 0;
+        UINT32 bitsPerSample = 16;
+
+        uint32_t objectType = 0;
+        uint32_t channelConfig = 0;
+        uint32_t coreRate = 0;
+        uint16_t formatTag = 0;
+        uint16_t asfChannels = 0;
+        uint32_t asfRate = 0;
+        uint16_t asfBits = 0;
+        if (mfObjects->mp4SampleTable != nullptr && mfObjects->mp4SampleTable->GetAacConfig(&objectType, &channelConfig, &coreRate))
+        {
+            if (objectType != 2 || coreRate <= 24000)
+            {
+                return false;
+            }
+            channels = channelConfig;
+            sampleRate = coreRate;
+        }
+        else if (mfObjects->asfFileInfo != nullptr && mfObjects->asfFileInfo->GetAudioFormat(&formatTag, &asfChannels, &asfRate, &asfBits))
+        {
+            if ((formatTag != MFAudioFormat_MSAudio1.Data1 && formatTag != MFAudioFormat_WMAudioV8.Data1) || asfBits != 16)
+            {
+                return false;
             }
+            channels = asfChannels;
+            sampleRate = asfRate;
         }
 
-        if (mediaSource != nullptr)
+        if ((channels != 1 && channels != 2) || sampleRate == 0)
         {
-            mediaSource->Release();
+            return false;
         }
-        if (propertyStore != nullptr)
+
+        // Asking for float gets float out of both decoders
+        const SampleType sampleType = mfObjects->wantFloat ? SampleType::Float : SampleType::S16;
+        if (mfObjects->wantFloat)
         {
-            propertyStore->Release();
+            bitsPerSample = 32;
         }
+
+        AudioFormat predicted = {};
+        predicted.channels = channels;
+        predicted.bitsPerSample = bitsPerSample;
+        predicted.sampleRate = sampleRate;
+        predicted.blockAlign = channels * bitsPerSample / 8;
+        predicted.bytesPerSec = predicted.blockAlign * sampleRate;
+        predicted.channelMask = (channels == 1) ? SPEAKER_FRONT_CENTER : (SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT);
+        predicted.sampleType = sampleType;
+        *outFormat = predicted;
+        return true;
     }
-    */
 
-    bool FindMimeType(FMOD_CODEC_STATE* codec, WCHAR* outMime, size_t mimeMaxLength)
+    // Builds the pipeline open() put off, and makes sure the decoder agrees with what FMOD was told.
+    HRESULT FinishDeferredOpen(MfObjects* mfObjects)
     {
-        // Endianness means that I have to write these out individually rather than packaging them into larger ints
-        static const uint8_t m4aSig[] = {0x00, 0x00, 0x00, 0x20, 0x66, 0x74, 0x79, 0x70, 0x4d, 0x34, 0x41, 0x20};
-        static const WCHAR m4aMime[] = L"audio/mp4";
-        static const uint8_t wmaSig[] = {0x30, 0x26, 0xb2, 0x75, 0x8e, 0x66, 0xcf, 0x11, 0xa6, 0xd9, 0x00, 0xaa, 0x00, 0x62, 0xce, 0x6c};
-        static const WCHAR wmaMime[] = L"audio/x-ms-wma";
-
-        assert(sizeof(m4aMime) <= mimeMaxLength);
-        assert(sizeof(wmaMime) <= mimeMaxLength);
-
-        bool success = false;
+        if (!mfObjects->pipelineDeferred)
+        {
+            return mfObjects->pipelineResult;
+        }
 
-        uint8_t* signatureBuffer = new uint8_t[32];
-        unsigned int bytesRead = 0;
-        FMOD_RESULT readResult = codec->fileread(codec->filehandle, signatureBuffer, 32, &bytesRead, nullptr);
+        mfObjects->pipelineDeferred = false;
+        stats.deferredPipelinesBuilt++;
 
-        if (readResult == FMOD_OK)
+        HRESULT result = BuildPipeline(mfObjects);
+        if (SUCCEEDED(result))
         {
-            if (std::memcmp(signatureBuffer, m4aSig, sizeof(m4aSig)) == 0 || std::memcmp(signatureBuffer + 4, m4aSig + 4, sizeof(m4aSig) - sizeof(UINT32)) == 0)
-            {
-                // It's an M4A!
-                // M4A files can have slightly different signatures.
-                std::memcpy(outMime, m4aMime, sizeof(m4aMime));
-                success = true;
-            }
-            else if (std::memcmp(signatureBuffer, wmaSig, sizeof(wmaSig)) == 0)
+            const AudioFormat actualOutput = MakeOutputFormat(mfObjects->format, mfObjects->wantFloat, mfObjects->channelMix, mfObjects->resampler);
+            if (actualOutput.channels != mfObjects->outputFormat.channels || actualOutput.sampleRate != mfObjects->outputFormat.sampleRate
+                || actualOutput.sampleType != mfObjects->outputFormat.sampleType)
             {
-                // It's a WMA!
-                std::memcpy(outMime, wmaMime, sizeof(wmaMime));
-                success = true;
+                PATCH_LOG(std::format("Decoder gave {} channels at {} Hz, not what the header said!", mfObjects->format.channels, mfObjects->format.sampleRate));
+                result = MF_E_INVALIDMEDIATYPE;
             }
-#if _DEBUG
-            else
-            {
-                std::stringstream signatureInHex;
-                for (unsigned int i = 0; i < 32; i++)
-                {
-                    signatureInHex << std::format("{:02x}", signatureBuffer[i]);
-                }
-                PATCH_LOG(std::format("Could not find signature to match {}", signatureInHex.str()));
-            }
-#endif
         }
-        else
+
+        if (SUCCEEDED(result))
         {
-            PATCH_LOG("Could not read from audio file!");
+            mfObjects->pcmPool.SetBlockSize(EstimateDecodedBlockSize(mfObjects->mfReader, mfObjects->format));
         }
 
-        // put the file back
-        codec->fileseek(codec->filehandle, 0, nullptr);
-        return success;
+        mfObjects->pipelineResult = result;
+        return result;
     }
 
     FMOD_RESULT F_CALLBACK open(FMOD_CODEC_STATE* codec, FMOD_MODE userMode, FMOD_CREATESOUNDEXINFO* userExInfo)
     {
-        // Make sure, for sanity's sake, that we're starting at the beginning of the file.
-        codec->fileseek(codec->filehandle, 0, nullptr);
-
-        WCHAR* mimeType = new WCHAR[16];
-        if (!FindMimeType(codec, mimeType, sizeof(WCHAR[16])))
+        const WCHAR* mimeType = FindMimeType(codec);
+        if (mimeType == nullptr)
         {
             PATCH_LOG("No matching MIME.");
-            delete[] mimeType;
             return FMOD_ERR_FORMAT;
         }
 
 #if _DEBUG
-        char* mimeTypeChar = new char[32];
-        WideCharToMultiByte(CP_UTF8, 0, mimeType, 16, mimeTypeChar, 32, nullptr, nullptr);
+        char mimeTypeChar[32] = {};
+        WideCharToMultiByte(CP_UTF8, 0, mimeType, -1, mimeTypeChar, sizeof(mimeTypeChar), nullptr, nullptr);
         PATCH_LOG(std::format("MIME found: {}", mimeTypeChar));
 #endif
 
         codec->waveformatversion = FMOD_CODEC_WAVEFORMAT_VERSION;
 
-        MfObjects* mfObjects = new MfObjects();
-
-        mfObjects->fmodStream = new FmodReadStream(codec);
-
-        FMOD_RESULT returnResult = FMOD_OK;
+        // The AAC and WMA decoders both work in float internally.  If FMOD is going to be mixing in float anyway,
+        // asking for float output saves converting down to int16 and straight back up again.  If the decoder won't do
+        // float, we convert its output ourselves.
+        // Remixing is done in float too, so we may as well have the decoder hand us float whenever that's turned on.
+        // Resampling only happens on the decode-ahead worker, so it's off if that is.
+        const ChannelLayout channelLayout = ChannelLayoutForSpeakerMode(settings.channelLayout);
+        const unsigned int decodeAheadMs = settings.decodeAheadMs;
+        const unsigned int loopHeadMs = settings.loopHeadMs;
+        const unsigned int resampleRate = (decodeAheadMs > 0) ? settings.resampleRate.load() : 0;
+        const bool wantFloat = settings.floatOutput || channelLayout != ChannelLayout::Passthrough || resampleRate != 0
+            || (userExInfo != nullptr && userExInfo->format == FMOD_SOUND_FORMAT_PCMFLOAT);
 
-        HRESULT winLibResult = MFCreateMFByteStreamOnStream(mfObjects->fmodStream, &(mfObjects->mfFmodStream));
+        MfObjects* mfObjects = new MfObjects();
 
-        if (SUCCEEDED(winLibResult))
+        // Small files are read in one go, and everything from here on, our own header parsing included, is served
+        // from memory
+        std::shared_ptr<const std::vector<uint8_t>> fileContents;
+        const unsigned int memoryStreamKb = settings.memoryStreamKb;
+        if (memoryStreamKb > 0 && codec->filesize <= static_cast<uint64_t>(memoryStreamKb) * 1024)
         {
-            PATCH_LOG("MF byte stream created.");
-
-            // Need to tell the byte stream what kind of format it is
-            IMFAttributes* streamAttributes = nullptr;
-            winLibResult = mfObjects->mfFmodStream->QueryInterface<IMFAttributes>(&streamAttributes);
-
-            if (SUCCEEDED(winLibResult))
+            fileContents = LoadFileContents(codec);
+            if (fileContents != nullptr)
             {
-                winLibResult = streamAttributes->SetString(MF_BYTESTREAM_CONTENT_TYPE, mimeType);
+                PATCH_LOG(std::format("Read all {} bytes into memory.", codec->filesize));
             }
         }
 
-        if (SUCCEEDED(winLibResult))
+        if (std::wcscmp(mimeType, L"audio/mp4") == 0 || std::wcsncmp(mimeType, L"audio/3gpp", 10) == 0)
         {
-            PATCH_LOG("MIME type given to byte stream attributes.");
+            // Read the sample table ourselves while we've still got the file to ourselves
+            CodecFileReader fileReader(codec, fileContents.get());
+            std::unique_ptr<Mp4SampleTable> sampleTable = std::make_unique<Mp4SampleTable>();
+            if (sampleTable->Parse(fileReader))
+            {
+                PATCH_LOG(std::format("MP4 sample table read: {} access units.", sampleTable->GetSampleCount()));
+                mfObjects->mp4SampleTable = std::move(sampleTable);
+            }
+            else
+            {
+                PATCH_LOG("Couldn't read MP4 sample table; seeking will be left to Media Foundation.");
+            }
 
-            winLibResult = MFCreateSourceResolver(&(mfObjects->mfResolver));
+            // Media Foundation leaves iTunes' gapless info alone, so the encoder delay and padding are ours to trim
+            mp4::ForEachFreeformTag(fileReader, [mfObjects](const std::string& name, const std::string& value) { mfObjects->loopPoints.ApplyTag(name, value); });
+            codec->fileseek(codec->filehandle, 0, nullptr);
         }
-
-        if (SUCCEEDED(winLibResult))
+        else if (std::wcscmp(mimeType, L"audio/x-ms-wma") == 0)
         {
-            PATCH_LOG("Source resolver ready.");
-
-            MF_OBJECT_TYPE objType;
-            IUnknown* unknownMedia;
-            winLibResult = mfObjects->mfResolver->CreateObjectFromByteStream(mfObjects->mfFmodStream, nullptr, MF_RESOLUTION_MEDIASOURCE | MF_RESOLUTION_READ, nullptr, &objType, &unknownMedia);
-
-            if (SUCCEEDED(winLibResult))
+            CodecFileReader fileReader(codec, fileContents.get());
+            std::unique_ptr<AsfFileInfo> fileInfo = std::make_unique<AsfFileInfo>();
+            if (fileInfo->Parse(fileReader))
             {
-                winLibResult = unknownMedia->QueryInterface(IID_PPV_ARGS(&(mfObjects->mfMedia)));
-
-                unknownMedia->Release();
+                PATCH_LOG(std::format("ASF header read: {} packets, {}.", fileInfo->GetPacketCount(), fileInfo->HasFileIndex() ? "indexed" : "no index"));
+                mfObjects->asfFileInfo = std::move(fileInfo);
             }
+            else
+            {
+                PATCH_LOG("Couldn't read ASF header; seeking will be left to Media Foundation.");
+            }
+
+            asf::ForEachContentAttribute(fileReader, [mfObjects](const std::string& name, const std::string& value) { mfObjects->loopPoints.ApplyTag(name, value); });
+            codec->fileseek(codec->filehandle, 0, nullptr);
         }
+        mfObjects->fileSize = codec->filesize;
 
-        if (SUCCEEDED(winLibResult))
-        {
-            PATCH_LOG("Media source prepared.");
+        // Everything above leaves the file rewound, which is where the stream expects to find it.  (A file that was
+        // read into memory may not be, but the stream never goes near it.)
+        mfObjects->fmodStream = new FmodReadStream(codec, std::move(fileContents));
+        mfObjects->mimeType = mimeType;
+        mfObjects->wantFloat = wantFloat;
+
+        FMOD_RESULT returnResult = FMOD_OK;
+        HRESULT winLibResult = S_OK;
 
-            winLibResult = MFCreateSourceReaderFromMediaSource(mfObjects->mfMedia, nullptr, &(mfObjects->mfReader));
+        // Decode-ahead would only go and build the pipeline straight away
+        if (settings.lazyOpen && decodeAheadMs == 0 && PredictDecodedFormat(mfObjects, &(mfObjects->format)))
+        {
+            PATCH_LOG(std::format("Format known from the header: {} channels at {} Hz; leaving the source reader until it's needed.", mfObjects->format.channels, mfObjects->format.sampleRate));
+            mfObjects->pipelineDeferred = true;
+            stats.deferredOpens++;
+        }
+        else
+        {
+            winLibResult = BuildPipeline(mfObjects);
         }
 
         if (SUCCEEDED(winLibResult))
         {
-            PATCH_LOG("Source reader created.");
+            mfObjects->SetChannelLayout(channelLayout);
+            if (mfObjects->channelMix.IsActive())
+            {
+                PATCH_LOG(std::format("Remixing {} channels to {}.", mfObjects->channelMix.inputChannels, mfObjects->channelMix.outputChannels));
+            }
+
+            mfObjects->SetResampleRate(resampleRate);
+            if (mfObjects->resampler.IsActive())
+            {
+                PATCH_LOG(std::format("Resampling {} Hz to {} Hz.", mfObjects->format.sampleRate, resampleRate));
+            }
 
-            winLibResult = ConfigureAudioStream(mfObjects->mfReader);
+            mfObjects->outputFormat = MakeOutputFormat(mfObjects->format, wantFloat, mfObjects->channelMix, mfObjects->resampler);
+
+            mfObjects->ApplyLoopPoints();
+            if (mfObjects->timelineOffset > 0 || mfObjects->contentEndFrame > 0)
+            {
+                PATCH_LOG(std::format("Gapless: skipping {} frames of encoder delay, {} frames long.", mfObjects->loopPoints.GetEncoderDelay(), mfObjects->loopPoints.GetContentFrames()));
+            }
+            if (mfObjects->hasLoop)
+            {
+                PATCH_LOG(std::format("Loop tagged from frame {} to {}.", mfObjects->loopStartFrame, mfObjects->loopEndFrame));
+            }
         }
 
         if (SUCCEEDED(winLibResult))
         {
-            PATCH_LOG("Audio stream configured.  Open successful.");
+            PATCH_LOG("Open successful.");
+
+            if (!mfObjects->pipelineDeferred)
+            {
+                mfObjects->pcmPool.SetBlockSize(EstimateDecodedBlockSize(mfObjects->mfReader, mfObjects->format));
+            }
+
+            if (decodeAheadMs > 0)
+            {
+                PATCH_LOG(std::format("Decoding {} ms ahead.", decodeAheadMs));
+                mfObjects->StartDecodeAhead(decodeAheadMs);
+            }
+
+            mfObjects->StartLoopHead(loopHeadMs);
 
             codec->plugindata = mfObjects;
 
@@ -637,8 +2629,6 @@ namespace mediaFoundation
             returnResult = FMOD_ERR_FILE_BAD;
         }
 
-        delete[] mimeType;
-
         return returnResult;
     }
 
@@ -655,9 +2645,9 @@ namespace mediaFoundation
         return FMOD_OK;
     }
 
-    unsigned int ConvertFrom100nsTimestamp(LONGLONG timestamp100ns, FMOD_TIMEUNIT timeUnit, IMFMediaType* audioType)
+    unsigned int ConvertFrom100nsTimestamp(LONGLONG timestamp100ns, FMOD_TIMEUNIT timeUnit, const AudioFormat& format)
     {
-        const UINT32 bytesPerSec = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_AVG_BYTES_PER_SECOND, 0);
+        const UINT32 bytesPerSec = format.bytesPerSec;
 
         switch (timeUnit)
         {
@@ -671,10 +2661,7 @@ namespace mediaFoundation
         case FMOD_TIMEUNIT_PCM:
             {
                 // Divide by channels and bytes-per-sample in addition to the 10 million for the whole 100ns thing
-                const UINT32 channels = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_NUM_CHANNELS, 0);
-                const UINT32 bits = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_BITS_PER_SAMPLE, 0);
-
-                const UINT64 bytesPerSample = channels * bits / 8;
+                const UINT64 bytesPerSample = format.blockAlign;
 
                 unsigned int sampleTimestamp = (unsigned int)(timestamp100ns * bytesPerSec / (bytesPerSample * 10000000));
                 //PATCH_LOG(std::format("{}00 nanoseconds is {} samples ({} channels, {} bits per sample).", timestamp100ns, sampleTimestamp, channels, bits));
@@ -693,9 +2680,9 @@ namespace mediaFoundation
         return -1;
     }
 
-    LONGLONG ConvertTo100nsTimestamp(unsigned int time, FMOD_TIMEUNIT timeUnit, IMFMediaType* mediaType)
+    LONGLONG ConvertTo100nsTimestamp(unsigned int time, FMOD_TIMEUNIT timeUnit, const AudioFormat& format)
     {
-        const UINT32 bytesPerSec = MFGetAttributeUINT32(mediaType, MF_MT_AUDIO_AVG_BYTES_PER_SECOND, 0);
+        const UINT32 bytesPerSec = format.bytesPerSec;
 
         INT64 positionIn100ns = 0;
         // Convert desired position to 100ns units
@@ -709,10 +2696,7 @@ namespace mediaFoundation
         case FMOD_TIMEUNIT_PCM:
             {
                 // Multiply by channels and bytes-per-sample in addition to the 10 million for the whole 100ns thing
-                const UINT32 channels = MFGetAttributeUINT32(mediaType, MF_MT_AUDIO_NUM_CHANNELS, 0);
-                const UINT32 bits = MFGetAttributeUINT32(mediaType, MF_MT_AUDIO_BITS_PER_SAMPLE, 0);
-
-                const UINT32 bytesPerSample = channels * bits / 8;
+                const UINT32 bytesPerSample = format.blockAlign;
 
                 positionIn100ns = (INT64)time * 10000000 * bytesPerSample / bytesPerSec;
                 break;
@@ -732,7 +2716,7 @@ namespace mediaFoundation
     FMOD_RESULT F_CALLBACK getLength(FMOD_CODEC_STATE* codec, unsigned int* length, FMOD_TIMEUNIT timeUnit)
     {
         MfObjects* mfObjects = static_cast<MfObjects*>(codec->plugindata);
-        if (mfObjects == nullptr || mfObjects->mfReader == nullptr)
+        if (mfObjects == nullptr || (mfObjects->mfReader == nullptr && !mfObjects->pipelineDeferred))
         {
             PATCH_LOG("Invalid plugin data in codec state!");
 
@@ -741,21 +2725,9 @@ namespace mediaFoundation
 
         if (timeUnit == FMOD_TIMEUNIT_RAWBYTES)
         {
-            PROPVARIANT sizeVariant;
-            HRESULT lengthResult = mfObjects->mfReader->GetPresentationAttribute((DWORD)MF_SOURCE_READER_MEDIASOURCE, MF_PD_TOTAL_FILE_SIZE, &sizeVariant);
-            if (FAILED(lengthResult))
-            {
-                PATCH_LOG("Could not get filesize attribute from the source reader.");
-                return FMOD_ERR_PLUGIN;
-            }
-
-            lengthResult = PropVariantToUInt32(sizeVariant, length);
-            if (FAILED(lengthResult))
-            {
-                PATCH_LOG("Filesize attributed did not convert to Int32.");
-                return FMOD_ERR_PLUGIN;
-            }
-
+            // The file FMOD gave us, which is all the media source would have said anyway.  Doesn't need the reader,
+            // so this works with the pipeline still deferred.
+            *length = static_cast<unsigned int>(mfObjects->fileSize);
             return FMOD_OK;
         }
         else if (timeUnit != FMOD_TIMEUNIT_MS && timeUnit != FMOD_TIMEUNIT_PCM && timeUnit != FMOD_TIMEUNIT_PCMBYTES)
@@ -764,32 +2736,34 @@ namespace mediaFoundation
             return FMOD_ERR_PLUGIN;
         }
 
-        IMFMediaType* audioType = nullptr;
-        HRESULT winLibResult = mfObjects->mfReader->GetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, &audioType);
-        if (FAILED(winLibResult))
+        // For some freaking reason, durations count in hundreds of nanoseconds.
+        INT64 trueDurationIn100ns = 0;
+        if (!mfObjects->GetExactDuration(&trueDurationIn100ns))
         {
-            PATCH_LOG("Failed to get audio type from the source reader.");
-            return FMOD_ERR_PLUGIN;
-        }
+            // A deferred open always has a container length, but don't count on it
+            if (FAILED(FinishDeferredOpen(mfObjects)))
+            {
+                PATCH_LOG("Couldn't build the source reader open() put off.");
+                return FMOD_ERR_FILE_BAD;
+            }
 
-        PROPVARIANT durationVariant;
-        winLibResult = mfObjects->mfReader->GetPresentationAttribute((DWORD)MF_SOURCE_READER_MEDIASOURCE, MF_PD_DURATION, &durationVariant);
-        if (FAILED(winLibResult))
-        {
-            PATCH_LOG("Failed to get duration attribute from the source reader.");
-            return FMOD_ERR_PLUGIN;
-        }
+            PROPVARIANT durationVariant;
+            HRESULT winLibResult = mfObjects->mfReader->GetPresentationAttribute((DWORD)MF_SOURCE_READER_MEDIASOURCE, MF_PD_DURATION, &durationVariant);
+            if (FAILED(winLibResult))
+            {
+                PATCH_LOG("Failed to get duration attribute from the source reader.");
+                return FMOD_ERR_PLUGIN;
+            }
 
-        // For some freaking reason, the duration attribute counts in hundreds of nanoseconds.
-        INT64 trueDurationIn100ns = 0;
-        winLibResult = PropVariantToInt64(durationVariant, &trueDurationIn100ns);
-        if (FAILED(winLibResult))
-        {
-            PATCH_LOG("Failed to convert duration in hundreds of nanoseconds to an Int64.");
-            return FMOD_ERR_PLUGIN;
+            winLibResult = PropVariantToInt64(durationVariant, &trueDurationIn100ns);
+            if (FAILED(winLibResult))
+            {
+                PATCH_LOG("Failed to convert duration in hundreds of nanoseconds to an Int64.");
+                return FMOD_ERR_PLUGIN;
+            }
         }
 
-        *length = ConvertFrom100nsTimestamp(trueDurationIn100ns, timeUnit, audioType);
+        *length = ConvertFrom100nsTimestamp(trueDurationIn100ns, timeUnit, mfObjects->outputFormat);
 
         return FMOD_OK;
     }
@@ -797,39 +2771,48 @@ namespace mediaFoundation
     FMOD_RESULT F_CALLBACK setPosition(FMOD_CODEC_STATE* codec, int subsound, unsigned int position, FMOD_TIMEUNIT timeUnit)
     {
         MfObjects* mfObjects = static_cast<MfObjects*>(codec->plugindata);
-        if (mfObjects == nullptr || mfObjects->mfReader == nullptr)
+        if (mfObjects == nullptr || (mfObjects->mfReader == nullptr && !mfObjects->pipelineDeferred))
         {
             PATCH_LOG("Invalid plugin data in codec state!");
 
             return FMOD_ERR_PLUGIN;
         }
 
-        HRESULT winLibResult = S_OK;
-
-        IMFMediaType* audioType = nullptr;
-        winLibResult = mfObjects->mfReader->GetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, &audioType);
-        if (FAILED(winLibResult))
+        if (FAILED(FinishDeferredOpen(mfObjects)))
         {
-            PATCH_LOG("Could not get media type from source reader.");
-            return FMOD_ERR_PLUGIN;
+            PATCH_LOG("Couldn't build the source reader open() put off.");
+            return FMOD_ERR_FILE_BAD;
         }
 
-        LONGLONG positionIn100ns = ConvertTo100nsTimestamp(position, timeUnit, audioType);
+        HRESULT winLibResult = S_OK;
+
+        LONGLONG positionIn100ns = ConvertTo100nsTimestamp(position, timeUnit, mfObjects->outputFormat);
 
         if (positionIn100ns < 0)
         {
             return FMOD_ERR_PLUGIN;
         }
 
-        PROPVARIANT positionVariant;
-        winLibResult = InitPropVariantFromInt64(positionIn100ns, &positionVariant);
+        // A loop back to the start gets played out of the loop head while the reader catches up.  With a worker
+        // decoding ahead, every seek is left to it, so FMOD never waits on the reader (or on an ASF seek index
+        // being built) here.  Without one, read() decodes on this same thread anyway, so the seek costs no more
+        // here than it would on the next read().
+        const UINT64 targetFrame = (static_cast<UINT64>(positionIn100ns) * mfObjects->outputFormat.sampleRate + 5000000) / 10000000;
+        LONGLONG seekTarget = positionIn100ns;
+        mfObjects->SeekIntoLoopHead(targetFrame, &seekTarget);
+        if (mfObjects->IsDecodingAhead())
+        {
+            mfObjects->SeekDecodeAhead(seekTarget);
+        }
+        else
+        {
+            winLibResult = mfObjects->SeekReader(seekTarget);
+        }
 
         if (SUCCEEDED(winLibResult))
         {
-            winLibResult = mfObjects->mfReader->SetCurrentPosition(GUID_NULL, positionVariant);
-            PropVariantClear(&positionVariant);
-
-            mfObjects->lastReadTimestamp = positionIn100ns;
+            mfObjects->lastReadTimestamp = positionIn100ns + mfObjects->timelineOffset;
+            mfObjects->playbackFrame = targetFrame;
         }
 
         return SUCCEEDED(winLibResult) ? FMOD_OK : FMOD_ERR_PLUGIN;
@@ -838,152 +2821,155 @@ namespace mediaFoundation
     FMOD_RESULT F_CALLBACK getPosition(FMOD_CODEC_STATE* codec, unsigned int* position, FMOD_TIMEUNIT timeUnit)
     {
         MfObjects* mfObjects = static_cast<MfObjects*>(codec->plugindata);
-        if (mfObjects == nullptr || mfObjects->mfReader == nullptr)
+        if (mfObjects == nullptr || (mfObjects->mfReader == nullptr && !mfObjects->pipelineDeferred))
         {
             PATCH_LOG("Invalid plugin data in codec state!");
 
             return FMOD_ERR_PLUGIN;
         }
 
-        IMFMediaType* audioType = nullptr;
-        HRESULT winLibResult = mfObjects->mfReader->GetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, &audioType);
-        if (FAILED(winLibResult))
+        // The decoder's timestamps still include the encoder delay
+        const LONGLONG playbackTimestamp = max(mfObjects->lastReadTimestamp - mfObjects->timelineOffset, 0LL);
+        *position = ConvertFrom100nsTimestamp(playbackTimestamp, timeUnit, mfObjects->outputFormat);
+
+        return FMOD_OK;
+    }
+
+    // read() for streams with a decode-ahead worker: nothing but copying out of the ring, unless the worker has
+    // fallen behind.
+    FMOD_RESULT ReadFromDecodeAhead(MfObjects* mfObjects, BYTE* buffer, unsigned int samplesRequested, UINT32 bytesPerSample, unsigned int* samplesRead)
+    {
+        const size_t bytesRequested = static_cast<size_t>(samplesRequested) * bytesPerSample;
+        size_t bytesCopied = 0;
+        FMOD_RESULT returnResult = FMOD_OK;
+
+        while (bytesCopied < bytesRequested)
         {
-            PATCH_LOG("Could not get media type from source reader.");
-            return FMOD_ERR_PLUGIN;
-        }
+            // Only ever take whole frames out of the ring
+            size_t bytesToCopy = min(mfObjects->decodeRing->GetReadableBytes(), bytesRequested - bytesCopied);
+            bytesToCopy -= bytesToCopy % bytesPerSample;
+            if (bytesToCopy > 0)
+            {
+                bytesCopied += mfObjects->decodeRing->Read(buffer + bytesCopied, bytesToCopy);
+                continue;
+            }
 
-        *position = ConvertFrom100nsTimestamp(mfObjects->lastReadTimestamp, timeUnit, audioType);
+            // Underrun.  Either the worker is done, or it's fallen behind and we have no choice but to wait for it.
+            if (FAILED(mfObjects->decodeResult))
+            {
+                returnResult = (mfObjects->decodeResult == MF_E_INVALIDMEDIATYPE) ? FMOD_ERR_FORMAT : FMOD_ERR_PLUGIN;
+                break;
+            }
+            if (mfObjects->decodeEndOfStream && mfObjects->decodeRing->GetReadableBytes() < bytesPerSample)
+            {
+                PATCH_LOG("End of stream.");
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
 
-        return FMOD_OK;
+        *samplesRead = static_cast<unsigned int>(bytesCopied / bytesPerSample);
+        return returnResult;
     }
 
     FMOD_RESULT F_CALLBACK read(FMOD_CODEC_STATE* codec, void* buffer, unsigned int samplesRequested, unsigned int* samplesRead)
     {
         MfObjects* mfObjects = static_cast<MfObjects*>(codec->plugindata);
-        if (mfObjects == nullptr || mfObjects->mfReader == nullptr)
+        if (mfObjects == nullptr || (mfObjects->mfReader == nullptr && !mfObjects->pipelineDeferred))
         {
             PATCH_LOG("Invalid plugin data in codec state!");
 
             return FMOD_ERR_PLUGIN;
         }
 
-        IMFMediaType* audioType = nullptr;
-        HRESULT winLibResult = mfObjects->mfReader->GetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, &audioType);
-        if (FAILED(winLibResult))
+        if (FAILED(FinishDeferredOpen(mfObjects)))
         {
-            PATCH_LOG("Failed to get audio type from the source reader.");
-            return FMOD_ERR_PLUGIN;
+            PATCH_LOG("Couldn't build the source reader open() put off.");
+            return FMOD_ERR_FILE_BAD;
         }
 
         *samplesRead = 0;
 
-        const UINT32 channels = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_NUM_CHANNELS, 0);
-        const UINT32 bits = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_BITS_PER_SAMPLE, 0);
+        const UINT32 bytesPerSample = mfObjects->outputFormat.blockAlign;
 
-        const UINT32 bytesPerSample = channels * bits / 8;
-
-        winLibResult = S_OK;
+        HRESULT winLibResult = S_OK;
         FMOD_RESULT returnResult = FMOD_OK;
 
-        BYTE* rawAudioData = nullptr;
-        DWORD mfBufferSize = 0;
+        // Anything past the end of the original audio is encoder padding
+        if (mfObjects->contentEndFrame > 0)
+        {
+            const UINT64 framesLeft = mfObjects->contentEndFrame - min(mfObjects->playbackFrame, mfObjects->contentEndFrame);
+            samplesRequested = static_cast<unsigned int>(min(static_cast<UINT64>(samplesRequested), framesLeft));
+        }
+
+        // Straight after a loop, the first part comes out of the loop head
+        *samplesRead = mfObjects->ReadLoopHead(static_cast<BYTE*>(buffer), samplesRequested);
+        mfObjects->lastReadTimestamp += ConvertTo100nsTimestamp(*samplesRead, FMOD_TIMEUNIT_PCM, mfObjects->outputFormat);
+
+        if (mfObjects->IsDecodingAhead())
+        {
+            BYTE* ringDest = static_cast<BYTE*>(buffer) + (*samplesRead * bytesPerSample);
+            unsigned int ringSamplesRead = 0;
+            returnResult = ReadFromDecodeAhead(mfObjects, ringDest, samplesRequested - *samplesRead, bytesPerSample, &ringSamplesRead);
+            mfObjects->CaptureLoopHead(ringDest, mfObjects->playbackFrame + *samplesRead, ringSamplesRead);
+            *samplesRead += ringSamplesRead;
+            mfObjects->lastReadTimestamp += ConvertTo100nsTimestamp(ringSamplesRead * bytesPerSample, FMOD_TIMEUNIT_PCMBYTES, mfObjects->outputFormat);
+            mfObjects->playbackFrame += *samplesRead;
+            mfObjects->NoteSamplesRead(*samplesRead);
+            return returnResult;
+        }
+
         while (*samplesRead < samplesRequested)
         {
-            if (mfObjects->mfBuffer == nullptr)
+            if (mfObjects->decodedSample.IsEmpty())
             {
                 // IMFSourceReader can give more data in one go than FMOD will ever ask for, and we don't have fine enough
-                // granularity with seeking to adjust for that.  Instead, we put the MF sample into a buffer and read from
-                // that gradually.  When that runs out, then we ask for a new sample from the source reader.
-
-                mfObjects->currentBufferPos = 0;
-
-                DWORD sampleReadFlags = 0;
-                IMFSample* sample = nullptr;
-                winLibResult = mfObjects->mfReader->ReadSample((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, 0, nullptr, &sampleReadFlags, &(mfObjects->lastReadTimestamp), &sample);
+                // granularity with seeking to adjust for that.  Instead, we hang on to the MF sample and read from its
+                // buffer gradually.  When that runs out, then we ask for a new sample from the source reader.
+                // Single-buffer samples (i.e. nearly anything a decoder outputs) get read in place, so nothing gets
+                // copied until the copy into FMOD's buffer below.
+                bool endOfStream = false;
+                winLibResult = mfObjects->DecodeNextSample(&(mfObjects->lastReadTimestamp), &endOfStream);
 
                 if (FAILED(winLibResult))
                 {
-                    PATCH_LOG(std::format("Failed to read sample: {}", winLibResult));
-                    returnResult = FMOD_ERR_PLUGIN;
+                    returnResult = (winLibResult == MF_E_INVALIDMEDIATYPE) ? FMOD_ERR_FORMAT : FMOD_ERR_PLUGIN;
                     break;
                 }
 
-                if (sampleReadFlags & MF_SOURCE_READERF_ENDOFSTREAM)
+                if (endOfStream)
                 {
                     PATCH_LOG("End of stream.");
                     break;
                 }
 
-                DWORD sampleLength = 0;
-                winLibResult = sample->GetTotalLength(&sampleLength);
-                if (FAILED(winLibResult))
-                {
-                    PATCH_LOG(std::format("Failed to get sample length: {}", winLibResult));
-                    returnResult = FMOD_ERR_PLUGIN;
-                    break;
-                }
-
-                winLibResult = MFCreateMemoryBuffer(sampleLength, &(mfObjects->mfBuffer));
-                if (FAILED(winLibResult))
-                {
-                    PATCH_LOG(std::format("Failed to initialize buffer: {}", winLibResult));
-                    returnResult = FMOD_ERR_PLUGIN;
-                    break;
-                }
-
-                // The intuitive thing to do here would be to, rather than separately initializing a buffer,
-                // just call IMFSample::ConvertToContiguousBuffer().  However, since that can just point
-                // directly to the internal buffer of the sample, the sample would need to stay valid.
-                // However, samples really don't like sticking around, causing a crash inside Media Foundation.
-                winLibResult = sample->CopyToBuffer(mfObjects->mfBuffer);
-                if (FAILED(winLibResult))
+                if (mfObjects->decodedSample.IsEmpty())
                 {
-                    PATCH_LOG(std::format("Failed to copy sample to buffer: {}", winLibResult));
-                    returnResult = FMOD_ERR_PLUGIN;
-                    break;
-                }
-
-                sample->Release();
-            }
-
-            winLibResult = mfObjects->mfBuffer->Lock(&rawAudioData, nullptr, &mfBufferSize);
-            if (FAILED(winLibResult))
-            {
-                PATCH_LOG(std::format("Failed to lock sample buffer: {}", winLibResult));
-                returnResult = FMOD_ERR_PLUGIN;
-                break;
+                    // Stream ticks and the like come through without any data attached, and samples from before a
+                    // seek target get dropped entirely
+                    continue;
+                }
             }
 
-            // Actual copy to FMOD's buffer
+            // Actual copy to FMOD's buffer, converting along the way if the decoder's output isn't what FMOD was promised
             unsigned int maxSamplesToRead = samplesRequested - *samplesRead;
-            unsigned int bytesToCopy = min(maxSamplesToRead * bytesPerSample, mfBufferSize);
-            std::memcpy(static_cast<BYTE*>(buffer) + (*samplesRead * bytesPerSample), rawAudioData + mfObjects->currentBufferPos, bytesToCopy);
-
-            winLibResult = mfObjects->mfBuffer->Unlock();
-            if (FAILED(winLibResult))
-            {
-                PATCH_LOG("Failed to unlock media buffer!");
-            }
-            rawAudioData = nullptr;
+            BYTE* copyDest = static_cast<BYTE*>(buffer) + (*samplesRead * bytesPerSample);
+            unsigned int samplesCopied = mfObjects->EmitFrames(copyDest, maxSamplesToRead);
+            mfObjects->CaptureLoopHead(copyDest, mfObjects->playbackFrame + *samplesRead, samplesCopied);
 
             // Update timestamps
-            mfObjects->currentBufferPos += bytesToCopy;
-            *samplesRead += bytesToCopy / bytesPerSample;
-            mfObjects->lastReadTimestamp += ConvertTo100nsTimestamp(bytesToCopy, FMOD_TIMEUNIT_PCMBYTES, audioType);
+            *samplesRead += samplesCopied;
+            mfObjects->lastReadTimestamp += ConvertTo100nsTimestamp(samplesCopied, FMOD_TIMEUNIT_PCM, mfObjects->outputFormat);
 
-            // If we've reached the end of the current buffer, kill it
-            if (mfObjects->currentBufferPos == mfBufferSize)
+            // If we've reached the end of the current buffer, let the decoder have it back
+            if (mfObjects->GetBufferedFrames() == 0)
             {
-                mfObjects->mfBuffer->Release();
-                mfObjects->mfBuffer = nullptr;
+                mfObjects->ReleaseBuffer();
             }
         }
-        if (audioType != nullptr)
-        {
-            audioType->Release();
-        }
 
+        mfObjects->playbackFrame += *samplesRead;
+        mfObjects->NoteSamplesRead(*samplesRead);
         return returnResult;
     }
 
@@ -996,29 +2982,20 @@ namespace mediaFoundation
     FMOD_RESULT F_CALLBACK getWaveFormat(FMOD_CODEC_STATE* codec, int index, FMOD_CODEC_WAVEFORMAT* waveFormat)
     {
         MfObjects* mfObjects = static_cast<MfObjects*>(codec->plugindata);
-        if (mfObjects == nullptr || mfObjects->mfReader == nullptr || mfObjects->mfFmodStream == nullptr)
+        if (mfObjects == nullptr || ((mfObjects->mfReader == nullptr || mfObjects->fmodStream == nullptr) && !mfObjects->pipelineDeferred))
         {
             PATCH_LOG("Invalid plugin data in codec state!");
 
             return FMOD_ERR_PLUGIN;
         }
 
-        IMFMediaType* audioType = nullptr;
-        HRESULT winLibResult = mfObjects->mfReader->GetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, &audioType);
-        if (FAILED(winLibResult))
-        {
-            PATCH_LOG("Could not get media type from source reader.");
-            return FMOD_ERR_PLUGIN;
-        }
-
         // Get base data
-        const UINT32 channels = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_NUM_CHANNELS, 0);
-        const UINT32 bits = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_BITS_PER_SAMPLE, 0);
-        const UINT32 frequency = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_SAMPLES_PER_SECOND, 0);
-        const UINT32 blockSize = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_SAMPLES_PER_BLOCK, 0);
-        const UINT32 channelMask = MFGetAttributeUINT32(audioType, MF_MT_AUDIO_CHANNEL_MASK, 0);
-
-        //PATCH_LOG(std::format("{} Hz, {} channels, {} bits", frequency, channels, bits));
+        const AudioFormat& format = mfObjects->outputFormat;
+        const UINT32 channels = format.channels;
+        const UINT32 bits = format.bitsPerSample;
+        const UINT32 frequency = format.sampleRate;
+        const UINT32 blockSize = format.samplesPerBlock;
+        const UINT32 channelMask = format.channelMask;
 
         unsigned int samples = 0;
         getLength(codec, &samples, FMOD_TIMEUNIT_PCM);
@@ -1045,7 +3022,7 @@ namespace mediaFoundation
             }
         case 32:
             {
-                waveFormat->format = FMOD_SOUND_FORMAT_PCM32;
+                waveFormat->format = (format.sampleType == SampleType::Float) ? FMOD_SOUND_FORMAT_PCMFLOAT : FMOD_SOUND_FORMAT_PCM32;
                 break;
             }
         default:
@@ -1058,6 +3035,13 @@ namespace mediaFoundation
         waveFormat->lengthpcm = samples;
         waveFormat->pcmblocksize = blockSize;
 
+        // FMOD's loop end is the last frame in the loop, not the one after
+        if (mfObjects->hasLoop)
+        {
+            waveFormat->loopstart = static_cast<int>(mfObjects->loopStartFrame);
+            waveFormat->loopend = static_cast<int>(mfObjects->loopEndFrame - 1);
+        }
+
         if (channelMask & SPEAKER_FRONT_LEFT)
         {
             waveFormat->channelmask |= FMOD_CHANNELMASK_FRONT_LEFT;
@@ -1098,6 +3082,336 @@ namespace mediaFoundation
         return FMOD_OK;
     }
 
+    // Everything the importer wants to know about a file, without the cost of a decoder or a source reader.
+    struct ProbedFile
+    {
+        const WCHAR* mimeType;
+        ProbeRecord summary;            // All of it but the tags, which is what gets cached
+        ContainerInfo containerInfo;
+    };
+
+    // The probe cache file, mapped in and loaded when it's opened, then appended to as files are probed.
+    class ProbeCacheFile
+    {
+    public:
+        ProbeCacheFile() :
+            file(INVALID_HANDLE_VALUE),
+            cache([this](const void* data, size_t bytes) { return Append(data, bytes); })
+        { }
+
+        ~ProbeCacheFile()
+        {
+            if (file != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(file);
+            }
+        }
+
+        ProbeCacheFile(const ProbeCacheFile&) = delete;
+        ProbeCacheFile& operator=(const ProbeCacheFile&) = delete;
+
+        bool Open(const WCHAR* path)
+        {
+            file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            LARGE_INTEGER fileSize;
+            if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize))
+            {
+                return false;
+            }
+
+            size_t goodSize = 0;
+            bool loaded = false;
+            if (fileSize.QuadPart > 0 && static_cast<uint64_t>(fileSize.QuadPart) <= SIZE_MAX)
+            {
+                HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (mapping != nullptr)
+                {
+                    const uint8_t* view = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                    if (view != nullptr)
+                    {
+                        goodSize = cache.Load(view, static_cast<size_t>(fileSize.QuadPart));
+                        loaded = true;
+                        UnmapViewOfFile(view);
+                    }
+                    CloseHandle(mapping);
+                }
+            }
+            if (!loaded)
+            {
+                cache.Load(nullptr, 0);
+            }
+
+            // Cut off whatever didn't make it to disk whole last time, so new records land where they should, or
+            // start over with a fresh header
+            LARGE_INTEGER goodEnd;
+            goodEnd.QuadPart = static_cast<LONGLONG>(goodSize);
+            if (!SetFilePointerEx(file, goodEnd, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+            {
+                return false;
+            }
+
+            if (goodSize == 0)
+            {
+                uint8_t header[ProbeCache::headerSize];
+                ProbeCache::WriteHeader(header);
+                return Append(header, sizeof(header));
+            }
+            return true;
+        }
+
+        ProbeCache& GetCache()
+        {
+            return cache;
+        }
+
+    private:
+        bool Append(const void* data, size_t bytes)
+        {
+            DWORD bytesWritten = 0;
+            return WriteFile(file, data, static_cast<DWORD>(bytes), &bytesWritten, nullptr) && bytesWritten == bytes;
+        }
+
+        HANDLE file;
+        ProbeCache cache;
+    };
+
+    // Set by SetProbeCachePath(); ProbeFiles() holds on to whichever one was current when it started
+    std::mutex probeCacheLock;
+    std::shared_ptr<ProbeCacheFile> probeCacheFile;
+
+    // The encoded audio's format, straight off the media source's presentation descriptor.  Creating the source
+    // parses the container, but nothing gets decoded.
+    HRESULT ReadSourceFormat(const WCHAR* path, const WCHAR* mimeType, ProbeRecord* summary)
+    {
+        IMFByteStream* byteStream = nullptr;
+        IMFSourceResolver* resolver = nullptr;
+        IMFMediaSource* mediaSource = nullptr;
+        IMFPresentationDescriptor* presentation = nullptr;
+
+        HRESULT result = MFCreateFile(MF_ACCESSMODE_READ, MF_OPENMODE_FAIL_IF_NOT_EXIST, MF_FILEFLAGS_NONE, path, &byteStream);
+
+        if (SUCCEEDED(result))
+        {
+            IMFAttributes* streamAttributes = nullptr;
+            result = byteStream->QueryInterface<IMFAttributes>(&streamAttributes);
+
+            if (SUCCEEDED(result))
+            {
+                result = streamAttributes->SetString(MF_BYTESTREAM_CONTENT_TYPE, mimeType);
+                streamAttributes->Release();
+            }
+        }
+
+        if (SUCCEEDED(result))
+        {
+            result = objectCache.GetResolver(&resolver);
+        }
+
+        if (SUCCEEDED(result))
+        {
+            MF_OBJECT_TYPE objType;
+            IUnknown* unknownMedia;
+            result = resolver->CreateObjectFromByteStream(byteStream, nullptr, MF_RESOLUTION_MEDIASOURCE | MF_RESOLUTION_READ, nullptr, &objType, &unknownMedia);
+
+            if (SUCCEEDED(result))
+            {
+                result = unknownMedia->QueryInterface(IID_PPV_ARGS(&mediaSource));
+                unknownMedia->Release();
+            }
+        }
+
+        if (SUCCEEDED(result))
+        {
+            result = mediaSource->CreatePresentationDescriptor(&presentation);
+        }
+
+        if (SUCCEEDED(result))
+        {
+            UINT64 duration = 0;
+            if (SUCCEEDED(presentation->GetUINT64(MF_PD_DURATION, &duration)))
+            {
+                summary->durationIn100ns = duration;
+            }
+
+            DWORD streamCount = 0;
+            result = presentation->GetStreamDescriptorCount(&streamCount);
+
+            bool foundAudio = false;
+            for (DWORD i = 0; SUCCEEDED(result) && i < streamCount && !foundAudio; ++i)
+            {
+                BOOL selected = FALSE;
+                IMFStreamDescriptor* streamDescriptor = nullptr;
+                IMFMediaTypeHandler* typeHandler = nullptr;
+                IMFMediaType* mediaType = nullptr;
+                GUID majorType = GUID_NULL;
+
+                if (SUCCEEDED(presentation->GetStreamDescriptorByIndex(i, &selected, &streamDescriptor))
+                    && SUCCEEDED(streamDescriptor->GetMediaTypeHandler(&typeHandler))
+                    && SUCCEEDED(typeHandler->GetMajorType(&majorType)) && majorType == MFMediaType_Audio
+                    && SUCCEEDED(typeHandler->GetCurrentMediaType(&mediaType)))
+                {
+                    GUID subtype = GUID_NULL;
+                    mediaType->GetGUID(MF_MT_SUBTYPE, &subtype);
+                    summary->formatTag = subtype.Data1;
+                    mediaType->GetUINT32(MF_MT_AUDIO_NUM_CHANNELS, &summary->channels);
+                    mediaType->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &summary->sampleRate);
+                    foundAudio = true;
+                }
+
+                if (mediaType != nullptr)
+                {
+                    mediaType->Release();
+                }
+                if (typeHandler != nullptr)
+                {
+                    typeHandler->Release();
+                }
+                if (streamDescriptor != nullptr)
+                {
+                    streamDescriptor->Release();
+                }
+            }
+
+            if (SUCCEEDED(result) && !foundAudio)
+            {
+                result = MF_E_INVALIDMEDIATYPE;
+            }
+        }
+
+        if (presentation != nullptr)
+        {
+            presentation->Release();
+        }
+        if (mediaSource != nullptr)
+        {
+            mediaSource->Shutdown();
+            mediaSource->Release();
+        }
+        if (resolver != nullptr)
+        {
+            resolver->Release();
+        }
+        if (byteStream != nullptr)
+        {
+            byteStream->Release();
+        }
+        return result;
+    }
+
+    // Works out what a file on disk is, the same way open() would if FMOD offered it to us, and reads what the
+    // importer needs to know about it.  Gives MF_E_UNSUPPORTED_BYTESTREAM_TYPE for anything that isn't ours.  If the
+    // cache has seen this exact file before, only its tags get read.
+    HRESULT ProbeFile(const WCHAR* path, ProbeCache* cache, ProbedFile* probed)
+    {
+        Win32FileReader fileReader(path);
+        if (!fileReader.IsOpen())
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        uint8_t probe[SignatureProbeSize()];
+        const size_t probeLength = static_cast<size_t>(min(fileReader.GetSize(), static_cast<uint64_t>(sizeof(probe))));
+        probed->mimeType = fileReader.ReadAt(0, probe, probeLength) ? MatchSignature(probe, probeLength) : nullptr;
+        if (probed->mimeType == nullptr)
+        {
+            return MF_E_UNSUPPORTED_BYTESTREAM_TYPE;
+        }
+
+        const bool isMp4 = std::wcscmp(probed->mimeType, L"audio/mp4") == 0 || std::wcsncmp(probed->mimeType, L"audio/3gpp", 10) == 0;
+        const bool isAsf = std::wcscmp(probed->mimeType, L"audio/x-ms-wma") == 0;
+        const uint64_t cacheKey = ProbeCache::MakeKey(path, fileReader.GetSize(), fileReader.GetModifiedTime());
+
+        if (cache != nullptr && cache->Find(cacheKey, &probed->summary))
+        {
+            stats.probeCacheHits++;
+            if (isMp4)
+            {
+                probed->containerInfo.ReadMp4Tags(fileReader);
+            }
+            else if (isAsf)
+            {
+                probed->containerInfo.ReadAsfTags(fileReader);
+            }
+            return S_OK;
+        }
+
+        if (isMp4)
+        {
+            probed->containerInfo.ReadMp4(fileReader);
+        }
+        else if (isAsf)
+        {
+            probed->containerInfo.ReadAsf(fileReader);
+        }
+
+        ProbeRecord& summary = probed->summary;
+        HRESULT result = ReadSourceFormat(path, probed->mimeType, &summary);
+        if (FAILED(result))
+        {
+            return result;
+        }
+        probed->containerInfo.FitTagsToLength(summary.sampleRate);
+
+        const LoopPoints& loopPoints = probed->containerInfo.GetLoopPoints();
+        probed->containerInfo.GetDuration(summary.sampleRate, &summary.durationIn100ns);
+        summary.key = cacheKey;
+        summary.lengthPcm = summary.durationIn100ns * summary.sampleRate / 10000000;
+        summary.encoderDelay = static_cast<uint32_t>(loopPoints.GetEncoderDelay());
+        summary.seekPoints = static_cast<uint32_t>(probed->containerInfo.GetSeekPoints());
+
+        uint64_t loopStart = 0;
+        uint64_t loopEnd = 0;
+        if (loopPoints.GetLoop(&loopStart, &loopEnd))
+        {
+            summary.loopStart = static_cast<uint32_t>(loopStart);
+            summary.loopEnd = static_cast<uint32_t>(loopEnd);
+        }
+
+        if (cache != nullptr)
+        {
+            cache->Add(summary);
+        }
+        return S_OK;
+    }
+
+    // Runs body(0) to body(count - 1) spread across up to threadCount threads (0 for one per core), and returns once
+    // they're all done.  Each thread has COM initialized for it, so body can use Media Foundation.
+    void ParallelFor(size_t count, unsigned int threadCount, const std::function<void(size_t)>& body)
+    {
+        if (threadCount == 0)
+        {
+            threadCount = max(std::thread::hardware_concurrency(), 1u);
+        }
+        threadCount = static_cast<unsigned int>(min(static_cast<size_t>(threadCount), count));
+
+        std::atomic<size_t> nextIndex(0);
+        auto worker = [&nextIndex, count, &body]()
+        {
+            HRESULT comResult = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+            for (size_t index = nextIndex++; index < count; index = nextIndex++)
+            {
+                body(index);
+            }
+
+            if (SUCCEEDED(comResult))
+            {
+                CoUninitialize();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        workers.reserve(threadCount);
+        for (unsigned int i = 0; i < threadCount; ++i)
+        {
+            workers.emplace_back(worker);
+        }
+        for (std::thread& thread : workers)
+        {
+            thread.join();
+        }
+    }
+
     FMOD_CODEC_DESCRIPTION mfCodec = {
         "FMOD Win32 Media Foundation Codec",
         0x00010000,
@@ -1120,6 +3434,74 @@ extern "C" {
     // C++ functions get name-mangled, so we need to export these via extern-C
     __declspec(dllexport) FMOD_CODEC_DESCRIPTION* F_CALL FMODGetCodecDescription();
     __declspec(dllexport) bool __stdcall RegisterLogCallback(FuncCallBack cb);
+
+    // Versioned like FMOD's own structures: callers set cbsize, and we only fill in what fits.
+    struct FMOD_WIN32_MF_STATS
+    {
+        int cbsize;
+        unsigned long long pcmBlockAllocations;
+        unsigned long long seeks;
+        unsigned long long seekFramesDiscarded;     // Decoded ahead of a seek target and thrown away to land on it exactly
+        unsigned long long loopHeadHits;            // Seeks played out of the loop head instead of waiting on the decoder
+        unsigned long long decodersCreated;         // Decoders instantiated for the pool
+        unsigned long long decodersReused;          // Opens that got a decoder back out of the pool
+        unsigned long long probes;                  // Files FMOD has offered us
+        unsigned long long probeRejects;            // ...and that we turned down
+        unsigned long long probeNanoseconds;        // Total time spent working out which was which
+        unsigned long long probeCacheHits;          // Files ProbeFiles() found in the probe cache
+        unsigned long long deferredOpens;           // Opens that left building the source reader until it was needed
+        unsigned long long deferredPipelinesBuilt;  // ...and how many of those it turned out to be needed for
+        unsigned long long fileReads;               // Reads actually made through FMOD's file callbacks
+        unsigned long long fileSeeks;               // Seeks the byte stream made through them, only ever to read somewhere new
+        unsigned long long readCacheHits;           // Blocks Media Foundation's reads found already cached
+        unsigned long long readCacheMisses;         // ...and had to go to the file for
+        unsigned long long memoryStreams;           // Opens that read the whole file into memory
+        unsigned long long memoryStreamsShared;     // ...and found another sound already had it
+        unsigned long long firstSamples;            // Sounds that have got as far as giving FMOD any samples
+        unsigned long long openToFirstSampleNanoseconds;    // Total time from their open() to that
+        unsigned long long streamReads;             // Reads Media Foundation made of the byte stream
+        unsigned long long streamReadNanoseconds;   // Total time it spent waiting on them
+    };
+    __declspec(dllexport) bool __stdcall GetCodecStats(FMOD_WIN32_MF_STATS* outStats);
+
+    enum FMOD_WIN32_MF_SETTING
+    {
+        FMOD_WIN32_MF_SETTING_DECODEAHEAD_MS,   // How far ahead of playback each stream decodes on its own thread.  0 (default) decodes inline.
+        FMOD_WIN32_MF_SETTING_FLOAT_OUTPUT,     // Non-zero to have the decoders output 32-bit float.  Can also be asked for per sound with FMOD_CREATESOUNDEXINFO::format.
+        FMOD_WIN32_MF_SETTING_SPEAKER_MODE,     // An FMOD_SPEAKERMODE to remix anything with more channels than that down to.  FMOD_SPEAKERMODE_DEFAULT (default) leaves them alone.
+        FMOD_WIN32_MF_SETTING_RESAMPLE_RATE,    // Sample rate (normally FMOD's own) to resample everything to.  Needs decode-ahead on.  0 (default) leaves it to FMOD.
+        FMOD_WIN32_MF_SETTING_ASYNC_READER,     // Non-zero to have the source reader decode asynchronously, so read() only waits if it's run out.
+        FMOD_WIN32_MF_SETTING_LOOP_HEAD_MS,     // How much of the start of each stream to keep decoded, so looping back to it doesn't wait on a seek.  0 (default) keeps none.
+        FMOD_WIN32_MF_SETTING_DECODER_POOL_SIZE,    // How many idle decoders to keep around for reuse by later opens.  0 (default) leaves decoders to the source reader.
+        FMOD_WIN32_MF_SETTING_LAZY_OPEN,        // Non-zero to have open() answer from the file's header where it can, and only build the source reader on the first read or seek.  Not with decode-ahead.
+        FMOD_WIN32_MF_SETTING_MEMORY_STREAM_KB, // Files up to this many KiB are read into memory whole at open(), and shared between sounds playing the same file.  0 (default) streams everything.
+    };
+    __declspec(dllexport) bool __stdcall SetCodecSetting(FMOD_WIN32_MF_SETTING setting, int value);
+
+    // One file's worth of ProbeFiles().  Versioned the same way as FMOD_WIN32_MF_STATS; cbsize is also how far apart
+    // the entries in the array are.
+    struct FMOD_WIN32_MF_PROBE
+    {
+        int cbsize;
+        int result;                     // An FMOD_RESULT: FMOD_ERR_FORMAT for anything this codec wouldn't open
+        char mimeType[32];
+        unsigned int formatTag;         // WAVE_FORMAT_* of the encoded audio, e.g. 0x1610 for AAC or 0x0161 for WMA
+        int channels;
+        int sampleRate;
+        unsigned int lengthMs;
+        unsigned int lengthPcm;         // Frames at sampleRate, with any gapless padding trimmed off
+        unsigned int loopStart;         // Tagged loop in frames, end exclusive.  Both 0 if there isn't one.
+        unsigned int loopEnd;
+        char tags[2048];                // UTF-8 "name=value\n" per tag; any that don't fit are left off
+        unsigned int encoderDelay;      // Frames of priming already left out of lengthPcm and the loop points
+        unsigned int seekPoints;        // Places the file's own index lets a seek land exactly; 0 if it hasn't got one
+    };
+    // Probes count files on a pool of threadCount threads (0 for one per core), filling in outProbes[i] for paths[i],
+    // without setting up anything to decode them.  Safe to call while sounds are playing.
+    __declspec(dllexport) bool __stdcall ProbeFiles(const wchar_t* const* paths, int count, FMOD_WIN32_MF_PROBE* outProbes, int threadCount);
+    // Where ProbeFiles() should remember what it's found, so files it's seen before (same path, size and modification
+    // time) only need their tags read.  nullptr (the default) for no cache.  Not to be called during ProbeFiles().
+    __declspec(dllexport) bool __stdcall SetProbeCachePath(const wchar_t* path);
 }
 
 FMOD_CODEC_DESCRIPTION* FMODGetCodecDescription()
@@ -1127,6 +3509,195 @@ FMOD_CODEC_DESCRIPTION* FMODGetCodecDescription()
     return &mediaFoundation::mfCodec;
 }
 
+bool GetCodecStats(FMOD_WIN32_MF_STATS* outStats)
+{
+    if (outStats == nullptr || outStats->cbsize < static_cast<int>(sizeof(int)))
+    {
+        return false;
+    }
+
+    FMOD_WIN32_MF_STATS snapshot = {};
+    snapshot.cbsize = outStats->cbsize;
+    snapshot.pcmBlockAllocations = mediaFoundation::stats.pcmBlockAllocations.load();
+    snapshot.seeks = mediaFoundation::stats.seeks.load();
+    snapshot.seekFramesDiscarded = mediaFoundation::stats.seekFramesDiscarded.load();
+    snapshot.loopHeadHits = mediaFoundation::stats.loopHeadHits.load();
+    snapshot.decodersCreated = mediaFoundation::stats.decodersCreated.load();
+    snapshot.decodersReused = mediaFoundation::stats.decodersReused.load();
+    snapshot.probes = mediaFoundation::stats.probes.load();
+    snapshot.probeRejects = mediaFoundation::stats.probeRejects.load();
+    snapshot.probeNanoseconds = mediaFoundation::stats.probeNanoseconds.load();
+    snapshot.probeCacheHits = mediaFoundation::stats.probeCacheHits.load();
+    snapshot.deferredOpens = mediaFoundation::stats.deferredOpens.load();
+    snapshot.deferredPipelinesBuilt = mediaFoundation::stats.deferredPipelinesBuilt.load();
+    snapshot.fileReads = mediaFoundation::stats.fileReads.load();
+    snapshot.fileSeeks = mediaFoundation::stats.fileSeeks.load();
+    snapshot.readCacheHits = mediaFoundation::stats.readCacheHits.load();
+    snapshot.readCacheMisses = mediaFoundation::stats.readCacheMisses.load();
+    snapshot.memoryStreams = mediaFoundation::stats.memoryStreams.load();
+    snapshot.memoryStreamsShared = mediaFoundation::stats.memoryStreamsShared.load();
+    snapshot.firstSamples = mediaFoundation::stats.firstSamples.load();
+    snapshot.openToFirstSampleNanoseconds = mediaFoundation::stats.openToFirstSampleNanoseconds.load();
+    snapshot.streamReads = mediaFoundation::stats.streamReads.load();
+    snapshot.streamReadNanoseconds = mediaFoundation::stats.streamReadNanoseconds.load();
+
+    // Older callers may hand us a smaller struct than we know about
+    std::memcpy(outStats, &snapshot, min(static_cast<size_t>(outStats->cbsize), sizeof(snapshot)));
+    return true;
+}
+
+bool SetCodecSetting(FMOD_WIN32_MF_SETTING setting, int value)
+{
+    if (value < 0)
+    {
+        return false;
+    }
+
+    switch (setting)
+    {
+    case FMOD_WIN32_MF_SETTING_DECODEAHEAD_MS:
+        {
+            mediaFoundation::settings.decodeAheadMs = static_cast<unsigned int>(value);
+            return true;
+        }
+    case FMOD_WIN32_MF_SETTING_FLOAT_OUTPUT:
+        {
+            mediaFoundation::settings.floatOutput = (value != 0);
+            return true;
+        }
+    case FMOD_WIN32_MF_SETTING_SPEAKER_MODE:
+        {
+            if (value >= FMOD_SPEAKERMODE_MAX)
+            {
+                return false;
+            }
+
+            mediaFoundation::settings.channelLayout = value;
+            return true;
+        }
+    case FMOD_WIN32_MF_SETTING_RESAMPLE_RATE:
+        {
+            mediaFoundation::settings.resampleRate = static_cast<unsigned int>(value);
+            return true;
+        }
+    case FMOD_WIN32_MF_SETTING_ASYNC_READER:
+        {
+            mediaFoundation::settings.asyncReader = (value != 0);
+            return true;
+        }
+    case FMOD_WIN32_MF_SETTING_LOOP_HEAD_MS:
+        {
+            mediaFoundation::settings.loopHeadMs = static_cast<unsigned int>(value);
+            return true;
+        }
+    case FMOD_WIN32_MF_SETTING_DECODER_POOL_SIZE:
+        {
+            mediaFoundation::settings.decoderPoolSize = static_cast<unsigned int>(value);
+            return true;
+        }
+    case FMOD_WIN32_MF_SETTING_LAZY_OPEN:
+        {
+            mediaFoundation::settings.lazyOpen = (value != 0);
+            return true;
+        }
+    case FMOD_WIN32_MF_SETTING_MEMORY_STREAM_KB:
+        {
+            mediaFoundation::settings.memoryStreamKb = static_cast<unsigned int>(value);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ProbeFiles(const wchar_t* const* paths, int count, FMOD_WIN32_MF_PROBE* outProbes, int threadCount)
+{
+    if (paths == nullptr || outProbes == nullptr || count < 0 || threadCount < 0 || outProbes->cbsize < static_cast<int>(sizeof(int)))
+    {
+        return false;
+    }
+
+    std::shared_ptr<mediaFoundation::ProbeCacheFile> cacheFile;
+    {
+        std::lock_guard<std::mutex> lock(mediaFoundation::probeCacheLock);
+        cacheFile = mediaFoundation::probeCacheFile;
+    }
+    mediaFoundation::ProbeCache* cache = (cacheFile != nullptr) ? &cacheFile->GetCache() : nullptr;
+
+    const size_t stride = static_cast<size_t>(outProbes->cbsize);
+    mediaFoundation::ParallelFor(static_cast<size_t>(count), static_cast<unsigned int>(threadCount), [paths, outProbes, stride, cache](size_t index)
+    {
+        FMOD_WIN32_MF_PROBE entry = {};
+        entry.cbsize = static_cast<int>(stride);
+
+        mediaFoundation::ProbedFile probed = {};
+        HRESULT result = mediaFoundation::ProbeFile(paths[index], cache, &probed);
+        if (SUCCEEDED(result))
+        {
+            const mediaFoundation::ProbeRecord& summary = probed.summary;
+            entry.result = FMOD_OK;
+            WideCharToMultiByte(CP_UTF8, 0, probed.mimeType, -1, entry.mimeType, sizeof(entry.mimeType), nullptr, nullptr);
+            entry.formatTag = summary.formatTag;
+            entry.channels = static_cast<int>(summary.channels);
+            entry.sampleRate = static_cast<int>(summary.sampleRate);
+            entry.lengthMs = static_cast<unsigned int>(summary.durationIn100ns / 10000);
+            entry.lengthPcm = static_cast<unsigned int>(summary.lengthPcm);
+            entry.loopStart = summary.loopStart;
+            entry.loopEnd = summary.loopEnd;
+            entry.encoderDelay = summary.encoderDelay;
+            entry.seekPoints = summary.seekPoints;
+
+            size_t tagsUsed = 0;
+            for (const auto& tag : probed.containerInfo.GetTags())
+            {
+                const size_t tagLength = tag.first.size() + 1 + tag.second.size() + 1;
+                if (tagsUsed + tagLength < sizeof(entry.tags))
+                {
+                    std::memcpy(entry.tags + tagsUsed, tag.first.data(), tag.first.size());
+                    entry.tags[tagsUsed + tag.first.size()] = '=';
+                    std::memcpy(entry.tags + tagsUsed + tag.first.size() + 1, tag.second.data(), tag.second.size());
+                    entry.tags[tagsUsed + tagLength - 1] = '\n';
+                    tagsUsed += tagLength;
+                }
+            }
+        }
+        else if (result == MF_E_UNSUPPORTED_BYTESTREAM_TYPE || result == MF_E_INVALIDMEDIATYPE)
+        {
+            entry.result = FMOD_ERR_FORMAT;
+        }
+        else if (result == HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND) || result == HRESULT_FROM_WIN32(ERROR_PATH_NOT_FOUND))
+        {
+            entry.result = FMOD_ERR_FILE_NOTFOUND;
+        }
+        else
+        {
+            entry.result = FMOD_ERR_FILE_BAD;
+        }
+
+        FMOD_WIN32_MF_PROBE* outEntry = reinterpret_cast<FMOD_WIN32_MF_PROBE*>(reinterpret_cast<char*>(outProbes) + index * stride);
+        std::memcpy(outEntry, &entry, min(stride, sizeof(entry)));
+    });
+    return true;
+}
+
+bool SetProbeCachePath(const wchar_t* path)
+{
+    std::shared_ptr<mediaFoundation::ProbeCacheFile> cacheFile;
+    if (path != nullptr)
+    {
+        cacheFile = std::make_shared<mediaFoundation::ProbeCacheFile>();
+        if (!cacheFile->Open(path))
+        {
+            PATCH_LOG("Couldn't open the probe cache file.");
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mediaFoundation::probeCacheLock);
+    mediaFoundation::probeCacheFile = std::move(cacheFile);
+    return true;
+}
+
 static FuncCallBack callbackInstance = nullptr;
 bool RegisterLogCallback(FuncCallBack cb)
 {
@@ -1176,6 +3747,7 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
     }
     else if (fdwReason == DLL_PROCESS_DETACH)
     {
+        mediaFoundation::objectCache.Clear();
         MFShutdown();
         CoUninitialize();
     }
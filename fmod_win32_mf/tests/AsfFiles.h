@@ -0,0 +1,106 @@
+#pragma once
+
+#include "AsfParser.h"
+#include "TestFiles.h"
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+
+// The objects an ASF file is made of, for building ones in memory to parse.  Times are in milliseconds, except for
+// the play duration, which like the file's own is in 100ns units and includes the preroll.
+namespace testFiles
+{
+    inline Bytes Object(const mediaFoundation::asf::Guid& guid, const Bytes& payload)
+    {
+        Bytes object(guid, guid + sizeof(mediaFoundation::asf::Guid));
+        AppendLittleEndian(&object, payload.size() + mediaFoundation::asf::objectHeaderSize, 8);
+        Append(&object, payload);
+        return object;
+    }
+
+    inline Bytes Utf16(const std::u16string& text)
+    {
+        Bytes bytes;
+        for (char16_t character : text)
+        {
+            AppendLittleEndian(&bytes, character, 2);
+        }
+        AppendLittleEndian(&bytes, 0, 2);
+        return bytes;
+    }
+
+    inline Bytes FileProperties(uint64_t packetCount, uint32_t minPacketSize, uint32_t maxPacketSize, uint64_t playDuration, uint64_t prerollMs)
+    {
+        Bytes fields(16, 0x11);
+        AppendLittleEndian(&fields, 0, 16);
+        AppendLittleEndian(&fields, packetCount, 8);
+        AppendLittleEndian(&fields, playDuration, 8);
+        AppendLittleEndian(&fields, playDuration, 8);
+        AppendLittleEndian(&fields, prerollMs, 8);
+        AppendLittleEndian(&fields, 2, 4);
+        AppendLittleEndian(&fields, minPacketSize, 4);
+        AppendLittleEndian(&fields, maxPacketSize, 4);
+        AppendLittleEndian(&fields, 128000, 4);
+        return Object(mediaFoundation::asf::filePropertiesObject, fields);
+    }
+
+    // WMA 2, stereo, 44.1 kHz, on the given stream number
+    inline Bytes AudioStreamProperties(uint16_t streamNumber)
+    {
+        Bytes fields(mediaFoundation::asf::audioMedia, mediaFoundation::asf::audioMedia + sizeof(mediaFoundation::asf::Guid));
+        AppendLittleEndian(&fields, 0, 16);
+        AppendLittleEndian(&fields, 0, 8);
+        AppendLittleEndian(&fields, 18, 4);
+        AppendLittleEndian(&fields, 0, 4);
+        AppendLittleEndian(&fields, streamNumber, 2);
+        AppendLittleEndian(&fields, 0, 4);
+        AppendLittleEndian(&fields, 0x161, 2);
+        AppendLittleEndian(&fields, 2, 2);
+        AppendLittleEndian(&fields, 44100, 4);
+        AppendLittleEndian(&fields, 16000, 4);
+        AppendLittleEndian(&fields, 2973, 2);
+        AppendLittleEndian(&fields, 16, 2);
+        AppendLittleEndian(&fields, 0, 2);
+        return Object(mediaFoundation::asf::streamPropertiesObject, fields);
+    }
+
+    // The header object around the given children
+    inline Bytes HeaderObject(std::initializer_list<Bytes> children)
+    {
+        Bytes all;
+        for (const Bytes& child : children)
+        {
+            Append(&all, child);
+        }
+
+        Bytes header(mediaFoundation::asf::headerObject, mediaFoundation::asf::headerObject + sizeof(mediaFoundation::asf::Guid));
+        AppendLittleEndian(&header, all.size() + 30, 8);
+        AppendLittleEndian(&header, children.size(), 4);
+        AppendLittleEndian(&header, 0x0201, 2);
+        Append(&header, all);
+        return header;
+    }
+
+    // The data object's own fields, for packetCount packets to follow, which it may declare to be some other number
+    inline Bytes DataObjectHeader(uint64_t packetCount, uint32_t packetSize, uint64_t declaredPackets)
+    {
+        Bytes data(mediaFoundation::asf::dataObject, mediaFoundation::asf::dataObject + sizeof(mediaFoundation::asf::Guid));
+        AppendLittleEndian(&data, mediaFoundation::asf::dataObjectHeaderSize + packetCount * packetSize, 8);
+        AppendLittleEndian(&data, 0, 16);
+        AppendLittleEndian(&data, declaredPackets, 8);
+        AppendLittleEndian(&data, 0x0101, 2);
+        return data;
+    }
+
+    // Each packet starts with 2 bytes of error correction data, then payload parsing information with a 1-byte
+    // padding length field ahead of the send time.  One a second, after the preroll.
+    inline Bytes Packet(uint64_t number, uint32_t packetSize, uint64_t prerollMs)
+    {
+        Bytes packet = { 0x82, 0x00, 0x00, 0x08, 0x5D, 0x00 };
+        AppendLittleEndian(&packet, prerollMs + number * 1000, 4);
+        AppendLittleEndian(&packet, 1000, 2);
+        packet.resize(packetSize, 0);
+        return packet;
+    }
+}
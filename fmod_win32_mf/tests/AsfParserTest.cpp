@@ -0,0 +1,300 @@
+#include "AsfFiles.h"
+#include "AsfParser.h"
+#include "TestCheck.h"
+#include "TestFiles.h"
+
+#include <map>
+#include <string>
+
+using namespace mediaFoundation;
+using namespace testFiles;
+
+namespace
+{
+    constexpr uint32_t packetSize = 64;
+    constexpr uint64_t packets = 10;
+    constexpr uint64_t prerollMs = 3000;
+
+    Bytes ContentDescription()
+    {
+        Bytes fields;
+        AppendLittleEndian(&fields, 5, 2);
+        auto attribute = [&fields](const std::u16string& name, uint16_t type, const Bytes& value)
+        {
+            const Bytes nameBytes = Utf16(name);
+            AppendLittleEndian(&fields, nameBytes.size(), 2);
+            Append(&fields, nameBytes);
+            AppendLittleEndian(&fields, type, 2);
+            AppendLittleEndian(&fields, value.size(), 2);
+            Append(&fields, value);
+        };
+
+        Bytes dword, qword, word;
+        AppendLittleEndian(&dword, 4410, 4);
+        AppendLittleEndian(&qword, 88200, 8);
+        AppendLittleEndian(&word, 7, 2);
+        attribute(u"LOOPSTART", 3, dword);
+        attribute(u"LOOPEND", 4, qword);
+        attribute(u"WM/TrackNumber", 5, word);
+        attribute(u"Title", 0, Utf16(u"Café"));
+        attribute(u"WM/Picture", 1, Bytes(10, 0));
+        return Object(asf::extendedContentDescriptionObject, fields);
+    }
+
+    Bytes SimpleIndex()
+    {
+        // An entry every 2 seconds, the last one past the end, as the padding some muxers write
+        Bytes fields(16, 0x11);
+        AppendLittleEndian(&fields, 20000000, 8);
+        AppendLittleEndian(&fields, 1, 4);
+        AppendLittleEndian(&fields, 6, 4);
+        for (uint32_t packet : { 0u, 2u, 4u, 6u, 8u, 0xFFFFFFFFu })
+        {
+            AppendLittleEndian(&fields, packet, 4);
+            AppendLittleEndian(&fields, 1, 2);
+        }
+        return Object(asf::simpleIndexObject, fields);
+    }
+
+    // Two specifiers, with the audio stream's second, in one block
+    Bytes Index(uint16_t audioStream)
+    {
+        Bytes fields;
+        AppendLittleEndian(&fields, 3000, 4);
+        AppendLittleEndian(&fields, 2, 2);
+        AppendLittleEndian(&fields, 1, 4);
+        AppendLittleEndian(&fields, audioStream + 1, 2);
+        AppendLittleEndian(&fields, 1, 2);
+        AppendLittleEndian(&fields, audioStream, 2);
+        AppendLittleEndian(&fields, 1, 2);
+
+        // The other stream's entries would all point at packet 1
+        AppendLittleEndian(&fields, 4, 4);
+        AppendLittleEndian(&fields, packetSize, 8);
+        AppendLittleEndian(&fields, 0, 8);
+        for (uint64_t entry = 0; entry < 4; ++entry)
+        {
+            AppendLittleEndian(&fields, 0, 4);
+            AppendLittleEndian(&fields, entry * 3 * packetSize, 4);
+        }
+        return Object(asf::indexObject, fields);
+    }
+
+    struct FileOptions
+    {
+        uint64_t declaredPackets = packets;
+        uint32_t maxPacketSize = packetSize;
+        bool simpleIndex = false;
+        bool index = false;
+    };
+
+    Bytes MakeFile(const FileOptions& options)
+    {
+        const uint64_t playDuration = (packets * 1000 + prerollMs) * 10000;
+        Bytes file = HeaderObject({ FileProperties(options.declaredPackets, packetSize, options.maxPacketSize, playDuration, prerollMs), AudioStreamProperties(2), ContentDescription() });
+        Append(&file, DataObjectHeader(packets, packetSize, options.declaredPackets));
+        for (uint64_t packet = 0; packet < packets; ++packet)
+        {
+            Append(&file, Packet(packet, packetSize, prerollMs));
+        }
+
+        if (options.index)
+        {
+            Append(&file, Index(2));
+        }
+        if (options.simpleIndex)
+        {
+            Append(&file, SimpleIndex());
+        }
+        return file;
+    }
+
+    void CheckEntry(const AsfFileInfo& info, uint64_t time, uint64_t expectedTime, uint64_t expectedPacket)
+    {
+        uint64_t entryTime = 0, packet = 0;
+        CHECK(info.FindIndexEntry(time, &entryTime, &packet));
+        CHECK(entryTime == expectedTime && packet == expectedPacket);
+    }
+
+    void TestHeader()
+    {
+        const Bytes file = MakeFile({});
+        MemoryReader reader(file);
+        AsfFileInfo info;
+        CHECK(info.Parse(reader));
+
+        // Play duration less the preroll
+        CHECK(info.GetDuration() == packets * 1000 * 10000);
+        CHECK(info.GetPacketCount() == packets);
+        CHECK(info.GetPacketOffset(1) - info.GetPacketOffset(0) == packetSize);
+        CHECK(info.GetPacketOffset(0) == file.size() - packets * packetSize);
+
+        uint16_t formatTag = 0, channels = 0, bitsPerSample = 0;
+        uint32_t sampleRate = 0;
+        CHECK(info.GetAudioFormat(&formatTag, &channels, &sampleRate, &bitsPerSample));
+        CHECK(formatTag == 0x161 && channels == 2 && sampleRate == 44100 && bitsPerSample == 16);
+
+        CHECK(!info.HasIndex());
+        uint64_t entryTime = 0, packet = 0;
+        CHECK(!info.FindIndexEntry(0, &entryTime, &packet));
+    }
+
+    void TestFileIndexes()
+    {
+        FileOptions options;
+        options.simpleIndex = true;
+        {
+            const Bytes file = MakeFile(options);
+            MemoryReader reader(file);
+            AsfFileInfo info;
+            CHECK(info.Parse(reader));
+            CHECK(info.HasFileIndex());
+
+            // The entry past the last packet is dropped
+            CheckEntry(info, 0, 0, 0);
+            CheckEntry(info, 39999999, 20000000, 2);
+            CheckEntry(info, 80000000, 80000000, 8);
+            CheckEntry(info, 200000000, 80000000, 8);
+        }
+
+        // The Index Object takes priority when both are there, and its audio specifier is the one that's used
+        options.index = true;
+        {
+            const Bytes file = MakeFile(options);
+            MemoryReader reader(file);
+            AsfFileInfo info;
+            CHECK(info.Parse(reader));
+            CHECK(info.HasFileIndex());
+            CheckEntry(info, 30000000, 30000000, 3);
+            CheckEntry(info, 95000000, 90000000, 9);
+        }
+    }
+
+    void TestSampledIndex()
+    {
+        const Bytes file = MakeFile({});
+        MemoryReader reader(file);
+        AsfFileInfo info;
+        CHECK(info.Parse(reader));
+        CHECK(info.BuildSampledIndex(reader));
+        CHECK(info.HasIndex() && !info.HasFileIndex());
+
+        // A second a packet, starting after the preroll
+        CheckEntry(info, 0, 0, 0);
+        CheckEntry(info, 45000000, 40000000, 4);
+        CheckEntry(info, 1000000000, 90000000, 9);
+    }
+
+    void TestUnusualFiles()
+    {
+        // A broadcast file doesn't know its packet count; the data object's size says it instead
+        {
+            FileOptions options;
+            options.declaredPackets = 0;
+            const Bytes file = MakeFile(options);
+            MemoryReader reader(file);
+            AsfFileInfo info;
+            CHECK(info.Parse(reader));
+            CHECK(info.GetPacketCount() == packets);
+        }
+
+        // Nor can it have more packets than fit
+        {
+            FileOptions options;
+            options.declaredPackets = 1000;
+            const Bytes file = MakeFile(options);
+            MemoryReader reader(file);
+            AsfFileInfo info;
+            CHECK(info.Parse(reader));
+            CHECK(info.GetPacketCount() == packets);
+        }
+
+        // Variable-size packets aren't supported
+        {
+            FileOptions options;
+            options.maxPacketSize = packetSize * 2;
+            const Bytes file = MakeFile(options);
+            MemoryReader reader(file);
+            CHECK(!AsfFileInfo().Parse(reader));
+        }
+
+        // Not ASF at all
+        {
+            const Bytes file(1000, 0);
+            MemoryReader reader(file);
+            CHECK(!AsfFileInfo().Parse(reader));
+        }
+    }
+
+    void TestContentAttributes()
+    {
+        const Bytes file = MakeFile({});
+        MemoryReader reader(file);
+        std::map<std::string, std::string> tags;
+        asf::ForEachContentAttribute(reader, [&tags](const std::string& name, const std::string& value) { tags[name] = value; });
+
+        // Byte arrays are skipped, and anything outside ASCII flattened
+        CHECK(tags.size() == 4);
+        CHECK(tags["LOOPSTART"] == "4410");
+        CHECK(tags["LOOPEND"] == "88200");
+        CHECK(tags["WM/TrackNumber"] == "7");
+        CHECK(tags["Title"] == "Caf?");
+    }
+
+    // Cut short, the header and data objects have to be all there to parse, and an index only counts if it's
+    // complete.  With garbage anywhere, whatever parses has to make sense.
+    void TestDamagedFiles()
+    {
+        FileOptions options;
+        options.simpleIndex = true;
+        const Bytes file = MakeFile(options);
+        const size_t dataEnd = file.size() - SimpleIndex().size();
+
+        for (size_t size = 0; size < file.size(); ++size)
+        {
+            MemoryReader reader(file, size);
+            AsfFileInfo info;
+            const bool parsed = info.Parse(reader);
+            if (parsed != (size >= dataEnd) || (parsed && info.HasFileIndex()))
+            {
+                std::fprintf(stderr, "Wrong result for a file cut off at %zu bytes of %zu\n", size, file.size());
+                CHECK(false);
+            }
+            info.BuildSampledIndex(reader);
+            asf::ForEachContentAttribute(reader, [](const std::string&, const std::string&) { });
+        }
+
+        Bytes damaged = file;
+        for (size_t position = 0; position < damaged.size(); ++position)
+        {
+            for (uint8_t garbage : { 0x00, 0x7F, 0xFF })
+            {
+                const uint8_t original = damaged[position];
+                damaged[position] = garbage;
+
+                MemoryReader reader(damaged);
+                AsfFileInfo info;
+                if (info.Parse(reader) && info.BuildSampledIndex(reader))
+                {
+                    uint64_t entryTime = 0, packet = 0;
+                    CHECK(info.FindIndexEntry(info.GetDuration() / 2, &entryTime, &packet));
+                    CHECK(packet < info.GetPacketCount());
+                }
+                asf::ForEachContentAttribute(reader, [](const std::string&, const std::string&) { });
+
+                damaged[position] = original;
+            }
+        }
+    }
+}
+
+int main()
+{
+    TestHeader();
+    TestFileIndexes();
+    TestSampledIndex();
+    TestUnusualFiles();
+    TestContentAttributes();
+    TestDamagedFiles();
+    return TestResult();
+}
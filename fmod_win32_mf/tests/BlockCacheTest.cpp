@@ -0,0 +1,371 @@
+#include "BlockCache.h"
+#include "FileCursor.h"
+#include "TestCheck.h"
+#include "TestFiles.h"
+
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace mediaFoundation;
+using namespace testFiles;
+
+namespace
+{
+    const size_t blockSize = BlockCache::blockSize;
+
+    // A file for the cache to fetch from, which keeps a log of every fetch.  Can be made to fail, or to hold less than
+    // the cache was told.  Fetches go through a FileCursor, as FmodReadStream::FetchBlock()'s do, onto a file with
+    // only a current position like FMOD's, which counts the seeks it's asked for.
+    class FakeFile
+    {
+    public:
+        explicit FakeFile(size_t size) :
+            contents(size),
+            failFetches(false),
+            position(0),
+            seeks(0),
+            cursor(0, [this](uint64_t offset) { return Seek(offset); }, [this](void* dest, size_t bytes, size_t* bytesRead) { return ReadFile(dest, bytes, bytesRead); })
+        {
+            for (size_t i = 0; i < size; ++i)
+            {
+                contents[i] = static_cast<uint8_t>((i * 2654435761u) >> 13);
+            }
+        }
+
+        std::function<bool(uint64_t, void*, size_t, size_t*)> Fetcher()
+        {
+            return [this](uint64_t offset, void* dest, size_t bytes, size_t* bytesFetched)
+            {
+                fetches.emplace_back(offset, bytes);
+                return cursor.Read(offset, dest, bytes, bytesFetched);
+            };
+        }
+
+        // What the cursor sees: like FMOD's fileseek and fileread, moving and reading from a current position
+        bool Seek(uint64_t offset)
+        {
+            seeks++;
+            position = offset;
+            return !failFetches;
+        }
+
+        bool ReadFile(void* dest, size_t bytes, size_t* bytesRead)
+        {
+            *bytesRead = 0;
+            if (failFetches)
+            {
+                return false;
+            }
+            if (position < contents.size())
+            {
+                *bytesRead = std::min<size_t>(bytes, contents.size() - static_cast<size_t>(position));
+                std::memcpy(dest, contents.data() + position, *bytesRead);
+            }
+            position += *bytesRead;
+            return true;
+        }
+
+        bool Matches(uint64_t offset, const Bytes& data, size_t bytes) const
+        {
+            return bytes == 0 || (offset + bytes <= contents.size() && std::memcmp(contents.data() + offset, data.data(), bytes) == 0);
+        }
+
+        Bytes contents;
+        std::vector<std::pair<uint64_t, size_t>> fetches;
+        bool failFetches;
+        uint64_t position;
+        size_t seeks;
+        FileCursor cursor;
+    };
+
+    // Reads through the cache and checks what comes back against the file.
+    size_t ReadAndCheck(BlockCache& cache, const FakeFile& file, uint64_t offset, size_t bytes)
+    {
+        Bytes data(bytes);
+        bool failed = true;
+        const size_t bytesRead = cache.Read(offset, data.data(), bytes, &failed);
+        CHECK(!failed);
+        CHECK(file.Matches(offset, data, bytesRead));
+        return bytesRead;
+    }
+
+    bool CountsAre(BlockCache& cache, unsigned long long expectedHits, unsigned long long expectedMisses)
+    {
+        unsigned long long hits = 0;
+        unsigned long long misses = 0;
+        cache.TakeCounts(&hits, &misses);
+        return hits == expectedHits && misses == expectedMisses;
+    }
+
+    void TestSmallReads()
+    {
+        FakeFile file(20 * blockSize);
+        BlockCache cache(file.contents.size(), file.Fetcher());
+
+        // The start of the file counts as reading in order, so it's fetched two blocks at a time from the off
+        CHECK(ReadAndCheck(cache, file, 0, 8) == 8);
+        CHECK(file.fetches.size() == 1);
+        CHECK(file.fetches[0] == std::make_pair(uint64_t(0), 2 * blockSize));
+
+        unsigned long long reads = 0;
+        for (uint64_t offset = 8; offset < 2 * blockSize - 100; offset += 997)
+        {
+            ReadAndCheck(cache, file, offset, 100);
+            ++reads;
+        }
+        CHECK(file.fetches.size() == 1);
+        CHECK(CountsAre(cache, reads, 1));
+        CHECK(CountsAre(cache, 0, 0));
+
+        // Somewhere else: just the one block, until the reads carry on from it
+        ReadAndCheck(cache, file, 10 * blockSize + 5, 16);
+        CHECK(file.fetches.back() == std::make_pair(uint64_t(10 * blockSize), blockSize));
+        ReadAndCheck(cache, file, 11 * blockSize + 5, 16);
+        CHECK(file.fetches.back() == std::make_pair(uint64_t(11 * blockSize), 2 * blockSize));
+        ReadAndCheck(cache, file, 12 * blockSize + 5, 16);
+        CHECK(file.fetches.size() == 3);
+        CHECK(CountsAre(cache, 1, 2));
+
+        // A read across a block boundary is one hit or miss for each block
+        ReadAndCheck(cache, file, 12 * blockSize - 10, 20);
+        CHECK(CountsAre(cache, 2, 0));
+        ReadAndCheck(cache, file, 13 * blockSize - 10, 20);
+        CHECK(file.fetches.back() == std::make_pair(uint64_t(13 * blockSize), 2 * blockSize));
+        CHECK(CountsAre(cache, 1, 1));
+    }
+
+    void TestSequentialReads()
+    {
+        // Not a whole number of blocks, so the last fetch is short
+        const size_t blocks = 9;
+        FakeFile file(blocks * blockSize - 1234);
+        BlockCache cache(file.contents.size(), file.Fetcher());
+
+        const size_t chunk = 4096;
+        size_t reads = 0;
+        uint64_t offset = 0;
+        while (offset < file.contents.size())
+        {
+            const size_t bytesRead = ReadAndCheck(cache, file, offset, chunk);
+            CHECK(bytesRead == std::min<size_t>(chunk, file.contents.size() - offset));
+            offset += bytesRead;
+            ++reads;
+        }
+
+        // Two blocks at a time, each carrying on from the last, and never past the end of the file
+        CHECK(file.fetches.size() == (blocks + 1) / 2);
+        uint64_t expectedOffset = 0;
+        for (const auto& fetch : file.fetches)
+        {
+            CHECK(fetch.first == expectedOffset);
+            CHECK(fetch.first + fetch.second <= file.contents.size());
+            expectedOffset = fetch.first + fetch.second;
+        }
+        CHECK(expectedOffset == file.contents.size());
+        CHECK(CountsAre(cache, reads - file.fetches.size(), file.fetches.size()));
+
+        // Past the end is nothing, and doesn't fetch anything
+        Bytes data(16);
+        bool failed = true;
+        CHECK(cache.Read(file.contents.size(), data.data(), data.size(), &failed) == 0 && !failed);
+        CHECK(cache.Read(file.contents.size() + blockSize, data.data(), data.size(), &failed) == 0 && !failed);
+        CHECK(file.fetches.size() == (blocks + 1) / 2);
+    }
+
+    void TestEviction()
+    {
+        FakeFile file(100 * blockSize);
+        BlockCache cache(file.contents.size(), file.Fetcher());
+
+        // Four blocks apart from each other fill the cache, one fetch each
+        const uint64_t blockIndices[] = { 20, 30, 40, 50 };
+        for (uint64_t index : blockIndices)
+        {
+            ReadAndCheck(cache, file, index * blockSize, 16);
+        }
+        CHECK(file.fetches.size() == 4);
+
+        // Using 20 again leaves 30 the oldest, which is the one a fifth block pushes out
+        ReadAndCheck(cache, file, 20 * blockSize + 100, 16);
+        ReadAndCheck(cache, file, 60 * blockSize, 16);
+        CHECK(file.fetches.size() == 5);
+        CHECK(CountsAre(cache, 1, 5));
+
+        for (uint64_t index : { 20, 40, 50, 60 })
+        {
+            ReadAndCheck(cache, file, index * blockSize + 200, 16);
+        }
+        CHECK(file.fetches.size() == 5);
+        ReadAndCheck(cache, file, 30 * blockSize, 16);
+        CHECK(file.fetches.back() == std::make_pair(uint64_t(30 * blockSize), blockSize));
+        CHECK(CountsAre(cache, 4, 1));
+
+        // 30 pushed out 20, leaving 40, 50, 60 and 30.  A read-ahead takes two slots, and the block that was asked for
+        // stays longest: 31 comes in with 32, pushing out 40 and 50, and then three more blocks push out 60, 30 and 32.
+        ReadAndCheck(cache, file, 31 * blockSize, 16);
+        CHECK(file.fetches.back() == std::make_pair(uint64_t(31 * blockSize), 2 * blockSize));
+        for (uint64_t index : { 70, 80, 90 })
+        {
+            ReadAndCheck(cache, file, index * blockSize, 16);
+        }
+        const size_t fetchCount = file.fetches.size();
+        ReadAndCheck(cache, file, 31 * blockSize + 300, 16);
+        CHECK(file.fetches.size() == fetchCount);
+        ReadAndCheck(cache, file, 32 * blockSize, 16);
+        CHECK(file.fetches.size() == fetchCount + 1);
+    }
+
+    void TestLargeReads()
+    {
+        FakeFile file(10 * blockSize + 77);
+        BlockCache cache(file.contents.size(), file.Fetcher());
+
+        // Straight through to the file at whatever offset and length was asked for, without touching the cache
+        CHECK(ReadAndCheck(cache, file, 5, blockSize) == blockSize);
+        CHECK(file.fetches.size() == 1 && file.fetches[0] == std::make_pair(uint64_t(5), blockSize));
+        CHECK(ReadAndCheck(cache, file, 3 * blockSize + 1, 3 * blockSize) == 3 * blockSize);
+        CHECK(file.fetches.size() == 2);
+        CHECK(CountsAre(cache, 0, 2));
+
+        ReadAndCheck(cache, file, 100, 16);
+        CHECK(file.fetches.size() == 3);
+        CHECK(CountsAre(cache, 0, 1));
+
+        // Trimmed to the end of the file first; what's left may then be small enough for the cache
+        CHECK(ReadAndCheck(cache, file, 8 * blockSize, 4 * blockSize) == 2 * blockSize + 77);
+        CHECK(file.fetches.back() == std::make_pair(uint64_t(8 * blockSize), 2 * blockSize + 77));
+        CHECK(ReadAndCheck(cache, file, 10 * blockSize, blockSize) == 77);
+        CHECK(file.fetches.back() == std::make_pair(uint64_t(10 * blockSize), size_t(77)));
+    }
+
+    void TestShortFile()
+    {
+        // The cache was told the file's bigger than it turns out to be
+        FakeFile file(3 * blockSize + 500);
+        BlockCache cache(5 * blockSize, file.Fetcher());
+
+        CHECK(ReadAndCheck(cache, file, 3 * blockSize + 400, 200) == 100);
+        CHECK(ReadAndCheck(cache, file, 3 * blockSize + 500, 200) == 0);
+        CHECK(ReadAndCheck(cache, file, 4 * blockSize, 200) == 0);
+        CHECK(ReadAndCheck(cache, file, 4 * blockSize, blockSize) == 0);
+    }
+
+    void TestFailedFetches()
+    {
+        FakeFile file(10 * blockSize);
+        BlockCache cache(file.contents.size(), file.Fetcher());
+
+        ReadAndCheck(cache, file, 0, 16);
+        file.failFetches = true;
+
+        // Whatever was already cached still comes back, along with the failure
+        Bytes data(200);
+        bool failed = false;
+        CHECK(cache.Read(2 * blockSize - 100, data.data(), data.size(), &failed) == 100);
+        CHECK(failed);
+        CHECK(file.Matches(2 * blockSize - 100, data, 100));
+
+        failed = false;
+        CHECK(cache.Read(5 * blockSize, data.data(), data.size(), &failed) == 0 && failed);
+        failed = false;
+        Bytes large(blockSize);
+        cache.Read(5 * blockSize, large.data(), large.size(), &failed);
+        CHECK(failed);
+
+        // Nothing from a failed fetch is kept, so once the file's readable again it's fetched afresh
+        file.failFetches = false;
+        const size_t fetchCount = file.fetches.size();
+        CHECK(ReadAndCheck(cache, file, 2 * blockSize - 100, 200) == 200);
+        CHECK(ReadAndCheck(cache, file, 5 * blockSize, 200) == 200);
+        CHECK(file.fetches.size() == fetchCount + 2);
+    }
+
+    // What Media Foundation does with an M4A whose moov comes last: a few header reads at the start, a jump to the end
+    // for the sample tables, then back to the start of mdat to decode it an access unit at a time.  Only the two jumps
+    // should seek; decoding all the way through shouldn't seek once, nor fetch anything twice.
+    void TestDecodeSeeks()
+    {
+        const size_t mdatStart = 40;
+        const size_t moovSize = 20000;
+        FakeFile file(60 * blockSize + 12345);
+        const size_t mdatEnd = file.contents.size() - moovSize;
+        BlockCache cache(file.contents.size(), file.Fetcher());
+
+        ReadAndCheck(cache, file, 0, 8);
+        ReadAndCheck(cache, file, 8, 24);
+        ReadAndCheck(cache, file, 32, 8);
+        CHECK(file.seeks == 0);
+
+        for (uint64_t offset = mdatEnd; offset < file.contents.size(); offset += 500)
+        {
+            ReadAndCheck(cache, file, offset, 8);
+            ReadAndCheck(cache, file, offset + 8, 492);
+        }
+        CHECK(file.seeks == 1);
+
+        std::mt19937 random(54321);
+        uint64_t offset = mdatStart;
+        while (offset < mdatEnd)
+        {
+            const size_t accessUnit = std::min<size_t>(200 + random() % 1200, mdatEnd - offset);
+            CHECK(ReadAndCheck(cache, file, offset, accessUnit) == accessUnit);
+            offset += accessUnit;
+        }
+        CHECK(file.seeks == 2);
+
+        uint64_t bytesFetched = 0;
+        for (const auto& fetch : file.fetches)
+        {
+            bytesFetched += fetch.second;
+        }
+        CHECK(bytesFetched <= file.contents.size() + 2 * blockSize);
+
+        // After a failed fetch nobody knows where the file is, so even a fetch carrying on from the last good one seeks
+        FakeFile failing(10 * blockSize);
+        BlockCache failingCache(failing.contents.size(), failing.Fetcher());
+        ReadAndCheck(failingCache, failing, 0, 16);
+        failing.failFetches = true;
+        Bytes data(16);
+        bool failed = false;
+        failingCache.Read(2 * blockSize, data.data(), data.size(), &failed);
+        CHECK(failed);
+        failing.failFetches = false;
+        ReadAndCheck(failingCache, failing, 2 * blockSize, 16);
+        CHECK(failing.seeks == 1);
+    }
+
+    // Reads of every size at random against the file, in runs that sometimes carry on from each other
+    void TestRandomReads()
+    {
+        FakeFile file(37 * blockSize + 4321);
+        BlockCache cache(file.contents.size(), file.Fetcher());
+
+        std::mt19937 random(12345);
+        uint64_t offset = 0;
+        for (int i = 0; i < 20000; ++i)
+        {
+            if (random() % 8 == 0)
+            {
+                offset = random() % (file.contents.size() + 100);
+            }
+            const size_t bytes = (random() % 16 == 0) ? random() % (2 * blockSize) : random() % 3000;
+            const size_t bytesRead = ReadAndCheck(cache, file, offset, bytes);
+            CHECK(bytesRead == ((offset < file.contents.size()) ? std::min<size_t>(bytes, file.contents.size() - offset) : 0));
+            offset += bytesRead;
+        }
+    }
+}
+
+int main()
+{
+    TestSmallReads();
+    TestSequentialReads();
+    TestEviction();
+    TestLargeReads();
+    TestShortFile();
+    TestFailedFetches();
+    TestDecodeSeeks();
+    TestRandomReads();
+    return TestResult();
+}
@@ -0,0 +1,149 @@
+#include "ChannelMix.h"
+#include "TestCheck.h"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace mediaFoundation;
+
+namespace
+{
+    bool Near(float a, float b)
+    {
+        return std::fabs(a - b) <= 1e-6f;
+    }
+
+    void TestStereoFromFivePointOne()
+    {
+        using namespace speakers;
+        const unsigned int fivePointOne = frontLeft | frontRight | frontCenter | lowFrequency | backLeft | backRight;
+        const ChannelMatrix matrix = BuildChannelMatrix(6, fivePointOne, ChannelLayout::Stereo);
+
+        CHECK(matrix.IsActive());
+        CHECK(matrix.inputChannels == 6 && matrix.outputChannels == 2);
+        CHECK(matrix.outputMask == (frontLeft | frontRight));
+
+        // Fronts straight through, centre and surrounds at -3 dB into their side, LFE dropped
+        const float expected[6][2] = { { 1, 0 }, { 0, 1 }, { channelMixing::minus3dB, channelMixing::minus3dB }, { 0, 0 },
+            { channelMixing::minus3dB, 0 }, { 0, channelMixing::minus3dB } };
+        for (unsigned int input = 0; input < 6; ++input)
+        {
+            for (unsigned int output = 0; output < 2; ++output)
+            {
+                CHECK(Near(matrix.Get(input, output), expected[input][output]));
+            }
+        }
+
+        const float frame[6] = { 0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f };
+        float mixed[2] = {};
+        MixChannels(frame, mixed, 1, matrix);
+        CHECK(Near(mixed[0], 0.1f + (0.3f + 0.5f) * channelMixing::minus3dB));
+        CHECK(Near(mixed[1], 0.2f + (0.3f + 0.6f) * channelMixing::minus3dB));
+    }
+
+    void TestOtherLayouts()
+    {
+        using namespace speakers;
+
+        // Stereo to mono goes through the centre
+        const ChannelMatrix mono = BuildChannelMatrix(2, frontLeft | frontRight, ChannelLayout::Mono);
+        CHECK(mono.IsActive() && mono.outputChannels == 1);
+        CHECK(Near(mono.Get(0, 0), channelMixing::minus3dB) && Near(mono.Get(1, 0), channelMixing::minus3dB));
+
+        // 7.1's back pair lands on 5.1's sides, alongside its own sides
+        const unsigned int sevenPointOne = ChannelLayoutMask(ChannelLayout::SevenPointOne);
+        const ChannelMatrix fivePointOne = BuildChannelMatrix(8, sevenPointOne, ChannelLayout::FivePointOne);
+        CHECK(fivePointOne.IsActive() && fivePointOne.outputChannels == 6);
+        CHECK(Near(fivePointOne.Get(4, 4), 1.0f) && Near(fivePointOne.Get(6, 4), 1.0f));
+        CHECK(Near(fivePointOne.Get(5, 5), 1.0f) && Near(fivePointOne.Get(7, 5), 1.0f));
+
+        // No mask, or one that doesn't match the channel count, means the Windows default for that many channels
+        const ChannelMatrix guessed = BuildChannelMatrix(6, 0, ChannelLayout::Stereo);
+        CHECK(guessed.IsActive() && Near(guessed.Get(2, 0), channelMixing::minus3dB));
+        CHECK(!BuildChannelMatrix(7, 0, ChannelLayout::Stereo).IsActive());
+
+        // Nothing to do: already there, upmixing, or just the same speakers under different names
+        CHECK(!BuildChannelMatrix(2, frontLeft | frontRight, ChannelLayout::Stereo).IsActive());
+        CHECK(!BuildChannelMatrix(2, frontLeft | frontRight, ChannelLayout::FivePointOne).IsActive());
+        CHECK(!BuildChannelMatrix(4, frontLeft | frontRight | backLeft | backRight, ChannelLayout::Quad).IsActive());
+        CHECK(!BuildChannelMatrix(2, frontLeft | frontRight, ChannelLayout::Passthrough).IsActive());
+    }
+
+    // Each SIMD kernel against the scalar one, for every input channel count to every target, over every frame count
+    // up to a few vectors' worth.  The kernels sum in the same order, so they should agree to well within a rounding
+    // error, and mustn't write anything past the last frame.
+    void TestKernelsMatchScalar()
+    {
+        struct Kernel
+        {
+            const char* name;
+            mixKernels::MixFunc mix;
+        };
+        std::vector<Kernel> kernels;
+#if SAMPLE_CONVERT_X86
+        kernels.push_back({ "sse", mixKernels::MixSse });
+        if (sampleKernels::CpuHasAvx2())
+        {
+            kernels.push_back({ "avx2", mixKernels::MixAvx2 });
+        }
+#endif
+
+        constexpr size_t maxFrames = 24;
+        constexpr float guard = 12345.0f;
+
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> spread(-1.0f, 1.0f);
+        std::vector<float> input(maxFrames * 8);
+        for (float& sample : input)
+        {
+            sample = spread(random);
+        }
+
+        const ChannelLayout targets[] = { ChannelLayout::Mono, ChannelLayout::Stereo, ChannelLayout::Quad, ChannelLayout::Surround,
+            ChannelLayout::FivePointOne, ChannelLayout::SevenPointOne };
+        for (unsigned int channels = 1; channels <= 8; ++channels)
+        {
+            for (ChannelLayout target : targets)
+            {
+                const ChannelMatrix matrix = BuildChannelMatrix(channels, DefaultChannelMask(channels), target);
+                if (!matrix.IsActive())
+                {
+                    continue;
+                }
+
+                for (size_t frames = 0; frames <= maxFrames; ++frames)
+                {
+                    std::vector<float> expected(frames * matrix.outputChannels + 8, guard);
+                    mixKernels::MixScalar(input.data(), expected.data(), frames, matrix);
+
+                    for (const Kernel& kernel : kernels)
+                    {
+                        std::vector<float> actual(expected.size(), guard);
+                        kernel.mix(input.data(), actual.data(), frames, matrix);
+
+                        bool matches = true;
+                        for (size_t i = 0; i < actual.size(); ++i)
+                        {
+                            matches = matches && Near(actual[i], expected[i]);
+                        }
+                        if (!matches)
+                        {
+                            std::fprintf(stderr, "%s doesn't match scalar for %u channels to %u, %zu frames\n", kernel.name, channels, matrix.outputChannels, frames);
+                            CHECK(false);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main()
+{
+    TestStereoFromFivePointOne();
+    TestOtherLayouts();
+    TestKernelsMatchScalar();
+    return TestResult();
+}
@@ -0,0 +1,177 @@
+#include "ContainerSignature.h"
+#include "TestCheck.h"
+#include "TestFiles.h"
+
+#include <cstring>
+#include <string>
+
+using namespace mediaFoundation;
+using namespace testFiles;
+
+namespace
+{
+    // The start of an MPEG-4 file with the given major brand: an ftyp box, then the start of whatever comes next
+    Bytes FtypHeader(const char* brand)
+    {
+        Bytes file;
+        AppendBigEndian(&file, 24, 4);
+        AppendText(&file, "ftyp");
+        AppendText(&file, brand);
+        AppendBigEndian(&file, 0, 4);
+        AppendText(&file, "isommp42");
+        AppendBigEndian(&file, 0x1000, 4);
+        AppendText(&file, "mdat");
+        return file;
+    }
+
+    const wchar_t* Match(const Bytes& probe)
+    {
+        return MatchSignature(probe.data(), probe.size());
+    }
+
+    bool Is(const wchar_t* mimeType, const wchar_t* expected)
+    {
+        return mimeType != nullptr && std::wcscmp(mimeType, expected) == 0;
+    }
+
+    void TestFtypBrands()
+    {
+        const struct
+        {
+            const char* brand;
+            const wchar_t* mimeType;
+        } brands[] =
+        {
+            { "M4A ", L"audio/mp4" },
+            { "M4B ", L"audio/mp4" },
+            { "M4P ", L"audio/mp4" },
+            { "mp42", L"audio/mp4" },
+            { "mp41", L"audio/mp4" },
+            { "isom", L"audio/mp4" },
+            { "iso2", L"audio/mp4" },
+            { "dash", L"audio/mp4" },
+            { "F4A ", L"audio/mp4" },
+            { "3gp4", L"audio/3gpp" },
+            { "3gp5", L"audio/3gpp" },
+            { "3gp6", L"audio/3gpp" },
+            { "3g2a", L"audio/3gpp2" },
+        };
+        for (const auto& brand : brands)
+        {
+            CHECK(Is(Match(FtypHeader(brand.brand)), brand.mimeType));
+        }
+
+        // Every ftyp entry in the table is one of those
+        size_t ftypSignatures = 0;
+        for (const ContainerSignature& signature : containerSignatures)
+        {
+            ftypSignatures += (signature.offset == 4 && std::memcmp(signature.bytes, "ftyp", 4) == 0) ? 1 : 0;
+        }
+        CHECK(ftypSignatures == sizeof(brands) / sizeof(brands[0]));
+
+        // The box size in front doesn't matter
+        Bytes bigBox = FtypHeader("M4A ");
+        bigBox[0] = 0x7f;
+        bigBox[3] = 0x99;
+        CHECK(Is(Match(bigBox), L"audio/mp4"));
+
+        // Near misses: a brand we don't take, one that's only a case away, and ftyp somewhere other than its place
+        CHECK(Match(FtypHeader("qt  ")) == nullptr);
+        CHECK(Match(FtypHeader("avif")) == nullptr);
+        CHECK(Match(FtypHeader("m4a ")) == nullptr);
+        Bytes shifted(1, 0);
+        Append(&shifted, FtypHeader("M4A "));
+        CHECK(Match(shifted) == nullptr);
+    }
+
+    void TestAsf()
+    {
+        const uint8_t headerGuid[16] = { 0x30, 0x26, 0xb2, 0x75, 0x8e, 0x66, 0xcf, 0x11, 0xa6, 0xd9, 0x00, 0xaa, 0x00, 0x62, 0xce, 0x6c };
+        Bytes file(headerGuid, headerGuid + 16);
+        AppendLittleEndian(&file, 5000, 8);
+        AppendLittleEndian(&file, 6, 4);
+        CHECK(Is(Match(file), L"audio/x-ms-wma"));
+
+        // Any byte of the GUID wrong, say the data object's in place of the header's
+        for (size_t i = 0; i < 16; ++i)
+        {
+            Bytes wrong = file;
+            wrong[i] ^= 0x01;
+            CHECK(Match(wrong) == nullptr);
+        }
+    }
+
+    void TestAdts()
+    {
+        // MPEG-4 and MPEG-2 AAC, with and without a CRC: the ID and protection bits don't matter, but the layer does
+        for (uint8_t second : { 0xf0, 0xf1, 0xf8, 0xf9 })
+        {
+            const Bytes frame = { 0xff, second, 0x50, 0x80, 0x02, 0x1f, 0xfc };
+            CHECK(Is(Match(frame), L"audio/aac"));
+        }
+
+        // MP3 and MP2 frames have the same sync word, with a layer that isn't 0; none of them are ours
+        for (uint8_t second : { 0xfb, 0xfa, 0xf3, 0xf2, 0xe3, 0xfd, 0xfc })
+        {
+            const Bytes frame = { 0xff, second, 0x90, 0x64, 0x00, 0x00, 0x00 };
+            CHECK(Match(frame) == nullptr);
+        }
+        CHECK(Match(Bytes{ 0xfe, 0xf0, 0x50, 0x80 }) == nullptr);
+    }
+
+    void TestOtherFiles()
+    {
+        // What FMOD's own codecs play, and so never get past the probe
+        Bytes id3;
+        AppendText(&id3, "ID3");
+        Append(&id3, Bytes{ 0x04, 0x00, 0x00, 0x00, 0x00, 0x02, 0x01 });
+        AppendText(&id3, "TIT2");
+        CHECK(Match(id3) == nullptr);
+
+        Bytes ogg;
+        AppendText(&ogg, "OggS");
+        Append(&ogg, Bytes(12, 0));
+        AppendText(&ogg, "vorbis");
+        CHECK(Match(ogg) == nullptr);
+
+        Bytes wav;
+        AppendText(&wav, "RIFF");
+        AppendLittleEndian(&wav, 36, 4);
+        AppendText(&wav, "WAVEfmt ");
+        AppendLittleEndian(&wav, 16, 4);
+        CHECK(Match(wav) == nullptr);
+
+        Bytes zeros(SignatureProbeSize(), 0);
+        CHECK(Match(zeros) == nullptr);
+    }
+
+    void TestShortProbes()
+    {
+        // Enough of the file for ftyp and its brand, and no more, is enough
+        const Bytes header = FtypHeader("M4A ");
+        CHECK(Is(MatchSignature(header.data(), 12), L"audio/mp4"));
+        CHECK(MatchSignature(header.data(), 11) == nullptr);
+
+        // A file too short for one signature can still match a shorter one
+        const Bytes adts = { 0xff, 0xf1 };
+        CHECK(Is(Match(adts), L"audio/aac"));
+        CHECK(MatchSignature(adts.data(), 1) == nullptr);
+        CHECK(MatchSignature(nullptr, 0) == nullptr);
+
+        // The probe covers every signature
+        for (const ContainerSignature& signature : containerSignatures)
+        {
+            CHECK(signature.offset + signature.length <= SignatureProbeSize());
+        }
+    }
+}
+
+int main()
+{
+    TestFtypBrands();
+    TestAsf();
+    TestAdts();
+    TestOtherFiles();
+    TestShortProbes();
+    return TestResult();
+}
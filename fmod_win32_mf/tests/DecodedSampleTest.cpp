@@ -0,0 +1,161 @@
+#include "DecodedSample.h"
+#include "FakeMedia.h"
+#include "TestCheck.h"
+
+using namespace mediaFoundation;
+using namespace fakeMedia;
+
+namespace
+{
+    typedef DecodedSample<FakeSample, FakeBuffer> FakeDecodedSample;
+
+    FakeBuffer* CreateBlock(size_t size)
+    {
+        return new FakeBuffer(size);
+    }
+
+    // Decodes count more samples, each thrown away straight after, as a reader working ahead would
+    void DecodeMore(FakeDecoder& decoder, int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            FakeSample* sample = decoder.Decode();
+            CHECK(sample != nullptr);
+            if (sample != nullptr)
+            {
+                sample->Release();
+            }
+        }
+    }
+
+    // First, that the fake decoder does catch the crash: keep the buffer, let the sample go, and decode more.  This is
+    // what going through ConvertToContiguousBuffer() and releasing the sample would do.
+    void TestFakeCatchesCrash()
+    {
+        FakeDecoder decoder(2, 1, 4096);
+        FakeSample* sample = decoder.Decode();
+        FakeBuffer* buffer = nullptr;
+        CHECK(sample->GetBufferByIndex(0, &buffer) == 0);
+        sample->Release();
+
+        DecodeMore(decoder, 4);
+        CHECK(decoder.overwrites > 0);
+        CHECK(!FakeDecoder::MatchesPattern(buffer->memory.data(), buffer->memory.size(), 0));
+        buffer->Release();
+    }
+
+    // A single-buffer sample is read in place, and stays intact however far the decoder gets ahead of it
+    void TestInPlace()
+    {
+        FakeDecoder decoder(3, 1, 4096);
+        PcmBlockPool<FakeBuffer> pool(CreateBlock);
+        {
+            FakeDecodedSample held(pool);
+            CHECK(held.IsEmpty());
+            CHECK(held.Hold(decoder.Decode()) == 0);
+            CHECK(!held.IsEmpty());
+            CHECK(held.GetSize() == 4096);
+
+            DecodeMore(decoder, 100);
+            CHECK(decoder.overwrites == 0);
+            CHECK(FakeDecoder::MatchesPattern(held.GetData(), held.GetSize(), 0));
+            CHECK(decoder.GetFreeCount() == 2);
+
+            // Taking the next one lets the last go
+            const size_t next = decoder.decodedCount;
+            CHECK(held.Hold(decoder.Decode()) == 0);
+            CHECK(decoder.GetFreeCount() == 2);
+            DecodeMore(decoder, 100);
+            CHECK(decoder.overwrites == 0);
+            CHECK(FakeDecoder::MatchesPattern(held.GetData(), held.GetSize(), next));
+
+            held.Release();
+            CHECK(held.IsEmpty() && held.GetData() == nullptr && held.GetSize() == 0);
+            CHECK(decoder.GetFreeCount() == 3);
+
+            CHECK(held.Hold(decoder.Decode()) == 0);
+        }
+
+        // Going out of scope gives everything back, with nothing left locked
+        CHECK(decoder.GetFreeCount() == 3);
+        DecodeMore(decoder, 3);
+        CHECK(decoder.overwrites == 0);
+        CHECK(pool.GetAllocationCount() == 0);
+    }
+
+    // A scattered sample is flattened into a pooled block, and the sample goes straight back to the decoder
+    void TestScattered()
+    {
+        FakeDecoder decoder(2, 3, 1000);
+        PcmBlockPool<FakeBuffer> pool(CreateBlock);
+        pool.SetBlockSize(3000);
+        FakeDecodedSample held(pool);
+
+        for (int i = 0; i < 100; ++i)
+        {
+            const size_t number = decoder.decodedCount;
+            CHECK(held.Hold(decoder.Decode()) == 0);
+            CHECK(decoder.GetFreeCount() == 2);
+            CHECK(held.GetSize() == 3000);
+
+            DecodeMore(decoder, 5);
+            CHECK(FakeDecoder::MatchesPattern(held.GetData(), held.GetSize(), number));
+        }
+        CHECK(decoder.overwrites == 0);
+
+        // One block, used over and over
+        CHECK(pool.GetAllocationCount() == 1);
+    }
+
+    // Whatever goes wrong, nothing's left held, locked or leaked
+    void TestFailures()
+    {
+        const int buffersBefore = liveBuffers;
+        {
+            FakeDecoder decoder(2, 1, 4096);
+            PcmBlockPool<FakeBuffer> pool(CreateBlock);
+            FakeDecodedSample held(pool);
+
+            CHECK(held.Hold(decoder.Decode()) == 0);
+            failLocks = true;
+            CHECK(held.Hold(decoder.Decode()) < 0);
+            failLocks = false;
+            CHECK(held.IsEmpty());
+            CHECK(decoder.GetFreeCount() == 2);
+            DecodeMore(decoder, 2);
+            CHECK(decoder.overwrites == 0);
+
+            FakeDecoder scattered(2, 2, 1000);
+            failLocks = true;
+            CHECK(held.Hold(scattered.Decode()) < 0);
+            failLocks = false;
+            CHECK(held.IsEmpty());
+            CHECK(scattered.GetFreeCount() == 2);
+
+            // Out of memory for the block
+            PcmBlockPool<FakeBuffer> emptyPool([](size_t) { return static_cast<FakeBuffer*>(nullptr); });
+            FakeDecodedSample starved(emptyPool);
+            CHECK(starved.Hold(scattered.Decode()) < 0);
+            CHECK(starved.IsEmpty());
+            CHECK(scattered.GetFreeCount() == 2);
+
+            // A block too small to copy into
+            PcmBlockPool<FakeBuffer> smallPool([](size_t) { return new FakeBuffer(10); });
+            FakeDecodedSample cramped(smallPool);
+            CHECK(cramped.Hold(scattered.Decode()) < 0);
+            CHECK(cramped.IsEmpty());
+            CHECK(scattered.GetFreeCount() == 2);
+        }
+        CHECK(liveBuffers == buffersBefore);
+    }
+}
+
+int main()
+{
+    TestFakeCatchesCrash();
+    TestInPlace();
+    TestScattered();
+    TestFailures();
+    CHECK(liveBuffers == 0);
+    return TestResult();
+}
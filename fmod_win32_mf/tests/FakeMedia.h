@@ -0,0 +1,269 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Stand-ins for the Media Foundation objects behind a decoded sample, shaped the way DecodedSample and PcmBlockPool
+// expect.
+
+namespace fakeMedia
+{
+    // E_FAIL
+    const long failure = static_cast<int32_t>(0x80004005u);
+
+    // Set to make every Lock() fail
+    inline bool failLocks = false;
+    inline int liveBuffers = 0;
+
+    // Just enough of IMFMediaBuffer, reference counted for real
+    class FakeBuffer
+    {
+    public:
+        explicit FakeBuffer(size_t size) :
+            referenceCount(1),
+            lockCount(0),
+            currentLength(0),
+            memory(size)
+        {
+            ++liveBuffers;
+        }
+
+        unsigned long AddRef()
+        {
+            return ++referenceCount;
+        }
+
+        unsigned long Release()
+        {
+            const unsigned long remaining = --referenceCount;
+            if (remaining == 0)
+            {
+                --liveBuffers;
+                delete this;
+            }
+            return remaining;
+        }
+
+        long Lock(uint8_t** data, unsigned long* maxLength, unsigned long* length)
+        {
+            if (failLocks)
+            {
+                return failure;
+            }
+
+            ++lockCount;
+            *data = memory.data();
+            if (maxLength != nullptr)
+            {
+                *maxLength = static_cast<unsigned long>(memory.size());
+            }
+            if (length != nullptr)
+            {
+                *length = currentLength;
+            }
+            return 0;
+        }
+
+        long Unlock()
+        {
+            --lockCount;
+            return 0;
+        }
+
+        long GetMaxLength(unsigned long* length)
+        {
+            *length = static_cast<unsigned long>(memory.size());
+            return 0;
+        }
+
+        long SetCurrentLength(unsigned long length)
+        {
+            currentLength = length;
+            return 0;
+        }
+
+        unsigned long referenceCount;
+        int lockCount;
+        unsigned long currentLength;
+        std::vector<uint8_t> memory;
+    };
+
+    class FakeDecoder;
+
+    // Just enough of IMFSample.  When the last reference goes, it's handed back to the decoder that made it.
+    class FakeSample
+    {
+    public:
+        FakeSample(FakeDecoder* decoder, size_t bufferCount, size_t bufferSize) :
+            owner(decoder),
+            referenceCount(0)
+        {
+            for (size_t i = 0; i < bufferCount; ++i)
+            {
+                buffers.push_back(new FakeBuffer(bufferSize));
+            }
+        }
+
+        ~FakeSample()
+        {
+            for (FakeBuffer* buffer : buffers)
+            {
+                buffer->Release();
+            }
+        }
+
+        unsigned long Release();
+
+        long GetBufferCount(unsigned long* count)
+        {
+            *count = static_cast<unsigned long>(buffers.size());
+            return 0;
+        }
+
+        long GetBufferByIndex(unsigned long index, FakeBuffer** buffer)
+        {
+            if (index >= buffers.size())
+            {
+                return failure;
+            }
+            buffers[index]->AddRef();
+            *buffer = buffers[index];
+            return 0;
+        }
+
+        long GetTotalLength(unsigned long* length)
+        {
+            *length = 0;
+            for (FakeBuffer* buffer : buffers)
+            {
+                *length += buffer->currentLength;
+            }
+            return 0;
+        }
+
+        long CopyToBuffer(FakeBuffer* destination)
+        {
+            size_t position = 0;
+            for (FakeBuffer* buffer : buffers)
+            {
+                if (position + buffer->currentLength > destination->memory.size())
+                {
+                    return failure;
+                }
+                std::memcpy(destination->memory.data() + position, buffer->memory.data(), buffer->currentLength);
+                position += buffer->currentLength;
+            }
+            destination->currentLength = static_cast<unsigned long>(position);
+            return 0;
+        }
+
+        FakeDecoder* owner;
+        unsigned long referenceCount;
+        std::vector<FakeBuffer*> buffers;
+    };
+
+    // Decodes into a fixed set of samples, as a Media Foundation decoder does: a sample is reused as soon as its last
+    // reference goes, and its buffers written over, whether or not anyone's still got hold of them.  Every time that
+    // happens to a buffer that's still referenced or locked, it's counted as a crash.
+    class FakeDecoder
+    {
+    public:
+        FakeDecoder(size_t sampleCount, size_t buffersPerSample, size_t bufferSize) :
+            decodedCount(0),
+            overwrites(0),
+            writePattern(true)
+        {
+            for (size_t i = 0; i < sampleCount; ++i)
+            {
+                samples.push_back(new FakeSample(this, buffersPerSample, bufferSize));
+                freeSamples.push_back(samples.back());
+            }
+        }
+
+        ~FakeDecoder()
+        {
+            for (FakeSample* sample : samples)
+            {
+                delete sample;
+            }
+        }
+
+        // The next sample, with one reference for the caller, or null if they're all still out
+        FakeSample* Decode()
+        {
+            if (freeSamples.empty())
+            {
+                return nullptr;
+            }
+
+            FakeSample* sample = freeSamples.back();
+            freeSamples.pop_back();
+            sample->referenceCount = 1;
+
+            size_t position = 0;
+            for (FakeBuffer* buffer : sample->buffers)
+            {
+                if (buffer->referenceCount > 1 || buffer->lockCount > 0)
+                {
+                    ++overwrites;
+                }
+                for (size_t i = 0; writePattern && i < buffer->memory.size(); ++i)
+                {
+                    buffer->memory[i] = PatternByte(decodedCount, position++);
+                }
+                buffer->currentLength = static_cast<unsigned long>(buffer->memory.size());
+            }
+            ++decodedCount;
+            return sample;
+        }
+
+        void Recycle(FakeSample* sample)
+        {
+            freeSamples.push_back(sample);
+        }
+
+        size_t GetFreeCount() const
+        {
+            return freeSamples.size();
+        }
+
+        static uint8_t PatternByte(size_t sampleNumber, size_t position)
+        {
+            return static_cast<uint8_t>(sampleNumber * 31 + position * 7 + (position >> 8));
+        }
+
+        static bool MatchesPattern(const uint8_t* data, size_t size, size_t sampleNumber)
+        {
+            for (size_t i = 0; i < size; ++i)
+            {
+                if (data[i] != PatternByte(sampleNumber, i))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        size_t decodedCount;
+        size_t overwrites;
+
+        // Off for benchmarks, where writing the pattern would cost more than anything being measured
+        bool writePattern;
+
+    private:
+        std::vector<FakeSample*> samples;
+        std::vector<FakeSample*> freeSamples;
+    };
+
+    inline unsigned long FakeSample::Release()
+    {
+        const unsigned long remaining = --referenceCount;
+        if (remaining == 0)
+        {
+            owner->Recycle(this);
+        }
+        return remaining;
+    }
+}
@@ -0,0 +1,747 @@
+#include "AsfFiles.h"
+#include "BlockCache.h"
+#include "ChannelMix.h"
+#include "ContainerInfo.h"
+#include "ContainerSignature.h"
+#include "DecodedSample.h"
+#include "FakeMedia.h"
+#include "FileCursor.h"
+#include "LoopHead.h"
+#include "ReadTrace.h"
+#include "Mp4Files.h"
+#include "Resampler.h"
+#include "SampleConvert.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace mediaFoundation;
+
+// Throughput of every conversion and mixing kernel in every implementation the CPU can run, and of the resampler, in
+// millions of samples (or frames) a second, and of handing decoded samples over to FMOD.  Each is run over a buffer
+// the size of a decode-ahead chunk, which stays in cache, since that's how the codec uses them.  Also how quickly the
+// container probe turns files down, since FMOD offers it every file it opens, alone and across a whole library, and
+// how quickly a library can be probed for its lengths and tags, and what reading a clip whole saves in getting it
+// to its first sample, what the loop head saves a track that loops a thousand times, and a trace of the reads a
+// media source makes of a stream, with and without the block cache in front of FMOD's file.
+
+namespace
+{
+    constexpr size_t chunkSamples = 4096 * 2;
+    constexpr int repeats = 20000;
+
+    // Millions of whatever func processes count of in a call, per second
+    template <typename Func>
+    double MeasureRate(size_t count, Func func)
+    {
+        func();
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeats; ++i)
+        {
+            func();
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return static_cast<double>(count) * repeats / elapsed.count() / 1e6;
+    }
+
+    void BenchConversions()
+    {
+        struct Implementation
+        {
+            const char* name;
+            SampleConverters converters;
+        };
+        std::vector<Implementation> implementations = { { "scalar", SampleConverters::Scalar() } };
+#if SAMPLE_CONVERT_X86
+        implementations.push_back({ "sse2", SampleConverters::Sse2() });
+        if (sampleKernels::CpuHasAvx2())
+        {
+            implementations.push_back({ "avx2", SampleConverters::Avx2() });
+        }
+#endif
+
+        const struct
+        {
+            const char* name;
+            SampleConvertFunc SampleConverters::* kernel;
+        } conversions[] =
+        {
+            { "s16ToFloat", &SampleConverters::s16ToFloat },
+            { "floatToS16", &SampleConverters::floatToS16 },
+            { "s24ToS32", &SampleConverters::s24ToS32 },
+            { "s32ToS24", &SampleConverters::s32ToS24 },
+            { "s24ToFloat", &SampleConverters::s24ToFloat },
+            { "floatToS24", &SampleConverters::floatToS24 },
+            { "s32ToFloat", &SampleConverters::s32ToFloat },
+            { "u8ToS16", &SampleConverters::u8ToS16 },
+        };
+
+        // Big enough for any of them, and valid input for all of them: floats in range, as bytes
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> spread(-1.0f, 1.0f);
+        std::vector<float> input(chunkSamples);
+        for (float& sample : input)
+        {
+            sample = spread(random);
+        }
+        std::vector<float> output(chunkSamples);
+
+        std::printf("%-12s", "Msamples/s");
+        for (const Implementation& implementation : implementations)
+        {
+            std::printf("%10s", implementation.name);
+        }
+        std::printf("\n");
+
+        for (const auto& conversion : conversions)
+        {
+            std::printf("%-12s", conversion.name);
+            for (const Implementation& implementation : implementations)
+            {
+                const SampleConvertFunc kernel = implementation.converters.*conversion.kernel;
+                std::printf("%10.0f", MeasureRate(chunkSamples, [&] { kernel(input.data(), output.data(), chunkSamples); }));
+            }
+            std::printf("\n");
+        }
+    }
+
+    void BenchMixing()
+    {
+        struct Kernel
+        {
+            const char* name;
+            mixKernels::MixFunc mix;
+        };
+        std::vector<Kernel> kernels = { { "scalar", mixKernels::MixScalar } };
+#if SAMPLE_CONVERT_X86
+        kernels.push_back({ "sse", mixKernels::MixSse });
+        if (sampleKernels::CpuHasAvx2())
+        {
+            kernels.push_back({ "avx2", mixKernels::MixAvx2 });
+        }
+#endif
+
+        const struct
+        {
+            const char* name;
+            unsigned int channels;
+            ChannelLayout target;
+        } mixes[] =
+        {
+            { "5.1>stereo", 6, ChannelLayout::Stereo },
+            { "7.1>5.1", 8, ChannelLayout::FivePointOne },
+            { "stereo>mono", 2, ChannelLayout::Mono },
+        };
+
+        const size_t frames = chunkSamples / 2;
+        std::vector<float> input(frames * 8, 0.25f);
+        std::vector<float> output(frames * 8);
+
+        std::printf("\n%-12s", "Mframes/s");
+        for (const Kernel& kernel : kernels)
+        {
+            std::printf("%10s", kernel.name);
+        }
+        std::printf("\n");
+
+        for (const auto& mix : mixes)
+        {
+            const ChannelMatrix matrix = BuildChannelMatrix(mix.channels, DefaultChannelMask(mix.channels), mix.target);
+            std::printf("%-12s", mix.name);
+            for (const Kernel& kernel : kernels)
+            {
+                std::printf("%10.0f", MeasureRate(frames, [&] { kernel.mix(input.data(), output.data(), frames, matrix); }));
+            }
+            std::printf("\n");
+        }
+    }
+
+    // Stereo, pushed and pulled a chunk at a time the way the decode-ahead worker does it
+    void BenchResampling()
+    {
+        const unsigned int ratePairs[][2] = { { 44100, 48000 }, { 48000, 44100 }, { 22050, 48000 } };
+        const size_t frames = chunkSamples / 2;
+        std::vector<float> input(frames * 2, 0.25f);
+        std::vector<float> output(frames * 2 * 3);
+
+        std::printf("\n%-12s%10s\n", "Mframes/s", "in");
+        for (const auto& rates : ratePairs)
+        {
+            PolyphaseResampler resampler;
+            resampler.Configure(2, rates[0], rates[1]);
+            const double rate = MeasureRate(frames, [&]
+            {
+                resampler.Push(input.data(), frames);
+                while (resampler.Pull(output.data(), frames * 3) > 0)
+                {
+                }
+            });
+            std::printf("%5u>%-6u%10.1f\n", rates[0], rates[1], rate);
+        }
+    }
+
+    // Getting a decoded sample's PCM to FMOD, in MB/s: copied into a freshly made buffer and out again, as read()
+    // used to, against DecodedSample reading it in place, or flattening a scattered sample into a pooled block.
+    // The decoder's side is free here, so this is only the hand-off's share of the cost.
+    void BenchSampleHandOff()
+    {
+        using namespace fakeMedia;
+
+        const size_t sampleBytes = chunkSamples * 4;
+        const size_t readBytes = 4096;
+        std::vector<uint8_t> fmodBuffer(readBytes);
+        const auto drain = [&](const uint8_t* data, size_t size)
+        {
+            for (size_t position = 0; position < size; position += readBytes)
+            {
+                std::memcpy(fmodBuffer.data(), data + position, std::min<size_t>(readBytes, size - position));
+            }
+        };
+
+        FakeDecoder decoder(2, 1, sampleBytes);
+        decoder.writePattern = false;
+        const double copied = MeasureRate(sampleBytes, [&]
+        {
+            FakeSample* sample = decoder.Decode();
+            FakeBuffer* copy = new FakeBuffer(sampleBytes);
+            sample->CopyToBuffer(copy);
+            sample->Release();
+
+            uint8_t* data = nullptr;
+            unsigned long length = 0;
+            copy->Lock(&data, nullptr, &length);
+            drain(data, length);
+            copy->Unlock();
+            copy->Release();
+        });
+
+        PcmBlockPool<FakeBuffer> pool([](size_t size) { return new FakeBuffer(size); });
+        DecodedSample<FakeSample, FakeBuffer> held(pool);
+        const double inPlace = MeasureRate(sampleBytes, [&]
+        {
+            held.Hold(decoder.Decode());
+            drain(held.GetData(), held.GetSize());
+            held.Release();
+        });
+
+        FakeDecoder scatteredDecoder(2, 2, sampleBytes / 2);
+        scatteredDecoder.writePattern = false;
+        const double flattened = MeasureRate(sampleBytes, [&]
+        {
+            held.Hold(scatteredDecoder.Decode());
+            drain(held.GetData(), held.GetSize());
+            held.Release();
+        });
+
+        std::printf("\n%-12s%10s%10s%10s\n", "MB/s", "copied", "in place", "flattened");
+        std::printf("%-12s%10.0f%10.0f%10.0f\n", "hand-off", copied, inPlace, flattened);
+    }
+
+    // Millions of probes a second through MatchSignature(), for the first bytes of each kind of file.  Everything but
+    // the last two is a file FMOD plays itself, which is what the probe spends nearly all its time turning down, and
+    // has to be tried against every signature before it is.  Each kind gets a few variations, with the bytes past
+    // its magic number at random, so the match can't be worked out once and reused.
+    void BenchSignatureRejects()
+    {
+        const struct
+        {
+            const char* name;
+            std::vector<uint8_t> magic;
+        } kinds[] =
+        {
+            { "mp3 id3", { 'I', 'D', '3', 0x04, 0x00 } },
+            { "mp3 frame", { 0xff, 0xfb, 0x90, 0x64 } },
+            { "ogg", { 'O', 'g', 'g', 'S', 0x00, 0x02 } },
+            { "wav", { 'R', 'I', 'F', 'F', 0x24, 0x00, 0x00, 0x00, 'W', 'A', 'V', 'E' } },
+            { "flac", { 'f', 'L', 'a', 'C' } },
+            { "ftyp qt", { 0x00, 0x00, 0x00, 0x14, 'f', 't', 'y', 'p', 'q', 't', ' ', ' ' } },
+            { "m4a", { 0x00, 0x00, 0x00, 0x20, 'f', 't', 'y', 'p', 'M', '4', 'A', ' ' } },
+            { "aac", { 0xff, 0xf1, 0x50, 0x80 } },
+        };
+
+        constexpr size_t variations = 64;
+        const size_t probeSize = SignatureProbeSize();
+        std::mt19937 random(11);
+
+        std::printf("\n%-12s%10s\n", "Mprobes/s", "match");
+        for (const auto& kind : kinds)
+        {
+            std::vector<uint8_t> probes(variations * probeSize);
+            for (uint8_t& byte : probes)
+            {
+                byte = static_cast<uint8_t>(random());
+            }
+            for (size_t i = 0; i < variations; ++i)
+            {
+                std::memcpy(probes.data() + i * probeSize, kind.magic.data(), kind.magic.size());
+            }
+
+            size_t matches = 0;
+            const double rate = MeasureRate(variations, [&]
+            {
+                for (size_t i = 0; i < variations; ++i)
+                {
+                    matches += (MatchSignature(probes.data() + i * probeSize, probeSize) != nullptr) ? 1 : 0;
+                }
+            });
+            std::printf("%-12s%10.1f%10s\n", kind.name, rate, (matches != 0) ? "yes" : "no");
+        }
+    }
+
+    // Opening a whole library of 10,000 files, mostly ones FMOD plays itself: the first bytes of each, as
+    // FindMimeType() reads them, through MatchSignature().  Shows what the probe adds to opening a file that isn't
+    // ours, against the rest of what opening it costs, which isn't measured here.
+    void BenchMixedLibrary()
+    {
+        const struct
+        {
+            std::vector<uint8_t> magic;
+            size_t share;
+        } kinds[] =
+        {
+            { { 'I', 'D', '3', 0x03, 0x00 }, 25 },
+            { { 0xff, 0xfb, 0x90, 0x64 }, 15 },
+            { { 'O', 'g', 'g', 'S', 0x00, 0x02 }, 25 },
+            { { 'R', 'I', 'F', 'F', 0x24, 0x10, 0x00, 0x00, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' }, 20 },
+            { { 0x00, 0x00, 0x00, 0x20, 'f', 't', 'y', 'p', 'M', '4', 'A', ' ' }, 15 },
+        };
+
+        constexpr size_t fileCount = 10000;
+        const size_t probeSize = SignatureProbeSize();
+        std::mt19937 random(17);
+        std::vector<uint8_t> library(fileCount * probeSize);
+        for (uint8_t& byte : library)
+        {
+            byte = static_cast<uint8_t>(random());
+        }
+
+        // Laid out by share, then shuffled, so the matcher can't learn the order
+        std::vector<size_t> kindOfFile;
+        for (size_t kind = 0; kind < std::size(kinds); ++kind)
+        {
+            kindOfFile.insert(kindOfFile.end(), fileCount * kinds[kind].share / 100, kind);
+        }
+        std::shuffle(kindOfFile.begin(), kindOfFile.end(), random);
+        for (size_t file = 0; file < fileCount; ++file)
+        {
+            const std::vector<uint8_t>& magic = kinds[kindOfFile[file]].magic;
+            std::memcpy(library.data() + file * probeSize, magic.data(), magic.size());
+        }
+
+        constexpr int passes = 200;
+        size_t accepted = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < passes; ++pass)
+        {
+            for (size_t file = 0; file < fileCount; ++file)
+            {
+                accepted += (MatchSignature(library.data() + file * probeSize, probeSize) != nullptr) ? 1 : 0;
+            }
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::printf("\n%-12s%10s%10s%10s\n", "library", "files", "ours", "us/pass");
+        std::printf("%-12s%10zu%10zu%10.1f\n", "mixed", fileCount, accepted / passes, elapsed.count() / passes * 1e6);
+        std::printf("%-12s%10.1f\n", "ns/file", elapsed.count() / passes / fileCount * 1e9);
+    }
+
+    // A small M4A: ftyp, some media data, and a moov with the audio track's sample table and a few tags.  Lengths,
+    // rates and tags vary with the random numbers, as they would across a real library.
+    testFiles::Bytes MakeMp4File(std::mt19937& random)
+    {
+        using namespace testFiles;
+
+        Bytes brand;
+        AppendText(&brand, "M4A ");
+        AppendBigEndian(&brand, 0, 4);
+
+        const uint32_t timescale = (random() % 2 == 0) ? 44100 : 48000;
+        const uint32_t frames = 100 + random() % 20000;
+        const Bytes audioSpecificConfig = { 0x12, 0x10 };
+        const Bytes track = Track("soun", timescale, Concat({ SampleDescription(audioSpecificConfig), TimeToSample({ { frames, 1024 }, { 1, 1 + random() % 1024 } }) }));
+
+        const Bytes tags = Box("ilst", Concat({
+            FreeformTag("iTunSMPB", " 00000000 00000840 000001C4 0000000000019A7C"),
+            FreeformTag("LOOPSTART", std::to_string(random() % 44100)),
+            FreeformTag("LOOPLENGTH", std::to_string(44100 + random() % 441000)) }));
+        const Bytes meta = FullBox("meta", 0, Concat({ Handler("mdir"), tags }));
+        return Concat({ Box("ftyp", brand), Box("mdat", Bytes(256 + random() % 4096, 0xAB)), Box("moov", Concat({ track, Box("udta", meta) })) });
+    }
+
+    // A small WMA file: its header, with a couple of tags, and a second's packet for each second it plays
+    testFiles::Bytes MakeAsfFile(std::mt19937& random)
+    {
+        using namespace testFiles;
+
+        constexpr uint32_t packetSize = 64;
+        constexpr uint64_t prerollMs = 3000;
+        const uint64_t packets = 4 + random() % 60;
+
+        Bytes attributes;
+        AppendLittleEndian(&attributes, 2, 2);
+        const auto attribute = [&attributes](const std::u16string& name, uint16_t type, const Bytes& value)
+        {
+            const Bytes nameBytes = Utf16(name);
+            AppendLittleEndian(&attributes, nameBytes.size(), 2);
+            Append(&attributes, nameBytes);
+            AppendLittleEndian(&attributes, type, 2);
+            AppendLittleEndian(&attributes, value.size(), 2);
+            Append(&attributes, value);
+        };
+        Bytes loopStart;
+        AppendLittleEndian(&loopStart, random() % 44100, 4);
+        attribute(u"LOOPSTART", 3, loopStart);
+        attribute(u"Title", 0, Utf16(u"Ambience"));
+
+        Bytes file = HeaderObject({
+            FileProperties(packets, packetSize, packetSize, (packets * 1000 + prerollMs) * 10000, prerollMs),
+            AudioStreamProperties(1),
+            Object(mediaFoundation::asf::extendedContentDescriptionObject, attributes) });
+        Append(&file, DataObjectHeader(packets, packetSize, packets));
+        for (uint64_t packet = 0; packet < packets; ++packet)
+        {
+            Append(&file, Packet(packet, packetSize, prerollMs));
+        }
+        return file;
+    }
+
+    // Thousands of files a second through ContainerInfo, which is all a bulk probe reads of a file it hasn't seen
+    // before: the length from the container, and the tags.  Files are in memory, so this is the parsing alone.
+    void BenchContainerProbe()
+    {
+        using namespace testFiles;
+
+        constexpr size_t fileCount = 5000;
+        std::mt19937 random(23);
+        std::vector<Bytes> mp4Files;
+        std::vector<Bytes> asfFiles;
+        for (size_t i = 0; i < fileCount; ++i)
+        {
+            mp4Files.push_back(MakeMp4File(random));
+            asfFiles.push_back(MakeAsfFile(random));
+        }
+
+        constexpr int passes = 20;
+        const auto probeAll = [](const std::vector<Bytes>& files, auto readContainer, size_t* withDuration, size_t* reads)
+        {
+            *withDuration = 0;
+            *reads = 0;
+            const auto start = std::chrono::steady_clock::now();
+            for (int pass = 0; pass < passes; ++pass)
+            {
+                for (const Bytes& file : files)
+                {
+                    MemoryReader reader(file);
+                    ContainerInfo info;
+                    readContainer(info, reader);
+
+                    uint64_t duration = 0;
+                    info.FitTagsToLength(44100);
+                    *withDuration += info.GetDuration(44100, &duration) ? 1 : 0;
+                    *reads += reader.GetReadCount();
+                }
+            }
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            return static_cast<double>(files.size()) * passes / elapsed.count() / 1e3;
+        };
+
+        size_t mp4Durations = 0, mp4Reads = 0, asfDurations = 0, asfReads = 0;
+        const double mp4Rate = probeAll(mp4Files, [](ContainerInfo& info, MemoryReader& reader) { info.ReadMp4(reader); }, &mp4Durations, &mp4Reads);
+        const double asfRate = probeAll(asfFiles, [](ContainerInfo& info, MemoryReader& reader) { info.ReadAsf(reader); }, &asfDurations, &asfReads);
+
+        std::printf("\n%-12s%10s%10s%10s\n", "kfiles/s", "rate", "lengths", "reads");
+        std::printf("%-12s%10.1f%10zu%10.1f\n", "mp4", mp4Rate, mp4Durations / passes, static_cast<double>(mp4Reads) / passes / fileCount);
+        std::printf("%-12s%10.1f%10zu%10.1f\n", "asf", asfRate, asfDurations / passes, static_cast<double>(asfReads) / passes / fileCount);
+    }
+
+    // FMOD's file, as the codec sees it: a current position, moved by fileseek and read from by fileread, each of
+    // which is a call through FMOD's file layer and counted as one.
+    class FakeFmodFile
+    {
+    public:
+        explicit FakeFmodFile(const testFiles::Bytes& inContents) :
+            contents(inContents),
+            position(0),
+            calls(0)
+        { }
+
+        bool Seek(uint64_t offset)
+        {
+            ++calls;
+            position = offset;
+            return true;
+        }
+
+        bool Read(void* dest, size_t bytes, size_t* bytesRead)
+        {
+            ++calls;
+            *bytesRead = (position < contents.size()) ? std::min<size_t>(bytes, contents.size() - static_cast<size_t>(position)) : 0;
+            std::memcpy(dest, contents.data() + position, *bytesRead);
+            position += *bytesRead;
+            return true;
+        }
+
+        const testFiles::Bytes& contents;
+        uint64_t position;
+        size_t calls;
+    };
+
+    // The reads opening a clip makes before its first sample can be decoded, streamed against read whole: the
+    // container parsed through FMOD's file as CodecFileReader does it, a seek and a read each time, then the media
+    // source reading the headers again and the first few access units, through the block cache as FmodReadStream
+    // does.  Read whole, it's one read, and all the rest from memory.  What that saves is calls through FMOD's file
+    // layer, which cost nothing here, so the times only show what the whole read costs up front.  Building the Media
+    // Foundation pipeline and decoding are the rest of the time to the first sample, which only a Windows build can
+    // measure; the codec's openToFirstSampleNanoseconds stat does.
+    void BenchOpenReads()
+    {
+        using namespace testFiles;
+
+        Bytes brand;
+        AppendText(&brand, "M4A ");
+        AppendBigEndian(&brand, 0, 4);
+        const Bytes ftyp = Box("ftyp", brand);
+        const Bytes track = Track("soun", 44100, Concat({ SampleDescription({ 0x12, 0x10 }), TimeToSample({ { 2000, 1024 } }) }));
+        const Bytes tags = Box("ilst", Concat({ FreeformTag("iTunSMPB", " 00000000 00000840 000001C4 00000000001F3FBC"), FreeformTag("LOOPSTART", "0") }));
+        const Bytes file = Concat({ ftyp, Box("mdat", Bytes(2 * 1024 * 1024, 0xAB)), Box("moov", Concat({ track, Box("udta", FullBox("meta", 0, Concat({ Handler("mdir"), tags }))) })) });
+        const uint64_t moovStart = ftyp.size() + 8 + 2 * 1024 * 1024;
+
+        // Where each read goes: straight to FMOD's file, through the block cache, or to memory
+        struct SeekAndReadReader
+        {
+            FakeFmodFile& file;
+            bool ReadAt(uint64_t offset, void* dest, size_t bytes)
+            {
+                size_t bytesRead = 0;
+                return offset + bytes <= file.contents.size() && file.Seek(offset) && file.Read(dest, bytes, &bytesRead) && bytesRead == bytes;
+            }
+            uint64_t GetSize() { return file.contents.size(); }
+        };
+
+        constexpr size_t firstAccessUnits = 8;
+        constexpr size_t accessUnitSize = 400;
+        std::vector<uint8_t> scratch(64 * 1024);
+        constexpr int opens = 200;
+
+        size_t streamedCalls = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int open = 0; open < opens; ++open)
+        {
+            FakeFmodFile fmodFile(file);
+            SeekAndReadReader parserReader = { fmodFile };
+            ContainerInfo info;
+            info.ReadMp4(parserReader);
+
+            FileCursor cursor(0, [&](uint64_t offset) { return fmodFile.Seek(offset); }, [&](void* dest, size_t bytes, size_t* bytesRead) { return fmodFile.Read(dest, bytes, bytesRead); });
+            BlockCache cache(file.size(), [&](uint64_t offset, void* dest, size_t bytes, size_t* bytesFetched) { return cursor.Read(offset, dest, bytes, bytesFetched); });
+            bool failed = false;
+            cache.Read(0, scratch.data(), ftyp.size() + 8, &failed);
+            cache.Read(moovStart, scratch.data(), file.size() - moovStart, &failed);
+            for (size_t unit = 0; unit < firstAccessUnits; ++unit)
+            {
+                cache.Read(ftyp.size() + 8 + unit * accessUnitSize, scratch.data(), accessUnitSize, &failed);
+            }
+            streamedCalls += fmodFile.calls;
+        }
+        const std::chrono::duration<double> streamed = std::chrono::steady_clock::now() - start;
+
+        size_t wholeCalls = 0;
+        start = std::chrono::steady_clock::now();
+        for (int open = 0; open < opens; ++open)
+        {
+            FakeFmodFile fmodFile(file);
+            Bytes contents(file.size());
+            size_t bytesRead = 0;
+            fmodFile.Seek(0);
+            fmodFile.Read(contents.data(), contents.size(), &bytesRead);
+
+            MemoryReader parserReader(contents);
+            ContainerInfo info;
+            info.ReadMp4(parserReader);
+
+            std::memcpy(scratch.data(), contents.data(), ftyp.size() + 8);
+            std::memcpy(scratch.data(), contents.data() + moovStart, file.size() - moovStart);
+            for (size_t unit = 0; unit < firstAccessUnits; ++unit)
+            {
+                std::memcpy(scratch.data(), contents.data() + ftyp.size() + 8 + unit * accessUnitSize, accessUnitSize);
+            }
+            wholeCalls += fmodFile.calls;
+        }
+        const std::chrono::duration<double> whole = std::chrono::steady_clock::now() - start;
+
+        std::printf("\n%-12s%10s%10s\n", "open", "calls", "us");
+        std::printf("%-12s%10zu%10.1f\n", "streamed", streamedCalls / opens, streamed.count() / opens * 1e6);
+        std::printf("%-12s%10zu%10.1f\n", "whole", wholeCalls / opens, whole.count() / opens * 1e6);
+    }
+
+    // A two second stereo float track looped 1,000 times, read a chunk at a time as FMOD does, with and without a
+    // 100ms loop head.  The decoder here is only a position that output is generated from; what counts is how many
+    // times FMOD's read had to wait on it being moved back to the start, which a real decoder does by flushing and
+    // priming itself again, and whether every frame played still follows on from the one before.
+    void BenchLooping()
+    {
+        constexpr size_t blockAlign = 8;
+        constexpr uint64_t trackFrames = 2 * 44100;
+        constexpr size_t readFrames = 1024;
+        constexpr int loops = 1000;
+
+        const auto play = [&](size_t loopHeadFrames, size_t* waits, size_t* misplaced)
+        {
+            LoopHead loopHead;
+            loopHead.Start(0, loopHeadFrames, blockAlign);
+
+            std::vector<uint8_t> output(readFrames * blockAlign);
+            uint64_t decoderFrame = 0;
+            uint64_t playbackFrame = 0;
+            *waits = 0;
+            *misplaced = 0;
+
+            const auto start = std::chrono::steady_clock::now();
+            for (int loop = 0; loop < loops; ++loop)
+            {
+                while (playbackFrame < trackFrames)
+                {
+                    const size_t wanted = static_cast<size_t>(std::min<uint64_t>(readFrames, trackFrames - playbackFrame));
+                    size_t frames = loopHead.Read(output.data(), wanted);
+                    for (; frames < wanted; ++frames, ++decoderFrame)
+                    {
+                        const float sample = static_cast<float>(decoderFrame);
+                        std::memcpy(output.data() + frames * blockAlign, &sample, sizeof(sample));
+                        std::memcpy(output.data() + frames * blockAlign + sizeof(sample), &sample, sizeof(sample));
+                    }
+                    loopHead.Capture(output.data(), playbackFrame, frames);
+
+                    for (size_t frame = 0; frame < frames; ++frame)
+                    {
+                        float sample = 0.0f;
+                        std::memcpy(&sample, output.data() + frame * blockAlign, sizeof(sample));
+                        *misplaced += (sample == static_cast<float>(playbackFrame + frame)) ? 0 : 1;
+                    }
+                    playbackFrame += frames;
+                }
+
+                // FMOD loops back with setPosition(0)
+                uint64_t resumeFrame = 0;
+                if (!loopHead.SeekInto(0, &resumeFrame))
+                {
+                    ++*waits;
+                }
+                decoderFrame = resumeFrame;
+                playbackFrame = 0;
+            }
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            return elapsed.count() / loops * 1e6;
+        };
+
+        size_t seekWaits = 0, seekMisplaced = 0, headWaits = 0, headMisplaced = 0;
+        const double seekTime = play(0, &seekWaits, &seekMisplaced);
+        const double headTime = play(4410, &headWaits, &headMisplaced);
+
+        std::printf("\n%-12s%10s%10s%10s\n", "1000 loops", "waits", "misplaced", "us/loop");
+        std::printf("%-12s%10zu%10zu%10.1f\n", "seek", seekWaits, seekMisplaced, seekTime);
+        std::printf("%-12s%10zu%10zu%10.1f\n", "loop head", headWaits, headMisplaced, headTime);
+    }
+
+    // The reads Media Foundation's MPEG-4 source makes of an M4A with its moov last, traced call by call: a few header
+    // reads, the sample tables at the end, then the media data an access unit at a time.  Served the way a byte
+    // stream over an IStream would, a seek and a read of FMOD's file for every one, against through FmodReadStream's
+    // block cache.  FMOD's file is in memory here, so the latencies are only what's spent between the two; on a real
+    // file every FMOD call costs more, and the trace from a debug build's log shows how much.
+    void BenchReadTrace()
+    {
+        const size_t blockSize = BlockCache::blockSize;
+        testFiles::Bytes contents(60 * blockSize + 12345);
+        for (size_t i = 0; i < contents.size(); ++i)
+        {
+            contents[i] = static_cast<uint8_t>(i * 31);
+        }
+        const size_t moovSize = 20000;
+        const uint64_t mdatEnd = contents.size() - moovSize;
+
+        std::vector<std::pair<uint64_t, size_t>> reads = { { 0, 8 }, { 8, 24 }, { 32, 8 } };
+        for (uint64_t offset = mdatEnd; offset < contents.size(); offset += 500)
+        {
+            reads.emplace_back(offset, 8);
+            reads.emplace_back(offset + 8, 492);
+        }
+        std::mt19937 random(31);
+        for (uint64_t offset = 40; offset < mdatEnd;)
+        {
+            const size_t accessUnit = static_cast<size_t>(std::min<uint64_t>(200 + random() % 1200, mdatEnd - offset));
+            reads.emplace_back(offset, accessUnit);
+            offset += accessUnit;
+        }
+
+        std::vector<uint8_t> dest(2 * blockSize);
+        const auto trace = [&](auto readAt, ReadTrace* readTrace)
+        {
+            for (const auto& read : reads)
+            {
+                const auto start = std::chrono::steady_clock::now();
+                readAt(read.first, read.second);
+                readTrace->Record(read.first, read.second, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            }
+        };
+
+        FakeFmodFile directFile(contents);
+        ReadTrace directTrace;
+        trace([&](uint64_t offset, size_t bytes)
+        {
+            size_t bytesRead = 0;
+            directFile.Seek(offset);
+            directFile.Read(dest.data(), bytes, &bytesRead);
+        }, &directTrace);
+
+        FakeFmodFile cachedFile(contents);
+        FileCursor cursor(0, [&](uint64_t offset) { return cachedFile.Seek(offset); }, [&](void* buffer, size_t bytes, size_t* bytesRead) { return cachedFile.Read(buffer, bytes, bytesRead); });
+        BlockCache cache(contents.size(), [&](uint64_t offset, void* buffer, size_t bytes, size_t* bytesFetched) { return cursor.Read(offset, buffer, bytes, bytesFetched); });
+        ReadTrace cachedTrace;
+        trace([&](uint64_t offset, size_t bytes)
+        {
+            bool failed = false;
+            cache.Read(offset, dest.data(), bytes, &failed);
+        }, &cachedTrace);
+
+        const ReadTrace::Summary direct = directTrace.Summarise();
+        const ReadTrace::Summary cached = cachedTrace.Summarise();
+        std::printf("\n%-12s%10s%10s%10s%10s\n", "read trace", "reads", "fmod", "median ns", "worst ns");
+        std::printf("%-12s%10llu%10zu%10llu%10llu\n", "direct", static_cast<unsigned long long>(direct.reads), directFile.calls,
+            static_cast<unsigned long long>(direct.medianNanoseconds), static_cast<unsigned long long>(direct.worstNanoseconds));
+        std::printf("%-12s%10llu%10zu%10llu%10llu\n", "cached", static_cast<unsigned long long>(cached.reads), cachedFile.calls,
+            static_cast<unsigned long long>(cached.medianNanoseconds), static_cast<unsigned long long>(cached.worstNanoseconds));
+
+        // The last few of each, call by call
+        std::printf("%-12s%10s%10s%10s\n", "last reads", "offset", "bytes", "ns");
+        size_t skipped = 0;
+        cachedTrace.ForEach([&](const ReadTrace::Entry& entry)
+        {
+            if (++skipped > ReadTrace::capacity - 8)
+            {
+                std::printf("%-12s%10llu%10u%10llu\n", "cached", static_cast<unsigned long long>(entry.offset), entry.bytes, static_cast<unsigned long long>(entry.nanoseconds));
+            }
+        });
+    }
+}
+
+int main()
+{
+    BenchConversions();
+    BenchMixing();
+    BenchResampling();
+    BenchSampleHandOff();
+    BenchSignatureRejects();
+    BenchMixedLibrary();
+    BenchContainerProbe();
+    BenchOpenReads();
+    BenchLooping();
+    BenchReadTrace();
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include "LoopHead.h"
+#include "TestCheck.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace mediaFoundation;
+
+namespace
+{
+    // Stereo 16-bit, with every frame holding its own number, so where anything came from can be checked
+    constexpr size_t blockAlign = 4;
+
+    std::vector<uint8_t> Frames(uint64_t firstFrame, size_t count)
+    {
+        std::vector<uint8_t> frames(count * blockAlign);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const uint32_t number = static_cast<uint32_t>(firstFrame + i);
+            std::memcpy(frames.data() + i * blockAlign, &number, blockAlign);
+        }
+        return frames;
+    }
+
+    bool AreFrames(const uint8_t* data, uint64_t firstFrame, size_t count)
+    {
+        return std::memcmp(data, Frames(firstFrame, count).data(), count * blockAlign) == 0;
+    }
+
+    void Play(LoopHead& head, uint64_t firstFrame, size_t count)
+    {
+        const std::vector<uint8_t> frames = Frames(firstFrame, count);
+        head.Capture(frames.data(), firstFrame, count);
+    }
+
+    void TestFilling()
+    {
+        LoopHead head;
+        head.Start(100, 1000, blockAlign);
+        CHECK(!head.IsFull());
+
+        // Output from before the loop start is skipped over, and a chunk straddling it is kept from the start on
+        Play(head, 0, 60);
+        Play(head, 60, 60);
+        CHECK(!head.IsFull());
+
+        // Anything that doesn't carry on from what's kept is ignored, whether it's behind or ahead
+        Play(head, 500, 300);
+        Play(head, 0, 100);
+        Play(head, 120, 400);
+        Play(head, 520, 700);
+        CHECK(head.IsFull());
+
+        uint64_t resumeFrame = 0;
+        CHECK(head.SeekInto(100, &resumeFrame));
+        CHECK(resumeFrame == 1100);
+        std::vector<uint8_t> output(2000 * blockAlign);
+        CHECK(head.Read(output.data(), 2000) == 1000);
+        CHECK(AreFrames(output.data(), 100, 1000));
+        CHECK(head.Read(output.data(), 2000) == 0);
+
+        // Playing on past it changes nothing
+        Play(head, 1100, 500);
+        CHECK(head.SeekInto(100, &resumeFrame));
+        CHECK(head.Read(output.data(), 2000) == 1000);
+        CHECK(AreFrames(output.data(), 100, 1000));
+    }
+
+    void TestSeeks()
+    {
+        LoopHead head;
+        head.Start(0, 500, blockAlign);
+
+        // Nothing's read back while it's filling, seek or no seek
+        std::vector<uint8_t> output(600 * blockAlign);
+        Play(head, 0, 100);
+        CHECK(head.Read(output.data(), 600) == 0);
+
+        // Not until it's full
+        Play(head, 100, 399);
+        uint64_t resumeFrame = 12345;
+        CHECK(!head.SeekInto(0, &resumeFrame));
+        CHECK(resumeFrame == 12345);
+        CHECK(head.Read(output.data(), 600) == 0);
+        Play(head, 499, 1);
+        CHECK(head.IsFull());
+
+        // Anywhere inside it, read in pieces
+        CHECK(head.SeekInto(200, &resumeFrame));
+        CHECK(resumeFrame == 500);
+        CHECK(head.Read(output.data(), 128) == 128);
+        CHECK(AreFrames(output.data(), 200, 128));
+        CHECK(head.Read(output.data(), 600) == 172);
+        CHECK(AreFrames(output.data(), 328, 172));
+
+        // Past it, and the decoder has to go there itself; a seek away also drops what was left to read
+        CHECK(head.SeekInto(0, &resumeFrame));
+        CHECK(!head.SeekInto(500, &resumeFrame));
+        CHECK(head.Read(output.data(), 600) == 0);
+
+        // Before it, when it starts at a loop point
+        LoopHead later;
+        later.Start(1000, 100, blockAlign);
+        Play(later, 900, 300);
+        CHECK(later.IsFull());
+        CHECK(!later.SeekInto(999, &resumeFrame));
+        CHECK(later.SeekInto(1099, &resumeFrame) && resumeFrame == 1100);
+        CHECK(later.Read(output.data(), 600) == 1);
+        CHECK(AreFrames(output.data(), 1099, 1));
+    }
+
+    void TestUnused()
+    {
+        // Never started, or started with no room, it keeps nothing and never takes a seek
+        LoopHead head;
+        uint64_t resumeFrame = 0;
+        Play(head, 0, 100);
+        CHECK(!head.IsFull());
+        CHECK(!head.SeekInto(0, &resumeFrame));
+
+        head.Start(0, 0, blockAlign);
+        Play(head, 0, 100);
+        CHECK(!head.IsFull());
+        CHECK(!head.SeekInto(0, &resumeFrame));
+
+        // Starting again throws away what was kept
+        head.Start(0, 50, blockAlign);
+        Play(head, 0, 100);
+        CHECK(head.IsFull());
+        head.Start(0, 50, blockAlign);
+        CHECK(!head.IsFull());
+        CHECK(!head.SeekInto(0, &resumeFrame));
+    }
+}
+
+int main()
+{
+    TestFilling();
+    TestSeeks();
+    TestUnused();
+    return TestResult();
+}
@@ -0,0 +1,250 @@
+#include "LoopPoints.h"
+#include "TestCheck.h"
+
+#include <cstdint>
+
+using namespace mediaFoundation;
+
+namespace
+{
+    // What iTunes writes for a 105084 frame track: 2112 frames of priming and 452 of padding
+    const char* const smpb = " 00000000 00000840 000001C4 0000000000019A7C 00000000 00000000 00000000 00000000";
+    const uint64_t smpbDelay = 0x840;
+    const uint64_t smpbContent = 0x19A7C;
+    const uint64_t smpbContainer = smpbDelay + 0x1C4 + smpbContent;
+
+    void TestSmpb()
+    {
+        LoopPoints points;
+        points.ApplyTag("iTunSMPB", smpb);
+        CHECK(points.GetEncoderDelay() == smpbDelay);
+        CHECK(points.GetContentFrames() == smpbContent);
+
+        points.FitToLength(smpbContainer);
+        CHECK(points.GetEncoderDelay() == smpbDelay);
+        CHECK(points.GetContentFrames() == smpbContent);
+
+        // Exactly the delay and content with no padding still fits
+        LoopPoints exact;
+        exact.ApplyTag("itunsmpb", smpb);
+        exact.FitToLength(smpbDelay + smpbContent);
+        CHECK(exact.GetContentFrames() == smpbContent);
+
+        // A tag copied over from a longer file
+        LoopPoints tooLong;
+        tooLong.ApplyTag("iTunSMPB", smpb);
+        tooLong.FitToLength(smpbDelay + smpbContent - 1);
+        CHECK(tooLong.GetEncoderDelay() == 0);
+        CHECK(tooLong.GetContentFrames() == 0);
+
+        // A delay longer than the whole file
+        LoopPoints delayTooLong;
+        delayTooLong.ApplyTag("iTunSMPB", " 00000000 00010000 00000000 00000000");
+        delayTooLong.FitToLength(0x8000);
+        CHECK(delayTooLong.GetEncoderDelay() == 0);
+
+        // Nothing to check against
+        LoopPoints unknownLength;
+        unknownLength.ApplyTag("iTunSMPB", smpb);
+        unknownLength.FitToLength(0);
+        CHECK(unknownLength.GetEncoderDelay() == 0);
+        CHECK(unknownLength.GetContentFrames() == 0);
+    }
+
+    void TestBadSmpb()
+    {
+        const char* const badValues[] =
+        {
+            "",
+            " 00000000 00000840 000001C4",
+            " 00000000 00000840 zz 0000000000019A7C",
+            "garbage",
+            // A delay or length past maxFrames
+            " 00000000 10000000001 00000000 00000000",
+            " 00000000 00000840 00000000 10000000001",
+            " 00000000 00000840 00000000 FFFFFFFFFFFFFFFFFFFF",
+        };
+
+        for (const char* value : badValues)
+        {
+            LoopPoints points;
+            points.ApplyTag("iTunSMPB", value);
+            CHECK(points.GetEncoderDelay() == 0);
+            CHECK(points.GetContentFrames() == 0);
+        }
+
+        // Right at the limit is still allowed
+        LoopPoints atLimit;
+        atLimit.ApplyTag("iTunSMPB", " 00000000 00000000 00000000 10000000000");
+        CHECK(atLimit.GetContentFrames() == LoopPoints::maxFrames);
+    }
+
+    void TestLoopTags()
+    {
+        uint64_t start = 0;
+        uint64_t end = 0;
+
+        LoopPoints withLength;
+        withLength.ApplyTag("LOOPSTART", "1000");
+        withLength.ApplyTag("LOOPLENGTH", "500");
+        CHECK(withLength.GetLoop(&start, &end));
+        CHECK(start == 1000 && end == 1500);
+
+        LoopPoints withEnd;
+        withEnd.ApplyTag("loopstart", "1000");
+        withEnd.ApplyTag("LoopEnd", "3000");
+        CHECK(withEnd.GetLoop(&start, &end));
+        CHECK(start == 1000 && end == 3000);
+
+        // The length wins when a file has both
+        LoopPoints withBoth;
+        withBoth.ApplyTag("LOOPSTART", "1000");
+        withBoth.ApplyTag("LOOPEND", "3000");
+        withBoth.ApplyTag("LOOPLENGTH", "200");
+        CHECK(withBoth.GetLoop(&start, &end));
+        CHECK(start == 1000 && end == 1200);
+
+        // A start of 0 is a loop over the whole track
+        LoopPoints fromStart;
+        fromStart.ApplyTag("LOOPSTART", "0");
+        fromStart.ApplyTag("LOOPLENGTH", "44100");
+        CHECK(fromStart.GetLoop(&start, &end));
+        CHECK(start == 0 && end == 44100);
+
+        LoopPoints startOnly;
+        startOnly.ApplyTag("LOOPSTART", "1000");
+        CHECK(!startOnly.GetLoop(&start, &end));
+
+        LoopPoints lengthOnly;
+        lengthOnly.ApplyTag("LOOPLENGTH", "1000");
+        CHECK(!lengthOnly.GetLoop(&start, &end));
+
+        LoopPoints empty;
+        empty.ApplyTag("LOOPSTART", "1000");
+        empty.ApplyTag("LOOPLENGTH", "0");
+        CHECK(!empty.GetLoop(&start, &end));
+
+        LoopPoints backwards;
+        backwards.ApplyTag("LOOPSTART", "1000");
+        backwards.ApplyTag("LOOPEND", "999");
+        CHECK(!backwards.GetLoop(&start, &end));
+
+        // Names have to match whole
+        LoopPoints wrongNames;
+        wrongNames.ApplyTag("LOOPSTARTX", "1000");
+        wrongNames.ApplyTag("LOOP", "1000");
+        wrongNames.ApplyTag("LOOPLENGT", "500");
+        CHECK(!wrongNames.GetLoop(&start, &end));
+    }
+
+    void TestBadNumbers()
+    {
+        uint64_t start = 0;
+        uint64_t end = 0;
+
+        const char* const badValues[] = { "", "abc", "-", "1099511627777", "99999999999999999999999" };
+        for (const char* value : badValues)
+        {
+            LoopPoints points;
+            points.ApplyTag("LOOPSTART", value);
+            points.ApplyTag("LOOPLENGTH", "500");
+            CHECK(!points.GetLoop(&start, &end));
+        }
+
+        // A later bad tag undoes an earlier good one
+        LoopPoints overwritten;
+        overwritten.ApplyTag("LOOPSTART", "1000");
+        overwritten.ApplyTag("LOOPLENGTH", "500");
+        overwritten.ApplyTag("LOOPSTART", "junk");
+        CHECK(!overwritten.GetLoop(&start, &end));
+
+        // Both at maxFrames can't overflow the end
+        LoopPoints atLimit;
+        atLimit.ApplyTag("LOOPSTART", "1099511627776");
+        atLimit.ApplyTag("LOOPLENGTH", "1099511627776");
+        CHECK(atLimit.GetLoop(&start, &end));
+        CHECK(start == LoopPoints::maxFrames && end == 2 * LoopPoints::maxFrames);
+    }
+
+    void TestLoopClamping()
+    {
+        uint64_t start = 0;
+        uint64_t end = 0;
+
+        // Clamped to the gapless length, which counts from after the delay
+        LoopPoints gapless;
+        gapless.ApplyTag("iTunSMPB", smpb);
+        gapless.ApplyTag("LOOPSTART", "100000");
+        gapless.ApplyTag("LOOPLENGTH", "10000");
+        gapless.FitToLength(smpbContainer);
+        CHECK(gapless.GetLoop(&start, &end));
+        CHECK(start == 100000 && end == smpbContent);
+
+        // Without gapless info, to the container's length less any delay
+        LoopPoints container;
+        container.ApplyTag("LOOPSTART", "40000");
+        container.ApplyTag("LOOPEND", "60000");
+        container.FitToLength(50000);
+        CHECK(container.GetLoop(&start, &end));
+        CHECK(start == 40000 && end == 50000);
+
+        // A loop that starts past the end is no loop at all
+        LoopPoints pastEnd;
+        pastEnd.ApplyTag("LOOPSTART", "50000");
+        pastEnd.ApplyTag("LOOPLENGTH", "100");
+        pastEnd.FitToLength(50000);
+        CHECK(!pastEnd.GetLoop(&start, &end));
+
+        // Gapless info that gets dropped doesn't leave the loop clamped to it
+        LoopPoints droppedSmpb;
+        droppedSmpb.ApplyTag("iTunSMPB", smpb);
+        droppedSmpb.ApplyTag("LOOPSTART", "0");
+        droppedSmpb.ApplyTag("LOOPLENGTH", "200000");
+        droppedSmpb.FitToLength(100000);
+        CHECK(droppedSmpb.GetEncoderDelay() == 0);
+        CHECK(droppedSmpb.GetLoop(&start, &end));
+        CHECK(start == 0 && end == 100000);
+
+        // An unknown length leaves the loop alone
+        LoopPoints unknownLength;
+        unknownLength.ApplyTag("LOOPSTART", "0");
+        unknownLength.ApplyTag("LOOPLENGTH", "200000");
+        unknownLength.FitToLength(0);
+        CHECK(unknownLength.GetLoop(&start, &end));
+        CHECK(end == 200000);
+    }
+
+    void TestTimeToFrames()
+    {
+        CHECK(LoopPoints::TimeToFrames(10000000, 10000000, 48000) == 48000);
+        CHECK(LoopPoints::TimeToFrames(1, 3, 44100) == 14700);
+        CHECK(LoopPoints::TimeToFrames(3 * 44100 + 1, 44100, 48000) == 3 * 48000 + 2);
+
+        // Rounded up, so a frame that's partly there counts
+        CHECK(LoopPoints::TimeToFrames(1, 10000000, 44100) == 1);
+        CHECK(LoopPoints::TimeToFrames(10000001, 10000000, 44100) == 44101);
+
+        CHECK(LoopPoints::TimeToFrames(0, 10000000, 44100) == 0);
+        CHECK(LoopPoints::TimeToFrames(12345, 0, 44100) == 0);
+        CHECK(LoopPoints::TimeToFrames(12345, 1000, 0) == 0);
+
+        // Capped rather than wrapped
+        CHECK(LoopPoints::TimeToFrames(UINT64_MAX, 1, 1) == LoopPoints::maxFrames);
+        CHECK(LoopPoints::TimeToFrames(UINT64_MAX, 10000000, 192000) == LoopPoints::maxFrames);
+        CHECK(LoopPoints::TimeToFrames(UINT64_MAX, UINT32_MAX, 192000) == LoopPoints::maxFrames);
+        CHECK(LoopPoints::TimeToFrames(UINT32_MAX - 1, UINT32_MAX, 192000) == 192000);
+        CHECK(LoopPoints::TimeToFrames(LoopPoints::maxFrames, 1, 1) == LoopPoints::maxFrames);
+        CHECK(LoopPoints::TimeToFrames(LoopPoints::maxFrames + 1, 1, 1) == LoopPoints::maxFrames);
+    }
+}
+
+int main()
+{
+    TestSmpb();
+    TestBadSmpb();
+    TestLoopTags();
+    TestBadNumbers();
+    TestLoopClamping();
+    TestTimeToFrames();
+    return TestResult();
+}
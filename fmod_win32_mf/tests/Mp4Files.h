@@ -0,0 +1,119 @@
+#pragma once
+
+#include "TestFiles.h"
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The boxes an MPEG-4 file is made of, for building ones in memory to parse.
+namespace testFiles
+{
+    inline Bytes Box(const char* type, const Bytes& payload)
+    {
+        Bytes box;
+        AppendBigEndian(&box, payload.size() + 8, 4);
+        AppendText(&box, std::string(type, 4));
+        Append(&box, payload);
+        return box;
+    }
+
+    inline Bytes FullBox(const char* type, uint32_t versionAndFlags, const Bytes& payload)
+    {
+        Bytes fields;
+        AppendBigEndian(&fields, versionAndFlags, 4);
+        Append(&fields, payload);
+        return Box(type, fields);
+    }
+
+    inline Bytes Concat(std::initializer_list<Bytes> parts)
+    {
+        Bytes all;
+        for (const Bytes& part : parts)
+        {
+            Append(&all, part);
+        }
+        return all;
+    }
+
+    inline Bytes MediaHeader(uint32_t timescale, bool version1)
+    {
+        Bytes fields;
+        AppendBigEndian(&fields, 0, version1 ? 16 : 8);
+        AppendBigEndian(&fields, timescale, 4);
+        AppendBigEndian(&fields, 0, version1 ? 8 : 4);
+        AppendBigEndian(&fields, 0, 4);
+        return FullBox("mdhd", version1 ? 0x01000000 : 0, fields);
+    }
+
+    inline Bytes Handler(const char* type)
+    {
+        Bytes fields;
+        AppendBigEndian(&fields, 0, 4);
+        AppendText(&fields, std::string(type, 4));
+        AppendBigEndian(&fields, 0, 12);
+        fields.push_back(0);
+        return FullBox("hdlr", 0, fields);
+    }
+
+    inline Bytes TimeToSample(const std::vector<std::pair<uint32_t, uint32_t>>& runs)
+    {
+        Bytes fields;
+        AppendBigEndian(&fields, runs.size(), 4);
+        for (const auto& run : runs)
+        {
+            AppendBigEndian(&fields, run.first, 4);
+            AppendBigEndian(&fields, run.second, 4);
+        }
+        return FullBox("stts", 0, fields);
+    }
+
+    // An 'mp4a' sample entry whose esds carries the given AudioSpecificConfig
+    inline Bytes SampleDescription(const Bytes& audioSpecificConfig)
+    {
+        Bytes decoderSpecificInfo = { 0x05, static_cast<uint8_t>(audioSpecificConfig.size()) };
+        Append(&decoderSpecificInfo, audioSpecificConfig);
+
+        Bytes decoderConfig = { 0x04, static_cast<uint8_t>(13 + decoderSpecificInfo.size()), 0x40, 0x15 };
+        AppendBigEndian(&decoderConfig, 0, 11);
+        Append(&decoderConfig, decoderSpecificInfo);
+
+        // Long-form length on this one, as some muxers write it
+        Bytes esDescriptor = { 0x03, 0x80, 0x80, static_cast<uint8_t>(3 + decoderConfig.size()), 0x00, 0x01, 0x00 };
+        Append(&esDescriptor, decoderConfig);
+
+        Bytes entry;
+        AppendBigEndian(&entry, 0, 6);
+        AppendBigEndian(&entry, 1, 2);
+        AppendBigEndian(&entry, 0, 8);
+        AppendBigEndian(&entry, 2, 2);
+        AppendBigEndian(&entry, 16, 2);
+        AppendBigEndian(&entry, 0, 4);
+        AppendBigEndian(&entry, 44100u << 16, 4);
+        Append(&entry, FullBox("esds", 0, esDescriptor));
+
+        Bytes fields;
+        AppendBigEndian(&fields, 1, 4);
+        Append(&fields, Box("mp4a", entry));
+        return FullBox("stsd", 0, fields);
+    }
+
+    inline Bytes Track(const char* handler, uint32_t timescale, const Bytes& stbl, bool version1Header = false)
+    {
+        return Box("trak", Box("mdia", Concat({ MediaHeader(timescale, version1Header), Handler(handler), Box("minf", Box("stbl", stbl)) })));
+    }
+
+    inline Bytes FreeformTag(const std::string& name, const std::string& value)
+    {
+        Bytes mean;
+        AppendText(&mean, "com.apple.iTunes");
+        Bytes nameText;
+        AppendText(&nameText, name);
+        Bytes data;
+        AppendBigEndian(&data, 0, 4);
+        AppendText(&data, value);
+        return Box("----", Concat({ FullBox("mean", 0, mean), FullBox("name", 0, nameText), FullBox("data", 1, data) }));
+    }
+}
@@ -0,0 +1,220 @@
+#include "Mp4Files.h"
+#include "Mp4Parser.h"
+#include "TestCheck.h"
+#include "TestFiles.h"
+
+#include <map>
+#include <string>
+
+using namespace mediaFoundation;
+using namespace testFiles;
+
+namespace
+{
+    // AAC-LC, 44.1 kHz, stereo
+    const Bytes aacLcConfig = { 0x12, 0x10 };
+
+    const std::vector<std::pair<uint32_t, uint32_t>> audioRuns = { { 100, 1024 }, { 0, 5 }, { 1, 500 } };
+
+    // ftyp, then the media data, then a moov with a video track ahead of the audio one, and some tags.  With moov
+    // last, cutting the file short anywhere loses part of it.
+    Bytes MakeFile(const Bytes& audioTrack, bool quickTimeMeta = false)
+    {
+        Bytes brand;
+        AppendText(&brand, "M4A ");
+        AppendBigEndian(&brand, 0, 4);
+
+        const Bytes tags = Box("ilst", Concat({ FreeformTag("iTunSMPB", " 00000000 00000840 000001C4 0000000000019A7C"), FreeformTag("LOOPSTART", "4410") }));
+        const Bytes meta = quickTimeMeta ? Box("meta", Concat({ Handler("mdir"), tags })) : FullBox("meta", 0, Concat({ Handler("mdir"), tags }));
+
+        const Bytes videoTrack = Track("vide", 600, Concat({ SampleDescription({}), TimeToSample({ { 10, 60 } }) }));
+        return Concat({ Box("ftyp", brand), Box("mdat", Bytes(1000, 0xAB)), Box("moov", Concat({ videoTrack, audioTrack, Box("udta", meta) })) });
+    }
+
+    Bytes MakeAudioTrack()
+    {
+        return Track("soun", 44100, Concat({ SampleDescription(aacLcConfig), TimeToSample(audioRuns) }));
+    }
+
+    void TestSampleTable()
+    {
+        const Bytes file = MakeFile(MakeAudioTrack());
+        MemoryReader reader(file);
+        Mp4SampleTable table;
+        CHECK(table.Parse(reader));
+
+        // The audio track, not the video one ahead of it
+        CHECK(table.GetTimescale() == 44100);
+        CHECK(table.GetSampleCount() == 101);
+        CHECK(table.GetDuration() == 100 * 1024 + 500);
+
+        CHECK(table.GetSampleTime(0) == 0);
+        CHECK(table.GetSampleTime(99) == 99 * 1024);
+        CHECK(table.GetSampleTime(100) == 100 * 1024);
+
+        CHECK(table.FindSampleAtTime(0) == 0);
+        CHECK(table.FindSampleAtTime(1023) == 0);
+        CHECK(table.FindSampleAtTime(1024) == 1);
+        CHECK(table.FindSampleAtTime(100 * 1024 - 1) == 99);
+        CHECK(table.FindSampleAtTime(100 * 1024) == 100);
+        CHECK(table.FindSampleAtTime(1000000) == 100);
+
+        uint32_t objectType = 0, channelConfig = 0, sampleRate = 0;
+        CHECK(table.GetAacConfig(&objectType, &channelConfig, &sampleRate));
+        CHECK(objectType == 2 && channelConfig == 2 && sampleRate == 44100);
+    }
+
+    void TestHeaderVariants()
+    {
+        // Version 1 mdhd, with its 64-bit times
+        {
+            const Bytes file = MakeFile(Track("soun", 48000, TimeToSample(audioRuns), true));
+            MemoryReader reader(file);
+            Mp4SampleTable table;
+            CHECK(table.Parse(reader));
+            CHECK(table.GetTimescale() == 48000);
+
+            // No stsd, so nothing to say about the decoder config
+            uint32_t objectType = 0, channelConfig = 0, sampleRate = 0;
+            CHECK(!table.GetAacConfig(&objectType, &channelConfig, &sampleRate));
+        }
+
+        // A 64-bit size on moov, and a size of 0 (to the end of the file) on the box after it
+        {
+            const Bytes moovPayload = MakeAudioTrack();
+            Bytes file;
+            AppendBigEndian(&file, 1, 4);
+            AppendText(&file, "moov");
+            AppendBigEndian(&file, moovPayload.size() + 16, 8);
+            Append(&file, moovPayload);
+            AppendBigEndian(&file, 0, 4);
+            AppendText(&file, "free");
+            Append(&file, Bytes(100, 0));
+
+            MemoryReader reader(file);
+            Mp4SampleTable table;
+            CHECK(table.Parse(reader));
+            CHECK(table.GetSampleCount() == 101);
+        }
+
+        // Explicit-rate AudioSpecificConfig: HE-AAC (object type 5), frequency index 15, 24000 Hz, mono
+        {
+            const Bytes config = { 0x2F, 0x80, 0x2E, 0xE0, 0x08 };
+            const Bytes file = MakeFile(Track("soun", 24000, Concat({ SampleDescription(config), TimeToSample(audioRuns) })));
+            MemoryReader reader(file);
+            Mp4SampleTable table;
+            CHECK(table.Parse(reader));
+
+            uint32_t objectType = 0, channelConfig = 0, sampleRate = 0;
+            CHECK(table.GetAacConfig(&objectType, &channelConfig, &sampleRate));
+            CHECK(objectType == 5 && sampleRate == 24000 && channelConfig == 1);
+        }
+    }
+
+    void TestBadTables()
+    {
+        // Samples that take no time can't be seeked into by time
+        {
+            const Bytes file = MakeFile(Track("soun", 44100, TimeToSample({ { 10, 1024 }, { 5, 0 } })));
+            MemoryReader reader(file);
+            CHECK(!Mp4SampleTable().Parse(reader));
+        }
+
+        // No samples at all
+        {
+            const Bytes file = MakeFile(Track("soun", 44100, TimeToSample({ { 0, 1024 } })));
+            MemoryReader reader(file);
+            CHECK(!Mp4SampleTable().Parse(reader));
+        }
+
+        // No timescale
+        {
+            const Bytes file = MakeFile(Track("soun", 0, TimeToSample(audioRuns)));
+            MemoryReader reader(file);
+            CHECK(!Mp4SampleTable().Parse(reader));
+        }
+
+        // An entry count claiming more entries than the box holds
+        {
+            Bytes fields;
+            AppendBigEndian(&fields, 0x10000000, 4);
+            AppendBigEndian(&fields, 100, 4);
+            AppendBigEndian(&fields, 1024, 4);
+            const Bytes file = MakeFile(Track("soun", 44100, FullBox("stts", 0, fields)));
+            MemoryReader reader(file);
+            CHECK(!Mp4SampleTable().Parse(reader));
+        }
+
+        // No audio track
+        {
+            const Bytes file = MakeFile(Track("vide", 44100, TimeToSample(audioRuns)));
+            MemoryReader reader(file);
+            CHECK(!Mp4SampleTable().Parse(reader));
+        }
+    }
+
+    // A file cut short anywhere before the end of moov isn't a file we can use, and finding that out mustn't involve
+    // reading past the end.  Likewise for a byte anywhere in it being garbage: the result might or might not parse,
+    // but if it does, it has to be self-consistent.
+    void TestDamagedFiles()
+    {
+        const Bytes file = MakeFile(MakeAudioTrack());
+        for (size_t size = 0; size < file.size(); ++size)
+        {
+            MemoryReader reader(file, size);
+            Mp4SampleTable table;
+            if (table.Parse(reader))
+            {
+                std::fprintf(stderr, "Parsed a file cut off at %zu bytes of %zu\n", size, file.size());
+                CHECK(false);
+            }
+            mp4::ForEachFreeformTag(reader, [](const std::string&, const std::string&) { });
+        }
+
+        Bytes damaged = file;
+        for (size_t position = 0; position < damaged.size(); ++position)
+        {
+            for (uint8_t garbage : { 0x00, 0x7F, 0xFF })
+            {
+                const uint8_t original = damaged[position];
+                damaged[position] = garbage;
+
+                MemoryReader reader(damaged);
+                Mp4SampleTable table;
+                if (table.Parse(reader))
+                {
+                    CHECK(table.GetSampleCount() > 0 && table.GetTimescale() > 0);
+                    CHECK(table.FindSampleAtTime(table.GetDuration() / 2) < table.GetSampleCount());
+                }
+                mp4::ForEachFreeformTag(reader, [](const std::string&, const std::string&) { });
+
+                damaged[position] = original;
+            }
+        }
+    }
+
+    void TestFreeformTags()
+    {
+        for (bool quickTimeMeta : { false, true })
+        {
+            const Bytes file = MakeFile(MakeAudioTrack(), quickTimeMeta);
+            MemoryReader reader(file);
+            std::map<std::string, std::string> tags;
+            mp4::ForEachFreeformTag(reader, [&tags](const std::string& name, const std::string& value) { tags[name] = value; });
+
+            CHECK(tags.size() == 2);
+            CHECK(tags["iTunSMPB"] == " 00000000 00000840 000001C4 0000000000019A7C");
+            CHECK(tags["LOOPSTART"] == "4410");
+        }
+    }
+}
+
+int main()
+{
+    TestSampleTable();
+    TestHeaderVariants();
+    TestBadTables();
+    TestDamagedFiles();
+    TestFreeformTags();
+    return TestResult();
+}
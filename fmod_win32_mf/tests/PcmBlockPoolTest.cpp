@@ -0,0 +1,149 @@
+#include "PcmBlockPool.h"
+#include "TestCheck.h"
+
+#include <vector>
+
+using namespace mediaFoundation;
+
+namespace
+{
+    int liveBlocks = 0;
+
+    // Just enough of IMFMediaBuffer for the pool, with a count of how many are still alive
+    class FakeBlock
+    {
+    public:
+        explicit FakeBlock(size_t size) :
+            referenceCount(1),
+            maxLength(static_cast<unsigned long>(size)),
+            currentLength(0)
+        {
+            ++liveBlocks;
+        }
+
+        unsigned long Release()
+        {
+            const unsigned long remaining = --referenceCount;
+            if (remaining == 0)
+            {
+                --liveBlocks;
+                delete this;
+            }
+            return remaining;
+        }
+
+        long GetMaxLength(unsigned long* length)
+        {
+            *length = maxLength;
+            return 0;
+        }
+
+        long SetCurrentLength(unsigned long length)
+        {
+            currentLength = length;
+            return 0;
+        }
+
+        unsigned long referenceCount;
+        unsigned long maxLength;
+        unsigned long currentLength;
+    };
+
+    FakeBlock* CreateBlock(size_t size)
+    {
+        return new FakeBlock(size);
+    }
+
+    // Playback with up to two blocks held at once, as read() and the decode-ahead worker do
+    void TestSteadyState()
+    {
+        {
+            PcmBlockPool<FakeBlock> pool(CreateBlock);
+            pool.SetBlockSize(4096);
+
+            std::vector<FakeBlock*> held;
+            for (int i = 0; i < 10000; ++i)
+            {
+                FakeBlock* block = pool.Acquire(1000 + (i * 37) % 3000);
+                CHECK(block != nullptr && block->maxLength >= 4096);
+                block->currentLength = 123;
+                held.push_back(block);
+                if (held.size() > static_cast<size_t>(1 + i % 2))
+                {
+                    pool.Recycle(held.front());
+                    held.erase(held.begin());
+                }
+            }
+            CHECK(pool.GetAllocationCount() == 3);
+
+            for (FakeBlock* block : held)
+            {
+                pool.Recycle(block);
+                CHECK(block->currentLength == 0);
+            }
+            CHECK(pool.GetAllocationCount() == 3);
+            CHECK(liveBlocks == 3);
+        }
+        CHECK(liveBlocks == 0);
+    }
+
+    void TestGrowth()
+    {
+        PcmBlockPool<FakeBlock> pool(CreateBlock);
+        pool.SetBlockSize(4096);
+        FakeBlock* small = pool.Acquire(4096);
+        FakeBlock* pooled = pool.Acquire(4096);
+        pool.Recycle(pooled);
+        CHECK(liveBlocks == 2);
+
+        // A sample bigger than estimated: what's pooled is dropped, and every block from then on is big enough
+        FakeBlock* big = pool.Acquire(5000);
+        CHECK(pool.GetBlockSize() == 5000);
+        CHECK(big->maxLength == 5000);
+        CHECK(liveBlocks == 2);
+
+        // Shrinking isn't a thing
+        pool.SetBlockSize(1024);
+        CHECK(pool.GetBlockSize() == 5000);
+
+        // A block handed out before the growth is too small to keep
+        pool.Recycle(small);
+        CHECK(liveBlocks == 1);
+        pool.Recycle(big);
+        CHECK(pool.Acquire(100) == big);
+        pool.Recycle(big);
+        CHECK(pool.GetAllocationCount() == 3);
+    }
+
+    void TestLimits()
+    {
+        PcmBlockPool<FakeBlock> pool(CreateBlock);
+        pool.SetBlockSize(256);
+
+        std::vector<FakeBlock*> held;
+        for (size_t i = 0; i < PcmBlockPool<FakeBlock>::maxFreeBlocks + 2; ++i)
+        {
+            held.push_back(pool.Acquire(256));
+        }
+        for (FakeBlock* block : held)
+        {
+            pool.Recycle(block);
+        }
+        CHECK(liveBlocks == static_cast<int>(PcmBlockPool<FakeBlock>::maxFreeBlocks));
+
+        // Out of memory, once the pooled blocks are gone
+        PcmBlockPool<FakeBlock> failing([](size_t) { return static_cast<FakeBlock*>(nullptr); });
+        failing.SetBlockSize(256);
+        CHECK(failing.Acquire(256) == nullptr);
+        CHECK(failing.GetAllocationCount() == 0);
+    }
+}
+
+int main()
+{
+    TestSteadyState();
+    TestGrowth();
+    TestLimits();
+    CHECK(liveBlocks == 0);
+    return TestResult();
+}
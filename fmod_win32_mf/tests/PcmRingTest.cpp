@@ -0,0 +1,129 @@
+#include "PcmRing.h"
+#include "TestCheck.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace mediaFoundation;
+
+namespace
+{
+    void TestCapacity()
+    {
+        CHECK(PcmRing(1).GetCapacity() == 1);
+        CHECK(PcmRing(1000).GetCapacity() == 1024);
+        CHECK(PcmRing(4096).GetCapacity() == 4096);
+    }
+
+    void TestFillAndDrain()
+    {
+        PcmRing ring(16);
+        uint8_t data[24];
+        for (int i = 0; i < 24; ++i)
+        {
+            data[i] = static_cast<uint8_t>(i);
+        }
+
+        // Only as much as fits goes in
+        CHECK(ring.Write(data, 24) == 16);
+        CHECK(ring.GetReadableBytes() == 16);
+        CHECK(ring.GetWritableBytes() == 0);
+        CHECK(ring.Write(data, 1) == 0);
+
+        // Read part of it, then write across the wraparound point
+        uint8_t out[24] = {};
+        CHECK(ring.Read(out, 10) == 10);
+        CHECK(ring.Write(data + 16, 8) == 8);
+        CHECK(ring.Read(out + 10, 24) == 14);
+        for (int i = 0; i < 24; ++i)
+        {
+            CHECK(out[i] == i);
+        }
+        CHECK(ring.Read(out, 1) == 0);
+    }
+
+    void TestReset()
+    {
+        PcmRing ring(8);
+        const uint8_t data[5] = { 1, 2, 3, 4, 5 };
+        ring.Write(data, 5);
+        ring.Reset();
+        CHECK(ring.GetReadableBytes() == 0);
+        CHECK(ring.GetWritableBytes() == 8);
+
+        uint8_t out[5] = {};
+        ring.Write(data + 2, 3);
+        CHECK(ring.Read(out, 5) == 3);
+        CHECK(out[0] == 3 && out[1] == 4 && out[2] == 5);
+    }
+
+    // One thread writes a known byte sequence in random-sized pieces and another reads it back the same way, through
+    // a ring small enough to wrap thousands of times.  Any lost, repeated or torn byte shows up as a mismatch.
+    void TestProducerConsumer()
+    {
+        constexpr size_t totalBytes = 16 * 1024 * 1024;
+        PcmRing ring(4096);
+
+        std::thread producer([&ring]
+        {
+            std::mt19937 random(1);
+            std::vector<uint8_t> chunk(3000);
+            size_t written = 0;
+            while (written < totalBytes)
+            {
+                const size_t size = std::min<size_t>(random() % chunk.size() + 1, totalBytes - written);
+                for (size_t i = 0; i < size; ++i)
+                {
+                    chunk[i] = static_cast<uint8_t>((written + i) * 2654435761u >> 24);
+                }
+
+                size_t sent = 0;
+                while (sent < size)
+                {
+                    const size_t accepted = ring.Write(chunk.data() + sent, size - sent);
+                    if (accepted == 0)
+                    {
+                        std::this_thread::yield();
+                    }
+                    sent += accepted;
+                }
+                written += size;
+            }
+        });
+
+        std::mt19937 random(2);
+        std::vector<uint8_t> chunk(3000);
+        size_t read = 0;
+        size_t mismatches = 0;
+        while (read < totalBytes)
+        {
+            const size_t got = ring.Read(chunk.data(), random() % chunk.size() + 1);
+            if (got == 0)
+            {
+                std::this_thread::yield();
+            }
+            for (size_t i = 0; i < got; ++i)
+            {
+                mismatches += chunk[i] != static_cast<uint8_t>((read + i) * 2654435761u >> 24);
+            }
+            read += got;
+        }
+        producer.join();
+
+        CHECK(read == totalBytes);
+        CHECK(mismatches == 0);
+        CHECK(ring.GetReadableBytes() == 0);
+    }
+}
+
+int main()
+{
+    TestCapacity();
+    TestFillAndDrain();
+    TestReset();
+    TestProducerConsumer();
+    return TestResult();
+}
@@ -0,0 +1,328 @@
+#include "ProbeCache.h"
+#include "TestCheck.h"
+#include "TestFiles.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace mediaFoundation;
+using namespace testFiles;
+
+namespace
+{
+    // The cache's backing file, held in memory
+    class CacheFile
+    {
+    public:
+        CacheFile() :
+            contents(ProbeCache::headerSize),
+            appendCount(0)
+        {
+            ProbeCache::WriteHeader(contents.data());
+        }
+
+        std::function<bool(const void*, size_t)> Appender()
+        {
+            return [this](const void* data, size_t size)
+            {
+                const uint8_t* bytes = static_cast<const uint8_t*>(data);
+                contents.insert(contents.end(), bytes, bytes + size);
+                ++appendCount;
+                return true;
+            };
+        }
+
+        Bytes contents;
+        size_t appendCount;
+    };
+
+    ProbeRecord MakeRecord(uint64_t key)
+    {
+        ProbeRecord record = {};
+        record.key = key;
+        record.durationIn100ns = key * 3 + 1;
+        record.lengthPcm = key * 7 + 2;
+        record.formatTag = 0x1610;
+        record.channels = static_cast<uint32_t>(key % 8) + 1;
+        record.sampleRate = 44100;
+        record.encoderDelay = static_cast<uint32_t>(key % 2112);
+        record.loopStart = static_cast<uint32_t>(key);
+        record.loopEnd = static_cast<uint32_t>(key) + 1000;
+        record.seekPoints = static_cast<uint32_t>(key >> 3);
+        return record;
+    }
+
+    bool SameRecord(const ProbeRecord& found, uint64_t key)
+    {
+        const ProbeRecord expected = MakeRecord(key);
+        return found.key == expected.key && found.durationIn100ns == expected.durationIn100ns &&
+            found.lengthPcm == expected.lengthPcm && found.formatTag == expected.formatTag &&
+            found.channels == expected.channels && found.sampleRate == expected.sampleRate &&
+            found.encoderDelay == expected.encoderDelay && found.loopStart == expected.loopStart &&
+            found.loopEnd == expected.loopEnd && found.seekPoints == expected.seekPoints;
+    }
+
+    bool FindsRecord(const ProbeCache& cache, uint64_t key)
+    {
+        ProbeRecord found;
+        return cache.Find(key, &found) && SameRecord(found, key);
+    }
+
+    // Keys that all land in the same slot, so lookups have to probe past each other
+    uint64_t CollidingKey(size_t i)
+    {
+        return 5 + i * ProbeCache::minCapacity;
+    }
+
+    void TestRoundTrip()
+    {
+        CacheFile file;
+        {
+            ProbeCache cache(file.Appender());
+            CHECK(cache.Load(nullptr, 0) == 0);
+            CHECK(!cache.Find(CollidingKey(0), nullptr));
+
+            for (size_t i = 0; i < 100; ++i)
+            {
+                cache.Add(MakeRecord(CollidingKey(i)));
+            }
+            for (size_t i = 0; i < 100; ++i)
+            {
+                CHECK(FindsRecord(cache, CollidingKey(i)));
+            }
+            CHECK(!cache.Find(CollidingKey(100), nullptr));
+
+            // Already there, so not written again
+            cache.Add(MakeRecord(CollidingKey(50)));
+            CHECK(file.appendCount == 100);
+        }
+        CHECK(file.contents.size() == ProbeCache::headerSize + 100 * sizeof(ProbeRecord));
+
+        ProbeCache reloaded(file.Appender());
+        CHECK(reloaded.Load(file.contents.data(), file.contents.size()) == file.contents.size());
+        for (size_t i = 0; i < 100; ++i)
+        {
+            CHECK(FindsRecord(reloaded, CollidingKey(i)));
+        }
+        CHECK(!reloaded.Find(CollidingKey(100), nullptr));
+
+        reloaded.Add(MakeRecord(CollidingKey(100)));
+        CHECK(FindsRecord(reloaded, CollidingKey(100)));
+        CHECK(file.appendCount == 101);
+    }
+
+    CacheFile MakeFile(size_t recordCount)
+    {
+        CacheFile file;
+        ProbeCache cache(file.Appender());
+        cache.Load(nullptr, 0);
+        for (size_t i = 0; i < recordCount; ++i)
+        {
+            cache.Add(MakeRecord(i + 1));
+        }
+        return file;
+    }
+
+    void TestDamagedFiles()
+    {
+        const CacheFile file = MakeFile(5);
+        const size_t recordsStart = ProbeCache::headerSize;
+
+        // Cut off partway through the last record
+        for (size_t cut = 1; cut < sizeof(ProbeRecord); ++cut)
+        {
+            CacheFile dummy;
+            ProbeCache cache(dummy.Appender());
+            const size_t size = file.contents.size() - cut;
+            CHECK(cache.Load(file.contents.data(), size) == recordsStart + 4 * sizeof(ProbeRecord));
+            CHECK(FindsRecord(cache, 4));
+            CHECK(!cache.Find(5, nullptr));
+        }
+
+        // A bad byte anywhere in a record drops it and everything after it
+        for (size_t position = 0; position < sizeof(ProbeRecord); ++position)
+        {
+            Bytes damaged = file.contents;
+            damaged[recordsStart + 2 * sizeof(ProbeRecord) + position] ^= 0x10;
+
+            CacheFile dummy;
+            ProbeCache cache(dummy.Appender());
+            CHECK(cache.Load(damaged.data(), damaged.size()) == recordsStart + 2 * sizeof(ProbeRecord));
+            CHECK(FindsRecord(cache, 1) && FindsRecord(cache, 2));
+            CHECK(!cache.Find(3, nullptr) && !cache.Find(4, nullptr) && !cache.Find(5, nullptr));
+        }
+
+        // Not one of ours: the whole thing is thrown away, and the cache still works from empty
+        for (size_t field = 0; field < 3; ++field)
+        {
+            Bytes damaged = file.contents;
+            damaged[field * 4] ^= 0x01;
+
+            CacheFile dummy;
+            ProbeCache cache(dummy.Appender());
+            CHECK(cache.Load(damaged.data(), damaged.size()) == 0);
+            CHECK(!cache.Find(1, nullptr));
+            cache.Add(MakeRecord(1));
+            CHECK(FindsRecord(cache, 1));
+        }
+        for (size_t size = 0; size < ProbeCache::headerSize; ++size)
+        {
+            CacheFile dummy;
+            ProbeCache cache(dummy.Appender());
+            CHECK(cache.Load(file.contents.data(), size) == 0);
+        }
+
+        // Just a header is a good, empty file
+        CacheFile dummy;
+        ProbeCache cache(dummy.Appender());
+        CHECK(cache.Load(file.contents.data(), ProbeCache::headerSize) == ProbeCache::headerSize);
+    }
+
+    void TestSizeLimits()
+    {
+        // Grows to keep a big file at most a quarter full, with room to add as many again.  The file's built up over
+        // two runs, since one run can't fill the smallest table past half.
+        const size_t firstCount = ProbeCache::minCapacity / 2;
+        const size_t bigCount = firstCount + ProbeCache::minCapacity / 4;
+        CacheFile big = MakeFile(firstCount);
+        CHECK(big.appendCount == firstCount);
+        {
+            ProbeCache cache(big.Appender());
+            CHECK(cache.Load(big.contents.data(), big.contents.size()) == big.contents.size());
+            for (size_t i = firstCount + 1; i <= bigCount; ++i)
+            {
+                cache.Add(MakeRecord(i));
+            }
+        }
+        {
+            CacheFile dummy;
+            ProbeCache cache(dummy.Appender());
+            CHECK(cache.Load(big.contents.data(), big.contents.size()) == big.contents.size());
+            for (size_t i = 1; i <= bigCount; ++i)
+            {
+                CHECK(FindsRecord(cache, i));
+            }
+            for (size_t i = bigCount + 1; i <= 2 * bigCount; ++i)
+            {
+                cache.Add(MakeRecord(i));
+            }
+            CHECK(dummy.appendCount == bigCount);
+            CHECK(FindsRecord(cache, 2 * bigCount));
+        }
+
+        // Too many records, and it's started over
+        const CacheFile tooBig = MakeFile(0);
+        Bytes contents = tooBig.contents;
+        contents.resize(ProbeCache::headerSize + (ProbeCache::maxRecords + 1) * sizeof(ProbeRecord));
+        {
+            CacheFile dummy;
+            ProbeCache cache(dummy.Appender());
+            CHECK(cache.Load(contents.data(), contents.size()) == 0);
+        }
+
+        // Half full, the table stops taking records, so no run of taken slots a lookup has to probe gets any longer
+        const size_t halfFull = ProbeCache::minCapacity / 2;
+        CacheFile file;
+        {
+            ProbeCache full(file.Appender());
+            full.Load(nullptr, 0);
+            for (size_t i = 0; i <= halfFull; ++i)
+            {
+                full.Add(MakeRecord(CollidingKey(i)));
+            }
+            CHECK(file.appendCount == halfFull);
+            CHECK(FindsRecord(full, CollidingKey(halfFull - 1)));
+            CHECK(!full.Find(CollidingKey(halfFull), nullptr));
+
+            // Records already there don't count twice, and don't make room either
+            full.Add(MakeRecord(CollidingKey(0)));
+            full.Add(MakeRecord(CollidingKey(halfFull + 1)));
+            CHECK(file.appendCount == halfFull);
+        }
+
+        // The next run's table is big enough to take more
+        ProbeCache grown(file.Appender());
+        CHECK(grown.Load(file.contents.data(), file.contents.size()) == file.contents.size());
+        grown.Add(MakeRecord(CollidingKey(halfFull)));
+        CHECK(file.appendCount == halfFull + 1);
+        CHECK(FindsRecord(grown, CollidingKey(halfFull)));
+    }
+
+    void TestKeys()
+    {
+        const uint64_t key = ProbeCache::MakeKey(L"C:\\Music\\Battle1.m4a", 1234567, 132000000000000000ull);
+        CHECK(key == ProbeCache::MakeKey(L"c:\\MUSIC\\battle1.M4A", 1234567, 132000000000000000ull));
+        CHECK(key != ProbeCache::MakeKey(L"C:\\Music\\Battle2.m4a", 1234567, 132000000000000000ull));
+        CHECK(key != ProbeCache::MakeKey(L"C:\\Music\\Battle1.m4a", 1234568, 132000000000000000ull));
+        CHECK(key != ProbeCache::MakeKey(L"C:\\Music\\Battle1.m4a", 1234567, 132000000000000001ull));
+
+        // Size and time are kept apart
+        CHECK(ProbeCache::MakeKey(L"a", 1, 2) != ProbeCache::MakeKey(L"a", 2, 1));
+
+        // Only ASCII is folded
+        CHECK(ProbeCache::MakeKey(L"\u00e9", 0, 0) != ProbeCache::MakeKey(L"\u00c9", 0, 0));
+    }
+
+    // One thread adding while others look up: a lookup either misses or finds the whole record
+    void TestConcurrentLookups()
+    {
+        const size_t recordCount = 4000;
+        CacheFile file;
+        ProbeCache cache(file.Appender());
+        cache.Load(nullptr, 0);
+
+        std::atomic<size_t> added(0);
+        std::atomic<size_t> tornRecords(0);
+        std::atomic<size_t> missedRecords(0);
+
+        std::vector<std::thread> readers;
+        for (int reader = 0; reader < 3; ++reader)
+        {
+            readers.emplace_back([&]()
+            {
+                while (added.load() < recordCount)
+                {
+                    const size_t known = added.load();
+                    for (size_t i = 0; i < recordCount; i += 97)
+                    {
+                        ProbeRecord found;
+                        if (cache.Find(CollidingKey(i % 64) + i / 64, &found))
+                        {
+                            tornRecords += SameRecord(found, CollidingKey(i % 64) + i / 64) ? 0 : 1;
+                        }
+                        else if (i < known)
+                        {
+                            ++missedRecords;
+                        }
+                    }
+                    std::this_thread::yield();
+                }
+            });
+        }
+
+        for (size_t i = 0; i < recordCount; ++i)
+        {
+            cache.Add(MakeRecord(CollidingKey(i % 64) + i / 64));
+            added.store(i + 1);
+        }
+        for (std::thread& reader : readers)
+        {
+            reader.join();
+        }
+
+        CHECK(tornRecords == 0);
+        CHECK(missedRecords == 0);
+        CHECK(file.appendCount == recordCount);
+    }
+}
+
+int main()
+{
+    TestRoundTrip();
+    TestDamagedFiles();
+    TestSizeLimits();
+    TestKeys();
+    TestConcurrentLookups();
+    return TestResult();
+}
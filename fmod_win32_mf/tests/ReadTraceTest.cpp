@@ -0,0 +1,86 @@
+#include "ReadTrace.h"
+#include "TestCheck.h"
+
+#include <cstdint>
+#include <vector>
+
+using namespace mediaFoundation;
+
+namespace
+{
+    std::vector<ReadTrace::Entry> Kept(const ReadTrace& trace)
+    {
+        std::vector<ReadTrace::Entry> kept;
+        trace.ForEach([&kept](const ReadTrace::Entry& entry) { kept.push_back(entry); });
+        return kept;
+    }
+
+    void TestEmpty()
+    {
+        const ReadTrace trace;
+        CHECK(trace.GetCount() == 0);
+        CHECK(Kept(trace).empty());
+
+        const ReadTrace::Summary summary = trace.Summarise();
+        CHECK(summary.reads == 0 && summary.bytes == 0 && summary.medianNanoseconds == 0 && summary.worstNanoseconds == 0);
+        CHECK(summary.sequentialReads == 0);
+    }
+
+    void TestRecording()
+    {
+        ReadTrace trace;
+        trace.Record(0, 8, 300);
+        trace.Record(8, 24, 100);
+        trace.Record(5000, 100, 900);
+        trace.Record(5100, 100, 200);
+        trace.Record(0, 16, 500);
+
+        const std::vector<ReadTrace::Entry> kept = Kept(trace);
+        CHECK(kept.size() == 5);
+        CHECK(kept[0].offset == 0 && kept[0].bytes == 8 && kept[0].nanoseconds == 300);
+        CHECK(kept[2].offset == 5000 && kept[2].bytes == 100 && kept[2].nanoseconds == 900);
+        CHECK(kept[4].offset == 0 && kept[4].bytes == 16);
+
+        const ReadTrace::Summary summary = trace.Summarise();
+        CHECK(summary.reads == 5);
+        CHECK(summary.bytes == 248);
+        CHECK(summary.medianNanoseconds == 300);
+        CHECK(summary.worstNanoseconds == 900);
+        CHECK(summary.sequentialReads == 2);
+    }
+
+    void TestWrapping()
+    {
+        // Only the last capacity are kept, oldest first, though every read's counted
+        ReadTrace trace;
+        const uint64_t total = ReadTrace::capacity * 3 + 17;
+        for (uint64_t i = 0; i < total; ++i)
+        {
+            trace.Record(i * 10, 10, i);
+        }
+        CHECK(trace.GetCount() == total);
+
+        const std::vector<ReadTrace::Entry> kept = Kept(trace);
+        CHECK(kept.size() == ReadTrace::capacity);
+        const uint64_t first = total - ReadTrace::capacity;
+        for (size_t i = 0; i < kept.size(); ++i)
+        {
+            CHECK(kept[i].offset == (first + i) * 10 && kept[i].nanoseconds == first + i);
+        }
+
+        const ReadTrace::Summary summary = trace.Summarise();
+        CHECK(summary.reads == total);
+        CHECK(summary.bytes == ReadTrace::capacity * 10);
+        CHECK(summary.sequentialReads == ReadTrace::capacity - 1);
+        CHECK(summary.worstNanoseconds == total - 1);
+        CHECK(summary.medianNanoseconds == first + ReadTrace::capacity / 2);
+    }
+}
+
+int main()
+{
+    TestEmpty();
+    TestRecording();
+    TestWrapping();
+    return TestResult();
+}
@@ -0,0 +1,208 @@
+#include "Resampler.h"
+#include "TestCheck.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <numbers>
+#include <vector>
+
+using namespace mediaFoundation;
+
+namespace
+{
+    // Runs a whole mono signal through a freshly configured resampler, in uneven pieces the way the decode-ahead
+    // worker would.
+    std::vector<float> Resample(const std::vector<float>& input, unsigned int fromRate, unsigned int toRate)
+    {
+        PolyphaseResampler resampler;
+        CHECK(resampler.Configure(1, fromRate, toRate));
+
+        std::vector<float> output;
+        std::vector<float> pulled(777);
+        size_t pushed = 0;
+        while (pushed < input.size())
+        {
+            const size_t frames = std::min<size_t>(1000, input.size() - pushed);
+            resampler.Push(input.data() + pushed, frames);
+            pushed += frames;
+            for (size_t got; (got = resampler.Pull(pulled.data(), pulled.size())) > 0;)
+            {
+                output.insert(output.end(), pulled.begin(), pulled.begin() + got);
+            }
+        }
+        resampler.Flush();
+        for (size_t got; (got = resampler.Pull(pulled.data(), pulled.size())) > 0;)
+        {
+            output.insert(output.end(), pulled.begin(), pulled.begin() + got);
+        }
+        return output;
+    }
+
+    std::vector<float> Sine(double frequency, unsigned int rate, size_t frames, double amplitude)
+    {
+        std::vector<float> signal(frames);
+        for (size_t i = 0; i < frames; ++i)
+        {
+            signal[i] = static_cast<float>(amplitude * std::sin(2.0 * std::numbers::pi * frequency * i / rate));
+        }
+        return signal;
+    }
+
+    // Least-squares fit of a sine at the given frequency (plus DC) to the middle of the signal, away from the edges
+    // where the filter's running on silence.  Gives the sine's amplitude and phase, and what's left over.
+    struct SineFit
+    {
+        double amplitude;
+        double phase;
+        double residualRms;
+    };
+
+    SineFit FitSine(const std::vector<float>& signal, double frequency, unsigned int rate)
+    {
+        const size_t begin = signal.size() / 8;
+        const size_t end = signal.size() - signal.size() / 8;
+
+        // Normal equations for a*sin + b*cos + c
+        double m[3][4] = {};
+        for (size_t i = begin; i < end; ++i)
+        {
+            const double angle = 2.0 * std::numbers::pi * frequency * i / rate;
+            const double basis[3] = { std::sin(angle), std::cos(angle), 1.0 };
+            for (int row = 0; row < 3; ++row)
+            {
+                for (int column = 0; column < 3; ++column)
+                {
+                    m[row][column] += basis[row] * basis[column];
+                }
+                m[row][3] += basis[row] * signal[i];
+            }
+        }
+        for (int pivot = 0; pivot < 3; ++pivot)
+        {
+            for (int row = 0; row < 3; ++row)
+            {
+                if (row != pivot)
+                {
+                    const double factor = m[row][pivot] / m[pivot][pivot];
+                    for (int column = 0; column < 4; ++column)
+                    {
+                        m[row][column] -= factor * m[pivot][column];
+                    }
+                }
+            }
+        }
+        const double a = m[0][3] / m[0][0];
+        const double b = m[1][3] / m[1][1];
+        const double c = m[2][3] / m[2][2];
+
+        double residual = 0.0;
+        for (size_t i = begin; i < end; ++i)
+        {
+            const double angle = 2.0 * std::numbers::pi * frequency * i / rate;
+            const double error = signal[i] - (a * std::sin(angle) + b * std::cos(angle) + c);
+            residual += error * error;
+        }
+
+        return { std::hypot(a, b), std::atan2(b, a), std::sqrt(residual / (end - begin)) };
+    }
+
+    double ToDb(double ratio)
+    {
+        return 20.0 * std::log10(ratio);
+    }
+
+    // A 1 kHz tone through the common conversions.  Everything that isn't the tone is distortion, noise or filter
+    // leakage, and should be down near the filter's stopband.  The tone should also come out where it went in, since
+    // the resampler claims to take its own delay out.
+    void TestThdPlusNoise()
+    {
+        const unsigned int ratePairs[][2] = { { 44100, 48000 }, { 48000, 44100 }, { 22050, 48000 }, { 32000, 44100 }, { 96000, 48000 } };
+        for (const auto& rates : ratePairs)
+        {
+            const double amplitude = 0.5;
+            const std::vector<float> output = Resample(Sine(1000.0, rates[0], rates[0], amplitude), rates[0], rates[1]);
+            CHECK(std::abs(static_cast<double>(output.size()) - rates[1]) <= 64);
+
+            const SineFit fit = FitSine(output, 1000.0, rates[1]);
+            const double thdPlusNoise = ToDb(fit.residualRms / (fit.amplitude / std::numbers::sqrt2));
+            std::printf("%u -> %u Hz: THD+N %.1f dB, gain %.4f dB, phase %.2e rad\n", rates[0], rates[1], thdPlusNoise, ToDb(fit.amplitude / amplitude), fit.phase);
+
+            CHECK(thdPlusNoise < -95.0);
+            CHECK(std::fabs(ToDb(fit.amplitude / amplitude)) < 0.01);
+            CHECK(std::fabs(fit.phase) < 1e-3);
+        }
+    }
+
+    // Gain across the passband, which the class comment says runs out to about 82% of the lower Nyquist.
+    void TestPassbandRipple()
+    {
+        const unsigned int ratePairs[][2] = { { 44100, 48000 }, { 48000, 44100 } };
+        for (const auto& rates : ratePairs)
+        {
+            const double passbandEdge = 0.82 * 0.5 * std::min<unsigned int>(rates[0], rates[1]);
+            double minGain = 1e9;
+            double maxGain = -1e9;
+            for (double frequency = 50.0; frequency <= passbandEdge; frequency += passbandEdge / 40)
+            {
+                const std::vector<float> output = Resample(Sine(frequency, rates[0], rates[0] / 4, 0.5), rates[0], rates[1]);
+                const double gain = ToDb(FitSine(output, frequency, rates[1]).amplitude / 0.5);
+                minGain = std::min(minGain, gain);
+                maxGain = std::max(maxGain, gain);
+            }
+            std::printf("%u -> %u Hz: passband %.4f to %.4f dB\n", rates[0], rates[1], minGain, maxGain);
+
+            CHECK(maxGain - minGain < 0.01);
+            CHECK(std::fabs(minGain) < 0.01 && std::fabs(maxGain) < 0.01);
+        }
+    }
+
+    // Going down from 48 kHz, a tone above the new Nyquist has nowhere to go but to alias back down, so whatever comes
+    // out at its alias frequency is what the filter let through.
+    void TestAliasRejection()
+    {
+        const double tone = 23000.0;
+        const double alias = 44100.0 - tone;
+        const std::vector<float> output = Resample(Sine(tone, 48000, 48000, 0.5), 48000, 44100);
+        const double leakage = ToDb(FitSine(output, alias, 44100).amplitude / 0.5);
+        std::printf("48000 -> 44100 Hz: %.0f Hz aliases at %.1f dB\n", tone, leakage);
+        CHECK(leakage < -80.0);
+    }
+
+    void TestConfigure()
+    {
+        PolyphaseResampler resampler;
+        CHECK(!resampler.IsActive());
+        CHECK(!resampler.Configure(2, 48000, 48000));
+        CHECK(!resampler.Configure(2, 96000, 44100));
+        CHECK(!resampler.Configure(0, 44100, 48000));
+        // 44100 to 48017 needs 48017 phases
+        CHECK(!resampler.Configure(2, 44100, 48017));
+        CHECK(!resampler.IsActive());
+
+        CHECK(resampler.Configure(2, 44100, 48000));
+        CHECK(resampler.IsActive() && resampler.GetOutputRate() == 48000);
+
+        // Channels are kept apart
+        std::vector<float> stereo(2000);
+        for (size_t i = 0; i < 1000; ++i)
+        {
+            stereo[i * 2] = 0.25f;
+        }
+        resampler.Push(stereo.data(), 1000);
+        std::vector<float> output(2 * 1000);
+        const size_t frames = resampler.Pull(output.data(), 1000);
+        CHECK(frames > 900);
+        CHECK(std::fabs(output[(frames / 2) * 2] - 0.25f) < 1e-4f);
+        CHECK(std::fabs(output[(frames / 2) * 2 + 1]) < 1e-6f);
+    }
+}
+
+int main()
+{
+    TestConfigure();
+    TestThdPlusNoise();
+    TestPassbandRipple();
+    TestAliasRejection();
+    return TestResult();
+}
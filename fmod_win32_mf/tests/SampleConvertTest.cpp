@@ -0,0 +1,244 @@
+#include "SampleConvert.h"
+#include "TestCheck.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace mediaFoundation;
+
+namespace
+{
+    struct Implementation
+    {
+        const char* name;
+        SampleConverters converters;
+    };
+
+    std::vector<Implementation> FindImplementations()
+    {
+        std::vector<Implementation> implementations = { { "scalar", SampleConverters::Scalar() } };
+#if SAMPLE_CONVERT_X86
+        implementations.push_back({ "sse2", SampleConverters::Sse2() });
+        if (sampleKernels::CpuHasAvx2())
+        {
+            implementations.push_back({ "avx2", SampleConverters::Avx2() });
+        }
+#endif
+        return implementations;
+    }
+
+    // One conversion, from every implementation: which member it is, and how big its samples are on either side.
+    struct Conversion
+    {
+        const char* name;
+        SampleConvertFunc SampleConverters::* kernel;
+        size_t inSize;
+        size_t outSize;
+    };
+
+    const Conversion conversions[] =
+    {
+        { "s16ToFloat", &SampleConverters::s16ToFloat, 2, 4 },
+        { "floatToS16", &SampleConverters::floatToS16, 4, 2 },
+        { "s24ToS32", &SampleConverters::s24ToS32, 3, 4 },
+        { "s32ToS24", &SampleConverters::s32ToS24, 4, 3 },
+        { "s24ToFloat", &SampleConverters::s24ToFloat, 3, 4 },
+        { "floatToS24", &SampleConverters::floatToS24, 4, 3 },
+        { "s32ToFloat", &SampleConverters::s32ToFloat, 4, 4 },
+        { "u8ToS16", &SampleConverters::u8ToS16, 1, 2 },
+    };
+
+    // Runs kernel over count samples of input and checks it gives exactly what the scalar version does, and doesn't
+    // write a byte past the end.
+    bool MatchesScalar(const Conversion& conversion, SampleConvertFunc kernel, const uint8_t* input, size_t count)
+    {
+        constexpr size_t guardBytes = 64;
+        constexpr uint8_t guard = 0xA5;
+
+        std::vector<uint8_t> expected(count * conversion.outSize + guardBytes, guard);
+        std::vector<uint8_t> actual(count * conversion.outSize + guardBytes, guard);
+        (SampleConverters::Scalar().*conversion.kernel)(input, expected.data(), count);
+        kernel(input, actual.data(), count);
+        return expected == actual;
+    }
+
+    // Every implementation against the scalar one, on the same inputs.  Every possible 8, 16 and 24-bit sample goes
+    // through; 32-bit and float inputs are a random spread plus the awkward values.
+    void TestMatchesScalar(const std::vector<Implementation>& implementations)
+    {
+        std::mt19937 random(6);
+
+        std::vector<float> floats;
+        for (float special : { 0.0f, -0.0f, 1.0f, -1.0f, 2.0f, -2.0f, 0.99999994f, -0.99999994f,
+            std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN(),
+            std::numeric_limits<float>::denorm_min(), 1e30f, -1e30f })
+        {
+            floats.push_back(special);
+        }
+        // Exactly halfway between two output values, in both formats, where the rounding mode shows
+        for (int i = -40; i <= 40; ++i)
+        {
+            floats.push_back((i + 0.5f) / 32768.0f);
+            floats.push_back((i + 0.5f) / 8388608.0f);
+        }
+        std::uniform_real_distribution<float> spread(-1.25f, 1.25f);
+        while (floats.size() < (1 << 20))
+        {
+            floats.push_back(spread(random));
+        }
+
+        std::vector<int32_t> ints = { 0, -1, 1, INT32_MIN, INT32_MAX, 255, 256, -256, -257 };
+        while (ints.size() < (1 << 20))
+        {
+            ints.push_back(static_cast<int32_t>(random()));
+        }
+
+        std::vector<int16_t> s16(65536);
+        for (size_t i = 0; i < s16.size(); ++i)
+        {
+            s16[i] = static_cast<int16_t>(i);
+        }
+
+        std::vector<uint8_t> s24((size_t(1) << 24) * 3);
+        for (uint32_t i = 0; i < (1u << 24); ++i)
+        {
+            sampleKernels::StoreS24(s24.data() + i * 3, static_cast<int32_t>(i));
+        }
+
+        std::vector<uint8_t> u8(256);
+        for (size_t i = 0; i < u8.size(); ++i)
+        {
+            u8[i] = static_cast<uint8_t>(i);
+        }
+
+        for (const Conversion& conversion : conversions)
+        {
+            const uint8_t* input = nullptr;
+            size_t count = 0;
+            switch (conversion.inSize)
+            {
+            case 1:
+                input = u8.data();
+                count = u8.size();
+                break;
+            case 2:
+                input = reinterpret_cast<const uint8_t*>(s16.data());
+                count = s16.size();
+                break;
+            case 3:
+                input = s24.data();
+                count = s24.size() / 3;
+                break;
+            default:
+                const bool isFloat = std::strncmp(conversion.name, "float", 5) == 0;
+                input = isFloat ? reinterpret_cast<const uint8_t*>(floats.data()) : reinterpret_cast<const uint8_t*>(ints.data());
+                count = isFloat ? floats.size() : ints.size();
+                break;
+            }
+
+            for (const Implementation& implementation : implementations)
+            {
+                const SampleConvertFunc kernel = implementation.converters.*conversion.kernel;
+                if (!MatchesScalar(conversion, kernel, input, count))
+                {
+                    std::fprintf(stderr, "%s %s doesn't match scalar\n", implementation.name, conversion.name);
+                    CHECK(false);
+                }
+
+                // Every length up to a few vectors' worth, from misaligned starts, to cover the scalar tails
+                for (size_t offset = 0; offset < 4; ++offset)
+                {
+                    for (size_t length = 0; length <= 70; ++length)
+                    {
+                        if (!MatchesScalar(conversion, kernel, input + (offset + 1000) * conversion.inSize, length))
+                        {
+                            std::fprintf(stderr, "%s %s doesn't match scalar for %zu samples at offset %zu\n", implementation.name, conversion.name, length, offset);
+                            CHECK(false);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // What the scalar versions are meant to do, for the values where it matters.
+    void TestScalarValues()
+    {
+        const SampleConverters scalar = SampleConverters::Scalar();
+
+        const float floatIn[] = { 0.0f, 1.0f, -1.0f, 2.0f, -2.0f, std::numeric_limits<float>::quiet_NaN(), 0.5f / 32768.0f, 1.5f / 32768.0f, -2.5f / 32768.0f };
+        const int16_t s16Expected[] = { 0, 32767, -32768, 32767, -32768, -32768, 0, 2, -2 };
+        int16_t s16Out[9] = {};
+        scalar.floatToS16(floatIn, s16Out, 9);
+        CHECK(std::memcmp(s16Out, s16Expected, sizeof(s16Out)) == 0);
+
+        const uint8_t u8In[] = { 0, 128, 255 };
+        int16_t u8Out[3] = {};
+        scalar.u8ToS16(u8In, u8Out, 3);
+        CHECK(u8Out[0] == -32768 && u8Out[1] == 0 && u8Out[2] == 32512);
+
+        // Every 16-bit value survives the trip to float and back
+        std::vector<int16_t> s16(65536);
+        for (size_t i = 0; i < s16.size(); ++i)
+        {
+            s16[i] = static_cast<int16_t>(i);
+        }
+        std::vector<float> asFloat(s16.size());
+        std::vector<int16_t> roundTrip(s16.size());
+        scalar.s16ToFloat(s16.data(), asFloat.data(), s16.size());
+        scalar.floatToS16(asFloat.data(), roundTrip.data(), s16.size());
+        CHECK(roundTrip == s16);
+        CHECK(asFloat[0x8000] == -1.0f);
+
+        // 24-bit: sign extension, and the low byte of a 32-bit sample being dropped rather than rounded
+        const uint8_t s24In[] = { 0xFF, 0xFF, 0x7F, 0x00, 0x00, 0x80, 0xFF, 0xFF, 0xFF };
+        int32_t s32Out[3] = {};
+        scalar.s24ToS32(s24In, s32Out, 3);
+        CHECK(s32Out[0] == 0x7FFFFF00 && s32Out[1] == INT32_MIN && s32Out[2] == -256);
+
+        const int32_t s32In[] = { 0x123456FF, -1 };
+        uint8_t s24Out[6] = {};
+        scalar.s32ToS24(s32In, s24Out, 2);
+        CHECK(s24Out[0] == 0x56 && s24Out[1] == 0x34 && s24Out[2] == 0x12);
+        CHECK(s24Out[3] == 0xFF && s24Out[4] == 0xFF && s24Out[5] == 0xFF);
+
+        float s24Float[3] = {};
+        scalar.s24ToFloat(s24In, s24Float, 3);
+        CHECK(s24Float[1] == -1.0f && s24Float[2] == -1.0f / 8388608.0f);
+    }
+
+    void TestConvertSamples()
+    {
+        const int16_t in[] = { 16384, -16384 };
+        float out[2] = {};
+        CHECK(ConvertSamples(SampleType::S16, in, SampleType::Float, out, 2));
+        CHECK(out[0] == 0.5f && out[1] == -0.5f);
+
+        int16_t copy[2] = {};
+        CHECK(ConvertSamples(SampleType::S16, in, SampleType::S16, copy, 2));
+        CHECK(copy[0] == in[0] && copy[1] == in[1]);
+
+        // No kernel for these
+        CHECK(!ConvertSamples(SampleType::Float, out, SampleType::U8, copy, 2));
+        CHECK(!ConvertSamples(SampleType::S16, in, SampleType::S24, copy, 2));
+    }
+}
+
+int main()
+{
+    const std::vector<Implementation> implementations = FindImplementations();
+    for (const Implementation& implementation : implementations)
+    {
+        std::printf("Testing %s\n", implementation.name);
+    }
+
+    TestScalarValues();
+    TestMatchesScalar(implementations);
+    TestConvertSamples();
+    return TestResult();
+}
@@ -0,0 +1,474 @@
+#include "SampleQueue.h"
+#include "TestCheck.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+using namespace mediaFoundation;
+
+namespace
+{
+    // Samples are just numbers from 1 up; 0 is no sample, same as a null IMFSample*.
+    typedef SampleQueue<int> IntQueue;
+
+    // Stands in for an asynchronous IMFSourceReader: reads are answered on a thread of its own, in order, from a stream
+    // of sampleCount samples.  Keeps track of everything that could go wrong from the reader's side of things.
+    //
+    // By default a flush is answered on the reading thread, after a read, whether or not one was asked for.  With
+    // flushCancelsReads, it works the way Media Foundation does instead: flushes are answered on a thread of their own,
+    // any read that hasn't been answered yet is cancelled and never answered at all, and the flush can be confirmed
+    // while the reading thread is still running our callback, so long as the sample itself has been handed over.
+    class ScriptedReader
+    {
+    public:
+        explicit ScriptedReader(int streamLength) :
+            sampleCount(streamLength),
+            failAtSample(0),
+            canFlush(true),
+            flushCancelsReads(false),
+            requestDelay(0),
+            nextSample(1),
+            readPending(false),
+            flushPending(false),
+            stopping(false),
+            readTaken(false),
+            takenReadCancelled(false),
+            delivering(false),
+            requestsInProgress(0),
+            requests(0),
+            overlappingRequests(0),
+            requestsAfterEnd(0),
+            queue(nullptr)
+        { }
+
+        ~ScriptedReader()
+        {
+            {
+                std::lock_guard<std::mutex> lock(readerLock);
+                stopping = true;
+            }
+            readerSignal.notify_all();
+            if (thread.joinable())
+            {
+                thread.join();
+            }
+            if (flushThread.joinable())
+            {
+                flushThread.join();
+            }
+        }
+
+        void Start(IntQueue* target)
+        {
+            queue = target;
+            thread = std::thread(&ScriptedReader::Run, this);
+            if (flushCancelsReads)
+            {
+                flushThread = std::thread(&ScriptedReader::RunFlushes, this);
+            }
+        }
+
+        bool RequestSample()
+        {
+            std::unique_lock<std::mutex> lock(readerLock);
+            ++requestsInProgress;
+            if (delivering && std::this_thread::get_id() == thread.get_id())
+            {
+                // Called from inside OnSampleRead(), which has the sample by now
+                delivering = false;
+                readerSignal.notify_all();
+            }
+
+            // The time it takes a call to get as far as the reader actually knowing about it
+            lock.unlock();
+            std::this_thread::sleep_for(requestDelay);
+            lock.lock();
+
+            overlappingRequests += readPending || (readTaken && !takenReadCancelled);
+            requestsAfterEnd += nextSample > sampleCount;
+            readPending = true;
+            ++requests;
+            --requestsInProgress;
+            readerSignal.notify_all();
+            return true;
+        }
+
+        bool RequestFlush()
+        {
+            std::lock_guard<std::mutex> lock(readerLock);
+            if (!canFlush)
+            {
+                return false;
+            }
+            flushPending = true;
+            readerSignal.notify_all();
+            return true;
+        }
+
+        void Release(int sample)
+        {
+            std::lock_guard<std::mutex> lock(readerLock);
+            released.insert(sample);
+        }
+
+        size_t GetReleasedCount()
+        {
+            std::lock_guard<std::mutex> lock(readerLock);
+            return released.size();
+        }
+
+        // Whether the reader has anything at all going on, as it should be once the queue's been flushed.  A read
+        // that's been cancelled is over, as far as anyone outside is concerned.
+        bool IsIdle()
+        {
+            std::lock_guard<std::mutex> lock(readerLock);
+            return !readPending && (!readTaken || takenReadCancelled) && requestsInProgress == 0;
+        }
+
+        // Waits for the reading thread to finish with a cancelled read, so that everything it's released is counted
+        void WaitForCancelledRead()
+        {
+            std::unique_lock<std::mutex> lock(readerLock);
+            readerSignal.wait(lock, [this] { return !readTaken; });
+        }
+
+        // Settings; only to be changed before Start()
+        const int sampleCount;
+        int failAtSample;
+        bool canFlush;
+        bool flushCancelsReads;
+        std::chrono::microseconds requestDelay;
+
+        // Where the reader's up to
+        std::mutex readerLock;
+        std::condition_variable readerSignal;
+        int nextSample;
+        bool readPending;
+        bool flushPending;
+        bool stopping;
+        bool readTaken;                 // Being answered, but not handed over yet
+        bool takenReadCancelled;
+        bool delivering;                // In OnSampleRead(), and the sample's not been handed over yet
+        int requestsInProgress;
+
+        // What it's seen
+        int requests;
+        int overlappingRequests;
+        int requestsAfterEnd;
+        std::set<int> released;
+
+    private:
+        void Run()
+        {
+            if (flushCancelsReads)
+            {
+                RunCancellableReads();
+                return;
+            }
+
+            std::unique_lock<std::mutex> lock(readerLock);
+            while (true)
+            {
+                readerSignal.wait(lock, [this] { return stopping || readPending || flushPending; });
+                if (stopping)
+                {
+                    return;
+                }
+
+                // Like the real thing, a read that's being flushed can still complete first
+                const bool flushing = flushPending;
+                const int sample = nextSample++;
+                readPending = false;
+                flushPending = false;
+                lock.unlock();
+
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+                if (sample == failAtSample)
+                {
+                    queue->OnSampleRead(false, { 0, 0, 0 }, false);
+                }
+                else
+                {
+                    queue->OnSampleRead(true, { sample, sample * 100LL, 0 }, sample == sampleCount);
+                }
+                if (flushing)
+                {
+                    queue->OnFlushed();
+                }
+
+                lock.lock();
+            }
+        }
+
+        void RunCancellableReads()
+        {
+            std::unique_lock<std::mutex> lock(readerLock);
+            while (true)
+            {
+                readerSignal.wait(lock, [this] { return stopping || readPending; });
+                if (stopping)
+                {
+                    return;
+                }
+
+                const int sample = nextSample++;
+                readPending = false;
+                readTaken = true;
+                takenReadCancelled = false;
+                lock.unlock();
+
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+
+                lock.lock();
+                readTaken = false;
+                if (takenReadCancelled)
+                {
+                    // Never answered; the reader gets rid of the sample itself
+                    released.insert(sample);
+                    readerSignal.notify_all();
+                    continue;
+                }
+                delivering = true;
+                lock.unlock();
+
+                if (sample == failAtSample)
+                {
+                    queue->OnSampleRead(false, { 0, 0, 0 }, false);
+                }
+                else
+                {
+                    queue->OnSampleRead(true, { sample, sample * 100LL, 0 }, sample == sampleCount);
+                }
+
+                lock.lock();
+                delivering = false;
+                readerSignal.notify_all();
+            }
+        }
+
+        void RunFlushes()
+        {
+            std::unique_lock<std::mutex> lock(readerLock);
+            while (true)
+            {
+                readerSignal.wait(lock, [this] { return stopping || flushPending; });
+                if (stopping)
+                {
+                    return;
+                }
+
+                readerSignal.wait(lock, [this] { return !delivering; });
+                readPending = false;
+                takenReadCancelled = readTaken;
+                flushPending = false;
+                lock.unlock();
+
+                queue->OnFlushed();
+                lock.lock();
+            }
+        }
+
+        IntQueue* queue;
+        std::thread thread;
+        std::thread flushThread;
+    };
+
+    // Closes the queue before destroying it, the same as MfObjects does, so that the reader's left with nothing in
+    // flight that could call back into it.
+    struct QueueCloser
+    {
+        void operator()(IntQueue* queue) const
+        {
+            queue->Close();
+            delete queue;
+        }
+    };
+    typedef std::unique_ptr<IntQueue, QueueCloser> QueuePtr;
+
+    QueuePtr MakeQueue(ScriptedReader& reader, size_t depth)
+    {
+        QueuePtr queue(new IntQueue(depth, [&reader] { return reader.RequestSample(); }, [&reader] { return reader.RequestFlush(); },
+            [&reader](int sample) { reader.Release(sample); }));
+        reader.Start(queue.get());
+        return queue;
+    }
+
+    // The whole stream comes out in order, then end of stream, and the reader is never asked for two samples at once or
+    // for anything past the end.
+    void TestReadsWholeStream()
+    {
+        ScriptedReader reader(200);
+        QueuePtr queue = MakeQueue(reader, 4);
+
+        IntQueue::Entry entry = {};
+        for (int expected = 1; expected <= 200; ++expected)
+        {
+            CHECK(queue->Pop(&entry) == IntQueue::Status::Ok);
+            CHECK(entry.sample == expected && entry.timestamp == expected * 100LL);
+            CHECK(queue->GetQueuedCount() <= 4);
+        }
+        CHECK(queue->Pop(&entry) == IntQueue::Status::EndOfStream);
+        CHECK(queue->Pop(&entry) == IntQueue::Status::EndOfStream);
+
+        std::lock_guard<std::mutex> lock(reader.readerLock);
+        CHECK(reader.requests == 200);
+        CHECK(reader.overlappingRequests == 0);
+        CHECK(reader.requestsAfterEnd == 0);
+        CHECK(reader.released.empty());
+    }
+
+    // Priming fills the queue up to its depth without anybody waiting on it.
+    void TestPrime()
+    {
+        ScriptedReader reader(100);
+        QueuePtr queue = MakeQueue(reader, 3);
+        queue->Prime();
+
+        for (int i = 0; i < 1000 && queue->GetQueuedCount() < 3; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK(queue->GetQueuedCount() == 3);
+
+        // And no further
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        CHECK(queue->GetQueuedCount() == 3);
+
+        // Dropped samples get released when the queue goes
+        queue.reset();
+        CHECK(reader.GetReleasedCount() == 3);
+    }
+
+    void TestReadFailure()
+    {
+        ScriptedReader reader(100);
+        reader.failAtSample = 5;
+        QueuePtr queue = MakeQueue(reader, 2);
+
+        IntQueue::Entry entry = {};
+        for (int expected = 1; expected < 5; ++expected)
+        {
+            CHECK(queue->Pop(&entry) == IntQueue::Status::Ok);
+            CHECK(entry.sample == expected);
+        }
+        CHECK(queue->Pop(&entry) == IntQueue::Status::Failed);
+
+        // A seek clears the failure, and reading carries on from wherever the reader's got to
+        queue->Flush();
+        CHECK(queue->Pop(&entry) == IntQueue::Status::Ok);
+        CHECK(entry.sample > 5);
+    }
+
+    void TestRequestFailure()
+    {
+        IntQueue queue(2, [] { return false; }, [] { return true; }, [](int) { });
+        IntQueue::Entry entry = {};
+        CHECK(queue.Pop(&entry) == IntQueue::Status::Failed);
+    }
+
+    // Flushing throws away everything queued and whatever was in flight, whether or not the reader can cancel it, and
+    // reading picks up afterwards with whatever the reader gives next.  Every sample handed to the queue ends up
+    // either popped or released, exactly once.
+    void TestFlush(bool canFlush)
+    {
+        ScriptedReader reader(10000);
+        reader.canFlush = canFlush;
+        QueuePtr queue = MakeQueue(reader, 4);
+
+        std::set<int> popped;
+        IntQueue::Entry entry = {};
+        for (int round = 0; round < 50; ++round)
+        {
+            for (int i = 0; i < round % 7; ++i)
+            {
+                CHECK(queue->Pop(&entry) == IntQueue::Status::Ok);
+                popped.insert(entry.sample);
+            }
+            queue->Flush();
+            CHECK(queue->GetQueuedCount() == 0);
+        }
+        queue->Close();
+
+        std::lock_guard<std::mutex> lock(reader.readerLock);
+        const int delivered = reader.nextSample - 1;
+        CHECK(popped.size() + reader.released.size() == static_cast<size_t>(delivered));
+        for (int sample : popped)
+        {
+            CHECK(reader.released.count(sample) == 0);
+        }
+        CHECK(reader.overlappingRequests == 0);
+    }
+
+    // Flushes that Media Foundation confirms with no read pending, while reads are being requested from the reader's
+    // own thread.  However the two interleave, once Flush() returns the reader has nothing going on: no read waiting
+    // to be answered, and no request still on its way in.
+    void TestFlushWithNoReadPending()
+    {
+        ScriptedReader reader(100000);
+        reader.flushCancelsReads = true;
+        reader.requestDelay = std::chrono::microseconds(200);
+        QueuePtr queue = MakeQueue(reader, 4);
+
+        std::set<int> popped;
+        IntQueue::Entry entry = {};
+        for (int round = 0; round < 300; ++round)
+        {
+            for (int i = 0; i < round % 3; ++i)
+            {
+                CHECK(queue->Pop(&entry) == IntQueue::Status::Ok);
+                popped.insert(entry.sample);
+            }
+
+            // Give the reader's thread time to get into requesting the next read
+            std::this_thread::sleep_for(std::chrono::microseconds(round % 5 * 60));
+            queue->Flush();
+            CHECK(reader.IsIdle());
+        }
+        queue->Close();
+        CHECK(reader.IsIdle());
+        reader.WaitForCancelledRead();
+
+        std::lock_guard<std::mutex> lock(reader.readerLock);
+        const int delivered = reader.nextSample - 1;
+        CHECK(popped.size() + reader.released.size() == static_cast<size_t>(delivered));
+        CHECK(reader.overlappingRequests == 0);
+    }
+
+    // Once closed, nothing more gets asked of the reader.
+    void TestClose()
+    {
+        ScriptedReader reader(100);
+        QueuePtr queue = MakeQueue(reader, 4);
+        IntQueue::Entry entry = {};
+        CHECK(queue->Pop(&entry) == IntQueue::Status::Ok);
+        queue->Close();
+
+        int requests = 0;
+        {
+            std::lock_guard<std::mutex> lock(reader.readerLock);
+            requests = reader.requests;
+        }
+        queue->Prime();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+        std::lock_guard<std::mutex> lock(reader.readerLock);
+        CHECK(reader.requests == requests);
+    }
+}
+
+int main()
+{
+    TestReadsWholeStream();
+    TestPrime();
+    TestReadFailure();
+    TestRequestFailure();
+    TestFlush(true);
+    TestFlush(false);
+    TestFlushWithNoReadPending();
+    TestClose();
+    return TestResult();
+}
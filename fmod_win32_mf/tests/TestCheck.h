@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdio>
+
+// Just enough of a test harness to not need one: CHECK() reports what failed and carries on, and a test's main()
+// returns TestResult(), which is nonzero if anything did.
+namespace testCheck
+{
+    inline int failures = 0;
+
+    inline void Fail(const char* file, int line, const char* expression)
+    {
+        std::fprintf(stderr, "%s(%d): CHECK(%s) failed\n", file, line, expression);
+        ++failures;
+    }
+}
+
+#define CHECK(expression) do { if (!(expression)) { testCheck::Fail(__FILE__, __LINE__, #expression); } } while (false)
+
+inline int TestResult()
+{
+    if (testCheck::failures > 0)
+    {
+        std::fprintf(stderr, "%d check(s) failed\n", testCheck::failures);
+        return 1;
+    }
+    return 0;
+}
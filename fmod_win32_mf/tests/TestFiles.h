@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Files built in memory, for the container parsers: a Reader over a byte vector, and the bits and pieces to put one
+// together with.
+namespace testFiles
+{
+    typedef std::vector<uint8_t> Bytes;
+
+    // The Reader the parsers want, over bytes in memory.  Counts reads, and can be told to pretend the file's shorter
+    // than it is.
+    class MemoryReader
+    {
+    public:
+        explicit MemoryReader(const Bytes& contents) :
+            data(contents),
+            size(contents.size()),
+            reads(0)
+        { }
+
+        MemoryReader(const Bytes& contents, size_t truncatedSize) :
+            data(contents),
+            size(truncatedSize < contents.size() ? truncatedSize : contents.size()),
+            reads(0)
+        { }
+
+        bool ReadAt(uint64_t offset, void* dest, size_t bytes)
+        {
+            ++reads;
+            if (offset > size || bytes > size - offset)
+            {
+                return false;
+            }
+            std::memcpy(dest, data.data() + offset, bytes);
+            return true;
+        }
+
+        uint64_t GetSize()
+        {
+            return size;
+        }
+
+        size_t GetReadCount() const
+        {
+            return reads;
+        }
+
+    private:
+        const Bytes& data;
+        const size_t size;
+        size_t reads;
+    };
+
+    // Grows bytes by count and returns where the new bytes start.  Sized up front rather than inserted into, which
+    // GCC's -O3 inlining otherwise takes for writes past the end of an empty buffer.
+    inline uint8_t* Extend(Bytes* bytes, size_t count)
+    {
+        const size_t oldSize = bytes->size();
+        bytes->resize(oldSize + count);
+        return bytes->data() + oldSize;
+    }
+
+    inline void Append(Bytes* bytes, const Bytes& more)
+    {
+        if (!more.empty())
+        {
+            std::memcpy(Extend(bytes, more.size()), more.data(), more.size());
+        }
+    }
+
+    inline void AppendText(Bytes* bytes, const std::string& text)
+    {
+        if (!text.empty())
+        {
+            std::memcpy(Extend(bytes, text.size()), text.data(), text.size());
+        }
+    }
+
+    // Byte i of value, counting from the least significant; anything past the eighth is zero padding
+    inline uint8_t ByteOf(uint64_t value, size_t i)
+    {
+        return (i < 8) ? static_cast<uint8_t>(value >> (i * 8)) : 0;
+    }
+
+    inline void AppendBigEndian(Bytes* bytes, uint64_t value, size_t size)
+    {
+        uint8_t* dest = Extend(bytes, size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            dest[i] = ByteOf(value, size - 1 - i);
+        }
+    }
+
+    inline void AppendLittleEndian(Bytes* bytes, uint64_t value, size_t size)
+    {
+        uint8_t* dest = Extend(bytes, size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            dest[i] = ByteOf(value, i);
+        }
+    }
+}